@@ -58,6 +58,15 @@ struct RedCharDeviceClient {
     uint32_t max_send_queue_size;
 };
 
+/* RedCharDeviceRead of an instance not released to it yet, in read order.
+ * Once the instance is detached from the device they are kept till the
+ * last one is released, as the messages still refer to their data. */
+struct RedCharDeviceReads {
+    SpiceCharDeviceInstance *sin;
+    GQueue queue;
+    bool detached;
+};
+
 struct RedCharDevicePrivate {
     SPICE_CXX_GLIB_ALLOCATOR
 
@@ -79,10 +88,19 @@ struct RedCharDevicePrivate {
     int during_read_from_device;
     int during_write_to_device;
 
+    /* data read in place from the current instance, NULL if none */
+    RedCharDeviceReads *reads;
+
     SpiceServer *reds;
 };
 
+struct RedCharDeviceReadPrivate {
+    RedCharDeviceReads *reads;
+    bool released;
+};
+
 static void red_char_device_write_buffer_unref(RedCharDeviceWriteBuffer *write_buf);
+static void red_char_device_detach_reads(RedCharDevice *dev);
 
 void
 RedCharDevice::send_tokens_to_client(RedCharDeviceClientOpaque *client, uint32_t tokens)
@@ -583,6 +601,7 @@ void RedCharDevice::write_buffer_release(RedCharDevice *dev,
 void RedCharDevice::reset_dev_instance(SpiceCharDeviceInstance *sin)
 {
     spice_debug("sin %p, char device %p", sin, this);
+    red_char_device_detach_reads(this);
     priv->sin = sin;
     if (sin) {
         sin->st = this;
@@ -901,8 +920,50 @@ void RedCharDevice::init_device_instance()
     priv->sin->st = this;
 }
 
+static void red_char_device_read_free(RedCharDeviceRead *read)
+{
+    g_free(read->priv);
+    g_free(read);
+}
+
+/* gives back to the instance the data of the first reads released, the
+ * instance releases the data in the order it was read */
+static void red_char_device_reads_release(RedCharDeviceReads *reads)
+{
+    RedCharDeviceRead *read;
+    size_t len = 0;
+
+    while ((read = (RedCharDeviceRead *) g_queue_peek_head(&reads->queue)) != NULL &&
+           read->priv->released) {
+        g_queue_pop_head(&reads->queue);
+        len += read->size;
+        red_char_device_read_free(read);
+    }
+    if (len > 0) {
+        spice_char_device_get_interface(reads->sin)->release_segments(reads->sin, len);
+    }
+    if (reads->detached && g_queue_is_empty(&reads->queue)) {
+        g_free(reads);
+    }
+}
+
+/* the data read in place which is still in use is released to the instance
+ * once the messages referring to it are done with it */
+static void red_char_device_detach_reads(RedCharDevice *dev)
+{
+    RedCharDeviceReads *reads = dev->priv->reads;
+
+    if (!reads) {
+        return;
+    }
+    dev->priv->reads = NULL;
+    reads->detached = true;
+    red_char_device_reads_release(reads);
+}
+
 RedCharDevice::~RedCharDevice()
 {
+    red_char_device_detach_reads(this);
     red_timer_remove(priv->write_to_dev_timer);
     priv->write_to_dev_timer = NULL;
 
@@ -958,3 +1019,54 @@ int RedCharDevice::read(uint8_t *buf, int len)
     }
     return ret;
 }
+
+bool RedCharDevice::can_read_segments()
+{
+    auto sif = spice_char_device_get_interface(priv->sin);
+
+    return sif->base.minor_version >= 4 && (sif->flags & SPICE_CHAR_DEVICE_READ_SEGMENTS) &&
+           sif->read_segments && sif->release_segments;
+}
+
+RedCharDeviceRead *RedCharDevice::read_segments(size_t len, bool *full)
+{
+    auto sif = spice_char_device_get_interface(priv->sin);
+    SpiceCharDeviceSegment segments[RED_CHAR_DEVICE_READ_MAX_SEGMENTS];
+
+    int ret = sif->read_segments(priv->sin, segments, G_N_ELEMENTS(segments), len);
+    if (full) {
+        *full = ret == SPICE_CHAR_DEVICE_SEGMENTS_FULL;
+    }
+    if (ret <= 0) {
+        return NULL;
+    }
+    spice_assert(ret <= (int) G_N_ELEMENTS(segments));
+    priv->active = true;
+
+    if (!priv->reads) {
+        priv->reads = g_new0(RedCharDeviceReads, 1);
+        priv->reads->sin = priv->sin;
+        g_queue_init(&priv->reads->queue);
+    }
+
+    auto read = g_new0(RedCharDeviceRead, 1);
+    read->priv = g_new0(RedCharDeviceReadPrivate, 1);
+    read->priv->reads = priv->reads;
+    read->num_segments = ret;
+    for (int i = 0; i < ret; i++) {
+        read->segments[i] = segments[i];
+        read->size += segments[i].len;
+    }
+    g_queue_push_tail(&priv->reads->queue, read);
+    return read;
+}
+
+void RedCharDevice::read_release(RedCharDeviceRead *read)
+{
+    if (!read) {
+        return;
+    }
+
+    read->priv->released = true;
+    red_char_device_reads_release(read->priv->reads);
+}
@@ -57,6 +57,9 @@ struct RedCharDeviceClientOpaque;
  *  When the device is ready, this callback is called, and is expected to
  *  return one message which is addressed to the client, or NULL if the read
  *  hasn't completed.
+ *  If the device supports it (can_read_segments) the data can be read in place
+ *  with read_segments, the RedCharDeviceRead returned is released with
+ *  read_release once the message referring to the data has been sent.
  *
  * calls triggered from the device (qemu):
  * --------------------------------------
@@ -103,6 +106,17 @@ struct RedCharDeviceWriteBuffer {
     uint8_t buf[0];
 };
 
+/* data read in place from the device, see RedCharDevice::read_segments */
+#define RED_CHAR_DEVICE_READ_MAX_SEGMENTS 8
+struct RedCharDeviceReadPrivate;
+struct RedCharDeviceRead {
+    size_t size;
+    int num_segments;
+    SpiceCharDeviceSegment segments[RED_CHAR_DEVICE_READ_MAX_SEGMENTS];
+
+    RedCharDeviceReadPrivate *priv;
+};
+
 
 class RedCharDevice: public red::shared_ptr_counted_weak
 {
@@ -179,6 +193,19 @@ public:
      */
     int read(uint8_t *buf, int len);
 
+    /* Whether the device supports read_segments */
+    bool can_read_segments();
+    /**
+     * Read up to len bytes from device without copying them.
+     * Returns NULL if no data is available, full is then set if the device
+     * cannot receive more data until some data read in place is released.
+     * The segments of the returned read are valid till calling read_release.
+     * If the device instance is removed before the release the data is
+     * still released to it, once read_release is called.
+     */
+    RedCharDeviceRead *read_segments(size_t len, bool *full=nullptr);
+    static void read_release(RedCharDeviceRead *read);
+
     red::unique_link<RedCharDevicePrivate> priv;
 
 //protected:
@@ -0,0 +1,214 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <glib.h>
+
+#include "compression-selector.h"
+
+/* number of samples of a codec before trusting its estimation */
+#define MIN_SAMPLES 2
+/* every EXPLORE_PERIOD choices of a class the least recently used codec
+ * is chosen, so that the estimations follow the changes of the content */
+#define EXPLORE_PERIOD 32
+/* weight of a new sample in the moving averages */
+#define SAMPLE_WEIGHT (1.0 / 8)
+
+/* images are classified by size in bytes: < 16K, < 256K, bigger */
+#define NUM_SIZE_CLASSES 3
+#define NUM_LEVEL_CLASSES (BITMAP_GRADUAL_HIGH + 1)
+
+typedef struct CodecEstimation {
+    double ns_per_byte;
+    double ratio;
+    uint32_t num_samples;
+    /* value of num_choices of the class when the codec was last chosen */
+    uint64_t last_chosen;
+} CodecEstimation;
+
+typedef struct ImageClass {
+    uint64_t num_choices;
+    CodecEstimation codecs[COMPRESSION_CODEC_NUM];
+} ImageClass;
+
+struct CompressionSelector {
+    GMutex lock;
+    uint64_t bitrate_per_sec;
+    uint32_t roundtrip_ms;
+    ImageClass classes[NUM_LEVEL_CLASSES][NUM_SIZE_CLASSES];
+};
+
+CompressionSelector *compression_selector_new(void)
+{
+    CompressionSelector *selector = g_new0(CompressionSelector, 1);
+
+    g_mutex_init(&selector->lock);
+    return selector;
+}
+
+void compression_selector_free(CompressionSelector *selector)
+{
+    if (!selector) {
+        return;
+    }
+    g_mutex_clear(&selector->lock);
+    g_free(selector);
+}
+
+void compression_selector_set_link(CompressionSelector *selector,
+                                   uint64_t bitrate_per_sec, uint32_t roundtrip_ms)
+{
+    g_mutex_lock(&selector->lock);
+    selector->bitrate_per_sec = bitrate_per_sec;
+    selector->roundtrip_ms = roundtrip_ms;
+    g_mutex_unlock(&selector->lock);
+}
+
+static ImageClass *get_class(CompressionSelector *selector,
+                             BitmapGradualType level, uint64_t image_size)
+{
+    unsigned int size_class;
+
+    if (level >= NUM_LEVEL_CLASSES || level == BITMAP_GRADUAL_INVALID) {
+        level = BITMAP_GRADUAL_NOT_AVAIL;
+    }
+    if (image_size < 16 * 1024) {
+        size_class = 0;
+    } else if (image_size < 256 * 1024) {
+        size_class = 1;
+    } else {
+        size_class = 2;
+    }
+    return &selector->classes[level][size_class];
+}
+
+static double estimate_ns(const CompressionSelector *selector, const CodecEstimation *estimation,
+                          uint64_t image_size)
+{
+    double time_ns = estimation->ns_per_byte * image_size;
+
+    /* the whole link is assumed to be used by the image */
+    if (selector->bitrate_per_sec > 0) {
+        time_ns += estimation->ratio * image_size * 8 * 1e9 / selector->bitrate_per_sec;
+    }
+    /* the same for all the codecs, it only makes the estimation a time to display */
+    time_ns += selector->roundtrip_ms * 1e6 / 2;
+    return time_ns;
+}
+
+CompressionCodec compression_selector_choose(CompressionSelector *selector,
+                                             BitmapGradualType level, uint64_t image_size,
+                                             uint32_t candidates)
+{
+    CompressionCodec codec, chosen = COMPRESSION_CODEC_INVALID;
+    CompressionCodec least_recent = COMPRESSION_CODEC_INVALID;
+    CompressionCodec unexplored = COMPRESSION_CODEC_INVALID;
+    double chosen_ns = 0;
+    ImageClass *image_class;
+
+    g_mutex_lock(&selector->lock);
+    image_class = get_class(selector, level, image_size);
+    image_class->num_choices++;
+
+    for (codec = 0; codec < COMPRESSION_CODEC_NUM; codec++) {
+        CodecEstimation *estimation = &image_class->codecs[codec];
+        double time_ns;
+
+        if (!(candidates & COMPRESSION_CODEC_MASK(codec))) {
+            continue;
+        }
+        if (least_recent == COMPRESSION_CODEC_INVALID ||
+            estimation->last_chosen < image_class->codecs[least_recent].last_chosen) {
+            least_recent = codec;
+        }
+        if (estimation->num_samples < MIN_SAMPLES) {
+            /* samples of the compressions done in the pool come later,
+             * try the other unexplored codecs meanwhile */
+            if (unexplored == COMPRESSION_CODEC_INVALID ||
+                estimation->last_chosen < image_class->codecs[unexplored].last_chosen) {
+                unexplored = codec;
+            }
+            continue;
+        }
+        time_ns = estimate_ns(selector, estimation, image_size);
+        if (chosen == COMPRESSION_CODEC_INVALID || time_ns < chosen_ns) {
+            chosen = codec;
+            chosen_ns = time_ns;
+        }
+    }
+
+    if (unexplored != COMPRESSION_CODEC_INVALID) {
+        chosen = unexplored;
+    } else if (image_class->num_choices % EXPLORE_PERIOD == 0) {
+        chosen = least_recent;
+    }
+    if (chosen != COMPRESSION_CODEC_INVALID) {
+        image_class->codecs[chosen].last_chosen = image_class->num_choices;
+    }
+    g_mutex_unlock(&selector->lock);
+
+    return chosen;
+}
+
+void compression_selector_add_sample(CompressionSelector *selector,
+                                     BitmapGradualType level, uint64_t image_size,
+                                     CompressionCodec codec, uint64_t compressed_size,
+                                     uint64_t encode_ns)
+{
+    CodecEstimation *estimation;
+    double ns_per_byte, ratio;
+
+    g_return_if_fail(codec < COMPRESSION_CODEC_NUM);
+    if (image_size == 0) {
+        return;
+    }
+
+    ns_per_byte = (double) encode_ns / image_size;
+    ratio = (double) compressed_size / image_size;
+
+    g_mutex_lock(&selector->lock);
+    estimation = &get_class(selector, level, image_size)->codecs[codec];
+    if (estimation->num_samples == 0) {
+        estimation->ns_per_byte = ns_per_byte;
+        estimation->ratio = ratio;
+    } else {
+        estimation->ns_per_byte += (ns_per_byte - estimation->ns_per_byte) * SAMPLE_WEIGHT;
+        estimation->ratio += (ratio - estimation->ratio) * SAMPLE_WEIGHT;
+    }
+    estimation->num_samples++;
+    g_mutex_unlock(&selector->lock);
+}
+
+double compression_selector_estimate_ns(CompressionSelector *selector,
+                                        BitmapGradualType level, uint64_t image_size,
+                                        CompressionCodec codec)
+{
+    CodecEstimation *estimation;
+    double time_ns = -1;
+
+    g_return_val_if_fail(codec < COMPRESSION_CODEC_NUM, -1);
+
+    g_mutex_lock(&selector->lock);
+    estimation = &get_class(selector, level, image_size)->codecs[codec];
+    if (estimation->num_samples >= MIN_SAMPLES) {
+        time_ns = estimate_ns(selector, estimation, image_size);
+    }
+    g_mutex_unlock(&selector->lock);
+
+    return time_ns;
+}
@@ -0,0 +1,82 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef COMPRESSION_SELECTOR_H_
+#define COMPRESSION_SELECTOR_H_
+
+#include <stdint.h>
+
+#include "spice-bitmap-utils.h"
+
+SPICE_BEGIN_DECLS
+
+/* Picks the image codec of a client in SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE
+ * mode. The encoding time and the compression ratio of every codec are
+ * learned for each class of images (graduality level and size) and the codec
+ * giving the shortest estimated time to display, encoding plus transmission
+ * on the link of the client, is chosen.
+ *
+ * All the functions are thread safe, samples can be added by the threads
+ * of the encoders pool.
+ */
+typedef enum {
+    COMPRESSION_CODEC_QUIC,
+    COMPRESSION_CODEC_JPEG,
+    COMPRESSION_CODEC_LZ,
+    COMPRESSION_CODEC_LZ4,
+    COMPRESSION_CODEC_GLZ,
+
+    COMPRESSION_CODEC_NUM,
+    COMPRESSION_CODEC_INVALID = COMPRESSION_CODEC_NUM,
+} CompressionCodec;
+
+#define COMPRESSION_CODEC_MASK(codec) (1u << (codec))
+
+typedef struct CompressionSelector CompressionSelector;
+
+CompressionSelector *compression_selector_new(void);
+void compression_selector_free(CompressionSelector *selector);
+
+/* @bitrate_per_sec: 0 if unknown, the transmission cost is then ignored */
+void compression_selector_set_link(CompressionSelector *selector,
+                                   uint64_t bitrate_per_sec, uint32_t roundtrip_ms);
+
+/* Returns the codec to use for an image of @image_size bytes among the
+ * codecs in @candidates (a mask of COMPRESSION_CODEC_MASK), or
+ * COMPRESSION_CODEC_INVALID if @candidates is empty. */
+CompressionCodec compression_selector_choose(CompressionSelector *selector,
+                                             BitmapGradualType level, uint64_t image_size,
+                                             uint32_t candidates);
+
+/* Records the result of the compression of an image of @image_size bytes.
+ * A failed compression should be recorded with @compressed_size equal to
+ * @image_size as the image is then sent uncompressed. */
+void compression_selector_add_sample(CompressionSelector *selector,
+                                     BitmapGradualType level, uint64_t image_size,
+                                     CompressionCodec codec, uint64_t compressed_size,
+                                     uint64_t encode_ns);
+
+/* Returns the estimated time in nanoseconds to encode and send an image
+ * with @codec, or -1 if not enough samples were collected */
+double compression_selector_estimate_ns(CompressionSelector *selector,
+                                        BitmapGradualType level, uint64_t image_size,
+                                        CompressionCodec codec);
+
+SPICE_END_DECLS
+
+#endif /* COMPRESSION_SELECTOR_H_ */
@@ -20,10 +20,12 @@
 #define DCC_PRIVATE_H_
 
 #include "cache-item.h"
+#include "compression-selector.h"
 #include "dcc.h"
 #include "image-encoders.h"
 #include "video-stream.h"
 #include "red-channel-client.h"
+#include "tile-region.h"
 
 #include "push-visibility.h"
 
@@ -37,12 +39,19 @@ struct DisplayChannelClientPrivate
     spice_wan_compression_t zlib_glz_state;
 
     ImageEncoders encoders;
+    /* used to compress surface images and the bitmaps of the drawables out of
+     * the worker thread, can be NULL */
+    ImageEncodersPool *encoders_pool = nullptr;
+    /* learns the codecs costs in SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE mode */
+    CompressionSelector *compression_selector = nullptr;
 
     int expect_init = 0;
 
     PixmapCache *pixmap_cache = nullptr;
     uint32_t pixmap_cache_generation = 0;
     int pending_pixmaps_sync = 0;
+    /* look up bitmaps in the pixmap cache by content */
+    bool image_dedup = false;
 
     RedCacheItem *palette_cache[PALETTE_CACHE_HASH_SIZE];
     Ring palette_cache_lru = { nullptr, nullptr };
@@ -61,7 +70,9 @@ struct DisplayChannelClientPrivate
     GArray *client_preferred_video_codecs;
 
     uint8_t surface_client_created[NUM_SURFACES];
-    QRegion surface_client_lossy_region[NUM_SURFACES];
+    /* number of drawables in the pipe drawing on or depending on each surface */
+    uint32_t pipe_surface_drawables[NUM_SURFACES];
+    TileRegion surface_client_lossy_region[NUM_SURFACES];
 
     VideoStreamAgent stream_agents[NUM_STREAMS];
     uint32_t streams_max_latency;
@@ -69,6 +80,31 @@ struct DisplayChannelClientPrivate
     bool gl_draw_ongoing;
 };
 
+/* Compression of a RedImageItem queued to the encoders pool */
+struct RedImageEncodeJob {
+    ImageEncodersPoolJob base;
+    DisplayChannelClient *dcc;
+    RedImageItem *item;
+    SpiceImageCompression image_compression;
+    int success;
+    SpiceImage image;
+    compress_send_data_t comp_send_data;
+};
+
+/* Compression of the source bitmap of a drawable queued to the encoders
+ * pool, ahead of the sending of the drawable */
+struct RedDrawableEncodeJob {
+    ImageEncodersPoolJob base;
+    DisplayChannelClient *dcc;
+    Drawable *drawable;
+    SpiceImage *src;
+    SpiceImageCompression image_compression;
+    int can_lossy;
+    int success;
+    SpiceImage image;
+    compress_send_data_t comp_send_data;
+};
+
 #include "pop-visibility.h"
 
 #endif /* DCC_PRIVATE_H_ */
@@ -88,8 +88,7 @@ static bool is_surface_area_lossy(DisplayChannelClient *dcc, uint32_t surface_id
                                   const SpiceRect *area, SpiceRect *out_lossy_area)
 {
     RedSurface *surface;
-    QRegion *surface_lossy_region;
-    QRegion lossy_region;
+    TileRegion *surface_lossy_region;
     DisplayChannel *display = DCC_TO_DC(dcc);
 
     spice_return_val_if_fail(display_channel_validate_surface(display, surface_id), FALSE);
@@ -98,7 +97,7 @@ static bool is_surface_area_lossy(DisplayChannelClient *dcc, uint32_t surface_id
     surface_lossy_region = &dcc->priv->surface_client_lossy_region[surface_id];
 
     if (!area) {
-        if (region_is_empty(surface_lossy_region)) {
+        if (tile_region_is_empty(surface_lossy_region)) {
             return FALSE;
         }
         out_lossy_area->top = 0;
@@ -108,17 +107,12 @@ static bool is_surface_area_lossy(DisplayChannelClient *dcc, uint32_t surface_id
         return TRUE;
     }
 
-    region_init(&lossy_region);
-    region_add(&lossy_region, area);
-    region_and(&lossy_region, surface_lossy_region);
-    if (region_is_empty(&lossy_region)) {
+    if (!tile_region_intersects(surface_lossy_region, area, out_lossy_area)) {
         return FALSE;
     }
-    out_lossy_area->left = lossy_region.extents.x1;
-    out_lossy_area->top = lossy_region.extents.y1;
-    out_lossy_area->right = lossy_region.extents.x2;
-    out_lossy_area->bottom = lossy_region.extents.y2;
-    region_destroy(&lossy_region);
+    /* the lossless resend of the area must clear all the lossy tiles it
+     * touches, else the next drawings on them would resend it again */
+    tile_region_align_rect(surface_lossy_region, out_lossy_area);
     return TRUE;
 }
 
@@ -172,14 +166,15 @@ static bool is_brush_lossy(DisplayChannelClient *dcc, SpiceBrush *brush,
     }
 }
 
-static GList *dcc_get_tail(DisplayChannelClient *dcc)
+static RedPipeLink *dcc_get_tail(DisplayChannelClient *dcc)
 {
     return dcc->get_pipe()->tail;
 }
 
+/* content_hash is the hash of the image pixels or 0 if unknown */
 static void red_display_add_image_to_pixmap_cache(DisplayChannelClient *dcc,
                                                   SpiceImage *image, SpiceImage *io_image,
-                                                  int is_lossy)
+                                                  int is_lossy, uint64_t content_hash)
 {
     DisplayChannel *display_channel G_GNUC_UNUSED = DCC_TO_DC(dcc);
 
@@ -192,6 +187,11 @@ static void red_display_add_image_to_pixmap_cache(DisplayChannelClient *dcc,
                 io_image->descriptor.flags |= SPICE_IMAGE_FLAGS_CACHE_ME;
                 dcc->priv->send_data.pixmap_cache_items[dcc->priv->send_data.num_pixmap_cache_items++] =
                                                                                image->descriptor.id;
+                if (content_hash) {
+                    pixmap_cache_unlocked_set_content(dcc->priv->pixmap_cache,
+                                                      image->descriptor.id, content_hash,
+                                                      &image->u.bitmap);
+                }
                 stat_inc_counter(display_channel->priv->add_to_cache_counter, 1);
             }
         }
@@ -342,6 +342,27 @@ static void marshaller_unref_drawable(uint8_t *data, void *opaque)
     drawable_unref(drawable);
 }
 
+static FillBitsType fill_bits_from_cache(DisplayChannelClient *dcc, SpiceMarshaller *m,
+                                         SpiceImage *image, int lossy_cache_item)
+{
+    DisplayChannel *display = DCC_TO_DC(dcc);
+    SpiceMarshaller *bitmap_palette_out, *lzplt_palette_out;
+
+    if (!display->priv->enable_jpeg || lossy_cache_item) {
+        image->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE;
+    } else {
+        // making sure, in multiple monitor scenario, that lossy items that
+        // should have been replaced with lossless data by one display channel,
+        // will be retrieved as lossless by another display channel.
+        image->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS;
+    }
+    spice_marshall_Image(m, image,
+                         &bitmap_palette_out, &lzplt_palette_out);
+    spice_assert(bitmap_palette_out == NULL);
+    spice_assert(lzplt_palette_out == NULL);
+    return FILL_BITS_TYPE_CACHE;
+}
+
 /* if the number of times fill_bits can be called per one qxl_drawable increases -
    MAX_LZ_DRAWABLE_INSTANCES must be increased as well */
 /* NOTE: 'simage' should be owned by the drawable. The drawable will be kept
@@ -354,6 +375,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
     SpiceImage image;
     compress_send_data_t comp_send_data = {0};
     SpiceMarshaller *bitmap_palette_out, *lzplt_palette_out;
+    uint64_t content_hash = 0;
 
     if (simage == NULL) {
         spice_assert(drawable->red_drawable->self_bitmap_image);
@@ -373,18 +395,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
             dcc->priv->send_data.pixmap_cache_items[dcc->priv->send_data.num_pixmap_cache_items++] =
                 image.descriptor.id;
             if (can_lossy || !lossy_cache_item) {
-                if (!display->priv->enable_jpeg || lossy_cache_item) {
-                    image.descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE;
-                } else {
-                    // making sure, in multiple monitor scenario, that lossy items that
-                    // should have been replaced with lossless data by one display channel,
-                    // will be retrieved as lossless by another display channel.
-                    image.descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS;
-                }
-                spice_marshall_Image(m, &image,
-                                     &bitmap_palette_out, &lzplt_palette_out);
-                spice_assert(bitmap_palette_out == NULL);
-                spice_assert(lzplt_palette_out == NULL);
+                fill_bits_from_cache(dcc, m, &image, lossy_cache_item);
                 stat_inc_counter(display->priv->cache_hits_counter, 1);
                 pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
                 return FILL_BITS_TYPE_CACHE;
@@ -396,6 +407,32 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         }
     }
 
+    /* The same pixels may be in the cache with a different id. Only lossless
+     * items are used so the lossy state of the destination is not changed.
+     * If the id must be replaced by lossless data send the data instead.
+     * The pixels are compared as the hash alone could collide. */
+    if (dcc->priv->image_dedup && simage->descriptor.type == SPICE_IMAGE_TYPE_BITMAP &&
+        bitmap_fmt_is_rgb(simage->u.bitmap.format) &&
+        !(image.descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_REPLACE_ME)) {
+        NewCacheItem *item;
+        int lossy_cache_item;
+
+        content_hash = bitmap_get_content_hash(&simage->u.bitmap);
+        item = pixmap_cache_unlocked_find_content(dcc->priv->pixmap_cache, content_hash,
+                                                  &simage->u.bitmap);
+        if (item && !item->lossy &&
+            dcc_pixmap_cache_unlocked_hit(dcc, item->id, &lossy_cache_item)) {
+            image.descriptor.id = item->id;
+            dcc->priv->send_data.pixmap_cache_items[dcc->priv->send_data.num_pixmap_cache_items++] =
+                image.descriptor.id;
+            fill_bits_from_cache(dcc, m, &image, lossy_cache_item);
+            stat_inc_counter(display->priv->content_cache_hits_counter, 1);
+            pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
+            return FILL_BITS_TYPE_CACHE;
+        }
+        stat_inc_counter(display->priv->content_cache_misses_counter, 1);
+    }
+
     switch (simage->descriptor.type) {
     case SPICE_IMAGE_TYPE_SURFACE: {
         int surface_id;
@@ -431,11 +468,13 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
            in order to prevent starvation in the client between pixmap_cache and
            global dictionary (in cases of multiple monitors) */
         if (red_stream_get_family(dcc->get_stream()) == AF_UNIX ||
-            !dcc_compress_image(dcc, &image, &simage->u.bitmap,
-                                drawable, can_lossy, &comp_send_data)) {
+            !(dcc_drawable_get_compressed(dcc, drawable, simage, can_lossy,
+                                          &image, &comp_send_data) ||
+              dcc_compress_image(dcc, &image, &simage->u.bitmap,
+                                 drawable, can_lossy, &comp_send_data))) {
             SpicePalette *palette;
 
-            red_display_add_image_to_pixmap_cache(dcc, simage, &image, FALSE);
+            red_display_add_image_to_pixmap_cache(dcc, simage, &image, FALSE, content_hash);
 
             *bitmap = simage->u.bitmap;
             bitmap->flags = bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN;
@@ -462,7 +501,8 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
             return FILL_BITS_TYPE_BITMAP;
         } else {
             red_display_add_image_to_pixmap_cache(dcc, simage, &image,
-                                                  comp_send_data.is_lossy);
+                                                  comp_send_data.is_lossy,
+                                                  comp_send_data.is_lossy ? 0 : content_hash);
 
             spice_marshall_Image(m, &image,
                                  &bitmap_palette_out, &lzplt_palette_out);
@@ -483,7 +523,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         break;
     }
     case SPICE_IMAGE_TYPE_QUIC:
-        red_display_add_image_to_pixmap_cache(dcc, simage, &image, FALSE);
+        red_display_add_image_to_pixmap_cache(dcc, simage, &image, FALSE, 0);
         image.u.quic = simage->u.quic;
         spice_marshall_Image(m, &image,
                              &bitmap_palette_out, &lzplt_palette_out);
@@ -561,7 +601,7 @@ static void marshall_qxl_draw_fill(DisplayChannelClient *dcc,
 static void surface_lossy_region_update(DisplayChannelClient *dcc,
                                         Drawable *item, int has_mask, int lossy)
 {
-    QRegion *surface_lossy_region;
+    TileRegion *surface_lossy_region;
     RedDrawable *drawable;
 
     if (has_mask && !lossy) {
@@ -572,26 +612,17 @@ static void surface_lossy_region_update(DisplayChannelClient *dcc,
     drawable = item->red_drawable;
 
     if (drawable->clip.type == SPICE_CLIP_TYPE_RECTS ) {
-        QRegion clip_rgn;
-        QRegion draw_region;
-        region_init(&clip_rgn);
-        region_init(&draw_region);
-        region_add(&draw_region, &drawable->bbox);
-        region_add_clip_rects(&clip_rgn, drawable->clip.rects);
-        region_and(&draw_region, &clip_rgn);
         if (lossy) {
-            region_or(surface_lossy_region, &draw_region);
+            tile_region_add_clipped(surface_lossy_region, &drawable->bbox, drawable->clip.rects);
         } else {
-            region_exclude(surface_lossy_region, &draw_region);
+            tile_region_remove_clipped(surface_lossy_region, &drawable->bbox,
+                                       drawable->clip.rects);
         }
-
-        region_destroy(&clip_rgn);
-        region_destroy(&draw_region);
     } else { /* no clip */
         if (!lossy) {
-            region_remove(surface_lossy_region, &drawable->bbox);
+            tile_region_remove(surface_lossy_region, &drawable->bbox);
         } else {
-            region_add(surface_lossy_region, &drawable->bbox);
+            tile_region_add(surface_lossy_region, &drawable->bbox);
         }
     }
 }
@@ -616,13 +647,13 @@ static bool pipe_rendered_drawables_intersect_with_areas(DisplayChannelClient *d
                                                          SpiceRect *surface_areas[],
                                                          int num_surfaces)
 {
-    GList *l;
+    RedPipeLink *l;
 
     spice_assert(num_surfaces);
 
     for (l = dcc->get_pipe()->head; l != NULL; l = l->next) {
         Drawable *drawable;
-        RedPipeItem *pipe_item = (RedPipeItem *) l->data;
+        RedPipeItem *pipe_item = l->item;
 
         if (pipe_item->type != RED_PIPE_ITEM_TYPE_DRAW)
             continue;
@@ -701,8 +732,8 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
     int resent_surface_ids[MAX_PIPE_SIZE];
     SpiceRect resent_areas[MAX_PIPE_SIZE]; // not pointers since drawables may be released
     int num_resent;
-    GList *l, *prev;
-    GQueue *pipe;
+    RedPipeLink *l, *prev;
+    RedPipe *pipe;
 
     resent_surface_ids[0] = first_surface_id;
     resent_areas[0] = *first_area;
@@ -712,7 +743,7 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
 
     // going from the oldest to the newest
     for (l = pipe->tail; l != NULL; l = prev) {
-        RedPipeItem *pipe_item = (RedPipeItem *) l->data;
+        RedPipeItem *pipe_item = l->item;
         Drawable *drawable;
         RedDrawablePipeItem *dpi;
 
@@ -1771,7 +1802,7 @@ static void display_channel_marshall_migrate_data_surfaces(DisplayChannelClient
         if (!lossy) {
             continue;
         }
-        region_extents(&dcc->priv->surface_client_lossy_region[i], &lossy_rect);
+        tile_region_extents(&dcc->priv->surface_client_lossy_region[i], &lossy_rect);
         spice_marshaller_add_int32(m2, lossy_rect.left);
         spice_marshaller_add_int32(m2, lossy_rect.top);
         spice_marshaller_add_int32(m2, lossy_rect.right);
@@ -1889,7 +1920,7 @@ static void red_marshall_image(DisplayChannelClient *dcc,
     SpiceImage red_image;
     SpiceBitmap bitmap;
     SpiceChunks *chunks;
-    QRegion *surface_lossy_region;
+    TileRegion *surface_lossy_region;
     SpiceMsgDisplayDrawCopy copy;
     SpiceMarshaller *src_bitmap_out, *mask_bitmap_out;
     SpiceMarshaller *bitmap_palette_out, *lzplt_palette_out;
@@ -1944,7 +1975,13 @@ static void red_marshall_image(DisplayChannelClient *dcc,
 
     compress_send_data_t comp_send_data = {0};
 
-    int comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, NULL, item->can_lossy, &comp_send_data);
+    int comp_succeeded;
+    if (item->encode_job) {
+        comp_succeeded = dcc_image_item_get_compressed(dcc, item, &red_image, &comp_send_data);
+    } else {
+        comp_succeeded = dcc_compress_image(dcc, &red_image, &bitmap, NULL, item->can_lossy,
+                                            &comp_send_data);
+    }
 
     surface_lossy_region = &dcc->priv->surface_client_lossy_region[item->surface_id];
     if (comp_succeeded) {
@@ -1959,9 +1996,9 @@ static void red_marshall_image(DisplayChannelClient *dcc,
         }
 
         if (spice_image_descriptor_is_lossy(&red_image.descriptor)) {
-            region_add(surface_lossy_region, &copy.base.box);
+            tile_region_add(surface_lossy_region, &copy.base.box);
         } else {
-            region_remove(surface_lossy_region, &copy.base.box);
+            tile_region_remove(surface_lossy_region, &copy.base.box);
         }
     } else {
         red_image.descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
@@ -1973,7 +2010,7 @@ static void red_marshall_image(DisplayChannelClient *dcc,
         spice_marshaller_add_by_ref_full(src_bitmap_out, item->data,
                                          bitmap.y * bitmap.stride,
                                          marshaller_unref_pipe_item, item);
-        region_remove(surface_lossy_region, &copy.base.box);
+        tile_region_remove(surface_lossy_region, &copy.base.box);
     }
     spice_chunks_destroy(chunks);
 }
@@ -2209,7 +2246,8 @@ static void marshall_surface_create(DisplayChannelClient *dcc,
                                     SpiceMarshaller *base_marshaller,
                                     SpiceMsgSurfaceCreate *surface_create)
 {
-    region_init(&dcc->priv->surface_client_lossy_region[surface_create->surface_id]);
+    tile_region_init(&dcc->priv->surface_client_lossy_region[surface_create->surface_id],
+                     surface_create->width, surface_create->height);
     dcc->init_send_data(SPICE_MSG_DISPLAY_SURFACE_CREATE);
 
     spice_marshall_msg_display_surface_create(base_marshaller, surface_create);
@@ -2220,7 +2258,7 @@ static void marshall_surface_destroy(DisplayChannelClient *dcc,
 {
     SpiceMsgSurfaceDestroy surface_destroy;
 
-    region_destroy(&dcc->priv->surface_client_lossy_region[surface_id]);
+    tile_region_destroy(&dcc->priv->surface_client_lossy_region[surface_id]);
     dcc->init_send_data(SPICE_MSG_DISPLAY_SURFACE_DESTROY);
 
     surface_destroy.surface_id = surface_id;
@@ -2333,6 +2371,7 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
 {
     DisplayChannelClient *dcc = this;
     SpiceMarshaller *m = get_marshaller();
+    DisplayStage stage = display_channel_enter_stage(DCC_TO_DC(dcc), DISPLAY_STAGE_MARSHALL);
 
     ::reset_send_data(dcc);
     switch (pipe_item->type) {
@@ -2406,6 +2445,7 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
     default:
         spice_warn_if_reached();
     }
+    display_channel_enter_stage(DCC_TO_DC(dcc), stage);
 
     // a message is pending
     if (send_message_pending()) {
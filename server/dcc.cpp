@@ -23,6 +23,7 @@
 #include "display-channel-private.h"
 #include "red-client.h"
 #include "main-channel-client.h"
+#include "reds.h"
 #include <spice-server-enums.h>
 
 #define DISPLAY_CLIENT_SHORT_TIMEOUT 15000000000ULL //nano
@@ -58,14 +59,27 @@ DisplayChannelClient::DisplayChannelClient(DisplayChannel *display,
 
 
     priv->id = id;
+    priv->image_dedup = reds_get_image_dedup(display->get_server());
 
     image_encoders_init(&priv->encoders, &DCC_TO_DC(this)->priv->encoder_shared_data);
 
+    unsigned int encoder_threads = reds_get_image_compression_threads(display->get_server());
+    if (encoder_threads > 0) {
+        priv->encoders_pool =
+            image_encoders_pool_new(&DCC_TO_DC(this)->priv->encoder_shared_data,
+                                    encoder_threads);
+    }
+    priv->compression_selector = compression_selector_new();
+
     dcc_init_stream_agents(this);
 }
 
 DisplayChannelClient::~DisplayChannelClient()
 {
+    for (unsigned int i = 0; i < NUM_SURFACES; i++) {
+        tile_region_destroy(&priv->surface_client_lossy_region[i]);
+    }
+    compression_selector_free(priv->compression_selector);
     g_clear_pointer(&priv->preferred_video_codecs, g_array_unref);
     g_clear_pointer(&priv->client_preferred_video_codecs, g_array_unref);
 }
@@ -106,6 +120,53 @@ bool dcc_drawable_is_in_pipe(DisplayChannelClient *dcc, Drawable *drawable)
     return FALSE;
 }
 
+static Drawable *pipe_item_get_drawable(RedPipeItem *item)
+{
+    if (item->type == RED_PIPE_ITEM_TYPE_DRAW) {
+        return SPICE_UPCAST(RedDrawablePipeItem, item)->drawable;
+    } else if (item->type == RED_PIPE_ITEM_TYPE_UPGRADE) {
+        return SPICE_UPCAST(RedUpgradeItem, item)->drawable;
+    }
+    return NULL;
+}
+
+static void pipe_surface_drawables_update(DisplayChannelClient *dcc, RedPipeItem *item,
+                                          int delta)
+{
+    Drawable *drawable = pipe_item_get_drawable(item);
+    int x, y;
+
+    if (!drawable) {
+        return;
+    }
+    dcc->priv->pipe_surface_drawables[drawable->surface_id] += delta;
+    for (x = 0; x < 3; ++x) {
+        int surface_id = drawable->surface_deps[x];
+        if (surface_id < 0 || surface_id == drawable->surface_id) {
+            continue;
+        }
+        /* count each surface once */
+        for (y = 0; y < x; ++y) {
+            if (drawable->surface_deps[y] == surface_id) {
+                break;
+            }
+        }
+        if (y == x) {
+            dcc->priv->pipe_surface_drawables[surface_id] += delta;
+        }
+    }
+}
+
+void DisplayChannelClient::on_pipe_item_added(RedPipeItem *item)
+{
+    pipe_surface_drawables_update(this, item, 1);
+}
+
+void DisplayChannelClient::on_pipe_item_removed(RedPipeItem *item)
+{
+    pipe_surface_drawables_update(this, item, -1);
+}
+
 /*
  * Return: TRUE if wait_if_used == FALSE, or otherwise, if all of the pipe items that
  * are related to the surface have been cleared (or sent) from the pipe.
@@ -113,7 +174,7 @@ bool dcc_drawable_is_in_pipe(DisplayChannelClient *dcc, Drawable *drawable)
 bool dcc_clear_surface_drawables_from_pipe(DisplayChannelClient *dcc, int surface_id,
                                            int wait_if_used)
 {
-    GList *l;
+    RedPipeLink *l;
     int x;
 
     spice_return_val_if_fail(dcc != NULL, TRUE);
@@ -122,18 +183,18 @@ bool dcc_clear_surface_drawables_from_pipe(DisplayChannelClient *dcc, int surfac
 
     for (l = dcc->get_pipe()->head; l != NULL; ) {
         Drawable *drawable;
-        RedDrawablePipeItem *dpi = NULL;
         int depend_found = FALSE;
-        RedPipeItem *item = (RedPipeItem *) l->data;
-        GList *item_pos = l;
+        RedPipeItem *item = l->item;
+        RedPipeLink *item_pos = l;
+
+        /* no more drawables related to the surface in the pipe */
+        if (dcc->priv->pipe_surface_drawables[surface_id] == 0) {
+            break;
+        }
 
         l = l->next;
-        if (item->type == RED_PIPE_ITEM_TYPE_DRAW) {
-            dpi = SPICE_UPCAST(RedDrawablePipeItem, item);
-            drawable = dpi->drawable;
-        } else if (item->type == RED_PIPE_ITEM_TYPE_UPGRADE) {
-            drawable = SPICE_UPCAST(RedUpgradeItem, item)->drawable;
-        } else {
+        drawable = pipe_item_get_drawable(item);
+        if (!drawable) {
             continue;
         }
 
@@ -197,10 +258,269 @@ void dcc_create_surface(DisplayChannelClient *dcc, int surface_id)
     dcc->pipe_add(&create->base);
 }
 
+static void comp_send_data_free_bufs(compress_send_data_t *comp_send_data)
+{
+    RedCompressBuf *buf = comp_send_data->comp_buf;
+
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+    comp_send_data->comp_buf = NULL;
+}
+
+static void red_image_encode_job_free(RedImageEncodeJob *job)
+{
+    comp_send_data_free_bufs(&job->comp_send_data);
+    g_free(job);
+}
+
+static void red_image_item_free(RedPipeItem *base)
+{
+    RedImageItem *item = SPICE_UPCAST(RedImageItem, base);
+    RedImageEncodeJob *job = item->encode_job;
+
+    if (job) {
+        /* the pool is freed only once all its jobs are done so don't
+         * access the client if there's nothing to wait for */
+        if (!image_encoders_pool_job_is_done(&job->base)) {
+            image_encoders_pool_wait(job->dcc->priv->encoders_pool, &job->base);
+        }
+        red_image_encode_job_free(job);
+    }
+    g_free(item);
+}
+
+static void red_image_item_fill_bitmap(RedImageItem *item, SpiceBitmap *bitmap)
+{
+    bitmap->format = item->image_format;
+    bitmap->flags = 0;
+    if (item->top_down) {
+        bitmap->flags |= SPICE_BITMAP_FLAGS_TOP_DOWN;
+    }
+    bitmap->x = item->width;
+    bitmap->y = item->height;
+    bitmap->stride = item->stride;
+    bitmap->palette = 0;
+    bitmap->palette_id = 0;
+}
+
+/* the compressions can run in the encoders pool so the link state is given
+ * to the selector beforehand, from the worker thread */
+static void dcc_update_compression_selector_link(DisplayChannelClient *dcc)
+{
+    MainChannelClient *mcc = dcc->get_client()->get_main();
+    int roundtrip = dcc->get_roundtrip_ms();
+    uint64_t bitrate;
+
+    if (roundtrip < 0) {
+        roundtrip = mcc->get_roundtrip_ms();
+    }
+    bitrate = mcc->is_network_info_initialized() ? mcc->get_bitrate_per_sec() : 0;
+    compression_selector_set_link(dcc->priv->compression_selector, bitrate, roundtrip);
+}
+
+static int compress_image(DisplayChannelClient *dcc, ImageEncoders *enc,
+                          SpiceImageCompression preferred_compression,
+                          SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
+                          int can_lossy,
+                          compress_send_data_t* o_comp_data);
+
+/* runs in one of the threads of the encoders pool */
+static void red_image_item_encode(ImageEncoders *enc, ImageEncodersPoolJob *base)
+{
+    RedImageEncodeJob *job = SPICE_CONTAINEROF(base, RedImageEncodeJob, base);
+    RedImageItem *item = job->item;
+    SpiceBitmap bitmap;
+
+    red_image_item_fill_bitmap(item, &bitmap);
+    bitmap.data = spice_chunks_new_linear(item->data, bitmap.stride * bitmap.y);
+
+    job->image.descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    job->image.descriptor.flags = item->image_flags;
+    job->image.descriptor.width = item->width;
+    job->image.descriptor.height = item->height;
+
+    /* no drawable is passed so GLZ, which cannot be used by the pool, won't be selected */
+    job->success = compress_image(job->dcc, enc, job->image_compression,
+                                  &job->image, &bitmap, NULL, item->can_lossy,
+                                  &job->comp_send_data);
+    spice_chunks_destroy(bitmap.data);
+}
+
+static void red_image_item_encode_async(DisplayChannelClient *dcc, RedImageItem *item)
+{
+    RedImageEncodeJob *job = g_new0(RedImageEncodeJob, 1);
+
+    job->dcc = dcc;
+    job->item = item;
+    job->image_compression = dcc->priv->image_compression;
+    if (job->image_compression == SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE) {
+        dcc_update_compression_selector_link(dcc);
+    }
+    if (!image_encoders_pool_push(dcc->priv->encoders_pool, &job->base,
+                                  red_image_item_encode)) {
+        /* pool is busy, image will be compressed when sent */
+        g_free(job);
+        return;
+    }
+    item->encode_job = job;
+}
+
+/* Retrieve the result of the compression done by the encoders pool, waiting
+ * for it to complete if needed. The compressed buffers are owned by the
+ * caller on success. */
+int dcc_image_item_get_compressed(DisplayChannelClient *dcc, RedImageItem *item,
+                                  SpiceImage *dest, compress_send_data_t* o_comp_data)
+{
+    RedImageEncodeJob *job = item->encode_job;
+    DisplayStage stage;
+
+    spice_return_val_if_fail(job != NULL, FALSE);
+
+    stage = display_channel_enter_stage(DCC_TO_DC(dcc), DISPLAY_STAGE_COMPRESS);
+    image_encoders_pool_wait(dcc->priv->encoders_pool, &job->base);
+    display_channel_enter_stage(DCC_TO_DC(dcc), stage);
+    if (!job->success) {
+        return FALSE;
+    }
+
+    dest->descriptor.type = job->image.descriptor.type;
+    dest->u = job->image.u;
+    *o_comp_data = job->comp_send_data;
+    job->comp_send_data.comp_buf = NULL;
+    job->success = FALSE;
+    return TRUE;
+}
+
+/* Bitmaps smaller than this are compressed when sent, queuing them to the
+ * encoders pool would cost more than it saves */
+#define DRAWABLE_ENCODE_MIN_SIZE (32 * 1024)
+
+/* runs in one of the threads of the encoders pool */
+static void red_drawable_encode(ImageEncoders *enc, ImageEncodersPoolJob *base)
+{
+    RedDrawableEncodeJob *job = SPICE_CONTAINEROF(base, RedDrawableEncodeJob, base);
+
+    job->image.descriptor = job->src->descriptor;
+    /* the drawable is only read, GLZ being selected makes the compression
+     * fail, it is then done when sending */
+    job->success = compress_image(job->dcc, enc, job->image_compression,
+                                  &job->image, &job->src->u.bitmap, job->drawable,
+                                  job->can_lossy, &job->comp_send_data);
+}
+
+/* Compress the source bitmap of a copy drawable in the encoders pool of the
+ * client, so that the compression of the drawings sent to each client is
+ * done out of the worker thread and in parallel with the other clients */
+static void red_drawable_encode_async(DisplayChannelClient *dcc, RedDrawablePipeItem *dpi)
+{
+    Drawable *drawable = dpi->drawable;
+    RedDrawable *red_drawable = drawable->red_drawable;
+    SpiceImage *src;
+    SpiceBitmap *bitmap;
+
+    if (red_drawable->type != QXL_DRAW_COPY || drawable->stream ||
+        red_stream_get_family(dcc->get_stream()) == AF_UNIX) {
+        return;
+    }
+    src = red_drawable->u.copy.src_bitmap;
+    if (src == NULL || src->descriptor.type != SPICE_IMAGE_TYPE_BITMAP) {
+        return;
+    }
+    bitmap = &src->u.bitmap;
+    if (bitmap->y * (uint64_t) bitmap->stride < DRAWABLE_ENCODE_MIN_SIZE ||
+        (bitmap->data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return;
+    }
+    /* don't bother if GLZ, which can't be used by the pool, would be selected */
+    if (bitmap_fmt_has_graduality(bitmap->format)) {
+        if (dcc->priv->image_compression == SPICE_IMAGE_COMPRESSION_GLZ ||
+            (dcc->priv->image_compression == SPICE_IMAGE_COMPRESSION_AUTO_GLZ &&
+             drawable->copy_bitmap_graduality != BITMAP_GRADUAL_HIGH)) {
+            return;
+        }
+    }
+
+    RedDrawableEncodeJob *job = g_new0(RedDrawableEncodeJob, 1);
+
+    job->dcc = dcc;
+    job->drawable = drawable;
+    job->src = src;
+    job->image_compression = dcc->priv->image_compression;
+    job->can_lossy = DCC_TO_DC(dcc)->priv->enable_jpeg;
+    if (job->image_compression == SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE) {
+        dcc_update_compression_selector_link(dcc);
+    }
+    if (!image_encoders_pool_push(dcc->priv->encoders_pool, &job->base,
+                                  red_drawable_encode)) {
+        /* pool is busy, bitmap will be compressed when sent */
+        g_free(job);
+        return;
+    }
+    dpi->encode_job = job;
+}
+
+static void red_drawable_encode_job_free(RedDrawableEncodeJob *job)
+{
+    /* the pool is freed only once all its jobs are done so don't
+     * access the client if there's nothing to wait for */
+    if (!image_encoders_pool_job_is_done(&job->base)) {
+        image_encoders_pool_wait(job->dcc->priv->encoders_pool, &job->base);
+    }
+    comp_send_data_free_bufs(&job->comp_send_data);
+    g_free(job);
+}
+
+/* Retrieve the compression of @src done by the encoders pool for the pipe
+ * item of @drawable, if any was done with the same settings. The compressed
+ * buffers are owned by the caller on success. */
+int dcc_drawable_get_compressed(DisplayChannelClient *dcc, Drawable *drawable,
+                                SpiceImage *src, int can_lossy,
+                                SpiceImage *dest, compress_send_data_t* o_comp_data)
+{
+    RedDrawableEncodeJob *job = NULL;
+    DisplayStage stage;
+    GList *l;
+
+    if (drawable == NULL) {
+        return FALSE;
+    }
+    for (l = drawable->pipes; l != NULL; l = l->next) {
+        RedDrawablePipeItem *dpi = (RedDrawablePipeItem *) l->data;
+        if (dpi->dcc == dcc) {
+            job = dpi->encode_job;
+            break;
+        }
+    }
+    if (job == NULL || job->src != src || job->can_lossy != can_lossy ||
+        job->image_compression != dcc->priv->image_compression) {
+        return FALSE;
+    }
+
+    stage = display_channel_enter_stage(DCC_TO_DC(dcc), DISPLAY_STAGE_COMPRESS);
+    image_encoders_pool_wait(dcc->priv->encoders_pool, &job->base);
+    display_channel_enter_stage(DCC_TO_DC(dcc), stage);
+    if (!job->success) {
+        return FALSE;
+    }
+
+    dest->descriptor.type = job->image.descriptor.type;
+    dest->u = job->image.u;
+    *o_comp_data = job->comp_send_data;
+    job->comp_send_data.comp_buf = NULL;
+    job->success = FALSE;
+    if (dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+        dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
+    }
+    return TRUE;
+}
+
 // adding the pipe item after pos. If pos == NULL, adding to head.
-void
-dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
-                           SpiceRect *area, GList *pipe_item_pos, int can_lossy)
+static void
+dcc_add_surface_area_image_item(DisplayChannelClient *dcc, int surface_id,
+                                SpiceRect *area, RedPipeLink *pipe_item_pos, int can_lossy)
 {
     DisplayChannel *display = DCC_TO_DC(dcc);
     RedSurface *surface = &display->priv->surfaces[surface_id];
@@ -221,8 +541,9 @@ dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
 
     item = (RedImageItem *)g_malloc(height * stride + sizeof(RedImageItem));
 
-    red_pipe_item_init(&item->base, RED_PIPE_ITEM_TYPE_IMAGE);
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_IMAGE, red_image_item_free);
 
+    item->encode_job = NULL;
     item->surface_id = surface_id;
     item->image_format =
         spice_bitmap_from_surface_type(surface->context.format);
@@ -249,6 +570,10 @@ dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
         }
     }
 
+    if (dcc->priv->encoders_pool) {
+        red_image_item_encode_async(dcc, item);
+    }
+
     if (pipe_item_pos) {
         dcc->pipe_add_after_pos(&item->base, pipe_item_pos);
     } else {
@@ -256,6 +581,46 @@ dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
     }
 }
 
+/* Large images are split in horizontal stripes sent as separate images, so
+ * that the stripes are compressed in parallel by the encoders pool */
+#define IMAGE_STRIPES_MIN_PIXELS (512 * 512)
+#define IMAGE_STRIPE_MIN_HEIGHT 64
+
+void
+dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
+                           SpiceRect *area, RedPipeLink *pipe_item_pos, int can_lossy)
+{
+    int width = area->right - area->left;
+    int height = area->bottom - area->top;
+    unsigned int num_stripes = 1;
+    unsigned int i;
+
+    display_channel_render_journal(DCC_TO_DC(dcc), surface_id);
+    if (dcc->priv->encoders_pool && (uint64_t) width * height >= IMAGE_STRIPES_MIN_PIXELS) {
+        num_stripes = MIN(image_encoders_pool_get_num_threads(dcc->priv->encoders_pool),
+                          height / IMAGE_STRIPE_MIN_HEIGHT);
+    }
+    if (num_stripes <= 1) {
+        dcc_add_surface_area_image_item(dcc, surface_id, area, pipe_item_pos, can_lossy);
+        return;
+    }
+
+    /* the first stripe is the nearest to the tail of the pipe so it is sent first.
+     * The stripes are cut on the tiles tracking the lossy areas, so that a
+     * lossless stripe clears all of the tiles it covers */
+    for (i = 0; i < num_stripes; i++) {
+        SpiceRect stripe = *area;
+        if (i > 0) {
+            stripe.top = (area->top + height * i / num_stripes) & ~(TILE_REGION_TILE_SIZE - 1);
+        }
+        if (i < num_stripes - 1) {
+            stripe.bottom = (area->top + height * (i + 1) / num_stripes) &
+                            ~(TILE_REGION_TILE_SIZE - 1);
+        }
+        dcc_add_surface_area_image_item(dcc, surface_id, &stripe, pipe_item_pos, can_lossy);
+    }
+}
+
 void dcc_push_surface_image(DisplayChannelClient *dcc, int surface_id)
 {
     DisplayChannel *display;
@@ -313,9 +678,12 @@ static void red_drawable_pipe_item_free(RedPipeItem *item)
     RedDrawablePipeItem *dpi = SPICE_UPCAST(RedDrawablePipeItem, item);
     spice_assert(item->refcount == 0);
 
+    if (dpi->encode_job) {
+        red_drawable_encode_job_free(dpi->encode_job);
+    }
     dpi->drawable->pipes = g_list_remove(dpi->drawable->pipes, dpi);
     drawable_unref(dpi->drawable);
-    g_free(dpi);
+    red_slab_free(dpi);
 }
 
 static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc,
@@ -323,13 +691,16 @@ static RedDrawablePipeItem *red_drawable_pipe_item_new(DisplayChannelClient *dcc
 {
     RedDrawablePipeItem *dpi;
 
-    dpi = g_new0(RedDrawablePipeItem, 1);
+    dpi = (RedDrawablePipeItem *) red_slab_alloc0(DCC_TO_DC(dcc)->priv->drawable_pipe_item_slab);
     dpi->drawable = drawable;
     dpi->dcc = dcc;
     drawable->pipes = g_list_prepend(drawable->pipes, dpi);
     red_pipe_item_init_full(&dpi->base, RED_PIPE_ITEM_TYPE_DRAW,
                             red_drawable_pipe_item_free);
     drawable->refs++;
+    if (dcc->priv->encoders_pool) {
+        red_drawable_encode_async(dcc, dpi);
+    }
     return dpi;
 }
 
@@ -487,6 +858,8 @@ static void dcc_stop(DisplayChannelClient *dcc)
     dcc_palette_cache_reset(dcc);
     g_free(dcc->priv->send_data.free_list.res);
     dcc_destroy_stream_agents(dcc);
+    image_encoders_pool_free(dcc->priv->encoders_pool);
+    dcc->priv->encoders_pool = NULL;
     image_encoders_free(&dcc->priv->encoders);
 
     if (dcc->priv->gl_draw_ongoing) {
@@ -703,32 +1076,136 @@ static SpiceImageCompression get_compression_for_bitmap(SpiceBitmap *bitmap,
     return SPICE_IMAGE_COMPRESSION_INVALID;
 }
 
-int dcc_compress_image(DisplayChannelClient *dcc,
-                       SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
-                       int can_lossy,
-                       compress_send_data_t* o_comp_data)
+static CompressionCodec compression_codec_from_image_type(uint8_t type)
+{
+    switch (type) {
+    case SPICE_IMAGE_TYPE_QUIC:
+        return COMPRESSION_CODEC_QUIC;
+    case SPICE_IMAGE_TYPE_JPEG:
+    case SPICE_IMAGE_TYPE_JPEG_ALPHA:
+        return COMPRESSION_CODEC_JPEG;
+    case SPICE_IMAGE_TYPE_LZ_RGB:
+    case SPICE_IMAGE_TYPE_LZ_PLT:
+        return COMPRESSION_CODEC_LZ;
+    case SPICE_IMAGE_TYPE_LZ4:
+        return COMPRESSION_CODEC_LZ4;
+    case SPICE_IMAGE_TYPE_GLZ_RGB:
+    case SPICE_IMAGE_TYPE_ZLIB_GLZ_RGB:
+        return COMPRESSION_CODEC_GLZ;
+    default:
+        return COMPRESSION_CODEC_INVALID;
+    }
+}
+
+/* Same as get_compression_for_bitmap for SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE,
+ * the codec is chosen by the compression selector of the client among the
+ * ones which can handle the bitmap */
+static SpiceImageCompression get_adaptive_compression_for_bitmap(DisplayChannelClient *dcc,
+                                                                 SpiceBitmap *bitmap,
+                                                                 Drawable *drawable,
+                                                                 bool *use_jpeg,
+                                                                 BitmapGradualType *o_level,
+                                                                 CompressionCodec *o_codec)
+{
+    uint32_t candidates = 0;
+    BitmapGradualType level = BITMAP_GRADUAL_NOT_AVAIL;
+
+    if (bitmap->y * bitmap->stride < MIN_SIZE_TO_COMPRESS) {
+        return SPICE_IMAGE_COMPRESSION_OFF;
+    }
+
+    if (can_quic_compress(bitmap)) {
+        candidates |= COMPRESSION_CODEC_MASK(*use_jpeg ? COMPRESSION_CODEC_JPEG :
+                                                         COMPRESSION_CODEC_QUIC);
+    }
+    if (can_lz_compress(bitmap)) {
+        candidates |= COMPRESSION_CODEC_MASK(COMPRESSION_CODEC_LZ);
+#ifdef USE_LZ4
+        if (bitmap_fmt_is_rgb(bitmap->format) &&
+            dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
+            candidates |= COMPRESSION_CODEC_MASK(COMPRESSION_CODEC_LZ4);
+        }
+#endif
+        if (drawable != NULL && bitmap_fmt_has_graduality(bitmap->format)) {
+            candidates |= COMPRESSION_CODEC_MASK(COMPRESSION_CODEC_GLZ);
+        }
+    }
+
+    if (bitmap_fmt_has_graduality(bitmap->format)) {
+        if (drawable == NULL || drawable->copy_bitmap_graduality == BITMAP_GRADUAL_INVALID) {
+            level = bitmap_get_graduality_level(bitmap);
+        } else {
+            level = drawable->copy_bitmap_graduality;
+        }
+    }
+
+    *o_level = level;
+    *o_codec = compression_selector_choose(dcc->priv->compression_selector, level,
+                                           bitmap->y * (uint64_t) bitmap->stride, candidates);
+    switch (*o_codec) {
+    case COMPRESSION_CODEC_QUIC:
+        *use_jpeg = false;
+        /* fall through */
+    case COMPRESSION_CODEC_JPEG:
+        return SPICE_IMAGE_COMPRESSION_QUIC;
+    case COMPRESSION_CODEC_LZ:
+        return SPICE_IMAGE_COMPRESSION_LZ;
+    case COMPRESSION_CODEC_LZ4:
+        return SPICE_IMAGE_COMPRESSION_LZ4;
+    case COMPRESSION_CODEC_GLZ:
+        return SPICE_IMAGE_COMPRESSION_GLZ;
+    default:
+        return SPICE_IMAGE_COMPRESSION_OFF;
+    }
+}
+
+/* Note: this can be called from the encoders pool threads so it should not
+ * access any state of the client which is not constant, besides @enc and
+ * the compression selector which is thread safe. @drawable is then only
+ * read and GLZ is not used. */
+static int compress_image(DisplayChannelClient *dcc, ImageEncoders *enc,
+                          SpiceImageCompression preferred_compression,
+                          SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
+                          int can_lossy,
+                          compress_send_data_t* o_comp_data)
 {
     DisplayChannel *display_channel = DCC_TO_DC(dcc);
     SpiceImageCompression image_compression;
     stat_start_time_t start_time;
+    stat_time_t histogram_start = stat_histogram_start();
     int success = FALSE;
+    bool use_jpeg = can_lossy && display_channel->priv->enable_jpeg &&
+        (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src));
+    CompressionCodec adaptive_codec = COMPRESSION_CODEC_INVALID;
+    BitmapGradualType adaptive_level = BITMAP_GRADUAL_NOT_AVAIL;
+    red_time_t adaptive_start = 0;
 
     stat_start_time_init(&start_time, &display_channel->priv->encoder_shared_data.off_stat);
 
-    image_compression = get_compression_for_bitmap(src, dcc->priv->image_compression, drawable);
+    if (preferred_compression == SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE) {
+        image_compression = get_adaptive_compression_for_bitmap(dcc, src, drawable, &use_jpeg,
+                                                                &adaptive_level,
+                                                                &adaptive_codec);
+        adaptive_start = spice_get_monotonic_time_ns();
+    } else {
+        image_compression = get_compression_for_bitmap(src, preferred_compression, drawable);
+    }
+    if (image_compression == SPICE_IMAGE_COMPRESSION_GLZ && enc != &dcc->priv->encoders) {
+        /* the encoders pool can't use the dictionary */
+        return FALSE;
+    }
     switch (image_compression) {
     case SPICE_IMAGE_COMPRESSION_OFF:
         break;
     case SPICE_IMAGE_COMPRESSION_QUIC:
-        if (can_lossy && display_channel->priv->enable_jpeg &&
-            (src->format != SPICE_BITMAP_FMT_RGBA || !bitmap_has_extra_stride(src))) {
-            success = image_encoders_compress_jpeg(&dcc->priv->encoders, dest, src, o_comp_data);
+        if (use_jpeg) {
+            success = image_encoders_compress_jpeg(enc, dest, src, o_comp_data);
             break;
         }
-        success = image_encoders_compress_quic(&dcc->priv->encoders, dest, src, o_comp_data);
+        success = image_encoders_compress_quic(enc, dest, src, o_comp_data);
         break;
     case SPICE_IMAGE_COMPRESSION_GLZ:
-        success = image_encoders_compress_glz(&dcc->priv->encoders, dest, src,
+        success = image_encoders_compress_glz(enc, dest, src,
                                               drawable->red_drawable, &drawable->glz_retention,
                                               o_comp_data,
                                               display_channel->priv->enable_zlib_glz_wrap);
@@ -739,26 +1216,64 @@ int dcc_compress_image(DisplayChannelClient *dcc,
 #ifdef USE_LZ4
     case SPICE_IMAGE_COMPRESSION_LZ4:
         if (dcc->test_remote_cap(SPICE_DISPLAY_CAP_LZ4_COMPRESSION)) {
-            success = image_encoders_compress_lz4(&dcc->priv->encoders, dest, src, o_comp_data);
+            success = image_encoders_compress_lz4(enc, dest, src, o_comp_data);
             break;
         }
 #endif
         /* fall through */
     case SPICE_IMAGE_COMPRESSION_LZ:
 lz_compress:
-        success = image_encoders_compress_lz(&dcc->priv->encoders, dest, src, o_comp_data);
-        if (success && !bitmap_fmt_is_rgb(src->format)) {
-            dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
-        }
+        success = image_encoders_compress_lz(enc, dest, src, o_comp_data);
         break;
     default:
         spice_error("invalid image compression type %u", image_compression);
     }
 
+    if (adaptive_codec != COMPRESSION_CODEC_INVALID) {
+        uint64_t image_size = src->stride * (uint64_t)src->y;
+        uint64_t encode_ns = spice_get_monotonic_time_ns() - adaptive_start;
+        uint64_t compressed_size = image_size;
+
+        if (success) {
+            /* the codec actually used can differ from the chosen one,
+             * GLZ falls back to LZ when it fails */
+            CompressionCodec codec = compression_codec_from_image_type(dest->descriptor.type);
+            if (codec != COMPRESSION_CODEC_INVALID) {
+                adaptive_codec = codec;
+            }
+            compressed_size = o_comp_data->comp_buf_size;
+        }
+        compression_selector_add_sample(dcc->priv->compression_selector, adaptive_level,
+                                        image_size, adaptive_codec, compressed_size, encode_ns);
+    }
+
     if (!success) {
         uint64_t image_size = src->stride * (uint64_t)src->y;
         stat_compress_add(&display_channel->priv->encoder_shared_data.off_stat, start_time, image_size, image_size);
+        stat_histogram_add_time(&display_channel->priv->encoder_shared_data.off_time,
+                                histogram_start);
+    }
+
+    return success;
+}
+
+int dcc_compress_image(DisplayChannelClient *dcc,
+                       SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
+                       int can_lossy,
+                       compress_send_data_t* o_comp_data)
+{
+    DisplayStage stage = display_channel_enter_stage(DCC_TO_DC(dcc), DISPLAY_STAGE_COMPRESS);
+    int success;
+
+    if (dcc->priv->image_compression == SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE) {
+        dcc_update_compression_selector_link(dcc);
+    }
+    success = compress_image(dcc, &dcc->priv->encoders, dcc->priv->image_compression,
+                             dest, src, drawable, can_lossy, o_comp_data);
+    if (success && dest->descriptor.type == SPICE_IMAGE_TYPE_LZ_PLT) {
+        dcc_palette_cache_palette(dcc, dest->u.lz_plt.palette, &(dest->u.lz_plt.flags));
     }
+    display_channel_enter_stage(DCC_TO_DC(dcc), stage);
 
     return success;
 }
@@ -853,6 +1368,7 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
             }
             now = &(*now)->next;
         }
+        pixmap_cache_unlocked_remove_content_hash(cache, tail);
         ring_remove(&tail->lru_link);
         cache->items--;
         cache->available += tail->size;
@@ -866,6 +1382,10 @@ bool dcc_pixmap_cache_unlocked_add(DisplayChannelClient *dcc, uint64_t id,
     ring_item_init(&item->lru_link);
     ring_add(&cache->lru, &item->lru_link);
     item->id = id;
+    item->content_next = NULL;
+    item->content_hash = 0;
+    item->content = NULL;
+    item->content_size = 0;
     item->size = size;
     item->lossy = lossy;
     memset(item->sync, 0, sizeof(item->sync));
@@ -1136,8 +1656,12 @@ static bool restore_surfaces_lossy(DisplayChannelClient *dcc,
         lossy_rect.top = mig_lossy_rect->top;
         lossy_rect.right = mig_lossy_rect->right;
         lossy_rect.bottom = mig_lossy_rect->bottom;
-        region_init(&dcc->priv->surface_client_lossy_region[surface_id]);
-        region_add(&dcc->priv->surface_client_lossy_region[surface_id], &lossy_rect);
+        /* the surface is normally created already, else fit the lossy area */
+        const DrawContext *context = &DCC_TO_DC(dcc)->priv->surfaces[surface_id].context;
+        tile_region_init(&dcc->priv->surface_client_lossy_region[surface_id],
+                         MAX(context->width, (uint32_t) MAX(lossy_rect.right, 0)),
+                         MAX(context->height, (uint32_t) MAX(lossy_rect.bottom, 0)));
+        tile_region_add(&dcc->priv->surface_client_lossy_region[surface_id], &lossy_rect);
     }
     return TRUE;
 }
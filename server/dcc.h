@@ -54,6 +54,8 @@ protected:
     virtual void migrate() override;
     virtual void handle_migrate_flush_mark() override;
     virtual bool handle_migrate_data_get_serial(uint32_t size, void *message, uint64_t &serial) override;
+    virtual void on_pipe_item_added(RedPipeItem *item) override;
+    virtual void on_pipe_item_removed(RedPipeItem *item) override;
 
 public:
     red::unique_link<DisplayChannelClientPrivate> priv;
@@ -110,8 +112,13 @@ typedef struct RedGlDrawItem {
     SpiceMsgDisplayGlDraw draw;
 } RedGlDrawItem;
 
+struct RedImageEncodeJob;
+struct RedDrawableEncodeJob;
+
 typedef struct RedImageItem {
     RedPipeItem base;
+    /* not NULL if the image is being compressed by the encoders pool */
+    RedImageEncodeJob *encode_job;
     SpicePoint pos;
     int width;
     int height;
@@ -128,6 +135,8 @@ typedef struct RedDrawablePipeItem {
     RedPipeItem base;
     Drawable *drawable;
     DisplayChannelClient *dcc;
+    /* not NULL if the source bitmap is being compressed by the encoders pool */
+    RedDrawableEncodeJob *encode_job;
 } RedDrawablePipeItem;
 
 DisplayChannelClient*      dcc_new                                   (DisplayChannel *display,
@@ -179,9 +188,19 @@ int                        dcc_compress_image                        (DisplayCha
                                                                       SpiceImage *dest, SpiceBitmap *src, Drawable *drawable,
                                                                       int can_lossy,
                                                                       compress_send_data_t* o_comp_data);
+int                        dcc_image_item_get_compressed             (DisplayChannelClient *dcc,
+                                                                      RedImageItem *item,
+                                                                      SpiceImage *dest,
+                                                                      compress_send_data_t* o_comp_data);
+int                        dcc_drawable_get_compressed               (DisplayChannelClient *dcc,
+                                                                      Drawable *drawable,
+                                                                      SpiceImage *src,
+                                                                      int can_lossy,
+                                                                      SpiceImage *dest,
+                                                                      compress_send_data_t* o_comp_data);
 
 void dcc_add_surface_area_image(DisplayChannelClient *dcc, int surface_id,
-                                SpiceRect *area, GList *pipe_item_pos, int can_lossy);
+                                SpiceRect *area, RedPipeLink *pipe_item_pos, int can_lossy);
 VideoStreamAgent *dcc_get_video_stream_agent(DisplayChannelClient *dcc, int stream_id);
 ImageEncoders *dcc_get_encoders(DisplayChannelClient *dcc);
 spice_wan_compression_t    dcc_get_jpeg_state                        (DisplayChannelClient *dcc);
@@ -63,6 +63,7 @@ struct DispatcherPrivate {
     size_t payload_size; /* used to track realloc calls */
     void *opaque;
     dispatcher_handle_any_message any_handler;
+    RedStatHistogram dispatch_time;
 };
 
 DispatcherPrivate::~DispatcherPrivate()
@@ -241,8 +242,10 @@ void DispatcherPrivate::handle_event(int fd, int event, DispatcherPrivate* priv)
 void DispatcherPrivate::send_message(const DispatcherMessage& msg, void *payload)
 {
     uint32_t ack;
+    stat_time_t start;
 
     pthread_mutex_lock(&lock);
+    start = stat_histogram_start();
     if (write_safe(send_fd, (uint8_t*)&msg, sizeof(msg)) == -1) {
         g_warning("error: failed to send message header for message %d",
                   msg.type);
@@ -260,6 +263,8 @@ void DispatcherPrivate::send_message(const DispatcherMessage& msg, void *payload
             g_warning("error: got wrong ack value in dispatcher "
                       "for message %d\n", msg.type);
             /* TODO handling error? */
+        } else {
+            stat_histogram_add_time(&dispatch_time, start);
         }
     }
 unlock:
@@ -319,3 +324,8 @@ void Dispatcher::set_opaque(void *opaque)
 {
     priv->opaque = opaque;
 }
+
+void Dispatcher::init_stat(SpiceServer *reds, const RedStatNode *parent)
+{
+    stat_init_histogram(&priv->dispatch_time, reds, parent, "dispatch_time", TRUE);
+}
@@ -23,6 +23,7 @@
 
 #include "red-common.h"
 #include "utils.hpp"
+#include "stat.h"
 
 #include "push-visibility.h"
 
@@ -149,6 +150,13 @@ public:
      */
     void set_opaque(void *opaque);
 
+    /* init_stat
+     *
+     * Publishes the time the messages requiring an ACK take to be handled,
+     * as a "dispatch_time" histogram under @parent.
+     */
+    void init_stat(SpiceServer *reds, const RedStatNode *parent);
+
 protected:
     virtual ~Dispatcher();
 
@@ -18,7 +18,11 @@
 #ifndef DISPLAY_CHANNEL_PRIVATE_H_
 #define DISPLAY_CHANNEL_PRIVATE_H_
 
+#include <pthread.h>
+
 #include "display-channel.h"
+#include "tile-region.h"
+#include "stream-grid.h"
 
 #define TRACE_ITEMS_SHIFT 3
 #define NUM_TRACE_ITEMS (1 << TRACE_ITEMS_SHIFT)
@@ -35,6 +39,14 @@ typedef struct DrawContext {
     void *line_0;
 } DrawContext;
 
+/* deferred drawings of a surface rendered by a render thread, see
+ * spice_server_set_display_render_threads() */
+typedef struct RenderJob {
+    /* the drawings to render, the tail being the oldest */
+    Ring items;
+    gint done;
+} RenderJob;
+
 typedef struct RedSurface {
     uint32_t refs;
     /* A Ring representing a hierarchical tree structure. This tree includes
@@ -46,10 +58,23 @@ typedef struct RedSurface {
      * actually used for drawing. The ring is maintained in order of age, the
      * tail being the oldest drawable. */
     Ring current_list;
+    /* spatial index of the items of the 'current' tree */
+    TreeIndex tree_index;
     DrawContext context;
 
     Ring depend_on_me;
-    QRegion draw_dirty_region;
+    TileRegion draw_dirty_region;
+    /* area of the last copy checked for a scrolling */
+    SpiceRect scroll_bbox;
+
+    /* Drawings removed from the tree but not rendered yet, only used in
+     * deferred render mode. They are rendered when the pixels of the
+     * surface are needed, the tail being the oldest drawing. */
+    Ring render_journal;
+    uint32_t render_journal_size;
+    /* the older drawings are being rendered by a render thread */
+    bool render_job_pending;
+    RenderJob render_job;
 
     //fix me - better handling here
     /* 'create_cmd' holds surface data through a pointer to guest memory, it
@@ -68,6 +93,7 @@ typedef struct MonitorsConfig {
 } MonitorsConfig;
 
 #define NUM_DRAWABLES 1000
+#define RED_PIPE_ITEMS_PER_SLAB_BLOCK 64
 typedef struct _Drawable _Drawable;
 struct _Drawable {
     union {
@@ -98,6 +124,9 @@ struct DisplayChannelPrivate
      * drawables when we need to make room for new drawables.  The ring is
      * maintained in order of age, the tail being the oldest drawable */
     Ring current_list;
+    /* serial given to the drawables added to the current lists, so that the
+     * order of the drawables of a surface is known without walking its list */
+    uint64_t current_serial;
 
     uint32_t drawable_count;
     _Drawable drawables[NUM_DRAWABLES];
@@ -113,6 +142,15 @@ struct DisplayChannelPrivate
     uint32_t next_item_trace;
     uint64_t streams_size_total;
 
+    /* see spice_server_set_streaming_video_detection() */
+    unsigned int stream_detection_min_fps;
+    unsigned int stream_detection_frames;
+    StreamGrid stream_grid;
+    RegionTrace region_traces[NUM_REGION_TRACES];
+    RedStatCounter stream_detection_hits_counter;
+    RedStatCounter stream_detection_misses_counter;
+    RedStatCounter stream_detection_false_positives_counter;
+
     RedSurface surfaces[NUM_SURFACES];
     uint32_t n_surfaces;
     SpiceImageSurfaces image_surfaces;
@@ -132,7 +170,41 @@ struct DisplayChannelPrivate
     RedStatCounter cache_hits_counter;
     RedStatCounter add_to_cache_counter;
     RedStatCounter non_cache_counter;
+    RedStatCounter content_cache_hits_counter;
+    RedStatCounter content_cache_misses_counter;
     ImageEncoderSharedData encoder_shared_data;
+
+    /* the objects allocated for every command, see red-slab.h */
+    RedDrawableSlabs drawable_slabs;
+    RedSlab *drawable_pipe_item_slab;
+    RedSlab *stream_clip_item_slab;
+
+    /* see spice_server_set_display_deferred_render() */
+    bool deferred_render;
+    RedSlab *render_journal_slab;
+    RedStatCounter deferred_draws_counter;
+    RedStatCounter deferred_dropped_counter;
+    RedStatCounter deferred_rendered_counter;
+
+    /* threads rendering the deferred drawings of the surfaces in parallel */
+    GThreadPool *render_threads;
+    pthread_mutex_t render_lock;
+    pthread_cond_t render_job_done;
+    RedStatCounter render_jobs_counter;
+    RedStatCounter render_waits_counter;
+
+    /* see spice_server_set_display_scroll_detection() */
+    bool scroll_detection;
+    RedStatCounter scroll_checks_counter;
+    RedStatCounter scroll_hits_counter;
+    RedStatCounter scroll_saved_pixels_counter;
+
+    /* see display_channel_enter_stage() */
+    DisplayStage stage;
+    uint64_t stage_start;
+    RedStatNode stage_stat;
+    RedStatCounter stage_time_counters[DISPLAY_STAGE_LAST];
+    RedStatHistogram draw_time;
 };
 
 #define FOREACH_DCC(_channel, _data) \
@@ -176,6 +248,10 @@ GArray* display_channel_get_video_codecs(DisplayChannel *display);
 int display_channel_get_stream_video(DisplayChannel *display);
 void display_channel_current_flush(DisplayChannel *display,
                                    int surface_id);
+/* renders the drawings whose rendering was deferred, to be called before
+ * reading the pixels of the surface */
+void display_channel_render_journal(DisplayChannel *display,
+                                    uint32_t surface_id);
 uint32_t display_channel_generate_uid(DisplayChannel *display);
 
 int display_channel_get_video_stream_id(DisplayChannel *display, VideoStream *stream);
@@ -20,11 +20,18 @@
 
 #include "display-channel-private.h"
 #include "red-qxl.h"
+#include "scroll-detect.h"
 
 DisplayChannel::~DisplayChannel()
 {
     display_channel_destroy_surfaces(this);
+    if (priv->render_threads) {
+        g_thread_pool_free(priv->render_threads, FALSE, TRUE);
+    }
+    pthread_cond_destroy(&priv->render_job_done);
+    pthread_mutex_destroy(&priv->render_lock);
     image_cache_reset(&priv->image_cache);
+    stream_grid_destroy(&priv->stream_grid);
 
     if (spice_extra_checks) {
         unsigned int count;
@@ -51,9 +58,20 @@ DisplayChannel::~DisplayChannel()
 
     monitors_config_unref(priv->monitors_config);
     g_array_unref(priv->video_codecs);
+
+    red_slab_destroy(priv->render_journal_slab);
+    red_slab_destroy(priv->stream_clip_item_slab);
+    red_slab_destroy(priv->drawable_pipe_item_slab);
+    image_encoder_shared_destroy(&priv->encoder_shared_data);
+    red_drawable_slabs_destroy(&priv->drawable_slabs);
 }
 
 static void drawable_draw(DisplayChannel *display, Drawable *drawable);
+static void red_drawable_draw(DisplayChannel *display, RedDrawable *red_drawable,
+                              Drawable *drawable, ImageCache *cache);
+static void render_journal_drop(DisplayChannel *display, RedSurface *surface);
+static void render_journals(DisplayChannel *display);
+static void current_flush(DisplayChannel *display, int surface_id);
 static Drawable *display_channel_drawable_try_new(DisplayChannel *display,
                                                   uint32_t process_commands_generation);
 
@@ -240,6 +258,8 @@ void display_channel_surface_unref(DisplayChannel *display, uint32_t surface_id)
     }
     spice_assert(surface->context.canvas);
 
+    render_journal_drop(display, surface);
+
     surface->context.canvas->ops->destroy(surface->context.canvas);
     if (surface->create_cmd != NULL) {
         red_surface_cmd_unref(surface->create_cmd);
@@ -250,7 +270,8 @@ void display_channel_surface_unref(DisplayChannel *display, uint32_t surface_id)
         surface->destroy_cmd = NULL;
     }
 
-    region_destroy(&surface->draw_dirty_region);
+    tile_region_destroy(&surface->draw_dirty_region);
+    tree_index_destroy(&surface->tree_index);
     surface->context.canvas = NULL;
     FOREACH_DCC(display, dcc) {
         dcc_destroy_surface(dcc, surface_id);
@@ -363,6 +384,8 @@ static void current_add_drawable(DisplayChannel *display,
 
     surface = &display->priv->surfaces[surface_id];
     ring_add_after(&drawable->tree_item.base.siblings_link, pos);
+    tree_index_add(&surface->tree_index, &drawable->tree_item.base);
+    drawable->current_serial = ++display->priv->current_serial;
     ring_add(&display->priv->current_list, &drawable->list_link);
     ring_add(&surface->current_list, &drawable->surface_list_link);
     drawable->refs++;
@@ -375,6 +398,7 @@ static void current_remove_drawable(DisplayChannel *display, Drawable *item)
     /* todo: move all to unref? */
     video_stream_trace_add_drawable(display, item);
     draw_item_remove_shadow(&item->tree_item);
+    tree_index_remove(&item->tree_item.base);
     ring_remove(&item->tree_item.base.siblings_link);
     ring_remove(&item->list_link);
     ring_remove(&item->surface_list_link);
@@ -828,6 +852,7 @@ static bool current_add_with_shadow(DisplayChannel *display, Ring *ring, Drawabl
 
     /* Prepend the shadow to the beginning of the current ring */
     ring_add(ring, &shadow->base.siblings_link);
+    tree_index_add(&display->priv->surfaces[item->surface_id].tree_index, &shadow->base);
     /* Prepend the draw item to the beginning of the current ring. NOTE: this
      * means that the drawable is placed *before* its associated shadow in the
      * tree. Changing this order will violate several unstated assumptions */
@@ -865,6 +890,18 @@ static bool current_add(DisplayChannel *display, Ring *ring, Drawable *drawable)
     region_init(&exclude_rgn);
     now = ring_next(ring, ring);
 
+    /* the loop below only acts on the items whose bounds intersect the ones
+     * of the new drawable, if none does skip walking the whole ring */
+    if (now) {
+        SpiceRect bounds;
+
+        region_extents(&item->base.rgn, &bounds);
+        if (!tree_index_intersects(&display->priv->surfaces[drawable->surface_id].tree_index,
+                                   &bounds)) {
+            now = NULL;
+        }
+    }
+
     /* check whether the new drawable region intersects any of the items
      * already in the 'current' ring */
     while (now) {
@@ -1158,7 +1195,7 @@ static void handle_self_bitmap(DisplayChannel *display, Drawable *drawable)
     height = red_drawable->self_bitmap_area.bottom - red_drawable->self_bitmap_area.top;
     dest_stride = SPICE_ALIGN(width * bpp, 4);
 
-    image = g_new0(SpiceImage, 1);
+    image = red_drawable_image_new(&display->priv->drawable_slabs);
     image->descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
     image->descriptor.flags = 0;
 
@@ -1276,6 +1313,22 @@ static bool validate_drawable_bbox(DisplayChannel *display, RedDrawable *drawabl
         return TRUE;
 }
 
+static bool validate_red_drawable(DisplayChannel *display, RedDrawable *red_drawable)
+{
+    int x;
+
+    if (!validate_drawable_bbox(display, red_drawable)) {
+        return FALSE;
+    }
+    for (x = 0; x < 3; ++x) {
+        if (red_drawable->surface_deps[x] != -1
+            && !display_channel_validate_surface(display, red_drawable->surface_deps[x])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 /**
  * @brief Get a new Drawable
  *
@@ -1288,20 +1341,13 @@ static Drawable *display_channel_get_drawable(DisplayChannel *display, uint8_t e
                                               uint32_t process_commands_generation)
 {
     Drawable *drawable;
-    int x;
 
     /* Validate all surface ids before updating counters
      * to avoid invalid updates if we find an invalid id.
      */
-    if (!validate_drawable_bbox(display, red_drawable)) {
+    if (!validate_red_drawable(display, red_drawable)) {
         return NULL;
     }
-    for (x = 0; x < 3; ++x) {
-        if (red_drawable->surface_deps[x] != -1
-            && !display_channel_validate_surface(display, red_drawable->surface_deps[x])) {
-            return NULL;
-        }
-    }
 
     drawable = display_channel_drawable_try_new(display, process_commands_generation);
     if (!drawable) {
@@ -1380,8 +1426,8 @@ static void display_channel_add_drawable(DisplayChannel *display, Drawable *draw
 #endif
 }
 
-void display_channel_process_draw(DisplayChannel *display, RedDrawable *red_drawable,
-                                  uint32_t process_commands_generation)
+static void display_channel_add_red_drawable(DisplayChannel *display, RedDrawable *red_drawable,
+                                             uint32_t process_commands_generation)
 {
     Drawable *drawable =
         display_channel_get_drawable(display, red_drawable->effect, red_drawable,
@@ -1396,6 +1442,248 @@ void display_channel_process_draw(DisplayChannel *display, RedDrawable *red_draw
     drawable_unref(drawable);
 }
 
+/* the repaints checked for a scrolling, see
+ * spice_server_set_display_scroll_detection() */
+#define SCROLL_MIN_HEIGHT 32
+#define SCROLL_MIN_AREA (256 * 128)
+
+static bool red_drawable_can_scroll(DisplayChannel *display, RedDrawable *red_drawable)
+{
+    SpiceCopy *copy = &red_drawable->u.copy;
+    SpiceRect *bbox = &red_drawable->bbox;
+    int32_t width = bbox->right - bbox->left;
+    int32_t height = bbox->bottom - bbox->top;
+    DrawContext *context;
+    int i;
+
+    if (red_drawable->type != QXL_DRAW_COPY ||
+        red_drawable->effect != QXL_EFFECT_OPAQUE ||
+        red_drawable->self_bitmap ||
+        red_drawable->clip.type != SPICE_CLIP_TYPE_NONE ||
+        copy->rop_descriptor != SPICE_ROPD_OP_PUT ||
+        copy->mask.bitmap != NULL ||
+        copy->src_bitmap->descriptor.type != SPICE_IMAGE_TYPE_BITMAP) {
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        if (red_drawable->surface_deps[i] != -1) {
+            return false;
+        }
+    }
+    if (height < SCROLL_MIN_HEIGHT || width * height < SCROLL_MIN_AREA ||
+        copy->src_area.right - copy->src_area.left != width ||
+        copy->src_area.bottom - copy->src_area.top != height) {
+        return false;
+    }
+    if (copy->src_bitmap->u.bitmap.format != SPICE_BITMAP_FMT_32BIT ||
+        (copy->src_bitmap->u.bitmap.data->flags & SPICE_CHUNKS_FLAGS_UNSTABLE)) {
+        return false;
+    }
+    if (!validate_red_drawable(display, red_drawable)) {
+        return false;
+    }
+    /* the current content is read in place */
+    context = &display->priv->surfaces[red_drawable->surface_id].context;
+    return context->canvas_draws_on_surface && context->format == SPICE_SURFACE_FMT_32_xRGB;
+}
+
+/* Processes @red_drawable as a copy of the part of its area which is
+ * already on the surface at another height, followed by a drawing of the
+ * newly exposed strip. Returns false if @red_drawable is not the repaint
+ * of a scrolled area. */
+static bool display_channel_process_scroll(DisplayChannel *display, RedDrawable *red_drawable,
+                                           uint32_t process_commands_generation)
+{
+    RedDrawableSlabs *slabs = &display->priv->drawable_slabs;
+    SpiceRect *bbox = &red_drawable->bbox;
+    SpiceCopy *copy = &red_drawable->u.copy;
+    RedSurface *surface;
+    SpiceBitmap *bitmap;
+    DrawContext *context;
+    bool repaint;
+    RedDrawable *copy_bits, *strip;
+    SpiceImage *image;
+    const uint8_t *old_rows, *new_rows;
+    uint8_t *dest;
+    int32_t new_stride, dy;
+    uint32_t width, height, strip_height, strip_stride, first, y;
+    int i;
+
+    if (!red_drawable_can_scroll(display, red_drawable)) {
+        return false;
+    }
+
+    /* A scrolled area is repainted again and again at the same place.
+     * Comparing with the surface requires to render the area, so only the
+     * repaints of the area of the previous candidate are checked and the
+     * other copies keep their deferred rendering. */
+    surface = &display->priv->surfaces[red_drawable->surface_id];
+    repaint = rect_is_equal(&surface->scroll_bbox, bbox);
+    surface->scroll_bbox = *bbox;
+    if (!repaint) {
+        return false;
+    }
+    stat_inc_counter(display->priv->scroll_checks_counter, 1);
+
+    width = bbox->right - bbox->left;
+    height = bbox->bottom - bbox->top;
+    bitmap = &copy->src_bitmap->u.bitmap;
+    if (bitmap->data->num_chunks != 1) {
+        spice_chunks_linearize(bitmap->data);
+    }
+    new_rows = bitmap->data->chunk[0].data + copy->src_area.left * sizeof(uint32_t);
+    if (bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN) {
+        new_rows += (size_t) copy->src_area.top * bitmap->stride;
+        new_stride = bitmap->stride;
+    } else {
+        new_rows += (size_t) (bitmap->y - 1 - copy->src_area.top) * bitmap->stride;
+        new_stride = -(int32_t) bitmap->stride;
+    }
+
+    display_channel_draw(display, bbox, red_drawable->surface_id);
+    context = &surface->context;
+    old_rows = (const uint8_t *) context->line_0 + (intptr_t) bbox->top * context->stride +
+               bbox->left * sizeof(uint32_t);
+    /* the exposed strip is at most half of the area */
+    dy = scroll_detect_offset(old_rows, context->stride, new_rows, new_stride,
+                              width, height, height / 2);
+    if (dy == 0) {
+        return false;
+    }
+    strip_height = abs(dy);
+
+    copy_bits = red_drawable_new_local(slabs);
+    copy_bits->surface_id = red_drawable->surface_id;
+    copy_bits->effect = QXL_EFFECT_OPAQUE;
+    copy_bits->type = QXL_COPY_BITS;
+    copy_bits->bbox = *bbox;
+    copy_bits->u.copy_bits.src_pos.x = bbox->left;
+    if (dy > 0) {
+        copy_bits->bbox.bottom -= dy;
+        copy_bits->u.copy_bits.src_pos.y = bbox->top + dy;
+    } else {
+        copy_bits->bbox.top -= dy;
+        copy_bits->u.copy_bits.src_pos.y = bbox->top;
+    }
+
+    strip = red_drawable_new_local(slabs);
+    strip->surface_id = red_drawable->surface_id;
+    strip->effect = red_drawable->effect;
+    strip->type = QXL_DRAW_COPY;
+    strip->bbox = *bbox;
+    if (dy > 0) {
+        strip->bbox.top = bbox->bottom - dy;
+        first = height - dy;
+    } else {
+        strip->bbox.bottom = bbox->top - dy;
+        first = 0;
+    }
+    for (i = 0; i < 3; i++) {
+        copy_bits->surface_deps[i] = -1;
+        strip->surface_deps[i] = -1;
+    }
+    strip->u.copy.rop_descriptor = copy->rop_descriptor;
+    strip->u.copy.scale_mode = copy->scale_mode;
+    strip->u.copy.src_area.right = width;
+    strip->u.copy.src_area.bottom = strip_height;
+
+    /* only the rows of the strip are kept, the rest of the image is
+     * released to the guest with @red_drawable */
+    strip_stride = width * sizeof(uint32_t);
+    image = red_drawable_image_new(slabs);
+    image->descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    image->descriptor.flags = copy->src_bitmap->descriptor.flags & SPICE_IMAGE_FLAGS_HIGH_BITS_SET;
+    QXL_SET_IMAGE_ID(image, QXL_IMAGE_GROUP_RED, display_channel_generate_uid(display));
+    image->u.bitmap.flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    image->u.bitmap.format = SPICE_BITMAP_FMT_32BIT;
+    image->u.bitmap.stride = strip_stride;
+    image->descriptor.width = image->u.bitmap.x = width;
+    image->descriptor.height = image->u.bitmap.y = strip_height;
+    image->u.bitmap.palette = NULL;
+    dest = (uint8_t *) spice_malloc_n(strip_height, strip_stride);
+    for (y = 0; y < strip_height; y++) {
+        memcpy(dest + y * strip_stride, new_rows + (intptr_t) new_stride * (first + y),
+               strip_stride);
+    }
+    image->u.bitmap.data = spice_chunks_new_linear(dest, strip_height * strip_stride);
+    image->u.bitmap.data->flags |= SPICE_CHUNKS_FLAGS_FREE;
+    strip->u.copy.src_bitmap = image;
+
+    stat_inc_counter(display->priv->scroll_hits_counter, 1);
+    stat_inc_counter(display->priv->scroll_saved_pixels_counter, width * (height - strip_height));
+
+    display_channel_add_red_drawable(display, copy_bits, process_commands_generation);
+    red_drawable_unref(copy_bits);
+    display_channel_add_red_drawable(display, strip, process_commands_generation);
+    red_drawable_unref(strip);
+    return true;
+}
+
+void display_channel_process_draw(DisplayChannel *display, RedDrawable *red_drawable,
+                                  uint32_t process_commands_generation)
+{
+    if (display->priv->scroll_detection &&
+        display_channel_process_scroll(display, red_drawable, process_commands_generation)) {
+        return;
+    }
+    display_channel_add_red_drawable(display, red_drawable, process_commands_generation);
+}
+
+/* maximum number of drawables of a batch checked against the following ones */
+#define MAX_BATCH_OCCLUDERS 16
+
+unsigned int display_channel_process_draw_batch(DisplayChannel *display,
+                                                RedDrawable **red_drawables,
+                                                unsigned int num_drawables,
+                                                uint32_t process_commands_generation)
+{
+    RedDrawable *occluders[MAX_BATCH_OCCLUDERS];
+    unsigned int num_occluders = 0;
+    unsigned int num_occluded = 0;
+    unsigned int i, j;
+
+    /* Walk the batch backward to find the drawables hidden by a later
+     * one. An occluder stops hiding the previous drawables as soon as a
+     * drawable in between reads its surface. */
+    for (i = num_drawables; i-- > 0;) {
+        RedDrawable *red_drawable = red_drawables[i];
+
+        for (j = 0; j < num_occluders; j++) {
+            if (red_drawable_occludes(occluders[j], red_drawable)) {
+                break;
+            }
+        }
+        if (j < num_occluders) {
+            red_drawable_unref(red_drawable);
+            red_drawables[i] = NULL;
+            num_occluded++;
+            continue;
+        }
+
+        for (j = 0; j < num_occluders;) {
+            if (red_drawable_reads_surface(red_drawable, occluders[j]->surface_id)) {
+                occluders[j] = occluders[--num_occluders];
+            } else {
+                j++;
+            }
+        }
+        if (num_occluders < MAX_BATCH_OCCLUDERS &&
+            red_drawable->effect == QXL_EFFECT_OPAQUE &&
+            validate_red_drawable(display, red_drawable)) {
+            occluders[num_occluders++] = red_drawable;
+        }
+    }
+
+    for (i = 0; i < num_drawables; i++) {
+        if (red_drawables[i]) {
+            display_channel_process_draw(display, red_drawables[i], process_commands_generation);
+            red_drawable_unref(red_drawables[i]);
+            red_drawables[i] = NULL;
+        }
+    }
+    return num_occluded;
+}
+
 bool display_channel_wait_for_migrate_data(DisplayChannel *display)
 {
     uint64_t end_time = spice_get_monotonic_time_ns() + DISPLAY_CLIENT_MIGRATE_DATA_TIMEOUT;
@@ -1439,9 +1727,10 @@ void display_channel_flush_all_surfaces(DisplayChannel *display)
 
     for (x = 0; x < NUM_SURFACES; ++x) {
         if (display->priv->surfaces[x].context.canvas) {
-            display_channel_current_flush(display, x);
+            current_flush(display, x);
         }
     }
+    render_journals(display);
 }
 
 void display_channel_free_glz_drawables_to_free(DisplayChannel *display)
@@ -1466,6 +1755,201 @@ void display_channel_free_glz_drawables(DisplayChannel *display)
     }
 }
 
+/* Deferred render mode: the drawables leaving the tree to make room are
+ * not rendered right away but kept in a journal of their surface, most
+ * of them are never read back as the clients get them as draw commands.
+ * Only the drawings which do not read any surface are deferred, so a
+ * journal can be rendered without rendering other surfaces first. */
+typedef struct RenderJournalItem {
+    RingItem link;
+    RedDrawable *red_drawable;
+} RenderJournalItem;
+
+#define RENDER_JOURNAL_MAX_SIZE 128
+
+/* the surface_deps are announced by the guest, the images actually read
+ * by the drawing are checked as well */
+static bool drawable_can_defer(DisplayChannel *display, Drawable *drawable)
+{
+    RedDrawable *red_drawable = drawable->red_drawable;
+    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES];
+    int x;
+
+    if (!display->priv->deferred_render ||
+        red_drawable->self_bitmap || red_drawable->type == QXL_COPY_BITS) {
+        return false;
+    }
+    for (x = 0; x < 3; ++x) {
+        if (drawable->surface_deps[x] != -1) {
+            return false;
+        }
+    }
+    return red_drawable_get_image_surfaces(red_drawable, surface_ids) == 0;
+}
+
+static void render_journal_item_free(RedSurface *surface, RenderJournalItem *item)
+{
+    ring_remove(&item->link);
+    surface->render_journal_size--;
+    red_drawable_unref(item->red_drawable);
+    red_slab_free(item);
+}
+
+static void render_journal_render_oldest(DisplayChannel *display, RedSurface *surface)
+{
+    RenderJournalItem *item =
+        SPICE_CONTAINEROF(ring_get_tail(&surface->render_journal), RenderJournalItem, link);
+
+    DisplayStage stage = display_channel_enter_stage(display, DISPLAY_STAGE_RENDER);
+
+    red_drawable_draw(display, item->red_drawable, NULL, &display->priv->image_cache);
+    render_journal_item_free(surface, item);
+    stat_inc_counter(display->priv->deferred_rendered_counter, 1);
+    display_channel_enter_stage(display, stage);
+}
+
+/* Render threads: the journal of a surface is handed to a render thread
+ * as a whole, the worker waits for it to be rendered before anything
+ * else reads or draws on the surface. The journals do not read other
+ * surfaces so the surfaces are rendered independently, the image cache
+ * owned by the worker is not used by the render threads. */
+static void render_job_run(gpointer data, gpointer user_data)
+{
+    RenderJob *job = (RenderJob *) data;
+    DisplayChannel *display = (DisplayChannel *) user_data;
+    RingItem *link;
+
+    for (link = ring_get_tail(&job->items); link != NULL; link = ring_prev(&job->items, link)) {
+        RenderJournalItem *item = SPICE_CONTAINEROF(link, RenderJournalItem, link);
+        red_drawable_draw(display, item->red_drawable, NULL, NULL);
+    }
+
+    pthread_mutex_lock(&display->priv->render_lock);
+    g_atomic_int_set(&job->done, TRUE);
+    pthread_cond_broadcast(&display->priv->render_job_done);
+    pthread_mutex_unlock(&display->priv->render_lock);
+}
+
+static void render_job_wait(DisplayChannel *display, RedSurface *surface)
+{
+    RenderJob *job = &surface->render_job;
+    RingItem *link;
+
+    if (!surface->render_job_pending) {
+        return;
+    }
+    if (!g_atomic_int_get(&job->done)) {
+        DisplayStage stage = display_channel_enter_stage(display, DISPLAY_STAGE_RENDER);
+
+        stat_inc_counter(display->priv->render_waits_counter, 1);
+        pthread_mutex_lock(&display->priv->render_lock);
+        while (!g_atomic_int_get(&job->done)) {
+            pthread_cond_wait(&display->priv->render_job_done, &display->priv->render_lock);
+        }
+        pthread_mutex_unlock(&display->priv->render_lock);
+        display_channel_enter_stage(display, stage);
+    }
+
+    /* the drawables and the items are freed by the worker, their slabs
+     * are not thread safe */
+    while ((link = ring_get_head(&job->items)) != NULL) {
+        RenderJournalItem *item = SPICE_CONTAINEROF(link, RenderJournalItem, link);
+        ring_remove(link);
+        red_drawable_unref(item->red_drawable);
+        red_slab_free(item);
+        stat_inc_counter(display->priv->deferred_rendered_counter, 1);
+    }
+    surface->render_job_pending = false;
+}
+
+static void render_job_push(DisplayChannel *display, uint32_t surface_id)
+{
+    RedSurface *surface = &display->priv->surfaces[surface_id];
+    RenderJob *job = &surface->render_job;
+    RingItem *link;
+
+    render_job_wait(display, surface);
+
+    ring_init(&job->items);
+    while ((link = ring_get_tail(&surface->render_journal)) != NULL) {
+        ring_remove(link);
+        ring_add(&job->items, link);
+    }
+    surface->render_journal_size = 0;
+    g_atomic_int_set(&job->done, FALSE);
+    surface->render_job_pending = true;
+
+    g_thread_pool_push(display->priv->render_threads, job, NULL);
+    stat_inc_counter(display->priv->render_jobs_counter, 1);
+}
+
+static void render_journal_add(DisplayChannel *display, Drawable *drawable)
+{
+    RedSurface *surface = &display->priv->surfaces[drawable->surface_id];
+    RenderJournalItem *item;
+    RingItem *link, *next;
+
+    /* nothing reads the surface until the journal is rendered, the
+     * drawings covered by the new one do not need to be rendered */
+    RING_FOREACH_SAFE(link, next, &surface->render_journal) {
+        item = SPICE_CONTAINEROF(link, RenderJournalItem, link);
+        if (red_drawable_occludes(drawable->red_drawable, item->red_drawable)) {
+            render_journal_item_free(surface, item);
+            stat_inc_counter(display->priv->deferred_dropped_counter, 1);
+        }
+    }
+    if (surface->render_journal_size >= RENDER_JOURNAL_MAX_SIZE) {
+        if (display->priv->render_threads) {
+            render_job_push(display, drawable->surface_id);
+        } else {
+            render_journal_render_oldest(display, surface);
+        }
+    }
+
+    item = (RenderJournalItem *) red_slab_alloc(display->priv->render_journal_slab);
+    item->red_drawable = red_drawable_ref(drawable->red_drawable);
+    ring_add(&surface->render_journal, &item->link);
+    surface->render_journal_size++;
+    stat_inc_counter(display->priv->deferred_draws_counter, 1);
+}
+
+void display_channel_render_journal(DisplayChannel *display, uint32_t surface_id)
+{
+    RedSurface *surface = &display->priv->surfaces[surface_id];
+
+    render_job_wait(display, surface);
+    while (surface->render_journal_size > 0) {
+        render_journal_render_oldest(display, surface);
+    }
+}
+
+/* renders the journals of all the surfaces, in parallel if possible */
+static void render_journals(DisplayChannel *display)
+{
+    uint32_t i;
+
+    if (display->priv->render_threads) {
+        for (i = 0; i < NUM_SURFACES; i++) {
+            if (display->priv->surfaces[i].render_journal_size > 1) {
+                render_job_push(display, i);
+            }
+        }
+    }
+    for (i = 0; i < NUM_SURFACES; i++) {
+        display_channel_render_journal(display, i);
+    }
+}
+
+static void render_journal_drop(DisplayChannel *display, RedSurface *surface)
+{
+    render_job_wait(display, surface);
+    while (surface->render_journal_size > 0) {
+        render_journal_item_free(surface,
+                                 SPICE_CONTAINEROF(ring_get_tail(&surface->render_journal),
+                                                   RenderJournalItem, link));
+    }
+}
+
 static bool free_one_drawable(DisplayChannel *display, int force_glz_free)
 {
     RingItem *ring_item = ring_get_tail(&display->priv->current_list);
@@ -1480,7 +1964,11 @@ static bool free_one_drawable(DisplayChannel *display, int force_glz_free)
     if (force_glz_free) {
         glz_retention_free_drawables(&drawable->glz_retention);
     }
-    drawable_draw(display, drawable);
+    if (drawable_can_defer(display, drawable)) {
+        render_journal_add(display, drawable);
+    } else {
+        drawable_draw(display, drawable);
+    }
     container = drawable->tree_item.base.container;
 
     current_remove_drawable(display, drawable);
@@ -1488,7 +1976,7 @@ static bool free_one_drawable(DisplayChannel *display, int force_glz_free)
     return TRUE;
 }
 
-void display_channel_current_flush(DisplayChannel *display, int surface_id)
+static void current_flush(DisplayChannel *display, int surface_id)
 {
     while (!ring_is_empty(&display->priv->surfaces[surface_id].current_list)) {
         free_one_drawable(display, FALSE);
@@ -1496,6 +1984,12 @@ void display_channel_current_flush(DisplayChannel *display, int surface_id)
     current_remove_all(display, surface_id);
 }
 
+void display_channel_current_flush(DisplayChannel *display, int surface_id)
+{
+    current_flush(display, surface_id);
+    display_channel_render_journal(display, surface_id);
+}
+
 void display_channel_free_some(DisplayChannel *display)
 {
     int n = 0;
@@ -1516,6 +2010,8 @@ void display_channel_free_some(DisplayChannel *display)
     while (!ring_is_empty(&display->priv->current_list) && n++ < RED_RELEASE_BUNCH_SIZE) {
         free_one_drawable(display, TRUE);
     }
+    /* the deferred drawings hold guest memory too */
+    render_journals(display);
 
     FOREACH_DCC(display, dcc) {
         ImageEncoders *encoders = dcc_get_encoders(dcc);
@@ -1653,7 +2149,8 @@ void drawable_unref(Drawable *drawable)
 
 static void drawable_deps_draw(DisplayChannel *display, Drawable *drawable)
 {
-    int x;
+    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES];
+    int x, n;
     int surface_id;
 
     for (x = 0; x < 3; ++x) {
@@ -1661,142 +2158,155 @@ static void drawable_deps_draw(DisplayChannel *display, Drawable *drawable)
         if (surface_id != -1 && drawable->depend_items[x].drawable) {
             depended_item_remove(&drawable->depend_items[x]);
             display_channel_draw(display, &drawable->red_drawable->surfaces_rects[x], surface_id);
+        } else if (surface_id != -1) {
+            display_channel_render_journal(display, surface_id);
+        }
+    }
+
+    /* the guest may not list all the surfaces read in surface_deps */
+    n = red_drawable_get_image_surfaces(drawable->red_drawable, surface_ids);
+    for (x = 0; x < n; ++x) {
+        if (surface_ids[x] < display->priv->n_surfaces) {
+            display_channel_render_journal(display, surface_ids[x]);
         }
     }
 }
 
-static void drawable_draw(DisplayChannel *display, Drawable *drawable)
+/* @drawable may be NULL if @red_drawable has no self bitmap, @cache is
+ * NULL when rendering out of the worker thread */
+static void red_drawable_draw(DisplayChannel *display, RedDrawable *red_drawable,
+                              Drawable *drawable, ImageCache *cache)
 {
     RedSurface *surface;
     SpiceCanvas *canvas;
-    SpiceClip clip = drawable->red_drawable->clip;
+    SpiceClip clip = red_drawable->clip;
 
-    drawable_deps_draw(display, drawable);
-
-    surface = &display->priv->surfaces[drawable->surface_id];
+    surface = &display->priv->surfaces[red_drawable->surface_id];
     canvas = surface->context.canvas;
     spice_return_if_fail(canvas);
 
-    image_cache_aging(&display->priv->image_cache);
+    if (cache) {
+        image_cache_aging(cache);
+    }
 
-    region_add(&surface->draw_dirty_region, &drawable->red_drawable->bbox);
+    tile_region_add(&surface->draw_dirty_region, &red_drawable->bbox);
 
-    switch (drawable->red_drawable->type) {
+    switch (red_drawable->type) {
     case QXL_DRAW_FILL: {
-        SpiceFill fill = drawable->red_drawable->u.fill;
+        SpiceFill fill = red_drawable->u.fill;
         SpiceImage img1, img2;
-        image_cache_localize_brush(&display->priv->image_cache, &fill.brush, &img1);
-        image_cache_localize_mask(&display->priv->image_cache, &fill.mask, &img2);
-        canvas->ops->draw_fill(canvas, &drawable->red_drawable->bbox,
+        image_cache_localize_brush(cache, &fill.brush, &img1);
+        image_cache_localize_mask(cache, &fill.mask, &img2);
+        canvas->ops->draw_fill(canvas, &red_drawable->bbox,
                                &clip, &fill);
         break;
     }
     case QXL_DRAW_OPAQUE: {
-        SpiceOpaque opaque = drawable->red_drawable->u.opaque;
+        SpiceOpaque opaque = red_drawable->u.opaque;
         SpiceImage img1, img2, img3;
-        image_cache_localize_brush(&display->priv->image_cache, &opaque.brush, &img1);
-        image_cache_localize(&display->priv->image_cache, &opaque.src_bitmap, &img2, drawable);
-        image_cache_localize_mask(&display->priv->image_cache, &opaque.mask, &img3);
-        canvas->ops->draw_opaque(canvas, &drawable->red_drawable->bbox, &clip, &opaque);
+        image_cache_localize_brush(cache, &opaque.brush, &img1);
+        image_cache_localize(cache, &opaque.src_bitmap, &img2, drawable);
+        image_cache_localize_mask(cache, &opaque.mask, &img3);
+        canvas->ops->draw_opaque(canvas, &red_drawable->bbox, &clip, &opaque);
         break;
     }
     case QXL_DRAW_COPY: {
-        SpiceCopy copy = drawable->red_drawable->u.copy;
+        SpiceCopy copy = red_drawable->u.copy;
         SpiceImage img1, img2;
-        image_cache_localize(&display->priv->image_cache, &copy.src_bitmap, &img1, drawable);
-        image_cache_localize_mask(&display->priv->image_cache, &copy.mask, &img2);
-        canvas->ops->draw_copy(canvas, &drawable->red_drawable->bbox,
+        image_cache_localize(cache, &copy.src_bitmap, &img1, drawable);
+        image_cache_localize_mask(cache, &copy.mask, &img2);
+        canvas->ops->draw_copy(canvas, &red_drawable->bbox,
                                &clip, &copy);
         break;
     }
     case QXL_DRAW_TRANSPARENT: {
-        SpiceTransparent transparent = drawable->red_drawable->u.transparent;
+        SpiceTransparent transparent = red_drawable->u.transparent;
         SpiceImage img1;
-        image_cache_localize(&display->priv->image_cache, &transparent.src_bitmap, &img1, drawable);
+        image_cache_localize(cache, &transparent.src_bitmap, &img1, drawable);
         canvas->ops->draw_transparent(canvas,
-                                      &drawable->red_drawable->bbox, &clip, &transparent);
+                                      &red_drawable->bbox, &clip, &transparent);
         break;
     }
     case QXL_DRAW_ALPHA_BLEND: {
-        SpiceAlphaBlend alpha_blend = drawable->red_drawable->u.alpha_blend;
+        SpiceAlphaBlend alpha_blend = red_drawable->u.alpha_blend;
         SpiceImage img1;
-        image_cache_localize(&display->priv->image_cache, &alpha_blend.src_bitmap, &img1, drawable);
+        image_cache_localize(cache, &alpha_blend.src_bitmap, &img1, drawable);
         canvas->ops->draw_alpha_blend(canvas,
-                                      &drawable->red_drawable->bbox, &clip, &alpha_blend);
+                                      &red_drawable->bbox, &clip, &alpha_blend);
         break;
     }
     case QXL_COPY_BITS: {
-        canvas->ops->copy_bits(canvas, &drawable->red_drawable->bbox,
-                               &clip, &drawable->red_drawable->u.copy_bits.src_pos);
+        canvas->ops->copy_bits(canvas, &red_drawable->bbox,
+                               &clip, &red_drawable->u.copy_bits.src_pos);
         break;
     }
     case QXL_DRAW_BLEND: {
-        SpiceBlend blend = drawable->red_drawable->u.blend;
+        SpiceBlend blend = red_drawable->u.blend;
         SpiceImage img1, img2;
-        image_cache_localize(&display->priv->image_cache, &blend.src_bitmap, &img1, drawable);
-        image_cache_localize_mask(&display->priv->image_cache, &blend.mask, &img2);
-        canvas->ops->draw_blend(canvas, &drawable->red_drawable->bbox,
+        image_cache_localize(cache, &blend.src_bitmap, &img1, drawable);
+        image_cache_localize_mask(cache, &blend.mask, &img2);
+        canvas->ops->draw_blend(canvas, &red_drawable->bbox,
                                 &clip, &blend);
         break;
     }
     case QXL_DRAW_BLACKNESS: {
-        SpiceBlackness blackness = drawable->red_drawable->u.blackness;
+        SpiceBlackness blackness = red_drawable->u.blackness;
         SpiceImage img1;
-        image_cache_localize_mask(&display->priv->image_cache, &blackness.mask, &img1);
+        image_cache_localize_mask(cache, &blackness.mask, &img1);
         canvas->ops->draw_blackness(canvas,
-                                    &drawable->red_drawable->bbox, &clip, &blackness);
+                                    &red_drawable->bbox, &clip, &blackness);
         break;
     }
     case QXL_DRAW_WHITENESS: {
-        SpiceWhiteness whiteness = drawable->red_drawable->u.whiteness;
+        SpiceWhiteness whiteness = red_drawable->u.whiteness;
         SpiceImage img1;
-        image_cache_localize_mask(&display->priv->image_cache, &whiteness.mask, &img1);
+        image_cache_localize_mask(cache, &whiteness.mask, &img1);
         canvas->ops->draw_whiteness(canvas,
-                                    &drawable->red_drawable->bbox, &clip, &whiteness);
+                                    &red_drawable->bbox, &clip, &whiteness);
         break;
     }
     case QXL_DRAW_INVERS: {
-        SpiceInvers invers = drawable->red_drawable->u.invers;
+        SpiceInvers invers = red_drawable->u.invers;
         SpiceImage img1;
-        image_cache_localize_mask(&display->priv->image_cache, &invers.mask, &img1);
+        image_cache_localize_mask(cache, &invers.mask, &img1);
         canvas->ops->draw_invers(canvas,
-                                 &drawable->red_drawable->bbox, &clip, &invers);
+                                 &red_drawable->bbox, &clip, &invers);
         break;
     }
     case QXL_DRAW_ROP3: {
-        SpiceRop3 rop3 = drawable->red_drawable->u.rop3;
+        SpiceRop3 rop3 = red_drawable->u.rop3;
         SpiceImage img1, img2, img3;
-        image_cache_localize_brush(&display->priv->image_cache, &rop3.brush, &img1);
-        image_cache_localize(&display->priv->image_cache, &rop3.src_bitmap, &img2, drawable);
-        image_cache_localize_mask(&display->priv->image_cache, &rop3.mask, &img3);
-        canvas->ops->draw_rop3(canvas, &drawable->red_drawable->bbox,
+        image_cache_localize_brush(cache, &rop3.brush, &img1);
+        image_cache_localize(cache, &rop3.src_bitmap, &img2, drawable);
+        image_cache_localize_mask(cache, &rop3.mask, &img3);
+        canvas->ops->draw_rop3(canvas, &red_drawable->bbox,
                                &clip, &rop3);
         break;
     }
     case QXL_DRAW_COMPOSITE: {
-        SpiceComposite composite = drawable->red_drawable->u.composite;
+        SpiceComposite composite = red_drawable->u.composite;
         SpiceImage src, mask;
-        image_cache_localize(&display->priv->image_cache, &composite.src_bitmap, &src, drawable);
+        image_cache_localize(cache, &composite.src_bitmap, &src, drawable);
         if (composite.mask_bitmap)
-            image_cache_localize(&display->priv->image_cache, &composite.mask_bitmap, &mask, drawable);
-        canvas->ops->draw_composite(canvas, &drawable->red_drawable->bbox,
+            image_cache_localize(cache, &composite.mask_bitmap, &mask, drawable);
+        canvas->ops->draw_composite(canvas, &red_drawable->bbox,
                                     &clip, &composite);
         break;
     }
     case QXL_DRAW_STROKE: {
-        SpiceStroke stroke = drawable->red_drawable->u.stroke;
+        SpiceStroke stroke = red_drawable->u.stroke;
         SpiceImage img1;
-        image_cache_localize_brush(&display->priv->image_cache, &stroke.brush, &img1);
+        image_cache_localize_brush(cache, &stroke.brush, &img1);
         canvas->ops->draw_stroke(canvas,
-                                 &drawable->red_drawable->bbox, &clip, &stroke);
+                                 &red_drawable->bbox, &clip, &stroke);
         break;
     }
     case QXL_DRAW_TEXT: {
-        SpiceText text = drawable->red_drawable->u.text;
+        SpiceText text = red_drawable->u.text;
         SpiceImage img1, img2;
-        image_cache_localize_brush(&display->priv->image_cache, &text.fore_brush, &img1);
-        image_cache_localize_brush(&display->priv->image_cache, &text.back_brush, &img2);
-        canvas->ops->draw_text(canvas, &drawable->red_drawable->bbox,
+        image_cache_localize_brush(cache, &text.fore_brush, &img1);
+        image_cache_localize_brush(cache, &text.back_brush, &img2);
+        canvas->ops->draw_text(canvas, &red_drawable->bbox,
                                &clip, &text);
         break;
     }
@@ -1805,6 +2315,18 @@ static void drawable_draw(DisplayChannel *display, Drawable *drawable)
     }
 }
 
+static void drawable_draw(DisplayChannel *display, Drawable *drawable)
+{
+    DisplayStage stage = display_channel_enter_stage(display, DISPLAY_STAGE_RENDER);
+    stat_time_t start = stat_histogram_start();
+
+    drawable_deps_draw(display, drawable);
+    display_channel_render_journal(display, drawable->surface_id);
+    red_drawable_draw(display, drawable->red_drawable, drawable, &display->priv->image_cache);
+    stat_histogram_add_time(&display->priv->draw_time, start);
+    display_channel_enter_stage(display, stage);
+}
+
 static void surface_update_dest(RedSurface *surface, const SpiceRect *area)
 {
     SpiceCanvas *canvas = surface->context.canvas;
@@ -1850,31 +2372,67 @@ static void draw_until(DisplayChannel *display, RedSurface *surface, Drawable *l
     } while (now != last);
 }
 
-/* Find the first Drawable in the @current ring that intersects the given
- * @area, starting at item @from (or the head of the ring if @from is NULL).
+typedef struct FindIntersectsData {
+    QRegion rgn;
+    uint64_t max_serial;
+    Drawable *last;
+} FindIntersectsData;
+
+static bool find_intersects_candidate(TreeItem *item, void *opaque)
+{
+    FindIntersectsData *data = (FindIntersectsData *) opaque;
+    Drawable *now;
+
+    if (!IS_DRAW_ITEM(item)) {
+        return true;
+    }
+    now = SPICE_CONTAINEROF(item, Drawable, tree_item.base);
+    if (now->current_serial > data->max_serial ||
+        (data->last && data->last->current_serial > now->current_serial)) {
+        return true;
+    }
+    if (region_intersects(&data->rgn, &item->rgn)) {
+        data->last = now;
+    }
+    return true;
+}
+
+/* Find the first Drawable in the Surface::current_list ring of @surface that
+ * intersects the given @area, starting at item @from (or the head of the ring
+ * if @from is NULL).
  *
- * NOTE: this function expects @current to be a ring of Drawables, and more
- * specifically an instance of Surface::current_list (not Surface::current) */
-static Drawable* current_find_intersects_rect(Ring *current, RingItem *from,
+ * When the area is small compared to the number of items of the tree only
+ * the candidates given by the tree index are checked, the newest one being
+ * the first one of the ring */
+static Drawable* current_find_intersects_rect(RedSurface *surface, Drawable *from,
                                               const SpiceRect *area)
 {
+    Ring *current = &surface->current_list;
     RingItem *it;
-    QRegion rgn;
-    Drawable *last = NULL;
+    FindIntersectsData data;
+
+    region_init(&data.rgn);
+    region_add(&data.rgn, area);
+    data.last = NULL;
 
-    region_init(&rgn);
-    region_add(&rgn, area);
+    if (tree_index_is_selective(&surface->tree_index, area)) {
+        data.max_serial = from ? from->current_serial : UINT64_MAX;
+        tree_index_foreach(&surface->tree_index, area, find_intersects_candidate, &data);
+        region_destroy(&data.rgn);
+        return data.last;
+    }
 
-    for (it = from ? from : ring_next(current, current); it != NULL; it = ring_next(current, it)) {
+    for (it = from ? &from->surface_list_link : ring_next(current, current); it != NULL;
+         it = ring_next(current, it)) {
         Drawable *now = SPICE_CONTAINEROF(it, Drawable, surface_list_link);
-        if (region_intersects(&rgn, &now->tree_item.base.rgn)) {
-            last = now;
+        if (region_intersects(&data.rgn, &now->tree_item.base.rgn)) {
+            data.last = now;
             break;
         }
     }
 
-    region_destroy(&rgn);
-    return last;
+    region_destroy(&data.rgn);
+    return data.last;
 }
 
 /*
@@ -1895,6 +2453,7 @@ void display_channel_draw_until(DisplayChannel *display, const SpiceRect *area,
     spice_return_if_fail(ring_item_is_linked(&last->list_link));
 
     surface = &display->priv->surfaces[surface_id];
+    display_channel_render_journal(display, surface_id);
 
     if (surface_id != last->surface_id) {
         // find the nearest older drawable from the appropriate surface
@@ -1917,8 +2476,7 @@ void display_channel_draw_until(DisplayChannel *display, const SpiceRect *area,
     if (!surface_last)
         return;
 
-    last = current_find_intersects_rect(&surface->current_list,
-                                        &surface_last->surface_list_link, area);
+    last = current_find_intersects_rect(surface, surface_last, area);
     if (!last)
         return;
 
@@ -1937,26 +2495,41 @@ void display_channel_draw(DisplayChannel *display, const SpiceRect *area, int su
                          area->left < area->right && area->top < area->bottom);
 
     surface = &display->priv->surfaces[surface_id];
+    display_channel_render_journal(display, surface_id);
 
-    last = current_find_intersects_rect(&surface->current_list, NULL, area);
+    last = current_find_intersects_rect(surface, NULL, area);
     if (last)
         draw_until(display, surface, last);
 
     surface_update_dest(surface, area);
 }
 
-static void region_to_qxlrects(QRegion *region, QXLRect *qxl_rects, uint32_t num_rects)
+/* if there are more rects than room in @qxl_rects the last one covers all
+ * the remaining ones */
+static void tile_region_to_qxlrects(TileRegion *region, QXLRect *qxl_rects, uint32_t num_rects)
 {
     SpiceRect *rects;
-    int i;
+    uint32_t i, n;
 
-    rects = g_new0(SpiceRect, num_rects);
-    region_ret_rects(region, rects, num_rects);
+    n = tile_region_get_rects(region, &rects);
     for (i = 0; i < num_rects; i++) {
-        qxl_rects[i].top    = rects[i].top;
-        qxl_rects[i].left   = rects[i].left;
-        qxl_rects[i].bottom = rects[i].bottom;
-        qxl_rects[i].right  = rects[i].right;
+        SpiceRect rect = { 0, 0, 0, 0 };
+
+        if (i < n) {
+            rect = rects[i];
+        }
+        if (i == num_rects - 1) {
+            for (uint32_t j = i + 1; j < n; j++) {
+                rect.left = MIN(rect.left, rects[j].left);
+                rect.top = MIN(rect.top, rects[j].top);
+                rect.right = MAX(rect.right, rects[j].right);
+                rect.bottom = MAX(rect.bottom, rects[j].bottom);
+            }
+        }
+        qxl_rects[i].top    = rect.top;
+        qxl_rects[i].left   = rect.left;
+        qxl_rects[i].bottom = rect.bottom;
+        qxl_rects[i].right  = rect.right;
     }
     g_free(rects);
 }
@@ -1979,13 +2552,16 @@ void display_channel_update(DisplayChannel *display,
 
     surface = &display->priv->surfaces[surface_id];
     if (*qxl_dirty_rects == NULL) {
-        *num_dirty_rects = pixman_region32_n_rects(&surface->draw_dirty_region);
+        SpiceRect *rects;
+
+        *num_dirty_rects = tile_region_get_rects(&surface->draw_dirty_region, &rects);
         *qxl_dirty_rects = g_new0(QXLRect, *num_dirty_rects);
+        g_free(rects);
     }
 
-    region_to_qxlrects(&surface->draw_dirty_region, *qxl_dirty_rects, *num_dirty_rects);
+    tile_region_to_qxlrects(&surface->draw_dirty_region, *qxl_dirty_rects, *num_dirty_rects);
     if (clear_dirty)
-        region_clear(&surface->draw_dirty_region);
+        tile_region_clear(&surface->draw_dirty_region);
 }
 
 static void clear_surface_drawables_from_pipes(DisplayChannel *display, int surface_id,
@@ -2111,8 +2687,11 @@ void display_channel_create_surface(DisplayChannel *display, uint32_t surface_id
     g_warn_if_fail(surface->destroy_cmd == NULL);
     ring_init(&surface->current);
     ring_init(&surface->current_list);
+    tree_index_init(&surface->tree_index, width, height);
     ring_init(&surface->depend_on_me);
-    region_init(&surface->draw_dirty_region);
+    ring_init(&surface->render_journal);
+    surface->render_journal_size = 0;
+    tile_region_init(&surface->draw_dirty_region, width, height);
     surface->refs = 1;
 
     if (display->priv->renderer == RED_RENDERER_INVALID) {
@@ -2210,10 +2789,40 @@ DisplayChannel::DisplayChannel(RedsState *reds,
 
     ring_init(&priv->current_list);
     drawables_init(this);
+    red_drawable_slabs_init(&priv->drawable_slabs);
+    priv->drawable_pipe_item_slab = red_slab_new(sizeof(RedDrawablePipeItem),
+                                                 RED_PIPE_ITEMS_PER_SLAB_BLOCK);
+    priv->stream_clip_item_slab = red_slab_new(sizeof(VideoStreamClipItem),
+                                               RED_PIPE_ITEMS_PER_SLAB_BLOCK);
+    priv->deferred_render = reds_get_display_deferred_render(reds);
+    pthread_mutex_init(&priv->render_lock, NULL);
+    pthread_cond_init(&priv->render_job_done, NULL);
+    unsigned int render_threads = reds_get_display_render_threads(reds);
+    if (render_threads > 0) {
+        GError *error = NULL;
+
+        priv->render_threads = g_thread_pool_new(render_job_run, this, render_threads,
+                                                 TRUE, &error);
+        if (priv->render_threads) {
+            /* the render threads render the journals */
+            priv->deferred_render = true;
+        } else {
+            spice_warning("failed to create render threads: %s", error->message);
+            g_error_free(error);
+        }
+    }
+    priv->render_journal_slab = red_slab_new(sizeof(RenderJournalItem),
+                                             RED_PIPE_ITEMS_PER_SLAB_BLOCK);
     priv->image_surfaces.ops = &image_surfaces_ops;
 
     image_cache_init(&priv->image_cache);
     display_channel_init_video_streams(this);
+    priv->scroll_detection = reds_get_display_scroll_detection(reds);
+    priv->stream_detection_min_fps = reds_get_streaming_video_detection_fps(reds);
+    priv->stream_detection_frames = reds_get_streaming_video_detection_frames(reds);
+    if (priv->stream_detection_frames == 0) {
+        priv->stream_detection_frames = RED_STREAM_FRAMES_START_CONDITION;
+    }
 
     display_channel_set_video_codecs(this, video_codecs);
 
@@ -2229,6 +2838,53 @@ DisplayChannel::DisplayChannel(RedsState *reds,
                       "add_to_cache", TRUE);
     stat_init_counter(&priv->non_cache_counter, reds, stat,
                       "non_cache", TRUE);
+    stat_init_counter(&priv->content_cache_hits_counter, reds, stat,
+                      "content_cache_hits", TRUE);
+    stat_init_counter(&priv->content_cache_misses_counter, reds, stat,
+                      "content_cache_misses", TRUE);
+    red_slab_init_stat(priv->drawable_slabs.drawables, reds, stat, "red_drawables");
+    red_slab_init_stat(priv->drawable_slabs.images, reds, stat, "images");
+    red_slab_init_stat(priv->drawable_pipe_item_slab, reds, stat, "drawable_items");
+    red_slab_init_stat(priv->stream_clip_item_slab, reds, stat, "stream_clip_items");
+    if (priv->deferred_render) {
+        stat_init_counter(&priv->deferred_draws_counter, reds, stat, "deferred_draws", TRUE);
+        stat_init_counter(&priv->deferred_dropped_counter, reds, stat, "deferred_dropped", TRUE);
+        stat_init_counter(&priv->deferred_rendered_counter, reds, stat,
+                          "deferred_rendered", TRUE);
+    }
+    if (priv->render_threads) {
+        stat_init_counter(&priv->render_jobs_counter, reds, stat, "render_jobs", TRUE);
+        stat_init_counter(&priv->render_waits_counter, reds, stat, "render_waits", TRUE);
+    }
+    if (priv->scroll_detection) {
+        stat_init_counter(&priv->scroll_checks_counter, reds, stat, "scroll_checks", TRUE);
+        stat_init_counter(&priv->scroll_hits_counter, reds, stat, "scroll_hits", TRUE);
+        stat_init_counter(&priv->scroll_saved_pixels_counter, reds, stat,
+                          "scroll_saved_pixels", TRUE);
+    }
+    if (priv->stream_detection_min_fps) {
+        stat_init_counter(&priv->stream_detection_hits_counter, reds, stat,
+                          "stream_detection_hits", TRUE);
+        stat_init_counter(&priv->stream_detection_misses_counter, reds, stat,
+                          "stream_detection_misses", TRUE);
+        stat_init_counter(&priv->stream_detection_false_positives_counter, reds, stat,
+                          "stream_detection_false_positives", TRUE);
+    }
+    red_slab_init_stat(priv->encoder_shared_data.glz_drawable_slab, reds, stat, "glz_drawables");
+    image_encoder_shared_init_stat(&priv->encoder_shared_data, reds, stat);
+    stat_init_histogram(&priv->draw_time, reds, stat, "draw_time", TRUE);
+    /* in nanoseconds */
+    stat_init_node(&priv->stage_stat, reds, stat, "stage_time", TRUE);
+    stat_init_counter(&priv->stage_time_counters[DISPLAY_STAGE_PARSE], reds, &priv->stage_stat,
+                      "parse", TRUE);
+    stat_init_counter(&priv->stage_time_counters[DISPLAY_STAGE_TREE], reds, &priv->stage_stat,
+                      "tree", TRUE);
+    stat_init_counter(&priv->stage_time_counters[DISPLAY_STAGE_RENDER], reds, &priv->stage_stat,
+                      "render", TRUE);
+    stat_init_counter(&priv->stage_time_counters[DISPLAY_STAGE_COMPRESS], reds, &priv->stage_stat,
+                      "compress", TRUE);
+    stat_init_counter(&priv->stage_time_counters[DISPLAY_STAGE_MARSHALL], reds, &priv->stage_stat,
+                      "marshall", TRUE);
 
     set_cap(SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     set_cap(SPICE_DISPLAY_CAP_PREF_COMPRESSION);
@@ -2521,3 +3177,27 @@ void display_channel_set_image_compression(DisplayChannel *display,
 {
     display->priv->image_compression = image_compression;
 }
+
+RedDrawableSlabs *display_channel_get_drawable_slabs(DisplayChannel *display)
+{
+    return &display->priv->drawable_slabs;
+}
+
+DisplayStage display_channel_enter_stage(DisplayChannel *display, DisplayStage stage)
+{
+    DisplayStage previous = display->priv->stage;
+
+#ifdef RED_STATISTICS
+    if (stage != previous) {
+        uint64_t now = spice_get_monotonic_time_ns();
+
+        if (previous != DISPLAY_STAGE_NONE) {
+            stat_inc_counter(display->priv->stage_time_counters[previous],
+                             now - display->priv->stage_start);
+        }
+        display->priv->stage_start = now;
+    }
+#endif
+    display->priv->stage = stage;
+    return previous;
+}
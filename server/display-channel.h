@@ -62,6 +62,8 @@ struct Drawable {
     uint32_t refs;
     RingItem surface_list_link;
     RingItem list_link;
+    /* position in the current lists, see DisplayChannelPrivate::current_serial */
+    uint64_t current_serial;
     DrawItem tree_item;
     GList *pipes;
     RedDrawable *red_drawable;
@@ -124,6 +126,13 @@ void                       display_channel_destroy_surfaces          (DisplayCha
 void                       display_channel_process_draw              (DisplayChannel *display,
                                                                       RedDrawable *red_drawable,
                                                                       uint32_t process_commands_generation);
+/* process drawables fetched together, skipping the ones hidden by a later
+ * drawable of the batch. Takes the references of the drawables.
+ * Returns the number of skipped drawables. */
+unsigned int               display_channel_process_draw_batch        (DisplayChannel *display,
+                                                                      RedDrawable **red_drawables,
+                                                                      unsigned int num_drawables,
+                                                                      uint32_t process_commands_generation);
 void                       display_channel_process_surface_cmd       (DisplayChannel *display,
                                                                       RedSurfaceCmd *surface_cmd,
                                                                       int loadvm);
@@ -146,6 +155,25 @@ void display_channel_debug_oom(DisplayChannel *display, const char *msg);
 void display_channel_update_qxl_running(DisplayChannel *display, bool running);
 void display_channel_set_image_compression(DisplayChannel *display,
                                            SpiceImageCompression image_compression);
+/* slabs to use to parse the drawing commands of the display */
+RedDrawableSlabs *display_channel_get_drawable_slabs(DisplayChannel *display);
+
+/* stages of the work of the worker thread on the display, their time is
+ * counted in the "stage_time" statistics */
+typedef enum {
+    DISPLAY_STAGE_NONE,
+    DISPLAY_STAGE_PARSE,
+    DISPLAY_STAGE_TREE,
+    DISPLAY_STAGE_RENDER,
+    DISPLAY_STAGE_COMPRESS,
+    DISPLAY_STAGE_MARSHALL,
+    DISPLAY_STAGE_LAST
+} DisplayStage;
+
+/* charges the time since the previous switch to the current stage, then
+ * switches to @stage. Returns the previous stage to switch back to it once
+ * a nested stage is done */
+DisplayStage display_channel_enter_stage(DisplayChannel *display, DisplayStage stage);
 
 #include "pop-visibility.h"
 
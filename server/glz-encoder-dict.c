@@ -45,6 +45,22 @@ static inline void __glz_dictionary_window_reset_images(SharedDictionary *dict)
     dict->window.used_images_tail = NULL;
 }
 
+static void glz_dictionary_window_reset_segs_chunk(WindowImageSegment *chunk,
+                                                   uint32_t first_seg_id)
+{
+    WindowImageSegment *seg;
+    uint32_t i;
+
+    for (seg = chunk, i = first_seg_id + 1; seg < chunk + IMAGE_SEGS_CHUNK_SIZE; seg++, i++) {
+        seg->next = i;
+        seg->image = NULL;
+        seg->lines = NULL;
+        seg->lines_end = NULL;
+        seg->pixels_num = 0;
+        seg->pixels_so_far = 0;
+    }
+}
+
 /* allocate window fields (no reset)*/
 static bool glz_dictionary_window_create(SharedDictionary *dict, uint32_t size)
 {
@@ -53,19 +69,30 @@ static bool glz_dictionary_window_create(SharedDictionary *dict, uint32_t size)
     }
 
     dict->window.size_limit = size;
-    dict->window.segs = (WindowImageSegment *)(
-            dict->cur_usr->malloc(dict->cur_usr, sizeof(WindowImageSegment) * INIT_IMAGE_SEGS_NUM));
+    dict->window.segs = (WindowImageSegment **)(
+            dict->cur_usr->malloc(dict->cur_usr,
+                                  sizeof(WindowImageSegment *) * MAX_IMAGE_SEGS_CHUNKS));
 
     if (!dict->window.segs) {
         return FALSE;
     }
+    memset(dict->window.segs, 0, sizeof(WindowImageSegment *) * MAX_IMAGE_SEGS_CHUNKS);
+
+    dict->window.segs[0] = (WindowImageSegment *)(
+            dict->cur_usr->malloc(dict->cur_usr,
+                                  sizeof(WindowImageSegment) * IMAGE_SEGS_CHUNK_SIZE));
+    if (!dict->window.segs[0]) {
+        dict->cur_usr->free(dict->cur_usr, dict->window.segs);
+        return FALSE;
+    }
 
-    dict->window.segs_quota = INIT_IMAGE_SEGS_NUM;
+    dict->window.segs_quota = IMAGE_SEGS_CHUNK_SIZE;
 
     dict->window.encoders_heads = (uint32_t *)dict->cur_usr->malloc(dict->cur_usr,
                                                             sizeof(uint32_t) * dict->max_encoders);
 
     if (!dict->window.encoders_heads) {
+        dict->cur_usr->free(dict->cur_usr, dict->window.segs[0]);
         dict->cur_usr->free(dict->cur_usr, dict->window.segs);
         return FALSE;
     }
@@ -83,20 +110,13 @@ static bool glz_dictionary_window_create(SharedDictionary *dict, uint32_t size)
 static void glz_dictionary_window_reset(SharedDictionary *dict)
 {
     uint32_t i;
-    WindowImageSegment *seg, *last_seg;
 
-    last_seg = dict->window.segs + dict->window.segs_quota;
     /* reset free segs list */
     dict->window.free_segs_head = 0;
-    for (seg = dict->window.segs, i = 0; seg < last_seg; seg++, i++) {
-        seg->next = i + 1;
-        seg->image = NULL;
-        seg->lines = NULL;
-        seg->lines_end = NULL;
-        seg->pixels_num = 0;
-        seg->pixels_so_far = 0;
+    for (i = 0; i < dict->window.segs_quota; i += IMAGE_SEGS_CHUNK_SIZE) {
+        glz_dictionary_window_reset_segs_chunk(WINDOW_SEG(dict, i), i);
     }
-    dict->window.segs[dict->window.segs_quota - 1].next = NULL_IMAGE_SEG_ID;
+    WINDOW_SEG(dict, dict->window.segs_quota - 1)->next = NULL_IMAGE_SEG_ID;
 
     dict->window.used_segs_head = NULL_IMAGE_SEG_ID;
     dict->window.used_segs_tail = NULL_IMAGE_SEG_ID;
@@ -122,6 +142,11 @@ static inline void glz_dictionary_window_destroy(SharedDictionary *dict)
     __glz_dictionary_window_reset_images(dict);
 
     if (dict->window.segs) {
+        uint32_t i;
+
+        for (i = 0; i < dict->window.segs_quota; i += IMAGE_SEGS_CHUNK_SIZE) {
+            dict->cur_usr->free(dict->cur_usr, WINDOW_SEG(dict, i));
+        }
         dict->cur_usr->free(dict->cur_usr, dict->window.segs);
         dict->window.segs = NULL;
     }
@@ -160,7 +185,6 @@ GlzEncDictContext *glz_enc_dictionary_create(uint32_t size, uint32_t max_encoder
     dict->max_encoders = max_encoders;
 
     pthread_mutex_init(&dict->lock, NULL);
-    pthread_rwlock_init(&dict->rw_alloc_lock, NULL);
 
     dict->window.encoders_heads = NULL;
 
@@ -228,7 +252,6 @@ void glz_enc_dictionary_destroy(GlzEncDictContext *opaque_dict, GlzEncoderUsrCon
     glz_dictionary_window_destroy(dict);
 
     pthread_mutex_destroy(&dict->lock);
-    pthread_rwlock_destroy(&dict->rw_alloc_lock);
 
     dict->cur_usr->free(dict->cur_usr, dict);
 }
@@ -269,48 +292,31 @@ static inline int __get_pixels_num(LzImageType image_type, unsigned int num_line
     }
 }
 
-static void __glz_dictionary_window_segs_realloc(SharedDictionary *dict)
+/* Adds a chunk of free segments. The existing chunks are not moved, so the
+   encoders that are in the middle of encoding are not disturbed. */
+static void __glz_dictionary_window_segs_grow(SharedDictionary *dict)
 {
-    WindowImageSegment *new_segs;
-    uint32_t new_quota = (MAX_IMAGE_SEGS_NUM < (dict->window.segs_quota * 2)) ?
-        MAX_IMAGE_SEGS_NUM : (dict->window.segs_quota * 2);
-    WindowImageSegment *seg;
-    uint32_t i;
-
-    pthread_rwlock_wrlock(&dict->rw_alloc_lock);
+    WindowImageSegment *chunk;
+    uint32_t first_seg_id = dict->window.segs_quota;
 
     if (dict->window.segs_quota == MAX_IMAGE_SEGS_NUM) {
         dict->cur_usr->error(dict->cur_usr, "overflow in image segments window\n");
     }
 
-    new_segs = (WindowImageSegment*)dict->cur_usr->malloc(
-            dict->cur_usr, sizeof(WindowImageSegment) * new_quota);
+    chunk = (WindowImageSegment*)dict->cur_usr->malloc(
+            dict->cur_usr, sizeof(WindowImageSegment) * IMAGE_SEGS_CHUNK_SIZE);
 
-    if (!new_segs) {
+    if (!chunk) {
         dict->cur_usr->error(dict->cur_usr,
-                             "realloc of dictionary window failed\n");
-    }
-
-    memcpy(new_segs, dict->window.segs,
-           sizeof(WindowImageSegment) * dict->window.segs_quota);
-
-    // resetting the new elements
-    for (i = dict->window.segs_quota, seg = new_segs + i; i < new_quota; i++, seg++) {
-        seg->image = NULL;
-        seg->lines = NULL;
-        seg->lines_end = NULL;
-        seg->pixels_num = 0;
-        seg->pixels_so_far = 0;
-        seg->next = i + 1;
+                             "allocation of dictionary window segments failed\n");
     }
-    new_segs[new_quota - 1].next = dict->window.free_segs_head;
-    dict->window.free_segs_head = dict->window.segs_quota;
 
-    dict->cur_usr->free(dict->cur_usr, dict->window.segs);
-    dict->window.segs = new_segs;
-    dict->window.segs_quota = new_quota;
+    glz_dictionary_window_reset_segs_chunk(chunk, first_seg_id);
+    chunk[IMAGE_SEGS_CHUNK_SIZE - 1].next = dict->window.free_segs_head;
+    dict->window.free_segs_head = first_seg_id;
 
-    pthread_rwlock_unlock(&dict->rw_alloc_lock);
+    g_atomic_pointer_set(&dict->window.segs[first_seg_id >> IMAGE_SEGS_CHUNK_SHIFT], chunk);
+    dict->window.segs_quota += IMAGE_SEGS_CHUNK_SIZE;
 }
 
 /* NOTE - it also updates the used_images_list*/
@@ -348,13 +354,13 @@ static uint32_t __glz_dictionary_window_alloc_image_seg(SharedDictionary *dict)
 
     // TODO: when is it best to realloc? when full or when half full?
     if (dict->window.free_segs_head == NULL_IMAGE_SEG_ID) {
-        __glz_dictionary_window_segs_realloc(dict);
+        __glz_dictionary_window_segs_grow(dict);
     }
 
     GLZ_ASSERT(dict->cur_usr, dict->window.free_segs_head != NULL_IMAGE_SEG_ID);
 
     seg_id = dict->window.free_segs_head;
-    seg = dict->window.segs + seg_id;
+    seg = WINDOW_SEG(dict, seg_id);
     dict->window.free_segs_head = seg->next;
 
     return seg_id;
@@ -382,13 +388,13 @@ static inline void __glz_dictionary_window_free_image_segs(SharedDictionary *dic
     dict->window.free_segs_head = image->first_seg;
 
     // retrieving the last segment of the image
-    for (seg_id = image->first_seg, next_seg_id = dict->window.segs[seg_id].next;
-         (next_seg_id != NULL_IMAGE_SEG_ID) && (dict->window.segs[next_seg_id].image == image);
-         seg_id = next_seg_id, next_seg_id = dict->window.segs[seg_id].next) {
+    for (seg_id = image->first_seg, next_seg_id = WINDOW_SEG(dict, seg_id)->next;
+         (next_seg_id != NULL_IMAGE_SEG_ID) && (WINDOW_SEG(dict, next_seg_id)->image == image);
+         seg_id = next_seg_id, next_seg_id = WINDOW_SEG(dict, seg_id)->next) {
     }
 
     // concatenate the free list
-    dict->window.segs[seg_id].next = old_free_head;
+    WINDOW_SEG(dict, seg_id)->next = old_free_head;
 }
 
 /* Returns the logical head of the window after we add an image with the give size to its tail.
@@ -414,10 +420,10 @@ static WindowImage *glz_dictionary_window_get_new_head(SharedDictionary *dict, i
     GLZ_ASSERT(dict->cur_usr, dict->window.used_segs_tail != NULL_IMAGE_SEG_ID);
 
     // used_segs_head is the latest logical head (the physical head may precede it)
-    cur_head = dict->window.segs[dict->window.used_segs_head].image;
-    cur_win_size = dict->window.segs[dict->window.used_segs_tail].pixels_num +
-        dict->window.segs[dict->window.used_segs_tail].pixels_so_far -
-        dict->window.segs[dict->window.used_segs_head].pixels_so_far;
+    cur_head = WINDOW_SEG(dict, dict->window.used_segs_head)->image;
+    cur_win_size = WINDOW_SEG(dict, dict->window.used_segs_tail)->pixels_num +
+        WINDOW_SEG(dict, dict->window.used_segs_tail)->pixels_so_far -
+        WINDOW_SEG(dict, dict->window.used_segs_head)->pixels_so_far;
 
     while ((cur_win_size + new_image_size) > dict->window.size_limit) {
         GLZ_ASSERT(dict->cur_usr, cur_head);
@@ -468,7 +474,7 @@ static uint32_t glz_dictionary_window_alloc_image_seg(SharedDictionary *dict, Wi
                                                       uint8_t *lines, unsigned int num_lines)
 {
     uint32_t seg_id = __glz_dictionary_window_alloc_image_seg(dict);
-    WindowImageSegment *seg = &dict->window.segs[seg_id];
+    WindowImageSegment *seg = WINDOW_SEG(dict, seg_id);
 
     seg->image = image;
     seg->lines = lines;
@@ -518,7 +524,7 @@ static WindowImage *glz_dictionary_window_add_image(SharedDictionary *dict, LzIm
         if (row == 0) {
             image->first_seg = seg_id;
         } else {
-            dict->window.segs[prev_seg_id].next = seg_id;
+            WINDOW_SEG(dict, prev_seg_id)->next = seg_id;
         }
 
         row += num_lines;
@@ -548,7 +554,7 @@ static WindowImage *glz_dictionary_window_add_image(SharedDictionary *dict, LzIm
         // For the other thread that may read 'next' of the old tail, NULL_IMAGE_SEG_ID
         // is equivalent to a segment with an image id that is different
         // from the image id of the tail, so we don't need to further protect this field.
-        dict->window.segs[prev_tail].next = image->first_seg;
+        WINDOW_SEG(dict, prev_tail)->next = image->first_seg;
         dict->window.used_segs_tail = seg_id;
     }
     image->is_alive = TRUE;
@@ -595,7 +601,6 @@ WindowImage *glz_dictionary_pre_encode(uint32_t encoder_id, GlzEncoderUsrContext
 
     // update encoders head  (the other heads were already updated)
     pthread_mutex_unlock(&dict->lock);
-    pthread_rwlock_rdlock(&dict->rw_alloc_lock);
     return ret;
 }
 
@@ -606,7 +611,6 @@ void glz_dictionary_post_encode(uint32_t encoder_id, GlzEncoderUsrContext *usr,
     uint32_t early_head_seg = NULL_IMAGE_SEG_ID;
     uint32_t this_encoder_head_seg;
 
-    pthread_rwlock_unlock(&dict->rw_alloc_lock);
     pthread_mutex_lock(&dict->lock);
     dict->cur_usr = usr;
 
@@ -633,7 +637,7 @@ void glz_dictionary_post_encode(uint32_t encoder_id, GlzEncoderUsrContext *usr,
         GLZ_ASSERT(dict->cur_usr,
                    this_encoder_head_seg == dict->window.used_images_head->first_seg);
         glz_dictionary_window_remove_head(dict, encoder_id,
-                                          dict->window.segs[early_head_seg].image);
+                                          WINDOW_SEG(dict, early_head_seg)->image);
     }
 
 
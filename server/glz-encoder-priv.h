@@ -19,6 +19,7 @@
 #define GLZ_ENCODER_PRIV_H_
 
 #include <pthread.h>
+#include <glib.h>
 #include <common/lz_common.h>
 
 #include "glz-encoder-dict.h"
@@ -57,9 +58,24 @@ struct WindowImage {
     uint8_t is_alive;
 };
 
-#define MAX_IMAGE_SEGS_NUM (0xffffffff)
-#define NULL_IMAGE_SEG_ID MAX_IMAGE_SEGS_NUM
-#define INIT_IMAGE_SEGS_NUM 1000
+/* The segments are allocated in chunks which are never moved or freed while
+   the dictionary exists. Encoders access the segments of their window without
+   holding any lock, even while other encoders add images to the window.
+   A new chunk is published under the dictionary lock, before any of its segments
+   can be referenced by the hash table. As the encoders find the segment ids in
+   the hash table without taking the lock, the chunk pointer is stored and read
+   atomically, so an encoder seeing a segment id also sees its chunk. */
+#define IMAGE_SEGS_CHUNK_SHIFT 10
+#define IMAGE_SEGS_CHUNK_SIZE (1 << IMAGE_SEGS_CHUNK_SHIFT)
+#define IMAGE_SEGS_CHUNK_MASK (IMAGE_SEGS_CHUNK_SIZE - 1)
+#define MAX_IMAGE_SEGS_CHUNKS (1 << 14)
+#define MAX_IMAGE_SEGS_NUM (MAX_IMAGE_SEGS_CHUNKS * IMAGE_SEGS_CHUNK_SIZE)
+#define NULL_IMAGE_SEG_ID (0xffffffff)
+
+#define WINDOW_SEG(dict, seg_id)                                                        \
+    (&((WindowImageSegment *)                                                           \
+       g_atomic_pointer_get(&(dict)->window.segs[(seg_id) >> IMAGE_SEGS_CHUNK_SHIFT])) \
+      [(seg_id) & IMAGE_SEGS_CHUNK_MASK])
 
 /* Images can be separated into several chunks. The basic unit of the
    dictionary window is one image segment. Each segment is encoded separately.
@@ -84,11 +100,12 @@ struct HashEntry {
 
 struct SharedDictionary {
     struct {
-        /* The segments storage. A dynamic array.
+        /* The segments storage. An array of MAX_IMAGE_SEGS_CHUNKS chunks,
+           allocated on demand (see WINDOW_SEG).
            By referring to a segment by its index, instead of address,
            we save space in the hash entries (32bit instead of 64bit) */
-        WindowImageSegment  *segs;
-        uint32_t segs_quota;
+        WindowImageSegment  **segs;
+        uint32_t segs_quota;                 // number of segments in the allocated chunks
 
         /* The window is manged as a linked list rather than as a cyclic
            array in order to keep the indices of the segments consistent
@@ -125,8 +142,8 @@ struct SharedDictionary {
 
     uint64_t last_image_id;
     uint32_t max_encoders;
-    pthread_mutex_t lock;
-    pthread_rwlock_t rw_alloc_lock;
+    pthread_mutex_t lock;                // protects the window lists, held only in
+                                         // glz_dictionary_pre_encode/post_encode
     GlzEncoderUsrContext       *cur_usr; // each encoder has other context.
 };
 
@@ -157,8 +174,8 @@ void glz_dictionary_post_encode(uint32_t encoder_id, GlzEncoderUsrContext *usr,
 
 #define IMAGE_SEG_IS_EARLIER(dict, dst_seg, src_seg) (                     \
     ((src_seg) == NULL_IMAGE_SEG_ID) || (((dst_seg) != NULL_IMAGE_SEG_ID)  \
-    && ((dict)->window.segs[(dst_seg)].pixels_so_far <                     \
-       (dict)->window.segs[(src_seg)].pixels_so_far)))
+    && (WINDOW_SEG(dict, dst_seg)->pixels_so_far <                         \
+        WINDOW_SEG(dict, src_seg)->pixels_so_far)))
 
 
 #ifdef CHAINED_HASH
@@ -184,8 +201,8 @@ void glz_dictionary_post_encode(uint32_t encoder_id, GlzEncoderUsrContext *usr,
      (ref_seg)->image->is_alive &&                         \
      (src_seg->image->type == ref_seg->image->type) &&     \
      (ref_seg->pixels_so_far <= src_seg->pixels_so_far) && \
-     ((dict)->window.segs[                                 \
-        (dict)->window.encoders_heads[enc_id]].pixels_so_far <= \
+     (WINDOW_SEG(dict,                                     \
+        (dict)->window.encoders_heads[enc_id])->pixels_so_far <= \
         ref_seg->pixels_so_far)))
 
 #ifdef DEBUG
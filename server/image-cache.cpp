@@ -170,6 +170,16 @@ void image_cache_localize(ImageCache *cache, SpiceImage **image_ptr,
         return;
     }
 
+    if (cache == NULL) {
+        /* the image must not be added to the cache either */
+        if (image->descriptor.flags & SPICE_IMAGE_FLAGS_CACHE_ME) {
+            *image_store = *image;
+            image_store->descriptor.flags &= ~SPICE_IMAGE_FLAGS_CACHE_ME;
+            *image_ptr = image_store;
+        }
+        return;
+    }
+
     if (image_cache_hit(cache, image->descriptor.id)) {
         image_store->descriptor = image->descriptor;
         image_store->descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE;
@@ -55,6 +55,8 @@ typedef struct ImageCache {
 void         image_cache_init              (ImageCache *cache);
 void         image_cache_reset             (ImageCache *cache);
 void         image_cache_aging             (ImageCache *cache);
+/* @cache can be NULL to render without using any cache, for instance out
+ * of the thread owning the cache */
 void         image_cache_localize          (ImageCache *cache, SpiceImage **image_ptr,
                                             SpiceImage *image_store, Drawable *drawable);
 void         image_cache_localize_brush    (ImageCache *cache, SpiceBrush *brush,
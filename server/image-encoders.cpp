@@ -30,6 +30,8 @@
 
 #define MAX_GLZ_DRAWABLE_INSTANCES 2
 
+#define RED_GLZ_DRAWABLES_PER_SLAB_BLOCK 64
+
 #if 0
 #define COMPRESS_DEBUG(...) g_debug(__VA_ARGS__)
 #else
@@ -529,7 +531,7 @@ static void glz_drawable_instance_item_free(GlzDrawableInstanceItem *instance)
         if (ring_item_is_linked(&glz_drawable->link)) {
             ring_remove(&glz_drawable->link);
         }
-        g_free(glz_drawable);
+        red_slab_free(glz_drawable);
     }
 }
 
@@ -838,6 +840,7 @@ bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
     int size, stride;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->quic_stat);
+    stat_time_t histogram_start = stat_histogram_start();
 
     COMPRESS_DEBUG("QUIC compress");
 
@@ -897,6 +900,7 @@ bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
 
     stat_compress_add(&enc->shared_data->quic_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_time(&enc->shared_data->quic_time, histogram_start);
     return TRUE;
 }
 
@@ -925,6 +929,7 @@ bool image_encoders_compress_lz(ImageEncoders *enc,
 
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->lz_stat);
+    stat_time_t histogram_start = stat_histogram_start();
 
     COMPRESS_DEBUG("LZ LOCAL compress");
 
@@ -974,6 +979,7 @@ bool image_encoders_compress_lz(ImageEncoders *enc,
 
     stat_compress_add(&enc->shared_data->lz_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_time(&enc->shared_data->lz_time, histogram_start);
     return TRUE;
 }
 
@@ -994,6 +1000,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
     uint8_t *lz_out_start_byte;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->jpeg_alpha_stat);
+    stat_time_t histogram_start = stat_histogram_start();
 
     COMPRESS_DEBUG("JPEG compress");
 
@@ -1057,6 +1064,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
 
         stat_compress_add(&enc->shared_data->jpeg_stat, start_time, src->stride * src->y,
                           o_comp_data->comp_buf_size);
+        stat_histogram_add_time(&enc->shared_data->jpeg_time, histogram_start);
         return TRUE;
     }
 
@@ -1097,6 +1105,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
     o_comp_data->is_lossy = TRUE;
     stat_compress_add(&enc->shared_data->jpeg_alpha_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_time(&enc->shared_data->jpeg_alpha_time, histogram_start);
     return TRUE;
 }
 
@@ -1109,6 +1118,7 @@ bool image_encoders_compress_lz4(ImageEncoders *enc, SpiceImage *dest,
     int lz4_size = 0;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->lz4_stat);
+    stat_time_t histogram_start = stat_histogram_start();
 
     COMPRESS_DEBUG("LZ4 compress");
 
@@ -1145,6 +1155,7 @@ bool image_encoders_compress_lz4(ImageEncoders *enc, SpiceImage *dest,
 
     stat_compress_add(&enc->shared_data->lz4_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_time(&enc->shared_data->lz4_time, histogram_start);
     return TRUE;
 }
 #endif
@@ -1166,7 +1177,7 @@ static RedGlzDrawable *get_glz_drawable(ImageEncoders *enc, RedDrawable *red_dra
         }
     }
 
-    ret = g_new(RedGlzDrawable, 1);
+    ret = (RedGlzDrawable *) red_slab_alloc(enc->shared_data->glz_drawable_slab);
 
     ret->encoders = enc;
     ret->red_drawable = red_drawable_ref(red_drawable);
@@ -1211,6 +1222,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
 {
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->zlib_glz_stat);
+    stat_time_t histogram_start = stat_histogram_start();
     spice_assert(bitmap_fmt_is_rgb(src->format));
     GlzData *glz_data = &enc->glz_data;
     ZlibData *zlib_data;
@@ -1251,6 +1263,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
                           &glz_drawable_instance->context);
 
     stat_compress_add(&enc->shared_data->glz_stat, start_time, src->stride * src->y, glz_size);
+    stat_histogram_add_time(&enc->shared_data->glz_time, histogram_start);
 
     if (!enable_zlib_glz_wrap || (glz_size < MIN_GLZ_SIZE_FOR_ZLIB)) {
         goto glz;
@@ -1263,6 +1276,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
         }
     }
     stat_start_time_init(&start_time, &enc->shared_data->zlib_glz_stat);
+    histogram_start = stat_histogram_start();
     zlib_data = &enc->zlib_data;
 
     encoder_data_init(&zlib_data->data);
@@ -1290,6 +1304,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
     o_comp_data->comp_buf_size = zlib_size;
 
     stat_compress_add(&enc->shared_data->zlib_glz_stat, start_time, glz_size, zlib_size);
+    stat_histogram_add_time(&enc->shared_data->zlib_glz_time, histogram_start);
     pthread_rwlock_unlock(&enc->glz_dict->encode_lock);
     return TRUE;
 
@@ -1305,6 +1320,131 @@ glz:
     return TRUE;
 }
 
+/* maximum number of jobs queued per thread */
+#define IMAGE_ENCODERS_POOL_QUEUE_DEPTH 4
+
+struct ImageEncodersPool {
+    GThreadPool *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t job_done;
+    unsigned int num_encoders;
+    unsigned int num_jobs;
+    ImageEncoders *encoders;
+    /* stack of the encoders not currently used by a thread */
+    ImageEncoders **free_encoders;
+    unsigned int num_free_encoders;
+};
+
+static void image_encoders_pool_run(gpointer data, gpointer user_data)
+{
+    ImageEncodersPoolJob *job = (ImageEncodersPoolJob *) data;
+    ImageEncodersPool *pool = (ImageEncodersPool *) user_data;
+    ImageEncoders *enc;
+
+    /* there are never more running jobs than encoders */
+    pthread_mutex_lock(&pool->lock);
+    spice_assert(pool->num_free_encoders > 0);
+    enc = pool->free_encoders[--pool->num_free_encoders];
+    pthread_mutex_unlock(&pool->lock);
+
+    job->func(enc, job);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->free_encoders[pool->num_free_encoders++] = enc;
+    pool->num_jobs--;
+    g_atomic_int_set(&job->done, TRUE);
+    pthread_cond_broadcast(&pool->job_done);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+ImageEncodersPool *image_encoders_pool_new(ImageEncoderSharedData *shared_data,
+                                           unsigned int num_threads)
+{
+    ImageEncodersPool *pool;
+    GError *error = NULL;
+    unsigned int i;
+
+    spice_return_val_if_fail(num_threads > 0 &&
+                             num_threads <= IMAGE_ENCODERS_POOL_MAX_THREADS, NULL);
+
+    pool = g_new0(ImageEncodersPool, 1);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+    pool->num_encoders = num_threads;
+    pool->encoders = g_new0(ImageEncoders, num_threads);
+    pool->free_encoders = g_new(ImageEncoders *, num_threads);
+    for (i = 0; i < num_threads; i++) {
+        image_encoders_init(&pool->encoders[i], shared_data);
+        pool->free_encoders[i] = &pool->encoders[i];
+    }
+    pool->num_free_encoders = num_threads;
+
+    pool->threads = g_thread_pool_new(image_encoders_pool_run, pool,
+                                      num_threads, TRUE, &error);
+    if (!pool->threads) {
+        spice_warning("failed to create image encoders threads: %s", error->message);
+        g_error_free(error);
+        image_encoders_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void image_encoders_pool_free(ImageEncodersPool *pool)
+{
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+    if (pool->threads) {
+        g_thread_pool_free(pool->threads, FALSE, TRUE);
+    }
+    for (i = 0; i < pool->num_encoders; i++) {
+        image_encoders_free(&pool->encoders[i]);
+    }
+    g_free(pool->encoders);
+    g_free(pool->free_encoders);
+    pthread_cond_destroy(&pool->job_done);
+    pthread_mutex_destroy(&pool->lock);
+    g_free(pool);
+}
+
+bool image_encoders_pool_push(ImageEncodersPool *pool, ImageEncodersPoolJob *job,
+                              image_encoders_pool_job_func_t func)
+{
+    job->func = func;
+    g_atomic_int_set(&job->done, FALSE);
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->num_jobs >= pool->num_encoders * IMAGE_ENCODERS_POOL_QUEUE_DEPTH) {
+        pthread_mutex_unlock(&pool->lock);
+        return false;
+    }
+    pool->num_jobs++;
+    pthread_mutex_unlock(&pool->lock);
+
+    g_thread_pool_push(pool->threads, job, NULL);
+    return true;
+}
+
+void image_encoders_pool_wait(ImageEncodersPool *pool, ImageEncodersPoolJob *job)
+{
+    if (image_encoders_pool_job_is_done(job)) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (!image_encoders_pool_job_is_done(job)) {
+        pthread_cond_wait(&pool->job_done, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+unsigned int image_encoders_pool_get_num_threads(ImageEncodersPool *pool)
+{
+    return pool->num_encoders;
+}
+
 void image_encoder_shared_init(ImageEncoderSharedData *shared_data)
 {
     clockid_t stat_clock = CLOCK_THREAD_CPUTIME_ID;
@@ -1317,6 +1457,31 @@ void image_encoder_shared_init(ImageEncoderSharedData *shared_data)
     stat_compress_init(&shared_data->zlib_glz_stat, "zlib", stat_clock);
     stat_compress_init(&shared_data->jpeg_alpha_stat, "jpeg_alpha", stat_clock);
     stat_compress_init(&shared_data->lz4_stat, "lz4", stat_clock);
+
+    shared_data->glz_drawable_slab = red_slab_new(sizeof(RedGlzDrawable),
+                                                  RED_GLZ_DRAWABLES_PER_SLAB_BLOCK);
+}
+
+void image_encoder_shared_init_stat(ImageEncoderSharedData *shared_data, SpiceServer *reds,
+                                    const RedStatNode *parent)
+{
+    RedStatNode *node = &shared_data->compress_time_stat;
+
+    stat_init_node(node, reds, parent, "compress_time", TRUE);
+    stat_init_histogram(&shared_data->off_time, reds, node, "off", TRUE);
+    stat_init_histogram(&shared_data->lz_time, reds, node, "lz", TRUE);
+    stat_init_histogram(&shared_data->glz_time, reds, node, "glz", TRUE);
+    stat_init_histogram(&shared_data->quic_time, reds, node, "quic", TRUE);
+    stat_init_histogram(&shared_data->jpeg_time, reds, node, "jpeg", TRUE);
+    stat_init_histogram(&shared_data->zlib_glz_time, reds, node, "zlib", TRUE);
+    stat_init_histogram(&shared_data->jpeg_alpha_time, reds, node, "jpeg_alpha", TRUE);
+    stat_init_histogram(&shared_data->lz4_time, reds, node, "lz4", TRUE);
+}
+
+void image_encoder_shared_destroy(ImageEncoderSharedData *shared_data)
+{
+    red_slab_destroy(shared_data->glz_drawable_slab);
+    shared_data->glz_drawable_slab = NULL;
 }
 
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data)
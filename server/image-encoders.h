@@ -45,6 +45,9 @@ typedef struct GlzSharedDictionary GlzSharedDictionary;
 typedef struct GlzImageRetention GlzImageRetention;
 
 void image_encoder_shared_init(ImageEncoderSharedData *shared_data);
+void image_encoder_shared_init_stat(ImageEncoderSharedData *shared_data, SpiceServer *reds,
+                                    const RedStatNode *parent);
+void image_encoder_shared_destroy(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_print(const ImageEncoderSharedData *shared_data);
 
@@ -149,6 +152,9 @@ static inline void glz_retention_init(GlzImageRetention *ret)
 
 struct ImageEncoderSharedData {
     uint32_t glz_drawable_count;
+    /* RedGlzDrawable allocator, the GLZ drawables are allocated and
+     * freed by the display channel thread */
+    RedSlab *glz_drawable_slab;
 
     stat_info_t off_stat;
     stat_info_t lz_stat;
@@ -158,6 +164,17 @@ struct ImageEncoderSharedData {
     stat_info_t zlib_glz_stat;
     stat_info_t jpeg_alpha_stat;
     stat_info_t lz4_stat;
+
+    /* the time of the compressions, for the statistics file */
+    RedStatNode compress_time_stat;
+    RedStatHistogram off_time;
+    RedStatHistogram lz_time;
+    RedStatHistogram glz_time;
+    RedStatHistogram quic_time;
+    RedStatHistogram jpeg_time;
+    RedStatHistogram zlib_glz_time;
+    RedStatHistogram jpeg_alpha_time;
+    RedStatHistogram lz4_time;
 };
 
 struct ImageEncoders {
@@ -218,6 +235,38 @@ bool image_encoders_compress_glz(ImageEncoders *enc, SpiceImage *dest,
                                  compress_send_data_t* o_comp_data,
                                  gboolean enable_zlib_glz_wrap);
 
+/* A pool of worker threads each owning a private set of encoders, used to
+ * run image compression out of the display worker thread.
+ * GLZ is not available in the pool as the dictionary requires the images to
+ * be encoded in the order they are sent.
+ */
+typedef struct ImageEncodersPool ImageEncodersPool;
+typedef struct ImageEncodersPoolJob ImageEncodersPoolJob;
+
+typedef void (*image_encoders_pool_job_func_t)(ImageEncoders *enc, ImageEncodersPoolJob *job);
+
+struct ImageEncodersPoolJob {
+    image_encoders_pool_job_func_t func;
+    gint done;
+};
+
+#define IMAGE_ENCODERS_POOL_MAX_THREADS 16
+
+ImageEncodersPool *image_encoders_pool_new(ImageEncoderSharedData *shared_data,
+                                           unsigned int num_threads);
+/* waits for all the pending jobs to complete */
+void image_encoders_pool_free(ImageEncodersPool *pool);
+/* returns FALSE if the pool queue is full, in this case the job is not queued */
+bool image_encoders_pool_push(ImageEncodersPool *pool, ImageEncodersPoolJob *job,
+                              image_encoders_pool_job_func_t func);
+void image_encoders_pool_wait(ImageEncodersPool *pool, ImageEncodersPoolJob *job);
+unsigned int image_encoders_pool_get_num_threads(ImageEncodersPool *pool);
+
+static inline bool image_encoders_pool_job_is_done(ImageEncodersPoolJob *job)
+{
+    return g_atomic_int_get(&job->done);
+}
+
 #define RED_RELEASE_BUNCH_SIZE 64
 
 SPICE_END_DECLS
@@ -0,0 +1,142 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <lz4.h>
+#include <glib.h>
+
+#include "lz4-stream.h"
+
+/* the history of a stream used by LZ4 */
+#define LZ4_HISTORY_SIZE (64 * 1024)
+
+struct Lz4StreamEncoder {
+    LZ4_stream_t *stream;
+    uint32_t max_block_size;
+    /* a block can be written without overwriting the history */
+    uint32_t ring_size;
+    uint32_t pos;
+    uint8_t *ring;
+};
+
+struct Lz4StreamDecoder {
+    LZ4_streamDecode_t *stream;
+    uint32_t max_block_size;
+    /* the minimum for decoding in place, see LZ4_decoderRingBufferSize() */
+    uint32_t ring_size;
+    uint32_t pos;
+    uint8_t *ring;
+};
+
+Lz4StreamEncoder *lz4_stream_encoder_new(uint32_t max_block_size)
+{
+    Lz4StreamEncoder *encoder = g_new0(Lz4StreamEncoder, 1);
+
+    encoder->stream = LZ4_createStream();
+    encoder->max_block_size = max_block_size;
+    encoder->ring_size = 2 * max_block_size + LZ4_HISTORY_SIZE;
+    encoder->ring = g_new(uint8_t, encoder->ring_size);
+    return encoder;
+}
+
+void lz4_stream_encoder_free(Lz4StreamEncoder *encoder)
+{
+    if (!encoder) {
+        return;
+    }
+    LZ4_freeStream(encoder->stream);
+    g_free(encoder->ring);
+    g_free(encoder);
+}
+
+uint8_t *lz4_stream_encoder_next_block(Lz4StreamEncoder *encoder)
+{
+    if (encoder->pos + encoder->max_block_size > encoder->ring_size) {
+        encoder->pos = 0;
+    }
+    return encoder->ring + encoder->pos;
+}
+
+int lz4_stream_encoder_compress(Lz4StreamEncoder *encoder, uint32_t size,
+                                uint8_t *dest, uint32_t dest_size)
+{
+    const char *block = (const char *) lz4_stream_encoder_next_block(encoder);
+    int compressed_size;
+
+    g_return_val_if_fail(size <= encoder->max_block_size, 0);
+
+#ifdef HAVE_LZ4_COMPRESS_FAST_CONTINUE
+    compressed_size = LZ4_compress_fast_continue(encoder->stream, block, (char *) dest,
+                                                 size, dest_size, 1);
+#else
+    if (dest_size < (uint32_t) LZ4_compressBound(size)) {
+        return 0;
+    }
+    compressed_size = LZ4_compress_continue(encoder->stream, block, (char *) dest, size);
+#endif
+    if (compressed_size <= 0) {
+        return 0;
+    }
+    encoder->pos += size;
+    return compressed_size;
+}
+
+Lz4StreamDecoder *lz4_stream_decoder_new(uint32_t max_block_size)
+{
+    Lz4StreamDecoder *decoder = g_new0(Lz4StreamDecoder, 1);
+
+    decoder->stream = LZ4_createStreamDecode();
+    decoder->max_block_size = max_block_size;
+    decoder->ring_size = LZ4_HISTORY_SIZE + 14 + max_block_size;
+    decoder->ring = g_new(uint8_t, decoder->ring_size);
+    return decoder;
+}
+
+void lz4_stream_decoder_free(Lz4StreamDecoder *decoder)
+{
+    if (!decoder) {
+        return;
+    }
+    LZ4_freeStreamDecode(decoder->stream);
+    g_free(decoder->ring);
+    g_free(decoder);
+}
+
+const uint8_t *lz4_stream_decoder_decompress(Lz4StreamDecoder *decoder,
+                                             const uint8_t *src, uint32_t src_size,
+                                             uint32_t size)
+{
+    char *block;
+    int decompressed_size;
+
+    if (size > decoder->max_block_size) {
+        return NULL;
+    }
+    /* the previous blocks must stay in place */
+    if (decoder->pos + decoder->max_block_size > decoder->ring_size) {
+        decoder->pos = 0;
+    }
+    block = (char *) decoder->ring + decoder->pos;
+    decompressed_size = LZ4_decompress_safe_continue(decoder->stream, (const char *) src,
+                                                     block, src_size, size);
+    if (decompressed_size < 0 || (uint32_t) decompressed_size != size) {
+        return NULL;
+    }
+    decoder->pos += size;
+    return (const uint8_t *) block;
+}
@@ -0,0 +1,59 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LZ4_STREAM_H_
+#define LZ4_STREAM_H_
+
+#include <stdint.h>
+#include <spice/macros.h>
+
+SPICE_BEGIN_DECLS
+
+/* Streaming LZ4 of a sequence of blocks of data: each block is compressed
+ * with the last 64K of the previous ones as dictionary, so the blocks
+ * have to be decompressed in the same order. The encoder and the decoder
+ * keep this history in a ring of blocks of at most @max_block_size bytes.
+ *
+ * Meant for the data of the spicevmc channels, which can use it once
+ * spice-protocol has a capability and a compression type for it.
+ */
+typedef struct Lz4StreamEncoder Lz4StreamEncoder;
+typedef struct Lz4StreamDecoder Lz4StreamDecoder;
+
+Lz4StreamEncoder *lz4_stream_encoder_new(uint32_t max_block_size);
+void lz4_stream_encoder_free(Lz4StreamEncoder *encoder);
+/* where the data of the next block has to be written */
+uint8_t *lz4_stream_encoder_next_block(Lz4StreamEncoder *encoder);
+/* compresses the @size bytes written at lz4_stream_encoder_next_block() to
+ * @dest, returns the compressed size or 0 on failure. After a failure the
+ * next blocks cannot be decoded, the stream has to be given up while the
+ * data of the block is still readable at the same place */
+int lz4_stream_encoder_compress(Lz4StreamEncoder *encoder, uint32_t size,
+                                uint8_t *dest, uint32_t dest_size);
+
+Lz4StreamDecoder *lz4_stream_decoder_new(uint32_t max_block_size);
+void lz4_stream_decoder_free(Lz4StreamDecoder *decoder);
+/* decompresses the next block of the stream, of @size bytes, returns its
+ * data, valid until the next call, or NULL on error */
+const uint8_t *lz4_stream_decoder_decompress(Lz4StreamDecoder *decoder,
+                                             const uint8_t *src, uint32_t src_size,
+                                             uint32_t size);
+
+SPICE_END_DECLS
+
+#endif /* LZ4_STREAM_H_ */
@@ -17,6 +17,7 @@
 #include <config.h>
 
 #include "pixmap-cache.h"
+#include "spice-bitmap-utils.h"
 
 int pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy)
 {
@@ -34,6 +35,77 @@ int pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy)
     return !!item;
 }
 
+void pixmap_cache_unlocked_remove_content_hash(PixmapCache *cache, NewCacheItem *item)
+{
+    NewCacheItem **now;
+
+    if (!item->content_hash) {
+        return;
+    }
+
+    now = &cache->content_hash_table[BITS_CACHE_HASH_KEY(item->content_hash)];
+    while (*now) {
+        if (*now == item) {
+            *now = item->content_next;
+            break;
+        }
+        now = &(*now)->content_next;
+    }
+    item->content_next = NULL;
+    item->content_hash = 0;
+    g_clear_pointer(&item->content, g_free);
+    cache->content_available += item->content_size;
+    item->content_size = 0;
+}
+
+void pixmap_cache_unlocked_set_content(PixmapCache *cache, uint64_t id,
+                                       uint64_t content_hash, SpiceBitmap *bitmap)
+{
+    NewCacheItem *item;
+    int key;
+
+    item = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
+    while (item && item->id != id) {
+        item = item->next;
+    }
+    if (!item) {
+        return;
+    }
+
+    pixmap_cache_unlocked_remove_content_hash(cache, item);
+    if (!content_hash || (int64_t) bitmap_get_content_size(bitmap) > cache->content_available) {
+        return;
+    }
+    item->content_hash = content_hash;
+    item->content = bitmap_get_content(bitmap, &item->content_size);
+    cache->content_available -= item->content_size;
+    item->content_width = bitmap->x;
+    item->content_height = bitmap->y;
+    item->content_format = bitmap->format;
+    item->content_flags = bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN;
+    item->content_next = cache->content_hash_table[(key = BITS_CACHE_HASH_KEY(content_hash))];
+    cache->content_hash_table[key] = item;
+}
+
+NewCacheItem *pixmap_cache_unlocked_find_content(PixmapCache *cache, uint64_t content_hash,
+                                                 SpiceBitmap *bitmap)
+{
+    NewCacheItem *item;
+
+    item = cache->content_hash_table[BITS_CACHE_HASH_KEY(content_hash)];
+    while (item) {
+        if (item->content_hash == content_hash &&
+            item->content_width == bitmap->x && item->content_height == bitmap->y &&
+            item->content_format == bitmap->format &&
+            item->content_flags == (bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN) &&
+            bitmap_content_equal(bitmap, item->content, item->content_size)) {
+            return item;
+        }
+        item = item->content_next;
+    }
+    return NULL;
+}
+
 void pixmap_cache_clear(PixmapCache *cache)
 {
     NewCacheItem *item;
@@ -47,11 +119,15 @@ void pixmap_cache_clear(PixmapCache *cache)
     SPICE_VERIFY(SPICE_OFFSETOF(NewCacheItem, lru_link) == 0);
     while ((item = SPICE_CONTAINEROF(ring_get_head(&cache->lru), NewCacheItem, lru_link))) {
         ring_remove(&item->lru_link);
+        g_free(item->content);
         g_free(item);
     }
     memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
+    memset(cache->content_hash_table, 0,
+           sizeof(*cache->content_hash_table) * BITS_CACHE_HASH_SIZE);
 
     cache->available = cache->size;
+    cache->content_available = PIXMAP_CACHE_CONTENT_MAX_SIZE;
     cache->items = 0;
 }
 
@@ -68,6 +144,8 @@ bool pixmap_cache_freeze(PixmapCache *cache)
     cache->frozen_tail = cache->lru.prev;
     ring_init(&cache->lru);
     memset(cache->hash_table, 0, sizeof(*cache->hash_table) * BITS_CACHE_HASH_SIZE);
+    memset(cache->content_hash_table, 0,
+           sizeof(*cache->content_hash_table) * BITS_CACHE_HASH_SIZE);
     cache->available = -1;
     cache->frozen = TRUE;
 
@@ -99,6 +177,7 @@ static PixmapCache *pixmap_cache_new(RedClient *client, uint8_t id, int64_t size
     ring_init(&cache->lru);
     cache->available = size;
     cache->size = size;
+    cache->content_available = PIXMAP_CACHE_CONTENT_MAX_SIZE;
     cache->client = client;
 
     return cache;
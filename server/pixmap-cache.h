@@ -31,6 +31,9 @@ SPICE_BEGIN_DECLS
 #define BITS_CACHE_HASH_SIZE (1 << BITS_CACHE_HASH_SHIFT)
 #define BITS_CACHE_HASH_MASK (BITS_CACHE_HASH_SIZE - 1)
 #define BITS_CACHE_HASH_KEY(id) ((id) & BITS_CACHE_HASH_MASK)
+/* memory used by the copies of the content of the items, beyond it the
+ * items can't be found by content */
+#define PIXMAP_CACHE_CONTENT_MAX_SIZE (32 * 1024 * 1024)
 
 typedef struct PixmapCache PixmapCache;
 typedef struct NewCacheItem NewCacheItem;
@@ -38,7 +41,19 @@ typedef struct NewCacheItem NewCacheItem;
 struct NewCacheItem {
     RingItem lru_link;
     NewCacheItem *next;
+    /* next item in PixmapCache::content_hash_table */
+    NewCacheItem *content_next;
     uint64_t id;
+    /* hash of the image content, 0 if not known */
+    uint64_t content_hash;
+    /* the image content with content_hash, a hash match is not enough to
+     * reuse the item */
+    uint8_t *content;
+    size_t content_size;
+    uint32_t content_width;
+    uint32_t content_height;
+    uint8_t content_format;
+    uint8_t content_flags;
     uint64_t sync[MAX_CACHE_CLIENTS];
     size_t size;
     int lossy;
@@ -50,9 +65,13 @@ struct PixmapCache {
     uint8_t id;
     uint32_t refs;
     NewCacheItem *hash_table[BITS_CACHE_HASH_SIZE];
+    /* items with a content_hash, indexed by content_hash */
+    NewCacheItem *content_hash_table[BITS_CACHE_HASH_SIZE];
     Ring lru;
     int64_t available;
     int64_t size;
+    /* bytes of PIXMAP_CACHE_CONTENT_MAX_SIZE not used by NewCacheItem::content */
+    int64_t content_available;
     int32_t items;
 
     int frozen;
@@ -74,6 +93,13 @@ void         pixmap_cache_unref(PixmapCache *cache);
 void         pixmap_cache_clear(PixmapCache *cache);
 int          pixmap_cache_unlocked_set_lossy(PixmapCache *cache, uint64_t id, int lossy);
 bool         pixmap_cache_freeze(PixmapCache *cache);
+/* records the content of @bitmap, its hash being @content_hash */
+void         pixmap_cache_unlocked_set_content(PixmapCache *cache, uint64_t id,
+                                               uint64_t content_hash, SpiceBitmap *bitmap);
+void         pixmap_cache_unlocked_remove_content_hash(PixmapCache *cache, NewCacheItem *item);
+/* returns the item with the same content as @bitmap, if any */
+NewCacheItem *pixmap_cache_unlocked_find_content(PixmapCache *cache, uint64_t content_hash,
+                                                 SpiceBitmap *bitmap);
 
 SPICE_END_DECLS
 
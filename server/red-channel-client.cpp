@@ -35,6 +35,7 @@
 
 #include "red-channel-client.h"
 #include "red-client.h"
+#include "reds.h"
 
 #define CLIENT_ACK_WINDOW 20
 
@@ -103,6 +104,11 @@ typedef struct RedChannelClientConnectivityMonitor {
 typedef struct OutgoingMessageBuffer {
     int pos;
     int size;
+    /* part of the message not written yet. Kept across partial writes
+     * so the marshaller is not walked again on each write */
+    struct iovec vec[IOV_MAX];
+    int vec_pos;
+    int vec_size;
 } OutgoingMessageBuffer;
 
 typedef struct IncomingMessageBuffer {
@@ -156,7 +162,7 @@ struct RedChannelClientPrivate
 
     bool block_read;
     bool during_send;
-    GQueue pipe;
+    RedPipe pipe;
 
     RedChannelCapabilities remote_caps;
     bool is_mini_header;
@@ -172,16 +178,19 @@ struct RedChannelClientPrivate
 
     RedStatCounter out_messages;
     RedStatCounter out_bytes;
+    RedStatCounter out_writes;
+    RedStatCounter out_blocked;
+    RedStatCounter out_flushes;
+    RedStatHistogram out_write_time;
 
-    inline RedPipeItem *pipe_item_get();
-    inline bool pipe_remove(RedPipeItem *item);
     void handle_pong(SpiceMsgPing *ping);
     inline void set_message_serial(uint64_t serial);
-    void pipe_clear();
     void data_sent(int n);
     void data_read(int n);
     inline int get_out_msg_size();
     inline int prepare_out_msg(struct iovec *vec, int vec_size, int pos);
+    inline void consume_out_msg(int n);
+    inline void reset_out_msg();
     inline void set_blocked();
     void reset_send_data();
     void seamless_migration_done();
@@ -308,13 +317,12 @@ RedChannelClientPrivate::RedChannelClientPrivate(RedChannel *channel,
 
     send_data.marshaller = send_data.main.marshaller;
 
-    g_queue_init(&pipe);
+    red_pipe_init(&pipe);
 
     red_channel_capabilities_reset(&remote_caps);
     red_channel_capabilities_init(&remote_caps, caps);
 
-    outgoing.pos = 0;
-    outgoing.size = 0;
+    reset_out_msg();
 
     if (test_capability(remote_caps.common_caps, remote_caps.num_common_caps,
                         SPICE_COMMON_CAP_MINI_HEADER)) {
@@ -332,6 +340,14 @@ RedChannelClientPrivate::RedChannelClientPrivate(RedChannel *channel,
     const RedStatNode *node = channel->get_stat_node();
     stat_init_counter(&out_messages, reds, node, "out_messages", TRUE);
     stat_init_counter(&out_bytes, reds, node, "out_bytes", TRUE);
+    stat_init_counter(&out_writes, reds, node, "out_writes", TRUE);
+    stat_init_counter(&out_blocked, reds, node, "out_blocked", TRUE);
+    stat_init_counter(&out_flushes, reds, node, "out_flushes", TRUE);
+    stat_init_histogram(&out_write_time, reds, node, "out_write_time", TRUE);
+
+    if (stream && reds_get_tls_write_offload(reds)) {
+        red_stream_enable_write_offload(stream, node);
+    }
 }
 
 RedChannelClientPrivate::~RedChannelClientPrivate()
@@ -348,6 +364,12 @@ RedChannelClientPrivate::~RedChannelClientPrivate()
         spice_marshaller_destroy(send_data.main.marshaller);
     }
 
+    RedPipeItem *item;
+    while ((item = red_pipe_pop_head(&pipe)) != NULL) {
+        red_pipe_item_unref(item);
+    }
+    red_pipe_destroy(&pipe);
+
     if (send_data.urgent.marshaller) {
         spice_marshaller_destroy(send_data.urgent.marshaller);
     }
@@ -402,6 +424,31 @@ inline int RedChannelClientPrivate::prepare_out_msg(struct iovec *vec, int vec_s
                                        vec, vec_size, pos);
 }
 
+/* move the iovec cursor of the message being sent after n written bytes,
+ * empty entries are skipped */
+inline void RedChannelClientPrivate::consume_out_msg(int n)
+{
+    while (outgoing.vec_pos < outgoing.vec_size) {
+        struct iovec *vec = &outgoing.vec[outgoing.vec_pos];
+
+        if ((size_t) n < vec->iov_len) {
+            vec->iov_base = (uint8_t *) vec->iov_base + n;
+            vec->iov_len -= n;
+            return;
+        }
+        n -= vec->iov_len;
+        outgoing.vec_pos++;
+    }
+}
+
+inline void RedChannelClientPrivate::reset_out_msg()
+{
+    outgoing.pos = 0;
+    outgoing.size = 0;
+    outgoing.vec_pos = 0;
+    outgoing.vec_size = 0;
+}
+
 inline void RedChannelClientPrivate::set_blocked()
 {
     send_data.blocked = true;
@@ -551,7 +598,7 @@ void RedChannelClient::msg_sent()
         spice_assert(priv->send_data.header.data != NULL);
         begin_send_message();
     } else {
-        if (g_queue_is_empty(&priv->pipe)) {
+        if (red_pipe_is_empty(&priv->pipe)) {
             /* It is possible that the socket will become idle, so we may be able to test latency */
             priv->restart_ping_timer();
         }
@@ -559,9 +606,16 @@ void RedChannelClient::msg_sent()
 
 }
 
-bool RedChannelClientPrivate::pipe_remove(RedPipeItem *item)
+bool RedChannelClient::pipe_remove(RedPipeItem *item)
 {
-    return g_queue_remove(&pipe, item);
+    RedPipeLink *link = red_pipe_find(&priv->pipe, item);
+
+    if (!link) {
+        return false;
+    }
+    red_pipe_remove_link(&priv->pipe, link);
+    on_pipe_item_removed(item);
+    return true;
 }
 
 bool RedChannelClient::test_remote_common_cap(uint32_t cap) const
@@ -919,6 +973,7 @@ void RedChannelClient::handle_outgoing()
     RedStream *stream = priv->stream;
     OutgoingMessageBuffer *buffer = &priv->outgoing;
     ssize_t n;
+    stat_time_t start;
 
     if (!stream) {
         return;
@@ -932,13 +987,21 @@ void RedChannelClient::handle_outgoing()
     }
 
     for (;;) {
-        struct iovec vec[IOV_MAX];
-        int vec_size =
-            priv->prepare_out_msg(vec, G_N_ELEMENTS(vec), buffer->pos);
-        n = red_stream_writev(stream, vec, vec_size);
+        if (buffer->vec_pos == buffer->vec_size) {
+            // the message can have more chunks than an iovec can hold
+            buffer->vec_size =
+                priv->prepare_out_msg(buffer->vec, G_N_ELEMENTS(buffer->vec), buffer->pos);
+            buffer->vec_pos = 0;
+        }
+        start = stat_histogram_start();
+        n = red_stream_writev(stream, buffer->vec + buffer->vec_pos,
+                              buffer->vec_size - buffer->vec_pos);
+        stat_histogram_add_time(&priv->out_write_time, start);
+        stat_inc_counter(priv->out_writes, 1);
         if (n == -1) {
             switch (errno) {
             case EAGAIN:
+                stat_inc_counter(priv->out_blocked, 1);
                 priv->set_blocked();
                 break;
             case EINTR:
@@ -959,11 +1022,11 @@ void RedChannelClient::handle_outgoing()
             /* reset buffer before calling on_msg_done, since it
              * can trigger another call to RedChannelClient::handle_outgoing (when
              * switching from the urgent marshaller to the main one */
-            buffer->pos = 0;
-            buffer->size = 0;
+            priv->reset_out_msg();
             msg_sent();
             return;
         }
+        priv->consume_out_msg(n);
     }
 }
 
@@ -1112,12 +1175,18 @@ void RedChannelClient::send()
     handle_outgoing();
 }
 
-inline RedPipeItem *RedChannelClientPrivate::pipe_item_get()
+inline RedPipeItem *RedChannelClient::pipe_item_get()
 {
-    if (send_data.blocked || waiting_for_ack()) {
+    RedPipeItem *item;
+
+    if (priv->send_data.blocked || priv->waiting_for_ack()) {
         return NULL;
     }
-    return (RedPipeItem*) g_queue_pop_tail(&pipe);
+    item = red_pipe_pop_tail(&priv->pipe);
+    if (item) {
+        on_pipe_item_removed(item);
+    }
+    return item;
 }
 
 void RedChannelClient::push()
@@ -1140,7 +1209,7 @@ void RedChannelClient::push()
                             "ERROR: an item waiting to be sent and not blocked");
     }
 
-    while ((pipe_item = priv->pipe_item_get())) {
+    while ((pipe_item = pipe_item_get())) {
         send_any_item(pipe_item);
     }
     /* prepare_pipe_add() will reenable WRITE events when the priv->pipe is empty
@@ -1150,7 +1219,7 @@ void RedChannelClient::push()
      * notified that we can write and we then exit (see pipe_item_get) as we
      * are waiting for the ack consuming CPU in a tight loop
      */
-    if ((no_item_being_sent() && g_queue_is_empty(&priv->pipe)) ||
+    if ((no_item_being_sent() && red_pipe_is_empty(&priv->pipe)) ||
         priv->waiting_for_ack()) {
         priv->watch_update_mask(SPICE_WATCH_EVENT_READ);
 
@@ -1161,7 +1230,9 @@ void RedChannelClient::push()
          * that for a long train of small messages the message that would
          * cause the client to send the ack is still in the queue
          */
-        red_stream_flush(priv->stream);
+        if (red_stream_flush(priv->stream)) {
+            stat_inc_counter(priv->out_flushes, 1);
+        }
     }
     priv->during_send = FALSE;
 }
@@ -1358,7 +1429,7 @@ inline bool RedChannelClient::prepare_pipe_add(RedPipeItem *item)
         red_pipe_item_unref(item);
         return false;
     }
-    if (g_queue_is_empty(&priv->pipe)) {
+    if (red_pipe_is_empty(&priv->pipe)) {
         priv->watch_update_mask(SPICE_WATCH_EVENT_READ | SPICE_WATCH_EVENT_WRITE);
     }
     return true;
@@ -1370,7 +1441,8 @@ void RedChannelClient::pipe_add(RedPipeItem *item)
     if (!prepare_pipe_add(item)) {
         return;
     }
-    g_queue_push_head(&priv->pipe, item);
+    red_pipe_push_head(&priv->pipe, item);
+    on_pipe_item_added(item);
 }
 
 void RedChannelClient::pipe_add_push(RedPipeItem *item)
@@ -1380,33 +1452,35 @@ void RedChannelClient::pipe_add_push(RedPipeItem *item)
 }
 
 void RedChannelClient::pipe_add_after_pos(RedPipeItem *item,
-                                          GList *pipe_item_pos)
+                                          RedPipeLink *pipe_item_pos)
 {
     spice_assert(pipe_item_pos);
     if (!prepare_pipe_add(item)) {
         return;
     }
 
-    g_queue_insert_after(&priv->pipe, pipe_item_pos, item);
+    red_pipe_insert_after(&priv->pipe, pipe_item_pos, item);
+    on_pipe_item_added(item);
 }
 
 void
-RedChannelClient::pipe_add_before_pos(RedPipeItem *item, GList *pipe_item_pos)
+RedChannelClient::pipe_add_before_pos(RedPipeItem *item, RedPipeLink *pipe_item_pos)
 {
     spice_assert(pipe_item_pos);
     if (!prepare_pipe_add(item)) {
         return;
     }
 
-    g_queue_insert_before(&priv->pipe, pipe_item_pos, item);
+    red_pipe_insert_before(&priv->pipe, pipe_item_pos, item);
+    on_pipe_item_added(item);
 }
 
 void RedChannelClient::pipe_add_after(RedPipeItem *item, RedPipeItem *pos)
 {
-    GList *prev;
+    RedPipeLink *prev;
 
     spice_assert(pos);
-    prev = g_queue_find(&priv->pipe, pos);
+    prev = red_pipe_find(&priv->pipe, pos);
     g_return_if_fail(prev != NULL);
 
     pipe_add_after_pos(item, prev);
@@ -1414,7 +1488,7 @@ void RedChannelClient::pipe_add_after(RedPipeItem *item, RedPipeItem *pos)
 
 int RedChannelClient::pipe_item_is_linked(RedPipeItem *item)
 {
-    return g_queue_find(&priv->pipe, item) != NULL;
+    return red_pipe_find(&priv->pipe, item) != NULL;
 }
 
 void RedChannelClient::pipe_add_tail(RedPipeItem *item)
@@ -1422,7 +1496,8 @@ void RedChannelClient::pipe_add_tail(RedPipeItem *item)
     if (!prepare_pipe_add(item)) {
         return;
     }
-    g_queue_push_tail(&priv->pipe, item);
+    red_pipe_push_tail(&priv->pipe, item);
+    on_pipe_item_added(item);
 }
 
 void RedChannelClient::pipe_add_type(int pipe_item_type)
@@ -1449,15 +1524,15 @@ void RedChannelClient::pipe_add_empty_msg(int msg_type)
 
 gboolean RedChannelClient::pipe_is_empty()
 {
-    return g_queue_is_empty(&priv->pipe);
+    return red_pipe_is_empty(&priv->pipe);
 }
 
 uint32_t RedChannelClient::get_pipe_size()
 {
-    return g_queue_get_length(&priv->pipe);
+    return priv->pipe.length;
 }
 
-GQueue* RedChannelClient::get_pipe()
+RedPipe* RedChannelClient::get_pipe()
 {
     return &priv->pipe;
 }
@@ -1482,12 +1557,13 @@ void RedChannelClientPrivate::clear_sent_item()
 // TODO: again - what is the context exactly? this happens in channel disconnect. but our
 // current red_channel_shutdown also closes the socket - is there a socket to close?
 // are we reading from an fd here? arghh
-void RedChannelClientPrivate::pipe_clear()
+void RedChannelClient::pipe_clear()
 {
     RedPipeItem *item;
 
-    clear_sent_item();
-    while ((item = (RedPipeItem*) g_queue_pop_head(&pipe)) != NULL) {
+    priv->clear_sent_item();
+    while ((item = red_pipe_pop_head(&priv->pipe)) != NULL) {
+        on_pipe_item_removed(item);
         red_pipe_item_unref(item);
     }
 }
@@ -1515,7 +1591,7 @@ void RedChannelClient::disconnect()
     if (!is_connected()) {
         return;
     }
-    priv->pipe_clear();
+    pipe_clear();
 
     shutdown();
 
@@ -1564,7 +1640,7 @@ void RedChannelClient::set_header_sub_list(uint32_t sub_list)
 }
 
 /* TODO: more evil sync stuff. anything with the word wait in it's name. */
-bool RedChannelClient::wait_pipe_item_sent(GList *item_pos, int64_t timeout)
+bool RedChannelClient::wait_pipe_item_sent(RedPipeLink *item_pos, int64_t timeout)
 {
     uint64_t end_time;
     bool item_sent;
@@ -1643,16 +1719,16 @@ bool RedChannelClient::no_item_being_sent() const
 
 void RedChannelClient::pipe_remove_and_release(RedPipeItem *item)
 {
-    if (priv->pipe_remove(item)) {
+    if (pipe_remove(item)) {
         red_pipe_item_unref(item);
     }
 }
 
-void RedChannelClient::pipe_remove_and_release_pos(GList *item_pos)
+void RedChannelClient::pipe_remove_and_release_pos(RedPipeLink *item_pos)
 {
-    RedPipeItem *item = (RedPipeItem*) item_pos->data;
+    RedPipeItem *item = red_pipe_remove_link(&priv->pipe, item_pos);
 
-    g_queue_delete_link(&priv->pipe, item_pos);
+    on_pipe_item_removed(item);
     red_pipe_item_unref(item);
 }
 
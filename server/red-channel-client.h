@@ -84,10 +84,10 @@ public:
     void pipe_add_push(RedPipeItem *item);
     void pipe_add(RedPipeItem *item);
     void pipe_add_after(RedPipeItem *item, RedPipeItem *pos);
-    void pipe_add_after_pos(RedPipeItem *item, GList *pos);
+    void pipe_add_after_pos(RedPipeItem *item, RedPipeLink *pos);
     int pipe_item_is_linked(RedPipeItem *item);
     void pipe_remove_and_release(RedPipeItem *item);
-    void pipe_remove_and_release_pos(GList *item_pos);
+    void pipe_remove_and_release_pos(RedPipeLink *item_pos);
     void pipe_add_tail(RedPipeItem *item);
     /* for types that use this routine -> the pipe item should be freed */
     void pipe_add_type(int pipe_item_type);
@@ -95,7 +95,7 @@ public:
     void pipe_add_empty_msg(int msg_type);
     gboolean pipe_is_empty();
     uint32_t get_pipe_size();
-    GQueue* get_pipe();
+    RedPipe* get_pipe();
     bool is_mini_header() const;
 
     void ack_zero_messages_window();
@@ -130,7 +130,7 @@ public:
      * Return: TRUE if waiting succeeded. FALSE if timeout expired.
      */
 
-    bool wait_pipe_item_sent(GList *item_pos, int64_t timeout);
+    bool wait_pipe_item_sent(RedPipeLink *item_pos, int64_t timeout);
     bool wait_outgoing_item(int64_t timeout);
 
     RedChannel* get_channel();
@@ -160,6 +160,11 @@ protected:
 
     virtual void on_disconnect() {};
 
+    /* called when an item is linked to or unlinked from the pipe, either
+     * to be sent or removed */
+    virtual void on_pipe_item_added(RedPipeItem *item) {};
+    virtual void on_pipe_item_removed(RedPipeItem *item) {};
+
     // TODO: add ASSERTS for thread_id  in client and channel calls
     /*
      * callbacks that are triggered from channel client stream events.
@@ -181,7 +186,10 @@ private:
     virtual void handle_migrate_flush_mark();
     void handle_migrate_data_early(uint32_t size, void *message);
     inline bool prepare_pipe_add(RedPipeItem *item);
-    void pipe_add_before_pos(RedPipeItem *item, GList *pipe_item_pos);
+    void pipe_add_before_pos(RedPipeItem *item, RedPipeLink *pipe_item_pos);
+    inline RedPipeItem *pipe_item_get();
+    bool pipe_remove(RedPipeItem *item);
+    void pipe_clear();
     void send_set_ack();
     void send_migrate();
     void send_empty_msg(RedPipeItem *base);
@@ -360,7 +360,40 @@ static SpiceClipRects *red_get_clip_rects(RedMemSlotInfo *slots, int group_id,
     return red;
 }
 
+/* Images are allocated with room for a SpiceChunks with a single chunk,
+ * which is enough for most of the bitmaps */
+#define RED_IMAGE_ALLOC_SIZE (sizeof(SpiceImage) + sizeof(SpiceChunks) + sizeof(SpiceChunk))
+#define RED_IMAGES_PER_BLOCK 64
+#define RED_DRAWABLES_PER_BLOCK 64
+
+static SpiceChunks *red_image_inline_chunks(SpiceImage *image)
+{
+    return (SpiceChunks *) (image + 1);
+}
+
+static SpiceChunks *red_image_chunks_new(SpiceImage *image, int num_chunks)
+{
+    SpiceChunks *chunks;
+
+    if (num_chunks != 1) {
+        return spice_chunks_new(num_chunks);
+    }
+    chunks = red_image_inline_chunks(image);
+    chunks->data_size = 0;
+    chunks->num_chunks = 1;
+    chunks->flags = 0;
+    return chunks;
+}
+
+static void red_image_chunks_destroy(SpiceImage *image, SpiceChunks *chunks)
+{
+    if (chunks != red_image_inline_chunks(image)) {
+        spice_chunks_destroy(chunks);
+    }
+}
+
 static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id,
+                                            SpiceImage *image,
                                             QXLPHYSICAL addr, size_t size)
 {
     SpiceChunks *data;
@@ -371,7 +404,7 @@ static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id,
         return NULL;
     }
 
-    data = spice_chunks_new(1);
+    data = red_image_chunks_new(image, 1);
     data->data_size      = size;
     data->chunk[0].data  = (uint8_t*) bitmap_virt;
     data->chunk[0].len   = size;
@@ -379,7 +412,7 @@ static SpiceChunks *red_get_image_data_flat(RedMemSlotInfo *slots, int group_id,
 }
 
 static SpiceChunks *red_get_image_data_chunked(RedMemSlotInfo *slots, int group_id,
-                                               RedDataChunk *head)
+                                               SpiceImage *image, RedDataChunk *head)
 {
     SpiceChunks *data;
     RedDataChunk *chunk;
@@ -389,7 +422,7 @@ static SpiceChunks *red_get_image_data_chunked(RedMemSlotInfo *slots, int group_
         i++;
     }
 
-    data = spice_chunks_new(i);
+    data = red_image_chunks_new(image, i);
     data->data_size = 0;
     for (i = 0, chunk = head;
          chunk != NULL && i < data->num_chunks;
@@ -444,7 +477,7 @@ static bool bitmap_consistent(SpiceBitmap *bitmap)
     return true;
 }
 
-static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
+static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                  QXLPHYSICAL addr, uint32_t flags, bool is_mask)
 {
     RedDataChunk chunks;
@@ -463,7 +496,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
     if (qxl == NULL) {
         return NULL;
     }
-    red = g_new0(SpiceImage, 1);
+    red = red_drawable_image_new(slabs);
     red->descriptor.id     = qxl->descriptor.id;
     red->descriptor.type   = qxl->descriptor.type;
     red->descriptor.flags = 0;
@@ -533,7 +566,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
             goto error;
         }
         if (qxl_flags & QXL_BITMAP_DIRECT) {
-            red->u.bitmap.data = red_get_image_data_flat(slots, group_id,
+            red->u.bitmap.data = red_get_image_data_flat(slots, group_id, red,
                                                          qxl->bitmap.data,
                                                          bitmap_size);
         } else {
@@ -543,7 +576,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
                 red_put_data_chunks(&chunks);
                 goto error;
             }
-            red->u.bitmap.data = red_get_image_data_chunked(slots, group_id,
+            red->u.bitmap.data = red_get_image_data_chunked(slots, group_id, red,
                                                             &chunks);
             red_put_data_chunks(&chunks);
         }
@@ -563,7 +596,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
             red_put_data_chunks(&chunks);
             goto error;
         }
-        red->u.quic.data = red_get_image_data_chunked(slots, group_id,
+        red->u.quic.data = red_get_image_data_chunked(slots, group_id, red,
                                                       &chunks);
         red_put_data_chunks(&chunks);
         break;
@@ -573,7 +606,7 @@ static SpiceImage *red_get_image(RedMemSlotInfo *slots, int group_id,
     }
     return red;
 error:
-    g_free(red);
+    red_slab_free(red);
     g_free(rp);
     return NULL;
 }
@@ -586,16 +619,16 @@ static void red_put_image(SpiceImage *red)
     switch (red->descriptor.type) {
     case SPICE_IMAGE_TYPE_BITMAP:
         g_free(red->u.bitmap.palette);
-        spice_chunks_destroy(red->u.bitmap.data);
+        red_image_chunks_destroy(red, red->u.bitmap.data);
         break;
     case SPICE_IMAGE_TYPE_QUIC:
-        spice_chunks_destroy(red->u.quic.data);
+        red_image_chunks_destroy(red, red->u.quic.data);
         break;
     }
-    g_free(red);
+    red_slab_free(red);
 }
 
-static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                               SpiceBrush *red, QXLBrush *qxl, uint32_t flags)
 {
     red->type = qxl->type;
@@ -608,7 +641,8 @@ static void red_get_brush_ptr(RedMemSlotInfo *slots, int group_id,
         }
         break;
     case SPICE_BRUSH_TYPE_PATTERN:
-        red->u.pattern.pat = red_get_image(slots, group_id, qxl->u.pattern.pat, flags, false);
+        red->u.pattern.pat = red_get_image(slots, group_id, slabs,
+                                           qxl->u.pattern.pat, flags, false);
         red_get_point_ptr(&red->u.pattern.pos, &qxl->u.pattern.pos);
         break;
     }
@@ -623,10 +657,10 @@ static void red_put_brush(SpiceBrush *red)
     }
 }
 
-static void red_get_qmask_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_qmask_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                               SpiceQMask *red, QXLQMask *qxl, uint32_t flags)
 {
-    red->bitmap = red_get_image(slots, group_id, qxl->bitmap, flags, true);
+    red->bitmap = red_get_image(slots, group_id, slabs, qxl->bitmap, flags, true);
     if (red->bitmap) {
         red->flags  = qxl->flags;
         red_get_point_ptr(&red->pos, &qxl->pos);
@@ -642,12 +676,12 @@ static void red_put_qmask(SpiceQMask *red)
     red_put_image(red->bitmap);
 }
 
-static void red_get_fill_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_fill_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                              SpiceFill *red, QXLFill *qxl, uint32_t flags)
 {
-    red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+    red_get_brush_ptr(slots, group_id, slabs, &red->brush, &qxl->brush, flags);
     red->rop_descriptor = qxl->rop_descriptor;
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, slabs, &red->mask, &qxl->mask, flags);
 }
 
 static void red_put_fill(SpiceFill *red)
@@ -656,15 +690,15 @@ static void red_put_fill(SpiceFill *red)
     red_put_qmask(&red->mask);
 }
 
-static void red_get_opaque_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_opaque_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                SpiceOpaque *red, QXLOpaque *qxl, uint32_t flags)
 {
-   red->src_bitmap     = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+   red->src_bitmap     = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
-   red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+   red_get_brush_ptr(slots, group_id, slabs, &red->brush, &qxl->brush, flags);
    red->rop_descriptor = qxl->rop_descriptor;
    red->scale_mode     = qxl->scale_mode;
-   red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+   red_get_qmask_ptr(slots, group_id, slabs, &red->mask, &qxl->mask, flags);
 }
 
 static void red_put_opaque(SpiceOpaque *red)
@@ -674,7 +708,7 @@ static void red_put_opaque(SpiceOpaque *red)
     red_put_qmask(&red->mask);
 }
 
-static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id,
+static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                              RedDrawable *red_drawable, QXLCopy *qxl, uint32_t flags)
 {
     /* there's no sense to have this true, this will just waste CPU and reduce optimizations
@@ -684,7 +718,7 @@ static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id,
 
     SpiceCopy *red = &red_drawable->u.copy;
 
-    red->src_bitmap      = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap      = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
     if (!red->src_bitmap) {
         return false;
     }
@@ -705,7 +739,7 @@ static bool red_get_copy_ptr(RedMemSlotInfo *slots, int group_id,
     }
     red->rop_descriptor  = qxl->rop_descriptor;
     red->scale_mode      = qxl->scale_mode;
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, slabs, &red->mask, &qxl->mask, flags);
     return true;
 }
 
@@ -719,11 +753,11 @@ static void red_put_copy(SpiceCopy *red)
 #define red_get_blend_ptr red_get_copy_ptr
 #define red_put_blend red_put_copy
 
-static void red_get_transparent_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_transparent_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                     SpiceTransparent *red, QXLTransparent *qxl,
                                     uint32_t flags)
 {
-    red->src_bitmap      = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap      = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
    red->src_color       = qxl->src_color;
    red->true_color      = qxl->true_color;
@@ -734,22 +768,23 @@ static void red_put_transparent(SpiceTransparent *red)
     red_put_image(red->src_bitmap);
 }
 
-static void red_get_alpha_blend_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_alpha_blend_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                     SpiceAlphaBlend *red, QXLAlphaBlend *qxl,
                                     uint32_t flags)
 {
     red->alpha_flags = qxl->alpha_flags;
     red->alpha       = qxl->alpha;
-    red->src_bitmap  = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap  = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
     red_get_rect_ptr(&red->src_area, &qxl->src_area);
 }
 
 static void red_get_alpha_blend_ptr_compat(RedMemSlotInfo *slots, int group_id,
+                                           RedDrawableSlabs *slabs,
                                            SpiceAlphaBlend *red, QXLCompatAlphaBlend *qxl,
                                            uint32_t flags)
 {
     red->alpha       = qxl->alpha;
-    red->src_bitmap  = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+    red->src_bitmap  = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
     red_get_rect_ptr(&red->src_area, &qxl->src_area);
 }
 
@@ -777,17 +812,17 @@ static bool get_transform(RedMemSlotInfo *slots,
     return true;
 }
 
-static void red_get_composite_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_composite_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                   SpiceComposite *red, QXLComposite *qxl, uint32_t flags)
 {
     red->flags = qxl->flags;
 
-    red->src_bitmap = red_get_image(slots, group_id, qxl->src, flags, false);
+    red->src_bitmap = red_get_image(slots, group_id, slabs, qxl->src, flags, false);
     if (get_transform(slots, group_id, qxl->src_transform, &red->src_transform))
         red->flags |= SPICE_COMPOSITE_HAS_SRC_TRANSFORM;
 
     if (qxl->mask) {
-        red->mask_bitmap = red_get_image(slots, group_id, qxl->mask, flags, false);
+        red->mask_bitmap = red_get_image(slots, group_id, slabs, qxl->mask, flags, false);
         red->flags |= SPICE_COMPOSITE_HAS_MASK;
         if (get_transform(slots, group_id, qxl->mask_transform, &red->mask_transform))
             red->flags |= SPICE_COMPOSITE_HAS_MASK_TRANSFORM;
@@ -807,15 +842,15 @@ static void red_put_composite(SpiceComposite *red)
         red_put_image(red->mask_bitmap);
 }
 
-static void red_get_rop3_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_rop3_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                              SpiceRop3 *red, QXLRop3 *qxl, uint32_t flags)
 {
-   red->src_bitmap = red_get_image(slots, group_id, qxl->src_bitmap, flags, false);
+   red->src_bitmap = red_get_image(slots, group_id, slabs, qxl->src_bitmap, flags, false);
    red_get_rect_ptr(&red->src_area, &qxl->src_area);
-   red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+   red_get_brush_ptr(slots, group_id, slabs, &red->brush, &qxl->brush, flags);
    red->rop3       = qxl->rop3;
    red->scale_mode = qxl->scale_mode;
-   red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+   red_get_qmask_ptr(slots, group_id, slabs, &red->mask, &qxl->mask, flags);
 }
 
 static void red_put_rop3(SpiceRop3 *red)
@@ -825,7 +860,7 @@ static void red_put_rop3(SpiceRop3 *red)
     red_put_qmask(&red->mask);
 }
 
-static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id,
+static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                SpiceStroke *red, QXLStroke *qxl, uint32_t flags)
 {
     red->path = red_get_path(slots, group_id, qxl->path);
@@ -851,7 +886,7 @@ static bool red_get_stroke_ptr(RedMemSlotInfo *slots, int group_id,
         red->attr.style_nseg  = 0;
         red->attr.style       = NULL;
     }
-    red_get_brush_ptr(slots, group_id, &red->brush, &qxl->brush, flags);
+    red_get_brush_ptr(slots, group_id, slabs, &red->brush, &qxl->brush, flags);
     red->fore_mode        = qxl->fore_mode;
     red->back_mode        = qxl->back_mode;
     return true;
@@ -958,13 +993,13 @@ static SpiceString *red_get_string(RedMemSlotInfo *slots, int group_id,
     return red;
 }
 
-static void red_get_text_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_text_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                              SpiceText *red, QXLText *qxl, uint32_t flags)
 {
    red->str = red_get_string(slots, group_id, qxl->str);
    red_get_rect_ptr(&red->back_area, &qxl->back_area);
-   red_get_brush_ptr(slots, group_id, &red->fore_brush, &qxl->fore_brush, flags);
-   red_get_brush_ptr(slots, group_id, &red->back_brush, &qxl->back_brush, flags);
+   red_get_brush_ptr(slots, group_id, slabs, &red->fore_brush, &qxl->fore_brush, flags);
+   red_get_brush_ptr(slots, group_id, slabs, &red->back_brush, &qxl->back_brush, flags);
    red->fore_mode  = qxl->fore_mode;
    red->back_mode  = qxl->back_mode;
 }
@@ -976,10 +1011,10 @@ static void red_put_text_ptr(SpiceText *red)
     red_put_brush(&red->back_brush);
 }
 
-static void red_get_whiteness_ptr(RedMemSlotInfo *slots, int group_id,
+static void red_get_whiteness_ptr(RedMemSlotInfo *slots, int group_id, RedDrawableSlabs *slabs,
                                   SpiceWhiteness *red, QXLWhiteness *qxl, uint32_t flags)
 {
-    red_get_qmask_ptr(slots, group_id, &red->mask, &qxl->mask, flags);
+    red_get_qmask_ptr(slots, group_id, slabs, &red->mask, &qxl->mask, flags);
 }
 
 static void red_put_whiteness(SpiceWhiteness *red)
@@ -1013,6 +1048,7 @@ static void red_put_clip(SpiceClip *red)
 }
 
 static bool red_get_native_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *slots, int group_id,
+                                    RedDrawableSlabs *slabs,
                                     RedDrawable *red, QXLPHYSICAL addr, uint32_t flags)
 {
     QXLDrawable *qxl;
@@ -1042,48 +1078,48 @@ static bool red_get_native_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *s
     red->type = qxl->type;
     switch (red->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_get_alpha_blend_ptr(slots, group_id,
+        red_get_alpha_blend_ptr(slots, group_id, slabs,
                                 &red->u.alpha_blend, &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_get_blackness_ptr(slots, group_id,
+        red_get_blackness_ptr(slots, group_id, slabs,
                               &red->u.blackness, &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        return red_get_blend_ptr(slots, group_id, red, &qxl->u.blend, flags);
+        return red_get_blend_ptr(slots, group_id, slabs, red, &qxl->u.blend, flags);
     case QXL_DRAW_COPY:
-        return red_get_copy_ptr(slots, group_id, red, &qxl->u.copy, flags);
+        return red_get_copy_ptr(slots, group_id, slabs, red, &qxl->u.copy, flags);
     case QXL_COPY_BITS:
         red_get_point_ptr(&red->u.copy_bits.src_pos, &qxl->u.copy_bits.src_pos);
         break;
     case QXL_DRAW_FILL:
-        red_get_fill_ptr(slots, group_id, &red->u.fill, &qxl->u.fill, flags);
+        red_get_fill_ptr(slots, group_id, slabs, &red->u.fill, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_get_opaque_ptr(slots, group_id, &red->u.opaque, &qxl->u.opaque, flags);
+        red_get_opaque_ptr(slots, group_id, slabs, &red->u.opaque, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_get_invers_ptr(slots, group_id, &red->u.invers, &qxl->u.invers, flags);
+        red_get_invers_ptr(slots, group_id, slabs, &red->u.invers, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_get_rop3_ptr(slots, group_id, &red->u.rop3, &qxl->u.rop3, flags);
+        red_get_rop3_ptr(slots, group_id, slabs, &red->u.rop3, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_COMPOSITE:
-        red_get_composite_ptr(slots, group_id, &red->u.composite, &qxl->u.composite, flags);
+        red_get_composite_ptr(slots, group_id, slabs, &red->u.composite, &qxl->u.composite, flags);
         break;
     case QXL_DRAW_STROKE:
-        return red_get_stroke_ptr(slots, group_id, &red->u.stroke, &qxl->u.stroke, flags);
+        return red_get_stroke_ptr(slots, group_id, slabs, &red->u.stroke, &qxl->u.stroke, flags);
     case QXL_DRAW_TEXT:
-        red_get_text_ptr(slots, group_id, &red->u.text, &qxl->u.text, flags);
+        red_get_text_ptr(slots, group_id, slabs, &red->u.text, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_get_transparent_ptr(slots, group_id,
+        red_get_transparent_ptr(slots, group_id, slabs,
                                 &red->u.transparent, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_get_whiteness_ptr(slots, group_id,
+        red_get_whiteness_ptr(slots, group_id, slabs,
                               &red->u.whiteness, &qxl->u.whiteness, flags);
         break;
     default:
@@ -1094,6 +1130,7 @@ static bool red_get_native_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *s
 }
 
 static bool red_get_compat_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *slots, int group_id,
+                                    RedDrawableSlabs *slabs,
                                     RedDrawable *red, QXLPHYSICAL addr, uint32_t flags)
 {
     QXLCompatDrawable *qxl;
@@ -1121,17 +1158,17 @@ static bool red_get_compat_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *s
     red->type = qxl->type;
     switch (red->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_get_alpha_blend_ptr_compat(slots, group_id,
+        red_get_alpha_blend_ptr_compat(slots, group_id, slabs,
                                        &red->u.alpha_blend, &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_get_blackness_ptr(slots, group_id,
+        red_get_blackness_ptr(slots, group_id, slabs,
                               &red->u.blackness, &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        return red_get_blend_ptr(slots, group_id, red, &qxl->u.blend, flags);
+        return red_get_blend_ptr(slots, group_id, slabs, red, &qxl->u.blend, flags);
     case QXL_DRAW_COPY:
-        return red_get_copy_ptr(slots, group_id, red, &qxl->u.copy, flags);
+        return red_get_copy_ptr(slots, group_id, slabs, red, &qxl->u.copy, flags);
     case QXL_COPY_BITS:
         red_get_point_ptr(&red->u.copy_bits.src_pos, &qxl->u.copy_bits.src_pos);
         red->surface_deps[0] = 0;
@@ -1143,30 +1180,30 @@ static bool red_get_compat_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *s
             (red->bbox.bottom - red->bbox.top);
         break;
     case QXL_DRAW_FILL:
-        red_get_fill_ptr(slots, group_id, &red->u.fill, &qxl->u.fill, flags);
+        red_get_fill_ptr(slots, group_id, slabs, &red->u.fill, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_get_opaque_ptr(slots, group_id, &red->u.opaque, &qxl->u.opaque, flags);
+        red_get_opaque_ptr(slots, group_id, slabs, &red->u.opaque, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_get_invers_ptr(slots, group_id, &red->u.invers, &qxl->u.invers, flags);
+        red_get_invers_ptr(slots, group_id, slabs, &red->u.invers, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_get_rop3_ptr(slots, group_id, &red->u.rop3, &qxl->u.rop3, flags);
+        red_get_rop3_ptr(slots, group_id, slabs, &red->u.rop3, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_STROKE:
-        return red_get_stroke_ptr(slots, group_id, &red->u.stroke, &qxl->u.stroke, flags);
+        return red_get_stroke_ptr(slots, group_id, slabs, &red->u.stroke, &qxl->u.stroke, flags);
     case QXL_DRAW_TEXT:
-        red_get_text_ptr(slots, group_id, &red->u.text, &qxl->u.text, flags);
+        red_get_text_ptr(slots, group_id, slabs, &red->u.text, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_get_transparent_ptr(slots, group_id,
+        red_get_transparent_ptr(slots, group_id, slabs,
                                 &red->u.transparent, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_get_whiteness_ptr(slots, group_id,
+        red_get_whiteness_ptr(slots, group_id, slabs,
                               &red->u.whiteness, &qxl->u.whiteness, flags);
         break;
     default:
@@ -1177,14 +1214,15 @@ static bool red_get_compat_drawable(QXLInstance *qxl_instance, RedMemSlotInfo *s
 }
 
 static bool red_get_drawable(QXLInstance *qxl, RedMemSlotInfo *slots, int group_id,
+                             RedDrawableSlabs *slabs,
                              RedDrawable *red, QXLPHYSICAL addr, uint32_t flags)
 {
     bool ret;
 
     if (flags & QXL_COMMAND_FLAG_COMPAT) {
-        ret = red_get_compat_drawable(qxl, slots, group_id, red, addr, flags);
+        ret = red_get_compat_drawable(qxl, slots, group_id, slabs, red, addr, flags);
     } else {
-        ret = red_get_native_drawable(qxl, slots, group_id, red, addr, flags);
+        ret = red_get_native_drawable(qxl, slots, group_id, slabs, red, addr, flags);
     }
     return ret;
 }
@@ -1241,15 +1279,34 @@ static void red_put_drawable(RedDrawable *red)
     }
 }
 
+void red_drawable_slabs_init(RedDrawableSlabs *slabs)
+{
+    slabs->drawables = red_slab_new(sizeof(RedDrawable), RED_DRAWABLES_PER_BLOCK);
+    slabs->images = red_slab_new(RED_IMAGE_ALLOC_SIZE, RED_IMAGES_PER_BLOCK);
+}
+
+void red_drawable_slabs_destroy(RedDrawableSlabs *slabs)
+{
+    red_slab_destroy(slabs->drawables);
+    slabs->drawables = NULL;
+    red_slab_destroy(slabs->images);
+    slabs->images = NULL;
+}
+
+SpiceImage *red_drawable_image_new(RedDrawableSlabs *slabs)
+{
+    return (SpiceImage *) red_slab_alloc0(slabs->images);
+}
+
 RedDrawable *red_drawable_new(QXLInstance *qxl, RedMemSlotInfo *slots,
-                              int group_id, QXLPHYSICAL addr,
-                              uint32_t flags)
+                              int group_id, RedDrawableSlabs *slabs,
+                              QXLPHYSICAL addr, uint32_t flags)
 {
-    RedDrawable *red = g_new0(RedDrawable, 1);
+    RedDrawable *red = (RedDrawable *) red_slab_alloc0(slabs->drawables);
 
     red->refs = 1;
 
-    if (!red_get_drawable(qxl, slots, group_id, red, addr, flags)) {
+    if (!red_get_drawable(qxl, slots, group_id, slabs, red, addr, flags)) {
        red_drawable_unref(red);
        return NULL;
     }
@@ -1257,6 +1314,14 @@ RedDrawable *red_drawable_new(QXLInstance *qxl, RedMemSlotInfo *slots,
     return red;
 }
 
+RedDrawable *red_drawable_new_local(RedDrawableSlabs *slabs)
+{
+    RedDrawable *red = (RedDrawable *) red_slab_alloc0(slabs->drawables);
+
+    red->refs = 1;
+    return red;
+}
+
 RedDrawable *red_drawable_ref(RedDrawable *drawable)
 {
     drawable->refs++;
@@ -1269,7 +1334,156 @@ void red_drawable_unref(RedDrawable *red_drawable)
         return;
     }
     red_put_drawable(red_drawable);
-    g_free(red_drawable);
+    red_slab_free(red_drawable);
+}
+
+static int add_surface_image(uint32_t *surface_ids, int n, const SpiceImage *image)
+{
+    if (image != NULL && image->descriptor.type == SPICE_IMAGE_TYPE_SURFACE) {
+        surface_ids[n++] = image->u.surface.surface_id;
+    }
+    return n;
+}
+
+static int add_surface_brush(uint32_t *surface_ids, int n, const SpiceBrush *brush)
+{
+    if (brush->type == SPICE_BRUSH_TYPE_PATTERN) {
+        n = add_surface_image(surface_ids, n, brush->u.pattern.pat);
+    }
+    return n;
+}
+
+int red_drawable_get_image_surfaces(const RedDrawable *drawable,
+                                    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES])
+{
+    int n = 0;
+
+    /* the images used by red_drawable_draw for each type */
+    switch (drawable->type) {
+    case QXL_DRAW_FILL:
+        n = add_surface_brush(surface_ids, n, &drawable->u.fill.brush);
+        n = add_surface_image(surface_ids, n, drawable->u.fill.mask.bitmap);
+        break;
+    case QXL_DRAW_OPAQUE:
+        n = add_surface_brush(surface_ids, n, &drawable->u.opaque.brush);
+        n = add_surface_image(surface_ids, n, drawable->u.opaque.src_bitmap);
+        n = add_surface_image(surface_ids, n, drawable->u.opaque.mask.bitmap);
+        break;
+    case QXL_DRAW_COPY:
+        n = add_surface_image(surface_ids, n, drawable->u.copy.src_bitmap);
+        n = add_surface_image(surface_ids, n, drawable->u.copy.mask.bitmap);
+        break;
+    case QXL_DRAW_TRANSPARENT:
+        n = add_surface_image(surface_ids, n, drawable->u.transparent.src_bitmap);
+        break;
+    case QXL_DRAW_ALPHA_BLEND:
+        n = add_surface_image(surface_ids, n, drawable->u.alpha_blend.src_bitmap);
+        break;
+    case QXL_DRAW_BLEND:
+        n = add_surface_image(surface_ids, n, drawable->u.blend.src_bitmap);
+        n = add_surface_image(surface_ids, n, drawable->u.blend.mask.bitmap);
+        break;
+    case QXL_DRAW_BLACKNESS:
+        n = add_surface_image(surface_ids, n, drawable->u.blackness.mask.bitmap);
+        break;
+    case QXL_DRAW_WHITENESS:
+        n = add_surface_image(surface_ids, n, drawable->u.whiteness.mask.bitmap);
+        break;
+    case QXL_DRAW_INVERS:
+        n = add_surface_image(surface_ids, n, drawable->u.invers.mask.bitmap);
+        break;
+    case QXL_DRAW_ROP3:
+        n = add_surface_brush(surface_ids, n, &drawable->u.rop3.brush);
+        n = add_surface_image(surface_ids, n, drawable->u.rop3.src_bitmap);
+        n = add_surface_image(surface_ids, n, drawable->u.rop3.mask.bitmap);
+        break;
+    case QXL_DRAW_COMPOSITE:
+        n = add_surface_image(surface_ids, n, drawable->u.composite.src_bitmap);
+        n = add_surface_image(surface_ids, n, drawable->u.composite.mask_bitmap);
+        break;
+    case QXL_DRAW_STROKE:
+        n = add_surface_brush(surface_ids, n, &drawable->u.stroke.brush);
+        break;
+    case QXL_DRAW_TEXT:
+        n = add_surface_brush(surface_ids, n, &drawable->u.text.fore_brush);
+        n = add_surface_brush(surface_ids, n, &drawable->u.text.back_brush);
+        break;
+    }
+    return n;
+}
+
+bool red_drawable_reads_surface(const RedDrawable *drawable, uint32_t surface_id)
+{
+    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES];
+    int i, n;
+
+    if (drawable->surface_id == surface_id &&
+        (drawable->self_bitmap || drawable->type == QXL_COPY_BITS)) {
+        return true;
+    }
+    for (i = 0; i < 3; i++) {
+        if (drawable->surface_deps[i] == (int32_t) surface_id) {
+            return true;
+        }
+    }
+    n = red_drawable_get_image_surfaces(drawable, surface_ids);
+    for (i = 0; i < n; i++) {
+        if (surface_ids[i] == surface_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool red_rect_contains(const SpiceRect *outer, const SpiceRect *inner)
+{
+    return outer->left <= inner->left && outer->top <= inner->top &&
+           outer->right >= inner->right && outer->bottom >= inner->bottom;
+}
+
+bool red_drawable_occludes(const RedDrawable *later, const RedDrawable *drawable)
+{
+    const SpiceQMask *mask;
+
+    if (later->surface_id != drawable->surface_id ||
+        later->effect != QXL_EFFECT_OPAQUE ||
+        red_drawable_reads_surface(later, later->surface_id)) {
+        return false;
+    }
+
+    /* only the drawables usually covering whole areas, without a mask
+     * which would make them transparent */
+    switch (later->type) {
+    case QXL_DRAW_FILL:
+        mask = &later->u.fill.mask;
+        break;
+    case QXL_DRAW_OPAQUE:
+        mask = &later->u.opaque.mask;
+        break;
+    case QXL_DRAW_COPY:
+        mask = &later->u.copy.mask;
+        break;
+    default:
+        return false;
+    }
+    if (mask->bitmap != NULL) {
+        return false;
+    }
+
+    if (!red_rect_contains(&later->bbox, &drawable->bbox)) {
+        return false;
+    }
+    if (later->clip.type == SPICE_CLIP_TYPE_RECTS) {
+        uint32_t i;
+
+        for (i = 0; i < later->clip.rects->num_rects; i++) {
+            if (red_rect_contains(&later->clip.rects->rects[i], &drawable->bbox)) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return true;
 }
 
 static bool red_get_update_cmd(QXLInstance *qxl_instance, RedMemSlotInfo *slots, int group_id,
@@ -23,6 +23,7 @@
 
 #include "red-common.h"
 #include "memslot.h"
+#include "red-slab.h"
 
 SPICE_BEGIN_DECLS
 
@@ -117,13 +118,42 @@ typedef struct RedCursorCmd {
     } u;
 } RedCursorCmd;
 
+/* Allocators of a worker for the RedDrawables and the structures parsed
+ * with them, see red-slab.h */
+typedef struct RedDrawableSlabs {
+    RedSlab *drawables;
+    RedSlab *images;
+} RedDrawableSlabs;
+
+void red_drawable_slabs_init(RedDrawableSlabs *slabs);
+void red_drawable_slabs_destroy(RedDrawableSlabs *slabs);
+/* allocates a zeroed image which can be referenced by a RedDrawable,
+ * it is released with the RedDrawable */
+SpiceImage *red_drawable_image_new(RedDrawableSlabs *slabs);
+
 void red_get_rect_ptr(SpiceRect *red, const QXLRect *qxl);
 
 RedDrawable *red_drawable_new(QXLInstance *qxl, RedMemSlotInfo *slots,
-                              int group_id, QXLPHYSICAL addr,
-                              uint32_t flags);
+                              int group_id, RedDrawableSlabs *slabs,
+                              QXLPHYSICAL addr, uint32_t flags);
+/* allocates a zeroed drawable made by the server, there is no guest
+ * resource to release with it */
+RedDrawable *red_drawable_new_local(RedDrawableSlabs *slabs);
 RedDrawable *red_drawable_ref(RedDrawable *drawable);
 void red_drawable_unref(RedDrawable *red_drawable);
+#define RED_DRAWABLE_MAX_IMAGES 3
+/* fills @surface_ids with the surfaces read through the images of
+ * @drawable and returns their number. Unlike the surface_deps announced
+ * by the guest these are the surfaces the canvas reads when drawing; the
+ * ids are not validated */
+int red_drawable_get_image_surfaces(const RedDrawable *drawable,
+                                    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES]);
+/* whether @drawable reads @surface_id, either another area of its own
+ * surface or a surface used as source */
+bool red_drawable_reads_surface(const RedDrawable *drawable, uint32_t surface_id);
+/* whether @later, drawn after @drawable, overwrites all of it; @drawable
+ * can then be dropped if no drawable in between reads its surface */
+bool red_drawable_occludes(const RedDrawable *later, const RedDrawable *drawable);
 
 RedUpdateCmd *red_update_cmd_new(QXLInstance *qxl, RedMemSlotInfo *slots,
                                  int group_id, QXLPHYSICAL addr);
@@ -45,6 +45,167 @@ void red_pipe_item_init_full(RedPipeItem *item,
     item->type = type;
     item->refcount = 1;
     item->free_func = free_func ? free_func : (red_pipe_item_free_t *)g_free;
+    item->link.next = NULL;
+    item->link.prev = NULL;
+    item->link.item = item;
+    item->link.pipe = NULL;
+    item->num_links = 0;
+}
+
+void red_pipe_init(RedPipe *pipe)
+{
+    pipe->head = NULL;
+    pipe->tail = NULL;
+    pipe->length = 0;
+    pipe->free_links = NULL;
+}
+
+void red_pipe_destroy(RedPipe *pipe)
+{
+    RedPipeLink *link;
+
+    spice_assert(red_pipe_is_empty(pipe));
+    while ((link = pipe->free_links) != NULL) {
+        pipe->free_links = link->next;
+        g_free(link);
+    }
+}
+
+static RedPipeLink *red_pipe_link_get(RedPipe *pipe, RedPipeItem *item)
+{
+    RedPipeLink *link;
+
+    if (!item->link.pipe) {
+        link = &item->link;
+    } else if ((link = pipe->free_links) != NULL) {
+        pipe->free_links = link->next;
+    } else {
+        link = g_new(RedPipeLink, 1);
+    }
+    link->item = item;
+    link->pipe = pipe;
+    item->num_links++;
+    pipe->length++;
+    return link;
+}
+
+RedPipeLink *red_pipe_push_head(RedPipe *pipe, RedPipeItem *item)
+{
+    RedPipeLink *link = red_pipe_link_get(pipe, item);
+
+    link->prev = NULL;
+    link->next = pipe->head;
+    if (pipe->head) {
+        pipe->head->prev = link;
+    } else {
+        pipe->tail = link;
+    }
+    pipe->head = link;
+    return link;
+}
+
+RedPipeLink *red_pipe_push_tail(RedPipe *pipe, RedPipeItem *item)
+{
+    RedPipeLink *link = red_pipe_link_get(pipe, item);
+
+    link->next = NULL;
+    link->prev = pipe->tail;
+    if (pipe->tail) {
+        pipe->tail->next = link;
+    } else {
+        pipe->head = link;
+    }
+    pipe->tail = link;
+    return link;
+}
+
+RedPipeLink *red_pipe_insert_after(RedPipe *pipe, RedPipeLink *pos, RedPipeItem *item)
+{
+    RedPipeLink *link;
+
+    spice_assert(pos->pipe == pipe);
+    if (pos == pipe->tail) {
+        return red_pipe_push_tail(pipe, item);
+    }
+    link = red_pipe_link_get(pipe, item);
+    link->prev = pos;
+    link->next = pos->next;
+    pos->next->prev = link;
+    pos->next = link;
+    return link;
+}
+
+RedPipeLink *red_pipe_insert_before(RedPipe *pipe, RedPipeLink *pos, RedPipeItem *item)
+{
+    RedPipeLink *link;
+
+    spice_assert(pos->pipe == pipe);
+    if (pos == pipe->head) {
+        return red_pipe_push_head(pipe, item);
+    }
+    link = red_pipe_link_get(pipe, item);
+    link->next = pos;
+    link->prev = pos->prev;
+    pos->prev->next = link;
+    pos->prev = link;
+    return link;
+}
+
+RedPipeItem *red_pipe_remove_link(RedPipe *pipe, RedPipeLink *link)
+{
+    RedPipeItem *item = link->item;
+
+    spice_assert(link->pipe == pipe);
+    if (link->prev) {
+        link->prev->next = link->next;
+    } else {
+        pipe->head = link->next;
+    }
+    if (link->next) {
+        link->next->prev = link->prev;
+    } else {
+        pipe->tail = link->prev;
+    }
+    pipe->length--;
+    item->num_links--;
+
+    link->pipe = NULL;
+    link->prev = NULL;
+    if (link == &item->link) {
+        link->next = NULL;
+    } else {
+        link->next = pipe->free_links;
+        pipe->free_links = link;
+    }
+    return item;
+}
+
+RedPipeItem *red_pipe_pop_head(RedPipe *pipe)
+{
+    return pipe->head ? red_pipe_remove_link(pipe, pipe->head) : NULL;
+}
+
+RedPipeItem *red_pipe_pop_tail(RedPipe *pipe)
+{
+    return pipe->tail ? red_pipe_remove_link(pipe, pipe->tail) : NULL;
+}
+
+RedPipeLink *red_pipe_find(RedPipe *pipe, RedPipeItem *item)
+{
+    RedPipeLink *link;
+
+    if (item->link.pipe == pipe) {
+        return &item->link;
+    }
+    if (item->num_links == 0 || (item->num_links == 1 && item->link.pipe)) {
+        return NULL;
+    }
+    for (link = pipe->head; link != NULL; link = link->next) {
+        if (link->item == item) {
+            return link;
+        }
+    }
+    return NULL;
 }
 
 void marshaller_unref_pipe_item(uint8_t *data G_GNUC_UNUSED, void *opaque)
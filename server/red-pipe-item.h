@@ -21,13 +21,26 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <stdbool.h>
 
 SPICE_BEGIN_DECLS
 
 typedef struct RedPipeItem RedPipeItem;
+typedef struct RedPipeLink RedPipeLink;
+typedef struct RedPipe RedPipe;
 
 typedef void red_pipe_item_free_t(RedPipeItem *item);
 
+/* Position of an item in a RedPipe.
+ * next goes toward the tail (older items), prev toward the head. */
+struct RedPipeLink {
+    RedPipeLink *next;
+    RedPipeLink *prev;
+    RedPipeItem *item;
+    /* pipe containing the link, NULL if not linked */
+    RedPipe *pipe;
+};
+
 struct RedPipeItem {
     int type;
 
@@ -35,6 +48,23 @@ struct RedPipeItem {
     int refcount;
 
     red_pipe_item_free_t *free_func;
+
+    /* Link used by the first pipe the item is added to, so queuing an item
+     * does not allocate. Items queued to more pipes at the same time
+     * (broadcast items) use links owned by the pipes. */
+    RedPipeLink link;
+    /* number of pipes the item is linked in */
+    unsigned int num_links;
+};
+
+/* Intrusive doubly-linked list of pipe items. Items are added to the head
+ * and sent from the tail. */
+struct RedPipe {
+    RedPipeLink *head;
+    RedPipeLink *tail;
+    uint32_t length;
+    /* unused links for items already linked in another pipe */
+    RedPipeLink *free_links;
 };
 
 void red_pipe_item_init_full(RedPipeItem *item, int type, red_pipe_item_free_t free_func);
@@ -46,6 +76,28 @@ static inline void red_pipe_item_init(RedPipeItem *item, int type)
     red_pipe_item_init_full(item, type, NULL);
 }
 
+void red_pipe_init(RedPipe *pipe);
+/* the pipe must be empty */
+void red_pipe_destroy(RedPipe *pipe);
+RedPipeLink *red_pipe_push_head(RedPipe *pipe, RedPipeItem *item);
+RedPipeLink *red_pipe_push_tail(RedPipe *pipe, RedPipeItem *item);
+/* insert item on the tail side of pos */
+RedPipeLink *red_pipe_insert_after(RedPipe *pipe, RedPipeLink *pos, RedPipeItem *item);
+/* insert item on the head side of pos */
+RedPipeLink *red_pipe_insert_before(RedPipe *pipe, RedPipeLink *pos, RedPipeItem *item);
+/* remove the link from the pipe, returns the item */
+RedPipeItem *red_pipe_remove_link(RedPipe *pipe, RedPipeLink *link);
+RedPipeItem *red_pipe_pop_head(RedPipe *pipe);
+RedPipeItem *red_pipe_pop_tail(RedPipe *pipe);
+/* returns the link of item in pipe or NULL if item is not in pipe.
+ * This is O(1) unless item is also linked in another pipe */
+RedPipeLink *red_pipe_find(RedPipe *pipe, RedPipeItem *item);
+
+static inline bool red_pipe_is_empty(const RedPipe *pipe)
+{
+    return pipe->head == NULL;
+}
+
 /* a convenience function for unreffing a pipe item after it has been sent */
 void marshaller_unref_pipe_item(uint8_t *data, void *opaque);
 
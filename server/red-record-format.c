@@ -0,0 +1,584 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "red-record-format.h"
+
+#define RECORD_PADDING(size) (-(size) & (RECORD_VALUE_SIZE - 1))
+
+typedef enum {
+    LENGTH_NONE,
+    LENGTH_HH,
+    LENGTH_H,
+    LENGTH_L,
+    LENGTH_LL,
+    LENGTH_J,
+    LENGTH_Z,
+    LENGTH_T,
+} ConversionLength;
+
+/* a conversion of a printf or scanf format */
+typedef struct Conversion {
+    bool star;
+    ConversionLength length;
+    char type;
+} Conversion;
+
+/* Returns the rest of @format after its next conversion, NULL if there is
+ * none */
+static const char *next_conversion(const char *format, Conversion *conv)
+{
+    for (; *format; format++) {
+        if (*format != '%') {
+            continue;
+        }
+        format++;
+        if (*format == '%') {
+            continue;
+        }
+        conv->star = false;
+        conv->length = LENGTH_NONE;
+        for (; *format && strchr("-+ #'0123456789.*", *format); format++) {
+            conv->star |= *format == '*';
+        }
+        switch (*format) {
+        case 'h':
+            conv->length = format[1] == 'h' ? LENGTH_HH : LENGTH_H;
+            format += conv->length == LENGTH_HH ? 2 : 1;
+            break;
+        case 'l':
+            conv->length = format[1] == 'l' ? LENGTH_LL : LENGTH_L;
+            format += conv->length == LENGTH_LL ? 2 : 1;
+            break;
+        case 'L':
+        case 'q':
+            conv->length = LENGTH_LL;
+            format++;
+            break;
+        case 'j':
+            conv->length = LENGTH_J;
+            format++;
+            break;
+        case 'z':
+            conv->length = LENGTH_Z;
+            format++;
+            break;
+        case 't':
+            conv->length = LENGTH_T;
+            format++;
+            break;
+        }
+        conv->type = *format;
+        return *format ? format + 1 : NULL;
+    }
+    return NULL;
+}
+
+static void append_value(GByteArray *buffer, uint64_t value)
+{
+    uint64_t le = GUINT64_TO_LE(value);
+
+    g_byte_array_append(buffer, (const guint8 *) &le, sizeof(le));
+}
+
+static void writer_write(RecordWriter *writer, const void *data, size_t size)
+{
+    if (size > 0 && fwrite(data, size, 1, writer->file) != 1) {
+        writer->error = true;
+    }
+    writer->offset += size;
+}
+
+void record_writer_init(RecordWriter *writer, FILE *file)
+{
+    char header[RECORD_FILE_HEADER_SIZE] = { 0 };
+
+    memset(writer, 0, sizeof(*writer));
+    writer->file = file;
+    writer->payload = g_byte_array_new();
+    writer->events = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+    snprintf(header, sizeof(header), "SPICE_REPLAY %u\n", RECORD_BINARY_VERSION);
+    writer_write(writer, header, sizeof(header));
+}
+
+bool record_writer_finish(RecordWriter *writer)
+{
+    uint64_t index_offset, trailer[2];
+    guint i;
+    bool ok;
+
+    record_writer_end_event(writer);
+    index_offset = writer->offset;
+    record_writer_begin_event(writer, writer->events->len, RECORD_EVENT_INDEX, 0, 0);
+    for (i = 0; i < writer->events->len; i++) {
+        record_writer_add_value(writer, g_array_index(writer->events, uint64_t, i));
+    }
+    record_writer_end_event(writer);
+    trailer[0] = GUINT64_TO_LE(index_offset);
+    trailer[1] = GUINT64_TO_LE(RECORD_INDEX_MAGIC);
+    writer_write(writer, trailer, sizeof(trailer));
+    if (fflush(writer->file) != 0) {
+        writer->error = true;
+    }
+
+    ok = !writer->error;
+    g_byte_array_free(writer->payload, TRUE);
+    g_array_free(writer->events, TRUE);
+    writer->payload = NULL;
+    writer->events = NULL;
+    return ok;
+}
+
+void record_writer_begin_event(RecordWriter *writer, uint32_t counter, int32_t what,
+                               uint32_t type, uint64_t timestamp)
+{
+    record_writer_end_event(writer);
+    writer->event.size = 0;
+    writer->event.counter = counter;
+    writer->event.what = what;
+    writer->event.type = type;
+    writer->event.timestamp = timestamp;
+    writer->in_event = true;
+    g_byte_array_set_size(writer->payload, 0);
+}
+
+void record_writer_end_event(RecordWriter *writer)
+{
+    uint64_t header[5];
+
+    if (!writer->in_event) {
+        return;
+    }
+    header[0] = GUINT64_TO_LE((uint64_t) writer->payload->len);
+    header[1] = GUINT64_TO_LE((uint64_t) writer->event.counter);
+    header[2] = GUINT64_TO_LE((uint64_t) (int64_t) writer->event.what);
+    header[3] = GUINT64_TO_LE((uint64_t) writer->event.type);
+    header[4] = GUINT64_TO_LE(writer->event.timestamp);
+    g_array_append_val(writer->events, writer->offset);
+    writer_write(writer, header, sizeof(header));
+    writer_write(writer, writer->payload->data, writer->payload->len);
+    writer->in_event = false;
+}
+
+void record_writer_drop_event(RecordWriter *writer)
+{
+    writer->in_event = false;
+}
+
+void record_writer_add_value(RecordWriter *writer, uint64_t value)
+{
+    append_value(writer->payload, value);
+}
+
+void record_writer_add_values_v(RecordWriter *writer, const char *format, va_list args)
+{
+    Conversion conv;
+
+    while ((format = next_conversion(format, &conv)) != NULL) {
+        uint64_t value;
+
+        if (conv.star) {
+            (void) va_arg(args, int);
+        }
+        switch (conv.type) {
+        case 'd':
+        case 'i':
+            switch (conv.length) {
+            case LENGTH_HH:
+                value = (int64_t) (signed char) va_arg(args, int);
+                break;
+            case LENGTH_H:
+                value = (int64_t) (short) va_arg(args, int);
+                break;
+            case LENGTH_L:
+                value = (int64_t) va_arg(args, long);
+                break;
+            case LENGTH_LL:
+                value = (int64_t) va_arg(args, long long);
+                break;
+            case LENGTH_J:
+                value = (int64_t) va_arg(args, intmax_t);
+                break;
+            case LENGTH_Z:
+                value = (int64_t) va_arg(args, gssize);
+                break;
+            case LENGTH_T:
+                value = (int64_t) va_arg(args, ptrdiff_t);
+                break;
+            default:
+                value = (int64_t) va_arg(args, int);
+                break;
+            }
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            switch (conv.length) {
+            case LENGTH_HH:
+                value = (unsigned char) va_arg(args, unsigned int);
+                break;
+            case LENGTH_H:
+                value = (unsigned short) va_arg(args, unsigned int);
+                break;
+            case LENGTH_L:
+                value = va_arg(args, unsigned long);
+                break;
+            case LENGTH_LL:
+                value = va_arg(args, unsigned long long);
+                break;
+            case LENGTH_J:
+                value = va_arg(args, uintmax_t);
+                break;
+            case LENGTH_Z:
+                value = va_arg(args, size_t);
+                break;
+            case LENGTH_T:
+                value = (uint64_t) va_arg(args, ptrdiff_t);
+                break;
+            default:
+                value = va_arg(args, unsigned int);
+                break;
+            }
+            break;
+        case 's':
+            /* the prefixes of the fields are only labels */
+            (void) va_arg(args, const char *);
+            continue;
+        case 'c':
+            (void) va_arg(args, int);
+            continue;
+        default:
+            g_warning("unsupported conversion %%%c in a recording", conv.type);
+            return;
+        }
+        append_value(writer->payload, value);
+    }
+}
+
+void record_writer_add_data(RecordWriter *writer, const uint8_t *data, size_t size)
+{
+    static const uint8_t zeros[RECORD_DATA_HEADROOM];
+
+    append_value(writer->payload, size);
+    g_byte_array_append(writer->payload, zeros, RECORD_DATA_HEADROOM);
+    if (size > 0) {
+        g_byte_array_append(writer->payload, data, size);
+    }
+    g_byte_array_append(writer->payload, zeros, RECORD_PADDING(size));
+}
+
+bool record_read_value(const uint8_t **pos, const uint8_t *end, uint64_t *value)
+{
+    uint64_t le;
+
+    if (end - *pos < RECORD_VALUE_SIZE) {
+        return false;
+    }
+    memcpy(&le, *pos, sizeof(le));
+    *value = GUINT64_FROM_LE(le);
+    *pos += RECORD_VALUE_SIZE;
+    return true;
+}
+
+bool record_read_values_v(const uint8_t **pos, const uint8_t *end,
+                          const char *format, va_list args)
+{
+    Conversion conv;
+
+    while ((format = next_conversion(format, &conv)) != NULL) {
+        uint64_t value = 0;
+
+        if (conv.type == 'n') {
+            /* nothing is parsed */
+            if (!conv.star) {
+                *va_arg(args, int *) = 0;
+            }
+            continue;
+        }
+        if (!strchr("diuoxX", conv.type) || !record_read_value(pos, end, &value)) {
+            return false;
+        }
+        if (conv.star) {
+            continue;
+        }
+        switch (conv.length) {
+        case LENGTH_HH:
+            *va_arg(args, unsigned char *) = value;
+            break;
+        case LENGTH_H:
+            *va_arg(args, unsigned short *) = value;
+            break;
+        case LENGTH_L:
+            *va_arg(args, unsigned long *) = value;
+            break;
+        case LENGTH_LL:
+            *va_arg(args, unsigned long long *) = value;
+            break;
+        case LENGTH_J:
+            *va_arg(args, uintmax_t *) = value;
+            break;
+        case LENGTH_Z:
+            *va_arg(args, size_t *) = value;
+            break;
+        case LENGTH_T:
+            *va_arg(args, ptrdiff_t *) = value;
+            break;
+        default:
+            *va_arg(args, unsigned int *) = value;
+            break;
+        }
+    }
+    return true;
+}
+
+bool record_read_data(const uint8_t **pos, const uint8_t *end,
+                      const uint8_t **data, size_t *size)
+{
+    const uint8_t *p = *pos;
+    uint64_t value;
+
+    if (!record_read_value(&p, end, &value) || end - p < RECORD_DATA_HEADROOM) {
+        return false;
+    }
+    p += RECORD_DATA_HEADROOM;
+    if (value > (uint64_t) (end - p) ||
+        value + RECORD_PADDING(value) > (uint64_t) (end - p)) {
+        return false;
+    }
+    *data = p;
+    *size = value;
+    *pos = p + value + RECORD_PADDING(value);
+    return true;
+}
+
+bool record_read_event_header(const uint8_t **pos, const uint8_t *end, RecordEvent *event)
+{
+    uint64_t values[5];
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(values); i++) {
+        if (!record_read_value(pos, end, &values[i])) {
+            return false;
+        }
+    }
+    event->size = values[0];
+    event->counter = values[1];
+    event->what = (int32_t) values[2];
+    event->type = values[3];
+    event->timestamp = values[4];
+    return true;
+}
+
+static GArray *load_index(const uint8_t *recording, size_t size)
+{
+    const uint8_t *pos, *end = recording + size;
+    uint64_t index_offset, magic, next = RECORD_FILE_HEADER_SIZE;
+    RecordEvent event;
+    GArray *events;
+
+    if (size < RECORD_FILE_HEADER_SIZE + RECORD_EVENT_HEADER_SIZE + 2 * RECORD_VALUE_SIZE) {
+        return NULL;
+    }
+    pos = end - 2 * RECORD_VALUE_SIZE;
+    record_read_value(&pos, end, &index_offset);
+    record_read_value(&pos, end, &magic);
+    end -= 2 * RECORD_VALUE_SIZE;
+    if (magic != RECORD_INDEX_MAGIC || index_offset < RECORD_FILE_HEADER_SIZE ||
+        index_offset > (uint64_t) (end - recording) - RECORD_EVENT_HEADER_SIZE) {
+        return NULL;
+    }
+    pos = recording + index_offset;
+    if (!record_read_event_header(&pos, end, &event) || event.what != RECORD_EVENT_INDEX ||
+        event.size != (uint64_t) (end - pos) || event.size % RECORD_VALUE_SIZE != 0) {
+        return NULL;
+    }
+
+    events = g_array_sized_new(FALSE, FALSE, sizeof(uint64_t), event.size / RECORD_VALUE_SIZE);
+    while (pos < end) {
+        uint64_t offset;
+
+        record_read_value(&pos, end, &offset);
+        /* in order, each one leaving room for its header */
+        if (offset < next || offset > index_offset ||
+            index_offset - offset < RECORD_EVENT_HEADER_SIZE) {
+            g_array_free(events, TRUE);
+            return NULL;
+        }
+        next = offset + RECORD_EVENT_HEADER_SIZE;
+        g_array_append_val(events, offset);
+    }
+    return events;
+}
+
+static GArray *scan_events(const uint8_t *recording, size_t size)
+{
+    GArray *events = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+    const uint8_t *pos, *end = recording + size;
+    RecordEvent event;
+
+    if (size < RECORD_FILE_HEADER_SIZE) {
+        return events;
+    }
+    pos = recording + RECORD_FILE_HEADER_SIZE;
+    for (;;) {
+        uint64_t offset = pos - recording;
+
+        /* a recording not closed can end with an incomplete event */
+        if (!record_read_event_header(&pos, end, &event) ||
+            event.what == RECORD_EVENT_INDEX || event.size > (uint64_t) (end - pos)) {
+            break;
+        }
+        g_array_append_val(events, offset);
+        pos += event.size;
+    }
+    return events;
+}
+
+GArray *record_get_events(const uint8_t *recording, size_t size)
+{
+    GArray *events = load_index(recording, size);
+
+    return events ? events : scan_events(recording, size);
+}
+
+/* Reads a line of a text recording, or the start of a line of data up to
+ * the ':' before the data */
+static bool read_text_line(FILE *in, GString *line)
+{
+    int c;
+
+    g_string_truncate(line, 0);
+    while ((c = getc(in)) != EOF) {
+        if (c == '\n') {
+            return true;
+        }
+        g_string_append_c(line, c);
+        if (c == ':' && g_str_has_prefix(line->str, "binary ")) {
+            return true;
+        }
+    }
+    return line->len > 0;
+}
+
+static bool parse_value(const char *token, uint64_t *value)
+{
+    char *end;
+
+    if (!g_ascii_isdigit(token[token[0] == '-'])) {
+        return false;
+    }
+    if (token[0] == '-') {
+        *value = g_ascii_strtoll(token, &end, 10);
+    } else {
+        *value = g_ascii_strtoull(token, &end, 10);
+    }
+    return *end == '\0';
+}
+
+static bool convert_values(RecordWriter *writer, char *line)
+{
+    while (*line) {
+        char *token = line;
+        uint64_t value;
+
+        while (*line && *line != ' ') {
+            line++;
+        }
+        if (*line) {
+            *line++ = '\0';
+        }
+        /* anything else is a label */
+        if (parse_value(token, &value)) {
+            if (!writer->in_event) {
+                return false;
+            }
+            record_writer_add_value(writer, value);
+        }
+    }
+    return true;
+}
+
+bool record_convert_text(FILE *in, FILE *out)
+{
+    RecordWriter writer;
+    GString *line;
+    uint8_t *data = NULL;
+    size_t data_alloc = 0;
+    unsigned int version, num_lines = 1;
+    bool ok = true;
+
+    if (fscanf(in, "SPICE_REPLAY %u\n", &version) != 1 || version != 1) {
+        g_warning("not a text recording");
+        return false;
+    }
+
+    record_writer_init(&writer, out);
+    line = g_string_new(NULL);
+    while (ok && read_text_line(in, line)) {
+        unsigned int counter, type;
+        int what, with_zlib;
+        uint64_t timestamp, size;
+
+        num_lines++;
+        if (g_str_has_prefix(line->str, "event ")) {
+            if (sscanf(line->str, "event %u %d %u %" SCNu64,
+                       &counter, &what, &type, &timestamp) != 4) {
+                ok = false;
+                break;
+            }
+            record_writer_begin_event(&writer, counter, what, type, timestamp);
+        } else if (g_str_has_prefix(line->str, "binary ")) {
+            if (sscanf(line->str, "binary %d %*s %" SCNu64 ":", &with_zlib, &size) != 2 ||
+                !writer.in_event || size > G_MAXUINT32) {
+                ok = false;
+                break;
+            }
+            if (with_zlib) {
+                g_warning("compressed data are not supported");
+                ok = false;
+                break;
+            }
+            if (size > data_alloc) {
+                data_alloc = size;
+                data = g_realloc(data, data_alloc);
+            }
+            if ((size > 0 && fread(data, size, 1, in) != 1) || getc(in) != '\n') {
+                /* the recording was interrupted, like the replay ignore
+                 * the last event */
+                g_warning("truncated recording at line %u", num_lines);
+                record_writer_drop_event(&writer);
+                break;
+            }
+            record_writer_add_data(&writer, data, size);
+        } else if (!convert_values(&writer, line->str)) {
+            ok = false;
+        }
+    }
+    if (!ok) {
+        g_warning("invalid recording at line %u", num_lines);
+    }
+
+    g_free(data);
+    g_string_free(line, TRUE);
+    return record_writer_finish(&writer) && ok;
+}
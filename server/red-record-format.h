@@ -0,0 +1,115 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RED_RECORD_FORMAT_H_
+#define RED_RECORD_FORMAT_H_
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <glib.h>
+#include <spice/macros.h>
+
+SPICE_BEGIN_DECLS
+
+/* Binary format of the recordings of the QXL commands.
+ *
+ * The text format of the recordings (version 1) is a sequence of labelled
+ * decimal values and of blocks of data, read back with scanf. The binary
+ * format (version 2) has the same values in the same order, each stored as
+ * a 64 bits little endian integer without its label, so that a replay can
+ * map the file and walk the commands without parsing any text:
+ *
+ * - the "SPICE_REPLAY 2\n" line, padded to RECORD_FILE_HEADER_SIZE bytes
+ * - the events, each one made of 5 values (the size of its payload, its
+ *   counter, what, type and timestamp) followed by its payload
+ * - in the payloads, the blocks of data are stored as their size followed by
+ *   RECORD_DATA_HEADROOM unused bytes, where the replay builds the QXL
+ *   structures around the data in place, and the data padded to
+ *   RECORD_VALUE_SIZE bytes
+ * - when the recording is closed, a RECORD_EVENT_INDEX event with the
+ *   offsets of all the events, then the offset of that index and
+ *   RECORD_INDEX_MAGIC. A recording which was not closed has no index, its
+ *   events can still be found from their sizes.
+ */
+#define RECORD_BINARY_VERSION 2
+#define RECORD_FILE_HEADER_SIZE 16
+#define RECORD_VALUE_SIZE 8
+#define RECORD_EVENT_HEADER_SIZE (5 * RECORD_VALUE_SIZE)
+#define RECORD_DATA_HEADROOM 64
+#define RECORD_EVENT_INDEX 2
+/* "SPICEIDX" */
+#define RECORD_INDEX_MAGIC UINT64_C(0x5844494543495053)
+
+typedef struct RecordEvent {
+    uint64_t size;
+    uint32_t counter;
+    int32_t what;
+    uint32_t type;
+    uint64_t timestamp;
+} RecordEvent;
+
+typedef struct RecordWriter {
+    FILE *file;
+    uint64_t offset;
+    bool error;
+    bool in_event;
+    RecordEvent event;
+    /* payload of the current event, written once complete */
+    GByteArray *payload;
+    /* offsets of the events written, for the index */
+    GArray *events;
+} RecordWriter;
+
+/* Writes the header of a binary recording to @file */
+void record_writer_init(RecordWriter *writer, FILE *file);
+/* Writes the index, @file is left open. Returns false if any write failed */
+bool record_writer_finish(RecordWriter *writer);
+/* Starts a new event, ending the current one */
+void record_writer_begin_event(RecordWriter *writer, uint32_t counter, int32_t what,
+                               uint32_t type, uint64_t timestamp);
+void record_writer_end_event(RecordWriter *writer);
+/* Forgets the current event */
+void record_writer_drop_event(RecordWriter *writer);
+void record_writer_add_value(RecordWriter *writer, uint64_t value);
+/* Adds the values of the numeric conversions of a printf @format, the text
+ * and the strings are dropped */
+void record_writer_add_values_v(RecordWriter *writer, const char *format, va_list args);
+void record_writer_add_data(RecordWriter *writer, const uint8_t *data, size_t size);
+
+/* The readers advance @pos, they return false without reading past @end */
+bool record_read_value(const uint8_t **pos, const uint8_t *end, uint64_t *value);
+/* Reads the values of the numeric conversions of a scanf @format */
+bool record_read_values_v(const uint8_t **pos, const uint8_t *end,
+                          const char *format, va_list args);
+/* @data points into the buffer, after RECORD_DATA_HEADROOM free bytes */
+bool record_read_data(const uint8_t **pos, const uint8_t *end,
+                      const uint8_t **data, size_t *size);
+bool record_read_event_header(const uint8_t **pos, const uint8_t *end, RecordEvent *event);
+
+/* Returns the offsets of the events of a binary recording loaded in memory,
+ * from its index if it has a valid one */
+GArray *record_get_events(const uint8_t *recording, size_t size);
+
+/* Converts a text recording to the binary format */
+bool record_convert_text(FILE *in, FILE *out);
+
+SPICE_END_DECLS
+
+#endif /* RED_RECORD_FORMAT_H_ */
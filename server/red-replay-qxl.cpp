@@ -28,6 +28,7 @@
 #include "red-common.h"
 #include "memslot.h"
 #include "red-parse-qxl.h"
+#include "red-record-format.h"
 
 #define QXLPHYSICAL_FROM_PTR(ptr) ((QXLPHYSICAL)(uintptr_t)(ptr))
 #define QXLPHYSICAL_TO_PTR(phy) ((void*)(uintptr_t)(phy))
@@ -54,6 +55,19 @@ struct SpiceReplay {
 
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+
+    /* binary recordings: mapped when possible, the data are then used in
+     * place, otherwise read event by event */
+    bool binary;
+    GMappedFile *mapped;
+    const uint8_t *map;
+    size_t map_size;
+    GArray *events;
+    guint next_event;
+    GByteArray *event_buf;
+    /* the payload of the current event */
+    const uint8_t *pos;
+    const uint8_t *end;
 };
 
 static ssize_t replay_fread(SpiceReplay *replay, uint8_t *buf, size_t size)
@@ -81,6 +95,14 @@ static replay_t replay_fscanf_check(SpiceReplay *replay, const char *fmt, ...)
     if (replay->error) {
         return REPLAY_ERROR;
     }
+    if (replay->binary) {
+        va_start(ap, fmt);
+        if (!record_read_values_v(&replay->pos, replay->end, fmt, ap)) {
+            replay->error = TRUE;
+        }
+        va_end(ap);
+        return replay->error ? REPLAY_ERROR : REPLAY_OK;
+    }
     if (feof(replay->fd)) {
         replay->error = TRUE;
         return REPLAY_ERROR;
@@ -116,6 +138,16 @@ static inline void replay_free(SpiceReplay *replay, void *mem)
     g_free(mem);
 }
 
+/* the data of the mapped recordings are not allocated */
+static void replay_free_data(SpiceReplay *replay, void *data)
+{
+    if (replay->map && (const uint8_t*) data >= replay->map &&
+        (const uint8_t*) data < replay->map + replay->map_size) {
+        return;
+    }
+    g_free(data);
+}
+
 static inline void *replay_realloc(SpiceReplay *replay, void *mem, size_t n_bytes)
 {
     GList *elem = g_list_find(replay->allocated, mem);
@@ -220,6 +252,31 @@ static void hexdump(uint8_t *hex, uint8_t bytes)
 }
 #endif
 
+static replay_t read_binary_record(SpiceReplay *replay, size_t *size, uint8_t **buf,
+                                   size_t base_size)
+{
+    const uint8_t *data;
+
+    if (replay->error) {
+        return REPLAY_ERROR;
+    }
+    if (!record_read_data(&replay->pos, replay->end, &data, size)) {
+        replay->error = TRUE;
+        return REPLAY_ERROR;
+    }
+    /* the structures embedding the data are built in the free space
+     * before them, the mapping is private */
+    if (*buf == NULL && replay->map && base_size <= RECORD_DATA_HEADROOM) {
+        *buf = (uint8_t*) data - base_size;
+        return REPLAY_OK;
+    }
+    if (*buf == NULL) {
+        *buf = (uint8_t*) replay_malloc(replay, *size + base_size);
+    }
+    memcpy(*buf + base_size, data, *size);
+    return REPLAY_OK;
+}
+
 static replay_t read_binary(SpiceReplay *replay, const char *prefix, size_t *size, uint8_t
                             **buf, size_t base_size)
 {
@@ -229,6 +286,10 @@ static replay_t read_binary(SpiceReplay *replay, const char *prefix, size_t *siz
     uint8_t *zlib_buffer;
     z_stream strm;
 
+    if (replay->binary) {
+        return read_binary_record(replay, size, buf, base_size);
+    }
+
     snprintf(pattern, sizeof(pattern), "binary %%d %s %%" PRIdPTR ":%%n", prefix);
     replay_fscanf_check(replay, pattern, &with_zlib, size, &replay->end_pos);
     if (replay->error) {
@@ -340,11 +401,11 @@ static void red_replay_data_chunks_free(SpiceReplay *replay, void *data, size_t
     cur = (QXLDataChunk*) QXLPHYSICAL_TO_PTR(cur->next_chunk);
     while (cur) {
         QXLDataChunk *next = (QXLDataChunk*) QXLPHYSICAL_TO_PTR(cur->next_chunk);
-        g_free(cur);
+        replay_free_data(replay, cur);
         cur = next;
     }
 
-    g_free(data);
+    replay_free_data(replay, data);
 }
 
 static void red_replay_point_ptr(SpiceReplay *replay, QXLPoint *qxl)
@@ -527,7 +588,7 @@ static void red_replay_image_free(SpiceReplay *replay, QXLPHYSICAL p, uint32_t f
     case SPICE_IMAGE_TYPE_BITMAP:
         g_free(QXLPHYSICAL_TO_PTR(qxl->bitmap.palette));
         if (qxl->bitmap.flags & QXL_BITMAP_DIRECT) {
-            g_free(QXLPHYSICAL_TO_PTR(qxl->bitmap.data));
+            replay_free_data(replay, QXLPHYSICAL_TO_PTR(qxl->bitmap.data));
         } else {
             red_replay_data_chunks_free(replay, QXLPHYSICAL_TO_PTR(qxl->bitmap.data), 0);
         }
@@ -738,7 +799,7 @@ static void red_replay_stroke_free(SpiceReplay *replay, QXLStroke *qxl, uint32_t
 {
     red_replay_path_free(replay, qxl->path);
     if (qxl->attr.flags & SPICE_LINE_FLAGS_STYLED) {
-        g_free(QXLPHYSICAL_TO_PTR(qxl->attr.style));
+        replay_free_data(replay, QXLPHYSICAL_TO_PTR(qxl->attr.style));
     }
     red_replay_brush_free(replay, &qxl->brush, flags);
 }
@@ -876,9 +937,9 @@ static void red_replay_composite_ptr(SpiceReplay *replay, QXLComposite *qxl, uin
 static void red_replay_composite_free(SpiceReplay *replay, QXLComposite *qxl, uint32_t flags)
 {
     red_replay_image_free(replay, qxl->src, flags);
-    g_free(QXLPHYSICAL_TO_PTR(qxl->src_transform));
+    replay_free_data(replay, QXLPHYSICAL_TO_PTR(qxl->src_transform));
     red_replay_image_free(replay, qxl->mask, flags);
-    g_free(QXLPHYSICAL_TO_PTR(qxl->mask_transform));
+    replay_free_data(replay, QXLPHYSICAL_TO_PTR(qxl->mask_transform));
 
 }
 
@@ -1175,7 +1236,7 @@ static void red_replay_surface_cmd_free(SpiceReplay *replay, QXLSurfaceCmd *qxl)
         replay_id_free(replay, qxl->surface_id);
     }
 
-    g_free(QXLPHYSICAL_TO_PTR(qxl->u.surface_create.data));
+    replay_free_data(replay, QXLPHYSICAL_TO_PTR(qxl->u.surface_create.data));
     g_free(qxl);
 }
 
@@ -1273,7 +1334,7 @@ static void replay_handle_create_primary(QXLInstance *instance, SpiceReplay *rep
     }
     read_binary(replay, "data", &size, &mem, 0);
     surface.group_id = 0;
-    g_free(replay->primary_mem);
+    replay_free_data(replay, replay->primary_mem);
     replay->allocated = g_list_remove(replay->allocated, mem);
     replay->primary_mem = mem;
     surface.mem = QXLPHYSICAL_FROM_PTR(mem);
@@ -1291,7 +1352,7 @@ static void replay_handle_dev_input(QXLInstance *instance, SpiceReplay *replay,
     case RED_WORKER_MESSAGE_DESTROY_PRIMARY_SURFACE:
         replay->created_primary = FALSE;
         spice_qxl_destroy_primary_surface(instance, 0);
-        g_free(replay->primary_mem);
+        replay_free_data(replay, replay->primary_mem);
         replay->primary_mem = NULL;
         break;
     case RED_WORKER_MESSAGE_DESTROY_SURFACES:
@@ -1308,6 +1369,65 @@ static void replay_handle_dev_input(QXLInstance *instance, SpiceReplay *replay,
     }
 }
 
+/* Moves to the payload of the next event of a binary recording */
+static replay_t replay_next_record(SpiceReplay *replay, RecordEvent *event)
+{
+    const uint8_t *pos, *end;
+
+    if (replay->error) {
+        return REPLAY_ERROR;
+    }
+    if (replay->map) {
+        if (replay->next_event >= replay->events->len) {
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+        pos = replay->map + g_array_index(replay->events, uint64_t, replay->next_event++);
+        end = replay->map + replay->map_size;
+        if (!record_read_event_header(&pos, end, event) || event->size > (uint64_t) (end - pos)) {
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+    } else {
+        uint8_t header[RECORD_EVENT_HEADER_SIZE];
+
+        pos = header;
+        if (replay_fread(replay, header, sizeof(header)) != sizeof(header) ||
+            !record_read_event_header(&pos, header + sizeof(header), event) ||
+            event->what == RECORD_EVENT_INDEX || event->size > G_MAXUINT32) {
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+        g_byte_array_set_size(replay->event_buf, event->size);
+        if (replay_fread(replay, replay->event_buf->data, event->size) != event->size) {
+            return REPLAY_ERROR;
+        }
+        pos = replay->event_buf->data;
+    }
+    replay->pos = pos;
+    replay->end = pos + event->size;
+    return REPLAY_OK;
+}
+
+static replay_t replay_next_event(SpiceReplay *replay, int *counter, int *what, int *type,
+                                  uint64_t *timestamp)
+{
+    RecordEvent event;
+
+    if (!replay->binary) {
+        return replay_fscanf(replay, "event %d %d %d %" SCNu64 "\n", counter,
+                             what, type, timestamp);
+    }
+    if (replay_next_record(replay, &event) == REPLAY_ERROR) {
+        return REPLAY_ERROR;
+    }
+    *counter = event.counter;
+    *what = event.what;
+    *type = event.type;
+    *timestamp = event.timestamp;
+    return REPLAY_OK;
+}
+
 /*
  * NOTE: This reads from a saved file and performs all io actions, calling the
  * dispatcher, until it sees a command, at which point it returns it.
@@ -1324,8 +1444,7 @@ SPICE_GNUC_VISIBLE QXLCommandExt* spice_replay_next_cmd(SpiceReplay *replay,
     int counter;
 
     while (what != 0) {
-        replay_fscanf(replay, "event %d %d %d %" SCNu64 "\n", &counter,
-                            &what, &type, &timestamp);
+        replay_next_event(replay, &counter, &what, &type, &timestamp);
         if (replay->error) {
             goto error;
         }
@@ -1426,6 +1545,31 @@ SPICE_GNUC_VISIBLE void spice_replay_free_cmd(SpiceReplay *replay, QXLCommandExt
     g_free(cmd);
 }
 
+static void replay_open_binary(SpiceReplay *replay)
+{
+    char header[RECORD_FILE_HEADER_SIZE];
+    int header_len;
+
+    replay->binary = true;
+    replay->mapped = g_mapped_file_new_from_fd(fileno(replay->fd), TRUE, NULL);
+    if (replay->mapped &&
+        g_mapped_file_get_length(replay->mapped) >= RECORD_FILE_HEADER_SIZE) {
+        replay->map = (const uint8_t*) g_mapped_file_get_contents(replay->mapped);
+        replay->map_size = g_mapped_file_get_length(replay->mapped);
+        replay->events = record_get_events(replay->map, replay->map_size);
+        return;
+    }
+    if (replay->mapped) {
+        g_mapped_file_unref(replay->mapped);
+        replay->mapped = NULL;
+    }
+
+    /* a pipe, skip the padding after the version */
+    replay->event_buf = g_byte_array_new();
+    header_len = snprintf(header, sizeof(header), "SPICE_REPLAY %u\n", RECORD_BINARY_VERSION);
+    replay_fread(replay, (uint8_t*) header, sizeof(header) - header_len);
+}
+
 /* caller is incharge of closing the replay when done and releasing the SpiceReplay
  * memory */
 SPICE_GNUC_VISIBLE
@@ -1437,7 +1581,7 @@ SpiceReplay *spice_replay_new(FILE *file, int nsurfaces)
     spice_return_val_if_fail(file != NULL, NULL);
 
     if (fscanf(file, "SPICE_REPLAY %u\n", &version) == 1) {
-        if (version != 1) {
+        if (version != 1 && version != RECORD_BINARY_VERSION) {
             spice_warning("Replay file version unsupported");
             return NULL;
         }
@@ -1459,6 +1603,10 @@ SpiceReplay *spice_replay_new(FILE *file, int nsurfaces)
     replay->nsurfaces = nsurfaces;
     replay->allocated = NULL;
 
+    if (version == RECORD_BINARY_VERSION) {
+        replay_open_binary(replay);
+    }
+
     /* reserve id 0 */
     replay_id_new(replay, 0);
 
@@ -1475,7 +1623,16 @@ SPICE_GNUC_VISIBLE void spice_replay_free(SpiceReplay *replay)
     g_array_free(replay->id_map, TRUE);
     g_array_free(replay->id_map_inv, TRUE);
     g_array_free(replay->id_free, TRUE);
-    g_free(replay->primary_mem);
+    replay_free_data(replay, replay->primary_mem);
+    if (replay->events) {
+        g_array_free(replay->events, TRUE);
+    }
+    if (replay->event_buf) {
+        g_byte_array_free(replay->event_buf, TRUE);
+    }
+    if (replay->mapped) {
+        g_mapped_file_unref(replay->mapped);
+    }
     fclose(replay->fd);
     g_free(replay);
 }
@@ -0,0 +1,179 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+#include <common/log.h>
+
+#include "red-slab.h"
+
+/* precedes every object, keeps the objects aligned to 16 bytes */
+typedef union RedSlabHeader RedSlabHeader;
+union RedSlabHeader {
+    /* while the object is allocated */
+    RedSlab *slab;
+    /* while the object is in the free list */
+    RedSlabHeader *next_free;
+    uint64_t align[2];
+};
+
+typedef union RedSlabBlock RedSlabBlock;
+union RedSlabBlock {
+    RedSlabBlock *next;
+    uint64_t align[2];
+};
+
+struct RedSlab {
+    size_t object_size;
+    size_t stride;
+    unsigned int objects_per_block;
+    RedSlabHeader *free_list;
+    RedSlabBlock *blocks;
+    bool destroyed;
+    RedSlabStats stats;
+
+    RedStatNode stat;
+    RedStatCounter allocs_counter;
+    RedStatCounter frees_counter;
+    RedStatCounter heap_allocs_counter;
+};
+
+RedSlab *red_slab_new(size_t object_size, unsigned int objects_per_block)
+{
+    RedSlab *slab;
+
+    g_return_val_if_fail(object_size > 0 && objects_per_block > 0, NULL);
+
+    slab = g_new0(RedSlab, 1);
+    slab->object_size = object_size;
+    slab->stride = sizeof(RedSlabHeader) +
+                   ((object_size + sizeof(RedSlabHeader) - 1) & ~(sizeof(RedSlabHeader) - 1));
+    slab->objects_per_block = objects_per_block;
+    return slab;
+}
+
+static void red_slab_release(RedSlab *slab)
+{
+    while (slab->blocks) {
+        RedSlabBlock *block = slab->blocks;
+        slab->blocks = block->next;
+        g_free(block);
+    }
+    g_free(slab);
+}
+
+void red_slab_destroy(RedSlab *slab)
+{
+    if (!slab) {
+        return;
+    }
+    spice_assert(!slab->destroyed);
+    slab->destroyed = true;
+    if (slab->stats.in_use == 0) {
+        red_slab_release(slab);
+    }
+}
+
+void red_slab_init_stat(RedSlab *slab, SpiceServer *reds,
+                        const RedStatNode *parent, const char *name)
+{
+    stat_init_node(&slab->stat, reds, parent, name, TRUE);
+    stat_init_counter(&slab->allocs_counter, reds, &slab->stat, "allocs", TRUE);
+    stat_init_counter(&slab->frees_counter, reds, &slab->stat, "frees", TRUE);
+    stat_init_counter(&slab->heap_allocs_counter, reds, &slab->stat, "heap_allocs", TRUE);
+}
+
+void red_slab_get_stats(const RedSlab *slab, RedSlabStats *stats)
+{
+    *stats = slab->stats;
+}
+
+static void red_slab_grow(RedSlab *slab)
+{
+    RedSlabBlock *block;
+    uint8_t *objects;
+    unsigned int i;
+
+    block = (RedSlabBlock *) g_malloc(sizeof(RedSlabBlock) +
+                                      slab->stride * slab->objects_per_block);
+    block->next = slab->blocks;
+    slab->blocks = block;
+
+    /* chain the objects so that they are allocated in address order */
+    objects = (uint8_t *) (block + 1);
+    for (i = slab->objects_per_block; i > 0; i--) {
+        RedSlabHeader *header = (RedSlabHeader *) (objects + (i - 1) * slab->stride);
+        header->next_free = slab->free_list;
+        slab->free_list = header;
+    }
+
+    slab->stats.capacity += slab->objects_per_block;
+    slab->stats.heap_allocs++;
+    stat_inc_counter(slab->heap_allocs_counter, 1);
+}
+
+void *red_slab_alloc(RedSlab *slab)
+{
+    RedSlabHeader *header;
+
+    spice_assert(!slab->destroyed);
+    if (G_UNLIKELY(slab->free_list == NULL)) {
+        red_slab_grow(slab);
+    }
+    header = slab->free_list;
+    slab->free_list = header->next_free;
+    header->slab = slab;
+
+    slab->stats.allocs++;
+    slab->stats.in_use++;
+    stat_inc_counter(slab->allocs_counter, 1);
+    return header + 1;
+}
+
+void *red_slab_alloc0(RedSlab *slab)
+{
+    void *obj = red_slab_alloc(slab);
+
+    memset(obj, 0, slab->object_size);
+    return obj;
+}
+
+void red_slab_free(void *obj)
+{
+    RedSlabHeader *header;
+    RedSlab *slab;
+
+    if (!obj) {
+        return;
+    }
+    header = ((RedSlabHeader *) obj) - 1;
+    slab = header->slab;
+
+    header->next_free = slab->free_list;
+    slab->free_list = header;
+
+    slab->stats.frees++;
+    slab->stats.in_use--;
+    stat_inc_counter(slab->frees_counter, 1);
+
+    if (G_UNLIKELY(slab->destroyed) && slab->stats.in_use == 0) {
+        red_slab_release(slab);
+    }
+}
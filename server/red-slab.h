@@ -0,0 +1,63 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef RED_SLAB_H_
+#define RED_SLAB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stat.h"
+
+SPICE_BEGIN_DECLS
+
+/* Allocator of objects of a fixed size, used for the objects allocated for
+ * every command processed by a worker. Objects are taken from blocks of
+ * memory which are kept until the slab is destroyed, so once the number of
+ * objects in use is stable no more heap allocation is done.
+ *
+ * A slab is not thread safe, the objects must be allocated and freed by
+ * the thread owning the slab. Objects can outlive red_slab_destroy(),
+ * the memory is released when the last object is freed.
+ */
+typedef struct RedSlab RedSlab;
+
+typedef struct RedSlabStats {
+    uint64_t allocs;
+    uint64_t frees;
+    /* number of blocks allocated from the heap */
+    uint64_t heap_allocs;
+    uint32_t in_use;
+    uint32_t capacity;
+} RedSlabStats;
+
+RedSlab *red_slab_new(size_t object_size, unsigned int objects_per_block);
+void red_slab_destroy(RedSlab *slab);
+/* add the allocs, frees and heap_allocs counters of the slab in a @name node */
+void red_slab_init_stat(RedSlab *slab, SpiceServer *reds,
+                        const RedStatNode *parent, const char *name);
+void red_slab_get_stats(const RedSlab *slab, RedSlabStats *stats);
+
+void *red_slab_alloc(RedSlab *slab);
+void *red_slab_alloc0(RedSlab *slab);
+/* @obj must have been allocated by red_slab_alloc() */
+void red_slab_free(void *obj);
+
+SPICE_END_DECLS
+
+#endif /* RED_SLAB_H_ */
@@ -89,6 +89,7 @@ StreamDevice::partial_read()
             hdr.type = GUINT16_FROM_LE(hdr.type);
             hdr.size = GUINT32_FROM_LE(hdr.size);
             msg_pos = 0;
+            frame_copied = false;
         }
     }
 
@@ -322,6 +323,10 @@ StreamDevice::handle_msg_data()
     spice_extra_assert(hdr_pos >= sizeof(StreamDevHeader));
     spice_extra_assert(hdr.type == STREAM_TYPE_DATA);
 
+    if (can_read_segments() && !frame_copied) {
+        return handle_msg_data_segments();
+    }
+
     /* make sure we have a large enough buffer for the whole frame */
     /* ---
      * TODO: Now that we copy partial data into the buffer, for each frame
@@ -357,6 +362,66 @@ StreamDevice::handle_msg_data()
     return true;
 }
 
+/* as handle_msg_data, the frame is kept in the device till it is sent if
+ * the device can buffer all of it */
+bool
+StreamDevice::handle_msg_data_segments()
+{
+    if (msg_pos == 0) {
+        frame_mmtime = reds_get_mm_time();
+        record(stream_device_data, "Stream data packet size %u mm_time %u",
+               hdr.size, frame_mmtime);
+    }
+
+    /* a read returns a limited number of segments, read till the device
+     * has no more data */
+    do {
+        bool full;
+        RedCharDeviceRead *read = read_segments(hdr.size - msg_pos, &full);
+        if (!read) {
+            /* the device has no room for the rest of the frame while the
+             * data read is held, copy it so the device can go on */
+            if (full) {
+                copy_frame_reads();
+                return handle_msg_data();
+            }
+            return msg_pos == hdr.size;
+        }
+        g_ptr_array_add(frame_reads, read);
+        msg_pos += read->size;
+    } while (msg_pos != hdr.size);
+
+    /* The whole frame was read from the device, send it */
+    stream_channel->send_data(frame_reads, hdr.size, frame_mmtime);
+    frame_reads = g_ptr_array_new_with_free_func((GDestroyNotify) RedCharDevice::read_release);
+
+    return true;
+}
+
+/* copies the part of the frame read in place to msg and releases it, the
+ * rest of the frame is read by handle_msg_data */
+void
+StreamDevice::copy_frame_reads()
+{
+    uint32_t pos = 0;
+
+    if (msg_len < hdr.size) {
+        g_free(msg);
+        msg = (StreamDevice::AllMessages*) g_malloc(hdr.size);
+        msg_len = hdr.size;
+    }
+    for (guint i = 0; i < frame_reads->len; ++i) {
+        auto read = (RedCharDeviceRead *) g_ptr_array_index(frame_reads, i);
+        for (int n = 0; n < read->num_segments; ++n) {
+            memcpy(msg->buf + pos, read->segments[n].data, read->segments[n].len);
+            pos += read->segments[n].len;
+        }
+    }
+    spice_assert(pos == msg_pos);
+    g_ptr_array_set_size(frame_reads, 0);
+    frame_copied = true;
+}
+
 /*
  * Returns number of bits required for a pixel of a given cursor type.
  *
@@ -567,6 +632,7 @@ StreamDevice::StreamDevice(RedsState *reds, SpiceCharDeviceInstance *sin):
 {
     msg = (StreamDevice::AllMessages*) g_malloc(sizeof(*msg));
     msg_len = sizeof(*msg);
+    frame_reads = g_ptr_array_new_with_free_func((GDestroyNotify) RedCharDevice::read_release);
 }
 
 StreamDevice::~StreamDevice()
@@ -583,6 +649,7 @@ StreamDevice::~StreamDevice()
     }
 
     g_free(msg);
+    g_ptr_array_unref(frame_reads);
 }
 
 void
@@ -661,6 +728,8 @@ StreamDevice::port_event(uint8_t event)
     }
     hdr_pos = 0;
     msg_pos = 0;
+    g_ptr_array_set_size(frame_reads, 0);
+    frame_copied = false;
     has_error = false;
     flow_stopped = false;
     reset();
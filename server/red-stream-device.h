@@ -87,6 +87,10 @@ private:
     red::shared_ptr<CursorChannel> cursor_channel;
     SpiceTimer *close_timer;
     uint32_t frame_mmtime;
+    /* data of the current frame read in place, see RedCharDevice::read_segments */
+    GPtrArray *frame_reads;
+    /* the current frame is copied in msg, the device could not hold it */
+    bool frame_copied;
     StreamDeviceDisplayInfo device_display_info;
 
 private:
@@ -101,6 +105,8 @@ private:
     bool handle_msg_cursor_move() SPICE_GNUC_WARN_UNUSED_RESULT;
     bool handle_msg_cursor_set() SPICE_GNUC_WARN_UNUSED_RESULT;
     bool handle_msg_data() SPICE_GNUC_WARN_UNUSED_RESULT;
+    bool handle_msg_data_segments() SPICE_GNUC_WARN_UNUSED_RESULT;
+    void copy_frame_reads();
     bool handle_msg_device_display_info() SPICE_GNUC_WARN_UNUSED_RESULT;
     void reset_channels();
     static void close_timer_func(StreamDevice *dev);
@@ -22,7 +22,11 @@
 #include <fcntl.h>
 #ifndef _WIN32
 #include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <netinet/tcp.h>
 #else
 #include <ws2tcpip.h>
@@ -46,6 +50,11 @@
 #define TCP_CORK TCP_NOPUSH
 #endif
 
+// kernel TLS, available starting with OpenSSL 3.0
+#if defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && !defined(_WIN32)
+#define USE_KTLS 1
+#endif
+
 struct AsyncRead {
     void *opaque;
     uint8_t *now;
@@ -78,8 +87,14 @@ typedef struct RedSASL {
 } RedSASL;
 #endif
 
+typedef struct RedStreamWriter RedStreamWriter;
+
 struct RedStreamPrivate {
     SSL *ssl;
+    /* the kernel encrypts the data written to the socket */
+    bool ktls_send;
+    /* thread encrypting and sending the data, see red_stream_enable_write_offload() */
+    RedStreamWriter *writer;
 
 #if HAVE_SASL
     RedSASL sasl;
@@ -184,10 +199,245 @@ static ssize_t stream_ssl_error(RedStream *s, int return_code)
     return -1;
 }
 
+#ifndef _WIN32
+#define RED_STREAM_WRITER_CHUNK_SIZE (64 * 1024)
+/* above this amount of data waiting to be sent, the writes wait for the
+ * writer thread to catch up, or fail with EAGAIN if it waits for the socket */
+#define RED_STREAM_WRITER_MAX_QUEUED (2 * 1024 * 1024)
+/* how long a closing stream waits for the data still queued to be sent */
+#define RED_STREAM_WRITER_DRAIN_TIMEOUT_SEC 2
+
+typedef struct RedStreamWriterChunk {
+    size_t size;
+    size_t capacity;
+    uint8_t data[];
+} RedStreamWriterChunk;
+
+struct RedStreamWriter {
+    pthread_t thread;
+    /* protects the fields below */
+    pthread_mutex_t lock;
+    /* signaled when chunks are queued or sent, and on state changes */
+    pthread_cond_t cond;
+    GQueue chunks;
+    size_t queued;
+    /* the writer thread waits for the socket to be ready */
+    bool blocked;
+    bool flush;
+    int quit;
+    /* errno value returned to the next writes once sending failed */
+    int error;
+
+    /* OpenSSL calls on the same connection can't be done concurrently, this
+     * serializes the SSL_write() calls of the writer thread with the
+     * SSL_read() calls of the thread of the channel */
+    pthread_mutex_t ssl_lock;
+
+    int64_t rate_start;
+    uint64_t rate_bytes;
+
+    RedStatCounter queued_bytes_counter;
+    RedStatCounter written_bytes_counter;
+    RedStatCounter bytes_per_sec_counter;
+    RedStatCounter queue_full_counter;
+    RedStatCounter socket_blocked_counter;
+};
+
+static ssize_t red_stream_writer_queue(RedStreamWriter *writer, const void *buf, size_t size)
+{
+    RedStreamWriterChunk *chunk;
+
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->error && writer->queued &&
+           writer->queued + size > RED_STREAM_WRITER_MAX_QUEUED) {
+        if (writer->blocked) {
+            /* the socket is full, the channel waits for it to be writable */
+            stat_inc_counter(writer->socket_blocked_counter, 1);
+            pthread_mutex_unlock(&writer->lock);
+            errno = EAGAIN;
+            return -1;
+        }
+        stat_inc_counter(writer->queue_full_counter, 1);
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    }
+    if (writer->error) {
+        errno = writer->error;
+        pthread_mutex_unlock(&writer->lock);
+        return -1;
+    }
+
+    /* the chunks in the queue are not being sent, the tail one can be filled */
+    chunk = (RedStreamWriterChunk *) g_queue_peek_tail(&writer->chunks);
+    if (!chunk || chunk->capacity - chunk->size < size) {
+        size_t capacity = MAX(size, RED_STREAM_WRITER_CHUNK_SIZE);
+
+        chunk = (RedStreamWriterChunk *) g_malloc(sizeof(RedStreamWriterChunk) + capacity);
+        chunk->size = 0;
+        chunk->capacity = capacity;
+        g_queue_push_tail(&writer->chunks, chunk);
+    }
+    memcpy(chunk->data + chunk->size, buf, size);
+    chunk->size += size;
+    writer->queued += size;
+    stat_set_counter(writer->queued_bytes_counter, writer->queued);
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+
+    return size;
+}
+
+static void red_stream_writer_set_blocked(RedStreamWriter *writer, bool blocked)
+{
+    pthread_mutex_lock(&writer->lock);
+    writer->blocked = blocked;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+static void red_stream_writer_account(RedStreamWriter *writer, size_t size)
+{
+    int64_t now = g_get_monotonic_time();
+
+    stat_inc_counter(writer->written_bytes_counter, size);
+    writer->rate_bytes += size;
+    if (now - writer->rate_start >= G_USEC_PER_SEC) {
+        stat_set_counter(writer->bytes_per_sec_counter,
+                         writer->rate_bytes * G_USEC_PER_SEC / (now - writer->rate_start));
+        writer->rate_start = now;
+        writer->rate_bytes = 0;
+    }
+}
+
+/* returns 0 once @chunk is sent, an errno value otherwise */
+static int red_stream_writer_send(RedStream *s, RedStreamWriterChunk *chunk)
+{
+    RedStreamWriter *writer = s->priv->writer;
+    size_t pos = 0;
+
+    while (pos < chunk->size) {
+        struct pollfd pollfd = { s->socket, 0, 0 };
+        int ssl_error = SSL_ERROR_NONE;
+        int n;
+
+        pthread_mutex_lock(&writer->ssl_lock);
+        n = SSL_write(s->priv->ssl, chunk->data + pos, chunk->size - pos);
+        if (n <= 0) {
+            ssl_error = SSL_get_error(s->priv->ssl, n);
+        }
+        pthread_mutex_unlock(&writer->ssl_lock);
+
+        if (n > 0) {
+            pos += n;
+            red_stream_writer_account(writer, n);
+            continue;
+        }
+        /* a renegotiation needs data from the peer: the socket is likely
+         * writable, waiting for POLLOUT would retry the write in a loop */
+        if (ssl_error == SSL_ERROR_WANT_WRITE) {
+            pollfd.events = POLLOUT;
+        } else if (ssl_error == SSL_ERROR_WANT_READ) {
+            pollfd.events = POLLIN;
+        } else {
+            red_dump_openssl_errors();
+            return EPIPE;
+        }
+
+        /* the write is retried with the same arguments once the socket is
+         * ready, as required by OpenSSL */
+        red_stream_writer_set_blocked(writer, true);
+        while (!g_atomic_int_get(&writer->quit)) {
+            int ret = poll(&pollfd, 1, 100);
+            if (ret > 0 || (ret < 0 && errno != EINTR)) {
+                break;
+            }
+        }
+        red_stream_writer_set_blocked(writer, false);
+        if (g_atomic_int_get(&writer->quit) ||
+            (pollfd.revents & (POLLERR | POLLHUP | POLLNVAL))) {
+            return EPIPE;
+        }
+    }
+    return 0;
+}
+
+static void *red_stream_writer_main(void *opaque)
+{
+    RedStream *s = (RedStream *) opaque;
+    RedStreamWriter *writer = s->priv->writer;
+
+    pthread_mutex_lock(&writer->lock);
+    while (!writer->quit && !writer->error) {
+        RedStreamWriterChunk *chunk;
+        int error;
+
+        chunk = (RedStreamWriterChunk *) g_queue_pop_head(&writer->chunks);
+        if (!chunk) {
+            if (writer->flush) {
+                /* everything written before red_stream_flush() is sent */
+                writer->flush = false;
+                socket_set_cork(s->socket, 0);
+                socket_set_cork(s->socket, 1);
+            } else {
+                pthread_cond_wait(&writer->cond, &writer->lock);
+            }
+            continue;
+        }
+
+        pthread_mutex_unlock(&writer->lock);
+        error = red_stream_writer_send(s, chunk);
+        pthread_mutex_lock(&writer->lock);
+
+        writer->queued -= chunk->size;
+        writer->error = error;
+        stat_set_counter(writer->queued_bytes_counter, writer->queued);
+        g_free(chunk);
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+static void red_stream_writer_free(RedStream *s)
+{
+    RedStreamWriter *writer = s->priv->writer;
+    struct timespec deadline;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += RED_STREAM_WRITER_DRAIN_TIMEOUT_SEC;
+
+    pthread_mutex_lock(&writer->lock);
+    /* the last messages written, like a disconnection reason, are sent
+     * unless the client stopped reading them */
+    while (writer->queued && !writer->error) {
+        if (pthread_cond_timedwait(&writer->cond, &writer->lock, &deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+    g_atomic_int_set(&writer->quit, TRUE);
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    g_queue_clear_full(&writer->chunks, g_free);
+    pthread_mutex_destroy(&writer->ssl_lock);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    g_free(writer);
+    s->priv->writer = NULL;
+}
+#endif
+
 static ssize_t stream_ssl_write_cb(RedStream *s, const void *buf, size_t size)
 {
     int return_code;
 
+#ifndef _WIN32
+    if (s->priv->writer) {
+        return red_stream_writer_queue(s->priv->writer, buf, size);
+    }
+#endif
+
     return_code = SSL_write(s->priv->ssl, buf, size);
 
     if (return_code < 0) {
@@ -199,14 +449,26 @@ static ssize_t stream_ssl_write_cb(RedStream *s, const void *buf, size_t size)
 
 static ssize_t stream_ssl_read_cb(RedStream *s, void *buf, size_t size)
 {
-    int return_code;
+    ssize_t return_code;
+
+#ifndef _WIN32
+    if (s->priv->writer) {
+        pthread_mutex_lock(&s->priv->writer->ssl_lock);
+    }
+#endif
 
     return_code = SSL_read(s->priv->ssl, buf, size);
 
     if (return_code < 0) {
-        return stream_ssl_error(s, return_code);
+        return_code = stream_ssl_error(s, return_code);
     }
 
+#ifndef _WIN32
+    if (s->priv->writer) {
+        pthread_mutex_unlock(&s->priv->writer->ssl_lock);
+    }
+#endif
+
     return return_code;
 }
 
@@ -273,12 +535,24 @@ bool red_stream_set_auto_flush(RedStream *s, bool auto_flush)
     return true;
 }
 
-void red_stream_flush(RedStream *s)
+bool red_stream_flush(RedStream *s)
 {
+#ifndef _WIN32
+    if (s->priv->corked && s->priv->writer) {
+        /* uncorking now would not send the data still queued */
+        pthread_mutex_lock(&s->priv->writer->lock);
+        s->priv->writer->flush = true;
+        pthread_cond_broadcast(&s->priv->writer->cond);
+        pthread_mutex_unlock(&s->priv->writer->lock);
+        return true;
+    }
+#endif
     if (s->priv->corked) {
         socket_set_cork(s->socket, 0);
         socket_set_cork(s->socket, 1);
+        return true;
     }
+    return false;
 }
 
 #if HAVE_SASL
@@ -430,6 +704,12 @@ void red_stream_free(RedStream *s)
     }
 #endif
 
+#ifndef _WIN32
+    if (s->priv->writer) {
+        red_stream_writer_free(s);
+    }
+#endif
+
     if (s->priv->ssl) {
         SSL_free(s->priv->ssl);
     }
@@ -513,6 +793,23 @@ static void red_stream_disable_writev(RedStream *stream)
     stream->priv->writev = NULL;
 }
 
+/* Once the handshake is done, if OpenSSL configured the socket to encrypt
+ * the data in the kernel, the data can be written to the socket directly,
+ * including with writev(). The reads still go through OpenSSL, which handles
+ * the TLS control messages. */
+static void red_stream_ssl_check_ktls(RedStream *stream)
+{
+#ifdef USE_KTLS
+    if (!BIO_get_ktls_send(SSL_get_wbio(stream->priv->ssl))) {
+        return;
+    }
+    spice_debug("using kernel TLS to send on stream %p", stream);
+    stream->priv->ktls_send = true;
+    stream->priv->write = stream_write_cb;
+    stream->priv->writev = stream_writev_cb;
+#endif
+}
+
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 {
     int ssl_error;
@@ -520,6 +817,7 @@ RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
 
     return_code = SSL_accept(stream->priv->ssl);
     if (return_code == 1) {
+        red_stream_ssl_check_ktls(stream);
         return RED_STREAM_SSL_STATUS_OK;
     }
 
@@ -541,6 +839,67 @@ RedStreamSslStatus red_stream_ssl_accept(RedStream *stream)
     return RED_STREAM_SSL_STATUS_ERROR;
 }
 
+/**
+ * red_stream_enable_write_offload:
+ * @stream: a #RedStream using TLS, whose handshake is done
+ * @stat_node: where to add the statistics of the writer thread
+ *
+ * Starts a thread doing the encryption and the socket writes of @stream.
+ * The writes then only queue a copy of the data, which allows the thread of
+ * the channel to go on while the data is encrypted and sent. Once the
+ * socket is full and too much data is queued, the writes fail with EAGAIN.
+ *
+ * Returns: #true if the writes of @stream are done by a thread.
+ */
+bool red_stream_enable_write_offload(RedStream *stream, const RedStatNode *stat_node)
+{
+#ifndef _WIN32
+    RedStreamWriter *writer;
+    RedsState *reds = stream->priv->reds;
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+    int r;
+
+    if (!stream->priv->ssl || stream->priv->ktls_send || stream->priv->writer) {
+        return false;
+    }
+
+    writer = g_new0(RedStreamWriter, 1);
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+    pthread_mutex_init(&writer->ssl_lock, NULL);
+    g_queue_init(&writer->chunks);
+    writer->rate_start = g_get_monotonic_time();
+    stat_init_counter(&writer->queued_bytes_counter, reds, stat_node, "tls_queued_bytes", TRUE);
+    stat_init_counter(&writer->written_bytes_counter, reds, stat_node, "tls_written_bytes", TRUE);
+    stat_init_counter(&writer->bytes_per_sec_counter, reds, stat_node, "tls_bytes_per_sec", TRUE);
+    stat_init_counter(&writer->queue_full_counter, reds, stat_node, "tls_queue_full", TRUE);
+    stat_init_counter(&writer->socket_blocked_counter, reds, stat_node,
+                      "tls_socket_blocked", TRUE);
+    stream->priv->writer = writer;
+
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+    r = pthread_create(&writer->thread, NULL, red_stream_writer_main, stream);
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, NULL);
+    if (r) {
+        spice_warning("failed to create the TLS writer thread: %s", strerror(r));
+        pthread_mutex_destroy(&writer->ssl_lock);
+        pthread_cond_destroy(&writer->cond);
+        pthread_mutex_destroy(&writer->lock);
+        g_free(writer);
+        stream->priv->writer = NULL;
+        return false;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx)
 {
     BIO *sbio;
@@ -559,6 +918,13 @@ RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx)
     }
 
     SSL_set_bio(stream->priv->ssl, sbio, sbio);
+#ifdef USE_KTLS
+    if (reds_get_tls_kernel_offload(stream->priv->reds)) {
+        /* OpenSSL falls back to encrypting itself if the kernel or the
+         * negotiated cipher don't support it */
+        SSL_set_options(stream->priv->ssl, SSL_OP_ENABLE_KTLS);
+    }
+#endif
 
     stream->priv->write = stream_ssl_write_cb;
     stream->priv->read = stream_ssl_read_cb;
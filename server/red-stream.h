@@ -22,6 +22,7 @@
 
 #include "spice-wrapped.h"
 #include "red-common.h"
+#include "stat.h"
 
 SPICE_BEGIN_DECLS
 
@@ -65,6 +66,7 @@ void red_stream_set_core_interface(RedStream *stream, SpiceCoreInterfaceInternal
 bool red_stream_is_ssl(RedStream *stream);
 RedStreamSslStatus red_stream_ssl_accept(RedStream *stream);
 RedStreamSslStatus red_stream_enable_ssl(RedStream *stream, SSL_CTX *ctx);
+bool red_stream_enable_write_offload(RedStream *stream, const RedStatNode *stat_node);
 int red_stream_get_family(const RedStream *stream);
 bool red_stream_is_plain_unix(const RedStream *stream);
 bool red_stream_set_no_delay(RedStream *stream, bool no_delay);
@@ -90,8 +92,10 @@ bool red_stream_set_auto_flush(RedStream *stream, bool auto_flush);
  * Flush data to the underlying socket.
  * Calling this function on a stream with auto flush set has
  * no result.
+ *
+ * Returns true if corked data were flushed.
  */
-void red_stream_flush(RedStream *stream);
+bool red_stream_flush(RedStream *stream);
 
 bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len);
 
@@ -82,6 +82,21 @@ struct RedWorker {
     RedStatCounter command_counter;
     RedStatCounter full_loop_counter;
     RedStatCounter total_loop_counter;
+    RedStatHistogram command_time;
+
+    /* drawing commands parsed but not processed yet, see
+     * spice_server_set_display_batch() */
+    RedDrawable **draw_batch;
+    unsigned int draw_batch_size;
+    unsigned int draw_batch_max_commands;
+    uint64_t draw_batch_max_time;
+    uint64_t draw_batch_start;
+    RedStatNode batch_stat;
+    RedStatCounter batch_counter;
+    RedStatCounter batch_commands_counter;
+    RedStatCounter batch_occluded_counter;
+    RedStatCounter batch_time_counter;
+    RedStatCounter batch_over_budget_counter;
 
     bool driver_cap_monitors_config;
 
@@ -150,18 +165,64 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
 static gboolean red_process_surface_cmd(RedWorker *worker, QXLCommandExt *ext, gboolean loadvm)
 {
     RedSurfaceCmd *surface_cmd;
+    DisplayStage stage;
 
     surface_cmd = red_surface_cmd_new(worker->qxl, &worker->mem_slots,
                                       ext->group_id, ext->cmd.data);
     if (surface_cmd == NULL) {
         return false;
     }
+    stage = display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_TREE);
     display_channel_process_surface_cmd(worker->display_channel, surface_cmd, loadvm);
+    display_channel_enter_stage(worker->display_channel, stage);
     red_surface_cmd_unref(surface_cmd);
 
     return true;
 }
 
+static void red_process_draw_batch(RedWorker *worker)
+{
+    unsigned int occluded;
+    uint64_t elapsed;
+    DisplayStage stage;
+
+    if (worker->draw_batch_size == 0) {
+        return;
+    }
+
+    stage = display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_TREE);
+    occluded = display_channel_process_draw_batch(worker->display_channel, worker->draw_batch,
+                                                  worker->draw_batch_size,
+                                                  worker->process_display_generation);
+    display_channel_enter_stage(worker->display_channel, stage);
+    elapsed = spice_get_monotonic_time_ns() - worker->draw_batch_start;
+
+    stat_inc_counter(worker->batch_counter, 1);
+    stat_inc_counter(worker->batch_commands_counter, worker->draw_batch_size);
+    stat_inc_counter(worker->batch_occluded_counter, occluded);
+    stat_inc_counter(worker->batch_time_counter, elapsed / NSEC_PER_MICROSEC);
+    if (worker->draw_batch_max_time && elapsed > worker->draw_batch_max_time) {
+        stat_inc_counter(worker->batch_over_budget_counter, 1);
+    }
+    worker->draw_batch_size = 0;
+}
+
+/* the drawables are processed when the batch is full, its time budget
+ * is spent or a command which is not a drawing one is fetched */
+static void red_add_draw_batch(RedWorker *worker, RedDrawable *red_drawable)
+{
+    if (worker->draw_batch_size == 0) {
+        worker->draw_batch_start = spice_get_monotonic_time_ns();
+    }
+    worker->draw_batch[worker->draw_batch_size++] = red_drawable;
+
+    if (worker->draw_batch_size >= worker->draw_batch_max_commands ||
+        (worker->draw_batch_max_time &&
+         spice_get_monotonic_time_ns() - worker->draw_batch_start >= worker->draw_batch_max_time)) {
+        red_process_draw_batch(worker);
+    }
+}
+
 static int red_process_display(RedWorker *worker, int *ring_is_empty)
 {
     QXLCommandExt ext_cmd;
@@ -179,6 +240,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
     *ring_is_empty = FALSE;
     while (worker->display_channel->max_pipe_size() <= MAX_PIPE_SIZE) {
         if (!red_qxl_get_command(worker->qxl, &ext_cmd)) {
+            red_process_draw_batch(worker);
             *ring_is_empty = TRUE;
             if (worker->display_poll_tries < CMD_RING_POLL_RETRIES) {
                 worker->event_timeout = MIN(worker->event_timeout, CMD_RING_POLL_TIMEOUT);
@@ -190,20 +252,34 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
             return n;
         }
 
+        stat_time_t command_start = stat_histogram_start();
         if (worker->record) {
             red_record_qxl_command(worker->record, &worker->mem_slots, ext_cmd);
         }
 
         stat_inc_counter(worker->command_counter, 1);
         worker->display_poll_tries = 0;
+        if (ext_cmd.cmd.type != QXL_CMD_DRAW) {
+            /* keep the order of the commands */
+            red_process_draw_batch(worker);
+        }
+        /* each command is timed as parsed until it is processed */
+        display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_PARSE);
         switch (ext_cmd.cmd.type) {
         case QXL_CMD_DRAW: {
+            RedDrawableSlabs *slabs = display_channel_get_drawable_slabs(worker->display_channel);
             RedDrawable *red_drawable;
             red_drawable = red_drawable_new(worker->qxl, &worker->mem_slots,
-                                            ext_cmd.group_id, ext_cmd.cmd.data,
+                                            ext_cmd.group_id, slabs, ext_cmd.cmd.data,
                                             ext_cmd.flags); // returns with 1 ref
 
-            if (red_drawable != NULL) {
+            if (red_drawable == NULL) {
+                break;
+            }
+            display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_TREE);
+            if (worker->draw_batch) {
+                red_add_draw_batch(worker, red_drawable);
+            } else {
                 display_channel_process_draw(worker->display_channel, red_drawable,
                                              worker->process_display_generation);
                 red_drawable_unref(red_drawable);
@@ -218,6 +294,7 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
             if (update == NULL) {
                 break;
             }
+            display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_RENDER);
             if (!display_channel_validate_surface(worker->display_channel, update->surface_id)) {
                 spice_warning("Invalid surface in QXL_CMD_UPDATE");
             } else {
@@ -248,13 +325,17 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
         default:
             spice_error("bad command type");
         }
+        display_channel_enter_stage(worker->display_channel, DISPLAY_STAGE_NONE);
+        stat_histogram_add_time(&worker->command_time, command_start);
         n++;
         if (worker->display_channel->all_blocked()
             || spice_get_monotonic_time_ns() - start > NSEC_PER_SEC / 100) {
+            red_process_draw_batch(worker);
             worker->event_timeout = 0;
             return n;
         }
     }
+    red_process_draw_batch(worker);
     worker->was_blocked = TRUE;
     stat_inc_counter(worker->full_loop_counter, 1);
     return n;
@@ -1042,6 +1123,24 @@ RedWorker* red_worker_new(QXLInstance *qxl)
     stat_init_counter(&worker->command_counter, reds, &worker->stat, "commands", TRUE);
     stat_init_counter(&worker->full_loop_counter, reds, &worker->stat, "full_loops", TRUE);
     stat_init_counter(&worker->total_loop_counter, reds, &worker->stat, "total_loops", TRUE);
+    stat_init_histogram(&worker->command_time, reds, &worker->stat, "command_time", TRUE);
+    dispatcher->init_stat(reds, &worker->stat);
+
+    worker->draw_batch_max_commands = reds_get_display_batch_commands(reds);
+    worker->draw_batch_max_time = reds_get_display_batch_time(reds) * NSEC_PER_MICROSEC;
+    if (worker->draw_batch_max_commands > 1) {
+        worker->draw_batch = g_new(RedDrawable *, worker->draw_batch_max_commands);
+        stat_init_node(&worker->batch_stat, reds, &worker->stat, "draw_batch", TRUE);
+        stat_init_counter(&worker->batch_counter, reds, &worker->batch_stat, "batches", TRUE);
+        stat_init_counter(&worker->batch_commands_counter, reds, &worker->batch_stat,
+                          "commands", TRUE);
+        stat_init_counter(&worker->batch_occluded_counter, reds, &worker->batch_stat,
+                          "occluded", TRUE);
+        stat_init_counter(&worker->batch_time_counter, reds, &worker->batch_stat,
+                          "time_us", TRUE);
+        stat_init_counter(&worker->batch_over_budget_counter, reds, &worker->batch_stat,
+                          "over_budget", TRUE);
+    }
 
     worker->dispatch_watch = dispatcher->create_watch(&worker->core);
     spice_assert(worker->dispatch_watch != NULL);
@@ -1163,5 +1262,6 @@ void red_worker_free(RedWorker *worker)
         red_record_unref(worker->record);
     }
     memslot_info_destroy(&worker->mem_slots);
+    g_free(worker->draw_batch);
     g_free(worker);
 }
@@ -77,8 +77,9 @@
 #include "red-client.h"
 #include "net-utils.h"
 #include "red-stream-device.h"
+#include "image-encoders.h"
 
-#define REDS_MAX_STAT_NODES 100
+#define REDS_MAX_STAT_NODES 2048
 
 static void reds_client_monitors_config(RedsState *reds, VDAgentMonitorsConfig *monitors_config);
 static gboolean reds_use_client_monitors_config(RedsState *reds);
@@ -130,11 +131,22 @@ struct RedServerConfig {
 
     gboolean ticketing_enabled;
     uint32_t streaming_video;
+    unsigned int streaming_video_detection_fps;
+    unsigned int streaming_video_detection_frames;
     GArray* video_codecs;
     SpiceImageCompression image_compression;
     bool playback_compression;
     spice_wan_compression_t jpeg_state;
     spice_wan_compression_t zlib_glz_state;
+    unsigned int image_compression_threads;
+    bool image_dedup;
+    unsigned int display_batch_commands;
+    unsigned int display_batch_time;
+    bool display_deferred_render;
+    unsigned int display_render_threads;
+    bool display_scroll_detection;
+    bool tls_write_offload;
+    bool tls_kernel_offload;
 
     gboolean agent_mouse;
     gboolean agent_copypaste;
@@ -318,6 +330,41 @@ void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
     }
 }
 
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible)
+{
+    memset(histogram, 0, sizeof(*histogram));
+    histogram->reds = reds;
+    histogram->visible = visible;
+    stat_init_node(&histogram->node, reds, parent, name, visible);
+    if (histogram->node.ref == INVALID_STAT_REF) {
+        return;
+    }
+    histogram->sum = stat_file_add_counter(reds->stat_file, histogram->node.ref, "sum", visible);
+    if (histogram->sum == NULL) {
+        return;
+    }
+    /* the histogram is used once it has a count */
+    histogram->count = stat_file_add_counter(reds->stat_file, histogram->node.ref,
+                                             "count", visible);
+}
+
+uint64_t *stat_histogram_add_bucket(RedStatHistogram *histogram, unsigned int bucket)
+{
+    char name[SPICE_STAT_NODE_NAME_MAX];
+    uint64_t *counter;
+
+    /* threads adding the same bucket get the same counter */
+    stat_histogram_bucket_name(bucket, name, sizeof(name));
+    counter = stat_file_add_counter(histogram->reds->stat_file, histogram->node.ref,
+                                    name, histogram->visible);
+    if (counter == NULL) {
+        counter = &histogram->lost;
+    }
+    __atomic_store_n(&histogram->buckets[bucket], counter, __ATOMIC_RELEASE);
+    return counter;
+}
+
 #endif
 
 void reds_register_channel(RedsState *reds, RedChannel *channel)
@@ -2901,7 +2948,10 @@ static void reds_config_set_image_compression(RedsState *reds, SpiceImageCompres
     if (image_compression == reds->config->image_compression) {
         return;
     }
-    switch (image_compression) {
+    switch ((int) image_compression) {
+    case SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE:
+        spice_debug("ic auto_adaptive");
+        break;
     case SPICE_IMAGE_COMPRESSION_AUTO_LZ:
         spice_debug("ic auto_lz");
         break;
@@ -3500,11 +3550,22 @@ SPICE_GNUC_VISIBLE SpiceServer *spice_server_new(void)
     memset(reds->config->spice_uuid, 0, sizeof(reds->config->spice_uuid));
     reds->config->ticketing_enabled = TRUE; /* ticketing enabled by default */
     reds->config->streaming_video = SPICE_STREAM_VIDEO_FILTER;
+    reds->config->streaming_video_detection_fps = 0;
+    reds->config->streaming_video_detection_frames = 0;
     reds->config->video_codecs = g_array_new(FALSE, FALSE, sizeof(RedVideoCodec));
     reds->config->image_compression = SPICE_IMAGE_COMPRESSION_AUTO_GLZ;
     reds->config->playback_compression = TRUE;
     reds->config->jpeg_state = SPICE_WAN_COMPRESSION_AUTO;
     reds->config->zlib_glz_state = SPICE_WAN_COMPRESSION_AUTO;
+    reds->config->image_compression_threads = 0;
+    reds->config->image_dedup = FALSE;
+    reds->config->display_batch_commands = 0;
+    reds->config->display_batch_time = 0;
+    reds->config->display_deferred_render = FALSE;
+    reds->config->display_render_threads = 0;
+    reds->config->display_scroll_detection = FALSE;
+    reds->config->tls_write_offload = FALSE;
+    reds->config->tls_kernel_offload = FALSE;
     reds->config->agent_mouse = TRUE;
     reds->config->agent_copypaste = TRUE;
     reds->config->agent_file_xfer = TRUE;
@@ -3969,6 +4030,16 @@ SPICE_GNUC_VISIBLE int spice_server_set_tls(SpiceServer *s, int port,
     return 0;
 }
 
+SPICE_GNUC_VISIBLE void spice_server_set_tls_write_offload(SpiceServer *s, int enable)
+{
+    s->config->tls_write_offload = !!enable;
+}
+
+SPICE_GNUC_VISIBLE void spice_server_set_tls_kernel_offload(SpiceServer *s, int enable)
+{
+    s->config->tls_kernel_offload = !!enable;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_image_compression(SpiceServer *s,
                                                           SpiceImageCompression comp)
 {
@@ -4011,6 +4082,64 @@ SPICE_GNUC_VISIBLE int spice_server_set_zlib_glz_compression(SpiceServer *s, spi
     return 0;
 }
 
+SPICE_GNUC_VISIBLE int spice_server_set_image_compression_threads(SpiceServer *s,
+                                                                  unsigned int threads)
+{
+    if (threads > IMAGE_ENCODERS_POOL_MAX_THREADS) {
+        spice_warning("too many image compression threads %u, maximum is %u",
+                      threads, IMAGE_ENCODERS_POOL_MAX_THREADS);
+        return -1;
+    }
+    // only used by new display channel clients
+    s->config->image_compression_threads = threads;
+    return 0;
+}
+
+SPICE_GNUC_VISIBLE void spice_server_set_image_dedup(SpiceServer *s, int enable)
+{
+    // only used by new display channel clients
+    s->config->image_dedup = !!enable;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_display_batch(SpiceServer *s, unsigned int max_commands,
+                                                      unsigned int max_time_us)
+{
+    if (max_commands > SPICE_DISPLAY_BATCH_MAX_COMMANDS) {
+        spice_warning("display batch of %u commands too big, maximum is %u",
+                      max_commands, SPICE_DISPLAY_BATCH_MAX_COMMANDS);
+        return -1;
+    }
+    // only used by new QXL devices
+    s->config->display_batch_commands = max_commands;
+    s->config->display_batch_time = max_time_us;
+    return 0;
+}
+
+SPICE_GNUC_VISIBLE void spice_server_set_display_deferred_render(SpiceServer *s, int enable)
+{
+    // only used by new QXL devices
+    s->config->display_deferred_render = !!enable;
+}
+
+SPICE_GNUC_VISIBLE int spice_server_set_display_render_threads(SpiceServer *s,
+                                                               unsigned int threads)
+{
+    if (threads > SPICE_DISPLAY_RENDER_MAX_THREADS) {
+        spice_warning("too many render threads %u, maximum is %u",
+                      threads, SPICE_DISPLAY_RENDER_MAX_THREADS);
+        return -1;
+    }
+    // only used by new QXL devices
+    s->config->display_render_threads = threads;
+    return 0;
+}
+
+SPICE_GNUC_VISIBLE void spice_server_set_display_scroll_detection(SpiceServer *s, int enable)
+{
+    // only used by new QXL devices
+    s->config->display_scroll_detection = !!enable;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_channel_security(SpiceServer *s, const char *channel, int security)
 {
     int type;
@@ -4068,11 +4197,30 @@ SPICE_GNUC_VISIBLE int spice_server_set_streaming_video(SpiceServer *reds, int v
     return 0;
 }
 
+SPICE_GNUC_VISIBLE void spice_server_set_streaming_video_detection(SpiceServer *s,
+                                                                   unsigned int min_fps,
+                                                                   unsigned int frames)
+{
+    // only used by new QXL devices
+    s->config->streaming_video_detection_fps = min_fps;
+    s->config->streaming_video_detection_frames = frames;
+}
+
 uint32_t reds_get_streaming_video(const RedsState *reds)
 {
     return reds->config->streaming_video;
 }
 
+unsigned int reds_get_streaming_video_detection_fps(const RedsState *reds)
+{
+    return reds->config->streaming_video_detection_fps;
+}
+
+unsigned int reds_get_streaming_video_detection_frames(const RedsState *reds)
+{
+    return reds->config->streaming_video_detection_frames;
+}
+
 SPICE_GNUC_VISIBLE int spice_server_set_video_codecs(SpiceServer *reds, const char *video_codecs)
 {
     unsigned int installed = 0;
@@ -4325,6 +4473,51 @@ spice_wan_compression_t reds_get_zlib_glz_state(const RedsState *reds)
     return reds->config->zlib_glz_state;
 }
 
+unsigned int reds_get_image_compression_threads(const RedsState *reds)
+{
+    return reds->config->image_compression_threads;
+}
+
+bool reds_get_image_dedup(const RedsState *reds)
+{
+    return reds->config->image_dedup;
+}
+
+unsigned int reds_get_display_batch_commands(const RedsState *reds)
+{
+    return reds->config->display_batch_commands;
+}
+
+unsigned int reds_get_display_batch_time(const RedsState *reds)
+{
+    return reds->config->display_batch_time;
+}
+
+bool reds_get_display_deferred_render(const RedsState *reds)
+{
+    return reds->config->display_deferred_render;
+}
+
+unsigned int reds_get_display_render_threads(const RedsState *reds)
+{
+    return reds->config->display_render_threads;
+}
+
+bool reds_get_display_scroll_detection(const RedsState *reds)
+{
+    return reds->config->display_scroll_detection;
+}
+
+bool reds_get_tls_write_offload(const RedsState *reds)
+{
+    return reds->config->tls_write_offload;
+}
+
+bool reds_get_tls_kernel_offload(const RedsState *reds)
+{
+    return reds->config->tls_kernel_offload;
+}
+
 SpiceCoreInterfaceInternal* reds_get_core_interface(RedsState *reds)
 {
     return &reds->core;
@@ -100,6 +100,17 @@ uint32_t reds_get_streaming_video(const RedsState *reds);
 GArray* reds_get_video_codecs(const RedsState *reds);
 spice_wan_compression_t reds_get_jpeg_state(const RedsState *reds);
 spice_wan_compression_t reds_get_zlib_glz_state(const RedsState *reds);
+unsigned int reds_get_image_compression_threads(const RedsState *reds);
+bool reds_get_image_dedup(const RedsState *reds);
+unsigned int reds_get_display_batch_commands(const RedsState *reds);
+unsigned int reds_get_display_batch_time(const RedsState *reds);
+bool reds_get_display_deferred_render(const RedsState *reds);
+unsigned int reds_get_display_render_threads(const RedsState *reds);
+bool reds_get_display_scroll_detection(const RedsState *reds);
+unsigned int reds_get_streaming_video_detection_fps(const RedsState *reds);
+unsigned int reds_get_streaming_video_detection_frames(const RedsState *reds);
+bool reds_get_tls_write_offload(const RedsState *reds);
+bool reds_get_tls_kernel_offload(const RedsState *reds);
 SpiceCoreInterfaceInternal* reds_get_core_interface(RedsState *reds);
 void reds_update_client_mouse_allowed(RedsState *reds);
 MainDispatcher* reds_get_main_dispatcher(RedsState *reds);
@@ -0,0 +1,163 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+
+#include "scroll-detect.h"
+
+/* the high byte of the pixels of the guest images and of the surfaces may
+ * differ for the same colors */
+#define PIXEL_MASK 0x00ffffffu
+/* rows of the new image looked up in the old rows */
+#define NUM_ANCHORS 8
+/* offsets checked row by row at most, to bound the cost on the images
+ * with many identical rows */
+#define MAX_CANDIDATES 16
+
+static inline const uint32_t *image_row(const uint8_t *rows, int32_t stride, uint32_t y)
+{
+    return (const uint32_t *) (rows + (intptr_t) stride * y);
+}
+
+#define PIXEL_PAIR_MASK ((uint64_t) PIXEL_MASK << 32 | PIXEL_MASK)
+#define HASH_PRIME UINT64_C(0x100000001b3)
+
+static inline uint64_t pixel_pair(const uint32_t *pixels)
+{
+    uint64_t pair;
+
+    memcpy(&pair, pixels, sizeof(pair));
+    return pair & PIXEL_PAIR_MASK;
+}
+
+/* FNV-1 like hash of 4 interleaved lanes of pixel pairs, to not wait for
+ * the result of each multiplication */
+static uint64_t row_hash(const uint32_t *row, uint32_t width)
+{
+    uint64_t h0 = UINT64_C(0xcbf29ce484222325), h1 = h0 + 1, h2 = h0 + 2, h3 = h0 + 3;
+    uint32_t x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        h0 = (h0 ^ pixel_pair(row + x)) * HASH_PRIME;
+        h1 = (h1 ^ pixel_pair(row + x + 2)) * HASH_PRIME;
+        h2 = (h2 ^ pixel_pair(row + x + 4)) * HASH_PRIME;
+        h3 = (h3 ^ pixel_pair(row + x + 6)) * HASH_PRIME;
+    }
+    for (; x < width; x++) {
+        h0 = (h0 ^ (row[x] & PIXEL_MASK)) * HASH_PRIME;
+    }
+    return ((h0 * HASH_PRIME ^ h1) * HASH_PRIME ^ h2) * HASH_PRIME ^ h3;
+}
+
+static bool rows_equal(const uint32_t *a, const uint32_t *b, uint32_t width)
+{
+    uint32_t x;
+
+    for (x = 0; x + 8 <= width; x += 8) {
+        uint64_t diff = (pixel_pair(a + x) ^ pixel_pair(b + x)) |
+                        (pixel_pair(a + x + 2) ^ pixel_pair(b + x + 2)) |
+                        (pixel_pair(a + x + 4) ^ pixel_pair(b + x + 4)) |
+                        (pixel_pair(a + x + 6) ^ pixel_pair(b + x + 6));
+        if (diff) {
+            return false;
+        }
+    }
+    for (; x < width; x++) {
+        if ((a[x] ^ b[x]) & PIXEL_MASK) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool offset_matches(const uint8_t *old_rows, int32_t old_stride,
+                           const uint8_t *new_rows, int32_t new_stride,
+                           const uint64_t *old_hashes, const uint64_t *new_hashes,
+                           uint32_t width, uint32_t height, int32_t dy)
+{
+    uint32_t first = dy < 0 ? -dy : 0;
+    uint32_t last = dy > 0 ? height - dy : height;
+    uint32_t y;
+
+    /* the hashes first, most mismatches are found without reading the
+     * pixels again */
+    for (y = first; y < last; y++) {
+        if (new_hashes[y] != old_hashes[y + dy]) {
+            return false;
+        }
+    }
+    for (y = first; y < last; y++) {
+        if (!rows_equal(image_row(new_rows, new_stride, y),
+                        image_row(old_rows, old_stride, y + dy), width)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int32_t scroll_detect_offset(const uint8_t *old_rows, int32_t old_stride,
+                             const uint8_t *new_rows, int32_t new_stride,
+                             uint32_t width, uint32_t height, uint32_t max_offset)
+{
+    uint64_t *old_hashes, *new_hashes;
+    unsigned int num_candidates = 0;
+    int32_t found = 0;
+    uint32_t y, anchor;
+
+    max_offset = MIN(max_offset, height - 1);
+    if (width == 0 || height < 3 || max_offset == 0) {
+        return 0;
+    }
+
+    old_hashes = g_new(uint64_t, 2 * height);
+    new_hashes = old_hashes + height;
+    for (y = 0; y < height; y++) {
+        old_hashes[y] = row_hash(image_row(old_rows, old_stride, y), width);
+        new_hashes[y] = row_hash(image_row(new_rows, new_stride, y), width);
+    }
+
+    for (anchor = 0; anchor < NUM_ANCHORS && !found; anchor++) {
+        uint32_t first, last, r;
+
+        /* spread over the image, skipping the rows repeated in their
+         * neighbours like the blank lines between text lines */
+        y = 1 + (uint64_t) (height - 2) * (2 * anchor + 1) / (2 * NUM_ANCHORS);
+        if (new_hashes[y] == new_hashes[y - 1] || new_hashes[y] == new_hashes[y + 1]) {
+            continue;
+        }
+        first = y > max_offset ? y - max_offset : 0;
+        last = MIN(y + max_offset, height - 1);
+        for (r = first; r <= last && num_candidates < MAX_CANDIDATES; r++) {
+            if (r == y || old_hashes[r] != new_hashes[y]) {
+                continue;
+            }
+            num_candidates++;
+            if (offset_matches(old_rows, old_stride, new_rows, new_stride,
+                               old_hashes, new_hashes, width, height, (int32_t) (r - y))) {
+                found = (int32_t) (r - y);
+                break;
+            }
+        }
+    }
+
+    g_free(old_hashes);
+    return found;
+}
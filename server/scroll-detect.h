@@ -0,0 +1,46 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SCROLL_DETECT_H_
+#define SCROLL_DETECT_H_
+
+#include <stdint.h>
+#include <spice/macros.h>
+
+SPICE_BEGIN_DECLS
+
+/* Detection of the scrolling of an area repainted by the guest: the new
+ * image of the area is compared with the current content of the surface
+ * to find the vertical offset at which it was already drawn.
+ *
+ * The rows are hashed and a few distinctive rows of the new image are
+ * looked up in the old rows, the candidate offsets are then checked row by
+ * row. The pixels are 32 bits, their high byte is ignored.
+ */
+
+/* Returns the offset @dy such that each row y of @new_rows is the row
+ * y + dy of @old_rows, for all the rows present in both, 0 if there is
+ * none. @dy is at most @max_offset in absolute value. The strides can be
+ * negative to walk bottom up images. */
+int32_t scroll_detect_offset(const uint8_t *old_rows, int32_t old_stride,
+                             const uint8_t *new_rows, int32_t new_stride,
+                             uint32_t width, uint32_t height, uint32_t max_offset);
+
+SPICE_END_DECLS
+
+#endif /* SCROLL_DETECT_H_ */
@@ -21,6 +21,38 @@
 
 #include "spice-bitmap-utils.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITMAP_UTILS_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/* Classification of the pixel pairs sampled by the graduality score.
+ * Counting the pairs instead of summing the weights is exact so all the
+ * implementations give the same score */
+typedef struct {
+    unsigned int same;
+    unsigned int contrast;
+    unsigned int not_contrast;
+    /* samples where all the pixels are identical, not taken into account */
+    unsigned int same_samples;
+} GradualityCounts;
+
+/* p0..p3 are the pixels of the samples in 0x00RRGGBB format */
+typedef void (*graduality_count_func_t)(const uint32_t *p0, const uint32_t *p1,
+                                        const uint32_t *p2, const uint32_t *p3,
+                                        int n, uint8_t contrast_th,
+                                        GradualityCounts *counts);
+
+#define GRADUALITY_BATCH_SIZE 64
+
+/* see PIX_PAIR_SCORE in spice-bitmap-utils.tmpl.c, weights are multiple of 1/4 */
+static inline double graduality_counts_to_score(const GradualityCounts *counts)
+{
+    int64_t quarters = 2 * (int64_t) counts->same + 4 * (int64_t) counts->contrast -
+                       (int64_t) counts->not_contrast - 6 * (int64_t) counts->same_samples;
+    return quarters * 0.25;
+}
+
 #define RED_BITMAP_UTILS_RGB16
 #include "spice-bitmap-utils.tmpl.c"
 #define RED_BITMAP_UTILS_RGB24
@@ -36,8 +68,141 @@
 // in window media player 12). see red_stream_add_frame
 #define GRADUAL_MEDIUM_SCORE_TH 0.002
 
+static void graduality_count_generic(const uint32_t *p0, const uint32_t *p1,
+                                     const uint32_t *p2, const uint32_t *p3,
+                                     int n, uint8_t contrast_th, GradualityCounts *counts)
+{
+    const uint32_t *others[3] = { p1, p2, p3 };
+    int i, j, shift;
+
+    for (i = 0; i < n; i++) {
+        int all_same = TRUE;
+        for (j = 0; j < 3; j++) {
+            int contrast = FALSE;
+            for (shift = 16; shift >= 0; shift -= 8) {
+                int diff = (int) ((p0[i] >> shift) & 0xff) - (int) ((others[j][i] >> shift) & 0xff);
+                if (diff <= -contrast_th || diff >= contrast_th) {
+                    contrast = TRUE;
+                    break;
+                }
+            }
+            if (contrast) {
+                counts->contrast++;
+                all_same = FALSE;
+            } else if (p0[i] == others[j][i]) {
+                counts->same++;
+            } else {
+                counts->not_contrast++;
+                all_same = FALSE;
+            }
+        }
+        counts->same_samples += all_same;
+    }
+}
+
+#ifdef BITMAP_UTILS_X86_SIMD
+/* The channels are compared using saturated byte subtractions:
+ * |a - b| = sat(a - b) | sat(b - a) and |a - b| >= th <=> sat(|a - b| - (th - 1)) != 0
+ * The pad byte is always 0 so it never adds a difference. */
+__attribute__((target("sse2")))
+static void graduality_count_sse2(const uint32_t *p0, const uint32_t *p1,
+                                  const uint32_t *p2, const uint32_t *p3,
+                                  int n, uint8_t contrast_th, GradualityCounts *counts)
+{
+    const uint32_t *others[3] = { p1, p2, p3 };
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i th = _mm_set1_epi8(contrast_th - 1);
+    int i, j;
+
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *) (p0 + i));
+        int same_samples = 0xf;
+        for (j = 0; j < 3; j++) {
+            __m128i b = _mm_loadu_si128((const __m128i *) (others[j] + i));
+            __m128i absdiff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+            __m128i over_th = _mm_subs_epu8(absdiff, th);
+            int same = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(absdiff, zero)));
+            int contrast = ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(over_th, zero))) & 0xf;
+
+            counts->same += __builtin_popcount(same);
+            counts->contrast += __builtin_popcount(contrast);
+            counts->not_contrast += __builtin_popcount(~(same | contrast) & 0xf);
+            same_samples &= same;
+        }
+        counts->same_samples += __builtin_popcount(same_samples);
+    }
+    graduality_count_generic(p0 + i, p1 + i, p2 + i, p3 + i, n - i, contrast_th, counts);
+}
+
+__attribute__((target("avx2")))
+static void graduality_count_avx2(const uint32_t *p0, const uint32_t *p1,
+                                  const uint32_t *p2, const uint32_t *p3,
+                                  int n, uint8_t contrast_th, GradualityCounts *counts)
+{
+    const uint32_t *others[3] = { p1, p2, p3 };
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i th = _mm256_set1_epi8(contrast_th - 1);
+    int i, j;
+
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) (p0 + i));
+        int same_samples = 0xff;
+        for (j = 0; j < 3; j++) {
+            __m256i b = _mm256_loadu_si256((const __m256i *) (others[j] + i));
+            __m256i absdiff = _mm256_or_si256(_mm256_subs_epu8(a, b), _mm256_subs_epu8(b, a));
+            __m256i over_th = _mm256_subs_epu8(absdiff, th);
+            int same = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(absdiff, zero)));
+            int contrast =
+                ~_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(over_th, zero))) & 0xff;
+
+            counts->same += __builtin_popcount(same);
+            counts->contrast += __builtin_popcount(contrast);
+            counts->not_contrast += __builtin_popcount(~(same | contrast) & 0xff);
+            same_samples &= same;
+        }
+        counts->same_samples += __builtin_popcount(same_samples);
+    }
+    graduality_count_generic(p0 + i, p1 + i, p2 + i, p3 + i, n - i, contrast_th, counts);
+}
+#endif
+
+bool bitmap_graduality_impl_available(BitmapGradualityImpl impl)
+{
+    switch (impl) {
+    case BITMAP_GRADUALITY_IMPL_AUTO:
+    case BITMAP_GRADUALITY_IMPL_SCALAR:
+        return true;
+#ifdef BITMAP_UTILS_X86_SIMD
+    case BITMAP_GRADUALITY_IMPL_SSE2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("sse2");
+    case BITMAP_GRADUALITY_IMPL_AVX2:
+        __builtin_cpu_init();
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+static BitmapGradualityImpl bitmap_graduality_best_impl(void)
+{
+    static gsize best_impl = 0;
+
+    if (g_once_init_enter(&best_impl)) {
+        BitmapGradualityImpl impl = BITMAP_GRADUALITY_IMPL_SCALAR;
+        if (bitmap_graduality_impl_available(BITMAP_GRADUALITY_IMPL_AVX2)) {
+            impl = BITMAP_GRADUALITY_IMPL_AVX2;
+        } else if (bitmap_graduality_impl_available(BITMAP_GRADUALITY_IMPL_SSE2)) {
+            impl = BITMAP_GRADUALITY_IMPL_SSE2;
+        }
+        g_once_init_leave(&best_impl, impl);
+    }
+    return (BitmapGradualityImpl) best_impl;
+}
+
 // assumes that stride doesn't overflow
-BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+double bitmap_get_graduality_score(SpiceBitmap *bitmap, BitmapGradualityImpl impl)
 {
     double score = 0.0;
     int num_samples = 0;
@@ -46,6 +211,23 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     int chunk_num_samples = 0;
     uint32_t x, i;
     SpiceChunk *chunk;
+    graduality_count_func_t count_func = NULL;
+
+    if (impl == BITMAP_GRADUALITY_IMPL_AUTO) {
+        impl = bitmap_graduality_best_impl();
+    }
+    switch (impl) {
+#ifdef BITMAP_UTILS_X86_SIMD
+    case BITMAP_GRADUALITY_IMPL_SSE2:
+        count_func = graduality_count_sse2;
+        break;
+    case BITMAP_GRADUALITY_IMPL_AVX2:
+        count_func = graduality_count_avx2;
+        break;
+#endif
+    default:
+        break;
+    }
 
     chunk = bitmap->data->chunk;
     for (i = 0; i < bitmap->data->num_chunks; i++) {
@@ -53,15 +235,33 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
         x = bitmap->x;
         switch (bitmap->format) {
         case SPICE_BITMAP_FMT_16BIT:
+            if (count_func) {
+                compute_lines_gradual_score_batched_rgb16((rgb16_pixel_t *)chunk[i].data, x,
+                                                          num_lines, count_func,
+                                                          &chunk_score, &chunk_num_samples);
+                break;
+            }
             compute_lines_gradual_score_rgb16((rgb16_pixel_t *)chunk[i].data, x, num_lines,
                                               &chunk_score, &chunk_num_samples);
             break;
         case SPICE_BITMAP_FMT_24BIT:
+            if (count_func) {
+                compute_lines_gradual_score_batched_rgb24((rgb24_pixel_t *)chunk[i].data, x,
+                                                          num_lines, count_func,
+                                                          &chunk_score, &chunk_num_samples);
+                break;
+            }
             compute_lines_gradual_score_rgb24((rgb24_pixel_t *)chunk[i].data, x, num_lines,
                                               &chunk_score, &chunk_num_samples);
             break;
         case SPICE_BITMAP_FMT_32BIT:
         case SPICE_BITMAP_FMT_RGBA:
+            if (count_func) {
+                compute_lines_gradual_score_batched_rgb32((rgb32_pixel_t *)chunk[i].data, x,
+                                                          num_lines, count_func,
+                                                          &chunk_score, &chunk_num_samples);
+                break;
+            }
             compute_lines_gradual_score_rgb32((rgb32_pixel_t *)chunk[i].data, x, num_lines,
                                               &chunk_score, &chunk_num_samples);
             break;
@@ -73,7 +273,12 @@ BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
     }
 
     spice_assert(num_samples);
-    score /= num_samples;
+    return score / num_samples;
+}
+
+BitmapGradualType bitmap_get_graduality_level(SpiceBitmap *bitmap)
+{
+    double score = bitmap_get_graduality_score(bitmap, BITMAP_GRADUALITY_IMPL_AUTO);
 
     if (bitmap->format == SPICE_BITMAP_FMT_16BIT) {
         if (score < GRADUAL_HIGH_RGB16_TH) {
@@ -119,6 +324,125 @@ int bitmap_has_extra_stride(SpiceBitmap *bitmap)
     return 0;
 }
 
+/* mixing derived from MurmurHash64A, processes 8 bytes at a time */
+#define CONTENT_HASH_MUL UINT64_C(0xc6a4a7935bd1e995)
+
+static inline uint64_t content_hash_mix(uint64_t hash, uint64_t k)
+{
+    k *= CONTENT_HASH_MUL;
+    k ^= k >> 47;
+    k *= CONTENT_HASH_MUL;
+    hash ^= k;
+    return hash * CONTENT_HASH_MUL;
+}
+
+static uint64_t content_hash_update(uint64_t hash, const uint8_t *data, size_t len)
+{
+    uint64_t k;
+
+    for (; len >= sizeof(k); len -= sizeof(k), data += sizeof(k)) {
+        memcpy(&k, data, sizeof(k));
+        hash = content_hash_mix(hash, k);
+    }
+    if (len) {
+        k = 0;
+        memcpy(&k, data, len);
+        hash = content_hash_mix(hash, k);
+    }
+    return hash;
+}
+
+/* returns the next bytes of the pixels of the bitmap, without the stride
+ * padding, from the position given by @chunk and @offset */
+static const uint8_t *bitmap_content_next(SpiceBitmap *bitmap, uint32_t *chunk,
+                                          uint32_t *offset, size_t *len)
+{
+    uint32_t line_size = bitmap->x * bitmap_fmt_get_bytes_per_pixel(bitmap->format);
+
+    for (; *chunk < bitmap->data->num_chunks; ++*chunk, *offset = 0) {
+        const SpiceChunk *c = &bitmap->data->chunk[*chunk];
+        if (*offset >= c->len) {
+            continue;
+        }
+        const uint8_t *data = c->data + *offset;
+        if (line_size == bitmap->stride) {
+            *len = c->len - *offset;
+            *offset = c->len;
+        } else {
+            *len = MIN(line_size, c->len - *offset);
+            *offset += bitmap->stride;
+        }
+        return data;
+    }
+    return NULL;
+}
+
+uint64_t bitmap_get_content_hash(SpiceBitmap *bitmap)
+{
+    uint32_t chunk = 0, offset = 0;
+    const uint8_t *data;
+    uint64_t hash;
+    size_t len;
+
+    spice_return_val_if_fail(bitmap_fmt_is_rgb(bitmap->format), 0);
+
+    hash = content_hash_mix(UINT64_C(0x5350494345), bitmap->format);
+    hash = content_hash_mix(hash, ((uint64_t) bitmap->x << 32) | bitmap->y);
+    hash = content_hash_mix(hash, bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN);
+
+    while ((data = bitmap_content_next(bitmap, &chunk, &offset, &len)) != NULL) {
+        hash = content_hash_update(hash, data, len);
+    }
+
+    hash ^= hash >> 47;
+    hash *= CONTENT_HASH_MUL;
+    hash ^= hash >> 47;
+    return hash ? hash : 1;
+}
+
+size_t bitmap_get_content_size(SpiceBitmap *bitmap)
+{
+    uint32_t chunk = 0, offset = 0;
+    size_t size = 0, len;
+
+    while (bitmap_content_next(bitmap, &chunk, &offset, &len)) {
+        size += len;
+    }
+    return size;
+}
+
+uint8_t *bitmap_get_content(SpiceBitmap *bitmap, size_t *size)
+{
+    uint32_t chunk = 0, offset = 0;
+    const uint8_t *data;
+    size_t len;
+
+    *size = bitmap_get_content_size(bitmap);
+    uint8_t *content = g_malloc(*size);
+    uint8_t *pos = content;
+    while ((data = bitmap_content_next(bitmap, &chunk, &offset, &len)) != NULL) {
+        memcpy(pos, data, len);
+        pos += len;
+    }
+    return content;
+}
+
+bool bitmap_content_equal(SpiceBitmap *bitmap, const uint8_t *content, size_t size)
+{
+    uint32_t chunk = 0, offset = 0;
+    const uint8_t *data;
+    size_t len;
+
+    while ((data = bitmap_content_next(bitmap, &chunk, &offset, &len)) != NULL) {
+        if (len > size || memcmp(data, content, len) != 0) {
+            return false;
+        }
+        content += len;
+        size -= len;
+    }
+    return size == 0;
+}
+
 int spice_bitmap_from_surface_type(uint32_t surface_format)
 {
     switch (surface_format) {
@@ -85,8 +85,27 @@ static inline int bitmap_fmt_has_graduality(uint8_t fmt)
 }
 
 
+/* Implementations of the graduality score, selected at runtime by
+ * BITMAP_GRADUALITY_IMPL_AUTO. All give the same results. */
+typedef enum {
+    BITMAP_GRADUALITY_IMPL_AUTO,
+    BITMAP_GRADUALITY_IMPL_SCALAR,
+    BITMAP_GRADUALITY_IMPL_SSE2,
+    BITMAP_GRADUALITY_IMPL_AVX2,
+} BitmapGradualityImpl;
+
+bool              bitmap_graduality_impl_available(BitmapGradualityImpl impl);
+double            bitmap_get_graduality_score     (SpiceBitmap *bitmap, BitmapGradualityImpl impl);
 BitmapGradualType bitmap_get_graduality_level     (SpiceBitmap *bitmap);
 int               bitmap_has_extra_stride         (SpiceBitmap *bitmap);
+/* 64 bit hash of the pixels of a RGB bitmap, the stride padding is ignored.
+ * Never returns 0 */
+uint64_t          bitmap_get_content_hash         (SpiceBitmap *bitmap);
+/* the pixels hashed by bitmap_get_content_hash, packed without padding */
+size_t            bitmap_get_content_size         (SpiceBitmap *bitmap);
+uint8_t          *bitmap_get_content              (SpiceBitmap *bitmap, size_t *size);
+bool              bitmap_content_equal            (SpiceBitmap *bitmap,
+                                                   const uint8_t *content, size_t size);
 
 void dump_bitmap(SpiceBitmap *bitmap);
 
@@ -144,6 +144,58 @@ static void FNAME(compute_lines_gradual_score)(PIXEL *lines, int width, int num_
     (*o_num_samples) = num_samples * 3;
 }
 
+static inline uint32_t FNAME(pixel_to_rgb)(PIXEL pix)
+{
+    return ((uint32_t) GET_r(pix) << 16) | ((uint32_t) GET_g(pix) << 8) | GET_b(pix);
+}
+
+/* Same as compute_lines_gradual_score but the samples are collected in
+ * batches of normalized pixels which are classified by count_func */
+static void FNAME(compute_lines_gradual_score_batched)(PIXEL *lines, int width, int num_lines,
+                                                       graduality_count_func_t count_func,
+                                                       double *o_samples_sum_score,
+                                                       int *o_num_samples)
+{
+    int jump = (SAMPLE_JUMP % width) ? SAMPLE_JUMP : SAMPLE_JUMP - 1;
+    PIXEL *cur_pix = lines + width / 2;
+    PIXEL *bottom_pix;
+    PIXEL *last_line = lines + (num_lines - 1) * width;
+    int num_samples = 0;
+    int n = 0;
+    uint32_t p0[GRADUALITY_BATCH_SIZE], p1[GRADUALITY_BATCH_SIZE];
+    uint32_t p2[GRADUALITY_BATCH_SIZE], p3[GRADUALITY_BATCH_SIZE];
+    GradualityCounts counts = { 0, 0, 0, 0 };
+
+    if ((width <= 1) || (num_lines <= 1)) {
+        *o_num_samples = 1;
+        *o_samples_sum_score = 1.0;
+        return;
+    }
+
+    while (cur_pix < last_line) {
+        if ((cur_pix + 1 - lines) % width == 0) { // last pixel in the row
+            cur_pix--; // jump is bigger than 1 so we will not enter endless loop
+        }
+        bottom_pix = cur_pix + width;
+        p0[n] = FNAME(pixel_to_rgb)(cur_pix[0]);
+        p1[n] = FNAME(pixel_to_rgb)(cur_pix[1]);
+        p2[n] = FNAME(pixel_to_rgb)(bottom_pix[0]);
+        p3[n] = FNAME(pixel_to_rgb)(bottom_pix[1]);
+        if (++n == GRADUALITY_BATCH_SIZE) {
+            count_func(p0, p1, p2, p3, n, CONTRAST_TH, &counts);
+            n = 0;
+        }
+        num_samples++;
+        cur_pix += jump;
+    }
+    if (n) {
+        count_func(p0, p1, p2, p3, n, CONTRAST_TH, &counts);
+    }
+
+    (*o_samples_sum_score) = graduality_counts_to_score(&counts);
+    (*o_num_samples) = num_samples * 3;
+}
+
 #undef PIXEL
 #undef FNAME
 #undef GET_r
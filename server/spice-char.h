@@ -30,15 +30,27 @@ SPICE_BEGIN_DECLS
 
 #define SPICE_INTERFACE_CHAR_DEVICE "char_device"
 #define SPICE_INTERFACE_CHAR_DEVICE_MAJOR 1
-#define SPICE_INTERFACE_CHAR_DEVICE_MINOR 3
+#define SPICE_INTERFACE_CHAR_DEVICE_MINOR 4
 typedef struct SpiceCharDeviceInterface SpiceCharDeviceInterface;
 typedef struct SpiceCharDeviceInstance SpiceCharDeviceInstance;
 typedef struct SpiceCharDeviceState SpiceCharDeviceState;
 
 typedef enum {
     SPICE_CHAR_DEVICE_NOTIFY_WRITABLE = 1 << 0,
+    /* the device implements read_segments/release_segments (since minor 4) */
+    SPICE_CHAR_DEVICE_READ_SEGMENTS = 1 << 1,
 } spice_char_device_flags;
 
+/* a contiguous part of the data read with read_segments */
+typedef struct SpiceCharDeviceSegment {
+    const uint8_t *data;
+    size_t len;
+} SpiceCharDeviceSegment;
+
+/* returned by read_segments when the device cannot buffer more data until
+ * some of the data read in place is released */
+#define SPICE_CHAR_DEVICE_SEGMENTS_FULL (-2)
+
 struct SpiceCharDeviceInterface {
     SpiceBaseInterface base;
 
@@ -73,6 +85,28 @@ struct SpiceCharDeviceInterface {
 
     void (*event)(SpiceCharDeviceInstance *sin, uint8_t event);
     spice_char_device_flags flags;
+
+    /* Used if SPICE_CHAR_DEVICE_READ_SEGMENTS is in flags, along with read.
+     * Read up to len bytes from the character device without copying
+     * them, the bytes read are described by at most max_segments segments.
+     * The bytes are consumed as with read.
+     * Returns the number of segments filled or a value < 0 on errors.
+     * Function can return 0 if no data is available, or
+     * SPICE_CHAR_DEVICE_SEGMENTS_FULL if no more data can be written to the
+     * device until the server releases some of the data it holds.
+     * The data of the segments must stay valid until released with
+     * release_segments.
+     * Function should be implemented as no-blocking.
+     */
+    int (*read_segments)(SpiceCharDeviceInstance *sin, SpiceCharDeviceSegment *segments,
+                         int max_segments, size_t len);
+
+    /* Release the first len bytes read with read_segments and not released
+     * yet. The bytes are released in the order they were read.
+     * It can be called after the device is removed with
+     * spice_server_remove_interface, for the data still used by the server.
+     */
+    void (*release_segments)(SpiceCharDeviceInstance *sin, size_t len);
 };
 
 struct SpiceCharDeviceInstance {
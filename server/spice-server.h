@@ -62,6 +62,30 @@ int spice_server_set_tls(SpiceServer *s, int port,
                          const char *private_key_file, const char *key_passwd,
                          const char *dh_key_file, const char *ciphersuite);
 
+/**
+ * Sets whether each TLS connection gets a thread encrypting and sending its
+ * data. The thread of the channel, for instance a display worker, then
+ * only queues the messages to send instead of encrypting them. Disabled by
+ * default. Only applies to the channels connected after the call.
+ *
+ * @s: the Spice server
+ * @enable: whether to use a writer thread for each TLS connection
+ */
+void spice_server_set_tls_write_offload(SpiceServer *s, int enable);
+
+/**
+ * Sets whether the TLS connections use the TLS implementation of the
+ * kernel (Linux kTLS) to send their data. The channels then write to the
+ * socket directly, and the kernel encrypts the data. The connections fall
+ * back to OpenSSL when OpenSSL, the kernel or the negotiated cipher don't
+ * support it. Disabled by default. Only applies to the connections
+ * established after the call.
+ *
+ * @s: the Spice server
+ * @enable: whether to try using kernel TLS
+ */
+void spice_server_set_tls_kernel_offload(SpiceServer *s, int enable);
+
 int spice_server_add_client(SpiceServer *s, int socket, int skip_auth);
 int spice_server_add_ssl_client(SpiceServer *s, int socket, int skip_auth);
 
@@ -87,6 +111,8 @@ typedef enum {
     SPICE_IMAGE_COMPRESSION_GLZ      = 5,
     SPICE_IMAGE_COMPRESSION_LZ       = 6,
     SPICE_IMAGE_COMPRESSION_LZ4      = 7,
+    /* server only, see below */
+    SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE = 15,
 } spice_image_compression_t;
 #endif
 
@@ -101,6 +127,12 @@ typedef SpiceImageCompression spice_image_compression_t;
 #define SPICE_IMAGE_COMPRESS_LZ SPICE_IMAGE_COMPRESSION_LZ
 #define SPICE_IMAGE_COMPRESS_LZ4 SPICE_IMAGE_COMPRESSION_LZ4
 
+/* Server only value of SpiceImageCompression: the codec used for each
+ * image is chosen per client from the measured encoding time and
+ * compression ratio of the codecs and from the bandwidth and latency
+ * of the client. Since 0.15.0 */
+#define SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE ((SpiceImageCompression) 15)
+
 int spice_server_set_image_compression(SpiceServer *s,
                                        SpiceImageCompression comp);
 SpiceImageCompression spice_server_get_image_compression(SpiceServer *s);
@@ -115,6 +147,91 @@ typedef enum {
 int spice_server_set_jpeg_compression(SpiceServer *s, spice_wan_compression_t comp);
 int spice_server_set_zlib_glz_compression(SpiceServer *s, spice_wan_compression_t comp);
 
+/**
+ * Sets the number of threads used by each display channel client to
+ * compress images out of the display worker thread. 0, the default,
+ * compresses all images in the worker thread.
+ * Only applies to clients connecting after the call.
+ *
+ * @s: the Spice server
+ * @threads: number of threads, at most 16
+ * @return 0 on success, -1 if @threads is too big
+ */
+int spice_server_set_image_compression_threads(SpiceServer *s, unsigned int threads);
+
+/**
+ * Enables lookup of bitmaps in the client pixmap cache by their content,
+ * so that identical bitmaps sent with different ids are not sent again.
+ * Costs a hash of each uncached bitmap. Disabled by default.
+ * Only applies to clients connecting after the call.
+ *
+ * @s: the Spice server
+ * @enable: whether to enable the lookup
+ */
+void spice_server_set_image_dedup(SpiceServer *s, int enable);
+
+#define SPICE_DISPLAY_BATCH_MAX_COMMANDS 256
+
+/**
+ * Makes the display workers fetch up to @max_commands drawing commands
+ * from the QXL device before processing them together. The drawings
+ * fully covered by a later drawing of the same batch are dropped before
+ * reaching the clients. A batch is also processed once @max_time_us
+ * microseconds are spent on it. 0 or 1 command, the default, processes
+ * every command as soon as it is fetched.
+ * Only applies to QXL devices added after the call.
+ *
+ * @s: the Spice server
+ * @max_commands: maximum number of commands of a batch,
+ *                at most SPICE_DISPLAY_BATCH_MAX_COMMANDS
+ * @max_time_us: time budget of a batch in microseconds, 0 for no limit
+ * @return 0 on success, -1 if @max_commands is too big
+ */
+int spice_server_set_display_batch(SpiceServer *s, unsigned int max_commands,
+                                   unsigned int max_time_us);
+
+/**
+ * Defers the rendering of the drawings in the server side surfaces until
+ * their pixels are needed (area updates requested by the guest, images of
+ * the surfaces sent to the clients, migration). The drawings fully covered
+ * by a later one before that are never rendered. Disabled by default.
+ * Only applies to QXL devices added after the call.
+ *
+ * @s: the Spice server
+ * @enable: whether to defer the rendering
+ */
+void spice_server_set_display_deferred_render(SpiceServer *s, int enable);
+
+#define SPICE_DISPLAY_RENDER_MAX_THREADS 16
+
+/**
+ * Sets the number of threads used by each display worker to render the
+ * server side surfaces in parallel. The drawings which do not read any
+ * surface are deferred as with spice_server_set_display_deferred_render()
+ * and the deferred drawings of different surfaces are rendered
+ * concurrently. 0, the default, renders everything in the worker thread.
+ * Only applies to QXL devices added after the call.
+ *
+ * @s: the Spice server
+ * @threads: number of threads, at most SPICE_DISPLAY_RENDER_MAX_THREADS
+ * @return 0 on success, -1 if @threads is too big
+ */
+int spice_server_set_display_render_threads(SpiceServer *s, unsigned int threads);
+
+/**
+ * Enables the detection of the scrolling of the areas repainted by the
+ * guest. When a big image drawn on a surface is mostly the current content
+ * of the area moved up or down, the client is sent a copy of this content
+ * and only the newly exposed strip of the image. Only the images drawn at
+ * the same place as the previous big image are compared with the surface,
+ * so the first step of a scrolling is sent as is. Disabled by default.
+ * Only applies to QXL devices added after the call.
+ *
+ * @s: the Spice server
+ * @enable: whether to detect the scrolling
+ */
+void spice_server_set_display_scroll_detection(SpiceServer *s, int enable);
+
 #define SPICE_CHANNEL_SECURITY_NONE (1 << 0)
 #define SPICE_CHANNEL_SECURITY_SSL (1 << 1)
 
@@ -131,6 +248,23 @@ enum {
 
 int spice_server_set_streaming_video(SpiceServer *s, int value);
 
+/**
+ * Enables the detection of the video streams from the update frequency of
+ * the areas of the screen. Besides the videos whose frames are all drawn at
+ * the same place, this detects the videos which are resized, scrolled or
+ * repainted in several parts. An area is considered for streaming when it
+ * is updated at least @min_fps times per second, and the stream is created
+ * after @frames drawings in this area. 0, the default, for @min_fps only
+ * detects the videos whose frames are drawn at the same place.
+ * Only applies to QXL devices added after the call.
+ *
+ * @s: the Spice server
+ * @min_fps: update frequency of the areas to stream, 0 to disable
+ * @frames: number of frames before starting a stream, 0 for the default
+ */
+void spice_server_set_streaming_video_detection(SpiceServer *s, unsigned int min_fps,
+                                                unsigned int frames);
+
 enum {
     SPICE_STREAMING_INVALID,
     SPICE_STREAMING_SPICE,
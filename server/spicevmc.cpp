@@ -32,11 +32,16 @@
 #include "red-channel.h"
 #include "red-channel-client.h"
 #include "reds.h"
+#include "red-slab.h"
 #include "migration-protocol.h"
 
 /* 64K should be enough for all but the largest writes + 32 bytes hdr */
 #define BUF_SIZE (64 * 1024 + 32)
+/* room for the LZ4 compression of BUF_SIZE bytes (LZ4_COMPRESSBOUND) */
+#define ITEM_BUF_SIZE (BUF_SIZE + BUF_SIZE / 255 + 16)
 #define COMPRESS_THRESHOLD 1000
+/* the items are allocated from a slab of the channel */
+#define ITEMS_PER_SLAB_BLOCK 4
 
 // limit of the queued data, at this limit we stop reading from device to
 // avoid DoS
@@ -49,8 +54,10 @@ typedef struct RedVmcPipeItem {
 
     SpiceDataCompressionType type;
     uint32_t uncompressed_data_size;
-    /* writes which don't fit this will get split, this is not a problem */
-    uint8_t buf[BUF_SIZE];
+    /* data read in place from the device, sent instead of buf */
+    RedCharDeviceRead *read;
+    /* writes which don't fit BUF_SIZE will get split, this is not a problem */
+    uint8_t buf[ITEM_BUF_SIZE];
     uint32_t buf_used;
 } RedVmcPipeItem;
 
@@ -84,12 +91,14 @@ struct RedVmcChannel: public RedChannel
     RedCharDeviceWriteBuffer *recv_from_client_buf;
     uint8_t port_opened;
     uint32_t queued_data;
+    RedSlab *item_slab;
     RedStatCounter in_data;
     RedStatCounter in_compressed;
     RedStatCounter in_decompressed;
     RedStatCounter out_data;
     RedStatCounter out_compressed;
     RedStatCounter out_uncompressed;
+    RedStatHistogram out_compress_time;
 };
 
 struct RedVmcChannelUsbredir final: public RedVmcChannel
@@ -145,6 +154,10 @@ RedVmcChannel::RedVmcChannel(RedsState *reds, uint32_t type, uint32_t id):
     stat_init_counter(&out_data, reds, stat, "out_data", TRUE);
     stat_init_counter(&out_compressed, reds, stat, "out_compressed", TRUE);
     stat_init_counter(&out_uncompressed, reds, stat, "out_uncompressed", TRUE);
+    stat_init_histogram(&out_compress_time, reds, stat, "out_compress_time", TRUE);
+
+    item_slab = red_slab_new(sizeof(RedVmcPipeItem), ITEMS_PER_SLAB_BLOCK);
+    red_slab_init_stat(item_slab, reds, stat, "items");
 
 #ifdef USE_LZ4
     set_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4);
@@ -159,6 +172,8 @@ RedVmcChannel::~RedVmcChannel()
     if (pipe_item) {
         red_pipe_item_unref(&pipe_item->base);
     }
+    /* the items still queued are freed later */
+    red_slab_destroy(item_slab);
 }
 
 static red::shared_ptr<RedVmcChannel> red_vmc_channel_new(RedsState *reds, uint8_t channel_type)
@@ -200,6 +215,27 @@ enum {
     RED_PIPE_ITEM_TYPE_PORT_EVENT,
 };
 
+static void spicevmc_pipe_item_free(RedPipeItem *base)
+{
+    RedVmcPipeItem *item = SPICE_UPCAST(RedVmcPipeItem, base);
+
+    RedCharDevice::read_release(item->read);
+    red_slab_free(item);
+}
+
+static RedVmcPipeItem *spicevmc_pipe_item_new(RedVmcChannel *channel)
+{
+    RedVmcPipeItem *item = (RedVmcPipeItem *) red_slab_alloc(channel->item_slab);
+
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_SPICEVMC_DATA,
+                            spicevmc_pipe_item_free);
+    item->type = SPICE_DATA_COMPRESSION_TYPE_NONE;
+    item->uncompressed_data_size = 0;
+    item->read = NULL;
+    item->buf_used = 0;
+    return item;
+}
+
 /* n is the data size (uncompressed)
  * msg_item -- the current pipe item with the uncompressed data
  * This function returns:
@@ -207,29 +243,38 @@ enum {
  *  - a new pipe item with the compressed data in it upon success
  */
 #ifdef USE_LZ4
+static bool can_compress_lz4(RedVmcChannel *channel)
+{
+    if (red_stream_get_family(channel->rcc->get_stream()) == AF_UNIX) {
+        /* AF_LOCAL - data will not be compressed */
+        return false;
+    }
+    if (!channel->rcc->test_remote_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4)) {
+        /* Client doesn't have compression cap - data will not be compressed */
+        return false;
+    }
+    return true;
+}
+
 static RedVmcPipeItem* try_compress_lz4(RedVmcChannel *channel, int n, RedVmcPipeItem *msg_item)
 {
     RedVmcPipeItem *msg_item_compressed;
     int compressed_data_count;
 
-    if (red_stream_get_family(channel->rcc->get_stream()) == AF_UNIX) {
-        /* AF_LOCAL - data will not be compressed */
-        return NULL;
-    }
     if (n <= COMPRESS_THRESHOLD) {
         /* n <= threshold - data will not be compressed */
         return NULL;
     }
-    if (!channel->rcc->test_remote_cap(SPICE_SPICEVMC_CAP_DATA_COMPRESS_LZ4)) {
-        /* Client doesn't have compression cap - data will not be compressed */
+    if (!can_compress_lz4(channel)) {
         return NULL;
     }
-    msg_item_compressed = g_new0(RedVmcPipeItem, 1);
-    red_pipe_item_init(&msg_item_compressed->base, RED_PIPE_ITEM_TYPE_SPICEVMC_DATA);
+    stat_time_t start = stat_histogram_start();
+    msg_item_compressed = spicevmc_pipe_item_new(channel);
     compressed_data_count = LZ4_compress_default((char*)&msg_item->buf,
                                                  (char*)&msg_item_compressed->buf,
                                                  n,
                                                  BUF_SIZE);
+    stat_histogram_add_time(&channel->out_compress_time, start);
 
     if (compressed_data_count > 0 && compressed_data_count < n) {
         stat_inc_counter(channel->out_uncompressed, n);
@@ -237,12 +282,12 @@ static RedVmcPipeItem* try_compress_lz4(RedVmcChannel *channel, int n, RedVmcPip
         msg_item_compressed->type = SPICE_DATA_COMPRESSION_TYPE_LZ4;
         msg_item_compressed->uncompressed_data_size = n;
         msg_item_compressed->buf_used = compressed_data_count;
-        g_free(msg_item);
+        red_pipe_item_unref(&msg_item->base);
         return msg_item_compressed;
     }
 
     /* LZ4 compression failed or did non compress, fallback a non-compressed data is to be sent */
-    g_free(msg_item_compressed);
+    red_pipe_item_unref(&msg_item_compressed->base);
     return NULL;
 }
 #endif
@@ -257,16 +302,33 @@ RedPipeItem* RedCharDeviceSpiceVmc::read_one_msg_from_device()
     }
 
     if (!channel->pipe_item) {
-        msg_item = g_new0(RedVmcPipeItem, 1);
-        msg_item->type = SPICE_DATA_COMPRESSION_TYPE_NONE;
-        red_pipe_item_init(&msg_item->base, RED_PIPE_ITEM_TYPE_SPICEVMC_DATA);
+        msg_item = spicevmc_pipe_item_new(channel.get());
     } else {
         spice_assert(channel->pipe_item->buf_used == 0);
         msg_item = channel->pipe_item;
         channel->pipe_item = NULL;
     }
 
-    n = read(msg_item->buf, sizeof(msg_item->buf));
+    /* the data is sent as it is, no need to copy it */
+#ifdef USE_LZ4
+    if (can_read_segments() && !can_compress_lz4(channel.get())) {
+#else
+    if (can_read_segments()) {
+#endif
+        msg_item->read = read_segments(BUF_SIZE);
+        if (!msg_item->read) {
+            channel->pipe_item = msg_item;
+            return NULL;
+        }
+        n = msg_item->read->size;
+        stat_inc_counter(channel->out_data, n);
+        msg_item->uncompressed_data_size = n;
+        msg_item->buf_used = n;
+        spicevmc_red_channel_queue_data(channel.get(), msg_item);
+        return NULL;
+    }
+
+    n = read(msg_item->buf, BUF_SIZE);
     if (n > 0) {
         spice_debug("read from dev %d", n);
 #ifdef USE_LZ4
@@ -531,9 +593,18 @@ static void spicevmc_red_channel_send_data(VmcChannelClient *rcc,
         };
         spice_marshall_SpiceMsgCompressedData(m, &compressed_msg);
     }
-    red_pipe_item_ref(item);
-    spice_marshaller_add_by_ref_full(m, i->buf, i->buf_used,
-                                     marshaller_unref_pipe_item, item);
+    if (i->read) {
+        for (int n = 0; n < i->read->num_segments; n++) {
+            red_pipe_item_ref(item);
+            spice_marshaller_add_by_ref_full(m, (uint8_t *) i->read->segments[n].data,
+                                             i->read->segments[n].len,
+                                             marshaller_unref_pipe_item, item);
+        }
+    } else {
+        red_pipe_item_ref(item);
+        spice_marshaller_add_by_ref_full(m, i->buf, i->buf_used,
+                                         marshaller_unref_pipe_item, item);
+    }
 
     // account for sent data and wake up device if was blocked
     uint32_t old_queued_data = channel->queued_data;
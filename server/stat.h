@@ -18,7 +18,10 @@
 #ifndef STAT_H_
 #define STAT_H_
 
+#include <stdbool.h>
 #include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <glib.h>
 
 #include "spice-wrapped.h"
@@ -40,6 +43,33 @@ typedef struct {
     uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
 } RedStatNode;
 
+/* Histograms have log-linear buckets: one bucket below 2^MIN_SHIFT,
+ * 2^SUB_SHIFT buckets for each power of two up to 2^MAX_SHIFT and one
+ * bucket above. With nanoseconds this goes from 1us to 17s with an error
+ * under 25%. */
+#define STAT_HISTOGRAM_MIN_SHIFT 10
+#define STAT_HISTOGRAM_MAX_SHIFT 34
+#define STAT_HISTOGRAM_SUB_SHIFT 2
+#define STAT_HISTOGRAM_BUCKETS \
+    (((STAT_HISTOGRAM_MAX_SHIFT - STAT_HISTOGRAM_MIN_SHIFT) << STAT_HISTOGRAM_SUB_SHIFT) + 2)
+
+/* A histogram is published as a node with the "count" and "sum" counters
+ * and a "lt_<limit>" counter for each bucket used, so the buckets sort by
+ * their limit. The buckets are added to the file when first used. */
+typedef struct {
+#ifdef RED_STATISTICS
+    SpiceServer *reds;
+    RedStatNode node;
+    int visible;
+    uint64_t *count;
+    uint64_t *sum;
+    uint64_t *buckets[STAT_HISTOGRAM_BUCKETS];
+    /* where the samples go if a bucket does not fit in the file */
+    uint64_t lost;
+#endif
+    uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
+} RedStatHistogram;
+
 #ifdef RED_STATISTICS
 void stat_init_node(RedStatNode *node, SpiceServer *reds,
                     const RedStatNode *parent, const char *name, int visible);
@@ -47,6 +77,9 @@ void stat_remove_node(SpiceServer *reds, RedStatNode *node);
 void stat_init_counter(RedStatCounter *counter, SpiceServer *reds,
                        const RedStatNode *parent, const char *name, int visible);
 void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter);
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible);
+uint64_t *stat_histogram_add_bucket(RedStatHistogram *histogram, unsigned int bucket);
 
 #else
 
@@ -71,6 +104,12 @@ static inline void
 stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
 {
 }
+
+static inline void
+stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                    const RedStatNode *parent, const char *name, int visible)
+{
+}
 #endif /* RED_STATISTICS */
 
 static inline void
@@ -83,6 +122,17 @@ stat_inc_counter(RedStatCounter counter, uint64_t value)
 #endif
 }
 
+/* for the counters holding a current value rather than a total */
+static inline void
+stat_set_counter(RedStatCounter counter, uint64_t value)
+{
+#ifdef RED_STATISTICS
+    if (counter.counter) {
+        *(counter.counter) = value;
+    }
+#endif
+}
+
 typedef uint64_t stat_time_t;
 
 static inline stat_time_t stat_now(clockid_t clock_id)
@@ -93,6 +143,89 @@ static inline stat_time_t stat_now(clockid_t clock_id)
     return ts.tv_nsec + (uint64_t) ts.tv_sec * (1000 * 1000 * 1000);
 }
 
+static inline unsigned int stat_histogram_bucket(uint64_t value)
+{
+    unsigned int shift;
+
+    if (value < (UINT64_C(1) << STAT_HISTOGRAM_MIN_SHIFT)) {
+        return 0;
+    }
+    if (value >= (UINT64_C(1) << STAT_HISTOGRAM_MAX_SHIFT)) {
+        return STAT_HISTOGRAM_BUCKETS - 1;
+    }
+    shift = 63 - __builtin_clzll(value);
+    return 1 + ((shift - STAT_HISTOGRAM_MIN_SHIFT) << STAT_HISTOGRAM_SUB_SHIFT) +
+           ((value >> (shift - STAT_HISTOGRAM_SUB_SHIFT)) &
+            ((1u << STAT_HISTOGRAM_SUB_SHIFT) - 1));
+}
+
+/* the values of @bucket are lower than its limit, the last bucket has none */
+static inline uint64_t stat_histogram_bucket_limit(unsigned int bucket)
+{
+    unsigned int shift, sub;
+
+    if (bucket == 0) {
+        return UINT64_C(1) << STAT_HISTOGRAM_MIN_SHIFT;
+    }
+    if (bucket >= STAT_HISTOGRAM_BUCKETS - 1) {
+        return UINT64_MAX;
+    }
+    shift = STAT_HISTOGRAM_MIN_SHIFT + ((bucket - 1) >> STAT_HISTOGRAM_SUB_SHIFT);
+    sub = (bucket - 1) & ((1u << STAT_HISTOGRAM_SUB_SHIFT) - 1);
+    return (UINT64_C(1) << shift) + ((uint64_t) (sub + 1) << (shift - STAT_HISTOGRAM_SUB_SHIFT));
+}
+
+static inline void stat_histogram_bucket_name(unsigned int bucket, char *name, size_t size)
+{
+    if (bucket >= STAT_HISTOGRAM_BUCKETS - 1) {
+        snprintf(name, size, "lt_inf");
+    } else {
+        snprintf(name, size, "lt_%011" PRIu64, stat_histogram_bucket_limit(bucket));
+    }
+}
+
+/* can be called from any thread */
+static inline void stat_histogram_add(G_GNUC_UNUSED RedStatHistogram *histogram,
+                                      G_GNUC_UNUSED uint64_t value)
+{
+#ifdef RED_STATISTICS
+    unsigned int bucket;
+    uint64_t *counter;
+
+    if (!histogram->count) {
+        return;
+    }
+    bucket = stat_histogram_bucket(value);
+    counter = __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_ACQUIRE);
+    if (G_UNLIKELY(counter == NULL)) {
+        counter = stat_histogram_add_bucket(histogram, bucket);
+    }
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(histogram->count, 1, __ATOMIC_RELAXED);
+#endif
+}
+
+/* start of a time given to stat_histogram_add_time() */
+static inline stat_time_t stat_histogram_start(void)
+{
+#ifdef RED_STATISTICS
+    return stat_now(CLOCK_MONOTONIC);
+#else
+    return 0;
+#endif
+}
+
+static inline void stat_histogram_add_time(G_GNUC_UNUSED RedStatHistogram *histogram,
+                                           G_GNUC_UNUSED stat_time_t start)
+{
+#ifdef RED_STATISTICS
+    if (histogram->count) {
+        stat_histogram_add(histogram, stat_now(CLOCK_MONOTONIC) - start);
+    }
+#endif
+}
+
 typedef struct {
 #if defined(RED_WORKER_STAT) || defined(COMPRESS_STAT)
     stat_time_t time;
@@ -160,6 +293,21 @@ static inline void stat_compress_init(G_GNUC_UNUSED stat_info_t *info,
     stat_init(info, name, clock);
 }
 
+#ifdef COMPRESS_STAT
+/* sets *@value to @time if @time is greater (@greater) or smaller */
+static inline void stat_time_atomic_update(stat_time_t *value, stat_time_t time, bool greater)
+{
+    stat_time_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+
+    while ((greater ? time > current : time < current) &&
+           !__atomic_compare_exchange_n(value, &current, time, true,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+#endif
+
+/* the images are also compressed by the threads of the encoders pool, the
+ * updates of @info are atomic */
 static inline void stat_compress_add(G_GNUC_UNUSED stat_info_t *info,
                                      G_GNUC_UNUSED stat_start_time_t start,
                                      G_GNUC_UNUSED int orig_size,
@@ -167,13 +315,13 @@ static inline void stat_compress_add(G_GNUC_UNUSED stat_info_t *info,
 {
 #ifdef COMPRESS_STAT
     stat_time_t time;
-    ++info->count;
+    __atomic_fetch_add(&info->count, 1, __ATOMIC_RELAXED);
     time = stat_now(info->clock) - start.time;
-    info->total += time;
-    info->max = MAX(info->max, time);
-    info->min = MIN(info->min, time);
-    info->orig_size += orig_size;
-    info->comp_size += comp_size;
+    __atomic_fetch_add(&info->total, time, __ATOMIC_RELAXED);
+    stat_time_atomic_update(&info->max, time, true);
+    stat_time_atomic_update(&info->min, time, false);
+    __atomic_fetch_add(&info->orig_size, (uint64_t) orig_size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&info->comp_size, (uint64_t) comp_size, __ATOMIC_RELAXED);
 #endif
 }
 
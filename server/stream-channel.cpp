@@ -22,6 +22,7 @@
 #include <spice/stream-device.h>
 
 #include "red-channel-client.h"
+#include "char-device.h"
 #include "stream-channel.h"
 #include "reds.h"
 #include "common-graphics-channel.h"
@@ -75,6 +76,8 @@ typedef struct StreamCreateItem {
 typedef struct StreamDataItem {
     RedPipeItem base;
     StreamChannel *channel;
+    // data read in place from the device, sent instead of data.data
+    GPtrArray *reads;
     // NOTE: this must be the last field in the structure
     SpiceMsgDisplayStreamData data;
 } StreamDataItem;
@@ -234,9 +237,21 @@ void StreamChannelClient::send_item(RedPipeItem *pipe_item)
         StreamDataItem *item = SPICE_UPCAST(StreamDataItem, pipe_item);
         init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA);
         spice_marshall_msg_display_stream_data(m, &item->data);
-        red_pipe_item_ref(pipe_item);
-        spice_marshaller_add_by_ref_full(m, item->data.data, item->data.data_size,
-                                         marshaller_unref_pipe_item, pipe_item);
+        if (item->reads) {
+            for (guint i = 0; i < item->reads->len; i++) {
+                auto read = (RedCharDeviceRead *) g_ptr_array_index(item->reads, i);
+                for (int n = 0; n < read->num_segments; n++) {
+                    red_pipe_item_ref(pipe_item);
+                    spice_marshaller_add_by_ref_full(m, (uint8_t *) read->segments[n].data,
+                                                     read->segments[n].len,
+                                                     marshaller_unref_pipe_item, pipe_item);
+                }
+            }
+        } else {
+            red_pipe_item_ref(pipe_item);
+            spice_marshaller_add_by_ref_full(m, item->data.data, item->data.data_size,
+                                             marshaller_unref_pipe_item, pipe_item);
+        }
         record(stream_channel_data, "Stream data packet size %u mm_time %u",
                item->data.data_size, item->data.base.multi_media_time);
         break;
@@ -460,6 +475,9 @@ StreamChannel::data_item_free(RedPipeItem *base)
 
     pipe_item->channel->update_queue_stat(-1, -pipe_item->data.data_size);
 
+    if (pipe_item->reads) {
+        g_ptr_array_unref(pipe_item->reads);
+    }
     g_free(pipe_item);
 }
 
@@ -480,12 +498,34 @@ StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
     item->data.base.multi_media_time = mm_time;
     item->data.data_size = size;
     item->channel = this;
+    item->reads = NULL;
     update_queue_stat(1, size);
     // TODO try to optimize avoiding the copy
     memcpy(item->data.data, data, size);
     pipes_add(&item->base);
 }
 
+void
+StreamChannel::send_data(GPtrArray *reads, size_t size, uint32_t mm_time)
+{
+    if (stream_id < 0) {
+        // see above
+        g_ptr_array_unref(reads);
+        return;
+    }
+
+    StreamDataItem *item = g_new(StreamDataItem, 1);
+    red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_STREAM_DATA,
+                            data_item_free);
+    item->data.base.id = stream_id;
+    item->data.base.multi_media_time = mm_time;
+    item->data.data_size = size;
+    item->channel = this;
+    item->reads = reads;
+    update_queue_stat(1, size);
+    pipes_add(&item->base);
+}
+
 void
 StreamChannel::register_start_cb(stream_channel_start_proc cb, void *opaque)
 {
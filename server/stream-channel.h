@@ -63,6 +63,9 @@ struct StreamChannel final: public RedChannel
 
     void change_format(const struct StreamMsgFormat *fmt);
     void send_data(const void *data, size_t size, uint32_t mm_time);
+    /* sends the data of @reads, an array of RedCharDeviceRead of @size bytes
+     * in total, without copying it, takes ownership of the array */
+    void send_data(GPtrArray *reads, size_t size, uint32_t mm_time);
 
     void register_start_cb(stream_channel_start_proc cb, void *opaque);
     void register_queue_stat_cb(stream_channel_queue_stat_proc cb, void *opaque);
@@ -0,0 +1,192 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "stream-grid.h"
+
+#define CELL_SIZE STREAM_GRID_CELL_SIZE
+#define CELL_SHIFT STREAM_GRID_CELL_SHIFT
+
+/* span of cells, end excluded */
+typedef struct CellSpan {
+    uint32_t col0, col1;
+    uint32_t row0, row1;
+} CellSpan;
+
+void stream_grid_init(StreamGrid *grid, uint32_t width, uint32_t height,
+                      uint64_t window_time, uint32_t hot_updates)
+{
+    size_t num_cells;
+
+    g_free(grid->cells);
+    g_free(grid->queue);
+    grid->width = width;
+    grid->height = height;
+    grid->cols = (width + CELL_SIZE - 1) >> CELL_SHIFT;
+    grid->rows = (height + CELL_SIZE - 1) >> CELL_SHIFT;
+    grid->window_time = MAX(window_time, 1);
+    grid->hot_updates = CLAMP(hot_updates, 1, G_MAXUINT16);
+    grid->visit = 0;
+    num_cells = (size_t) grid->cols * grid->rows;
+    grid->cells = g_new0(StreamGridCell, num_cells);
+    grid->queue = g_new(uint32_t, num_cells);
+}
+
+void stream_grid_destroy(StreamGrid *grid)
+{
+    g_free(grid->cells);
+    g_free(grid->queue);
+    memset(grid, 0, sizeof(*grid));
+}
+
+static bool span_touched(const StreamGrid *grid, const SpiceRect *rect, CellSpan *span)
+{
+    int32_t left = MAX(rect->left, 0);
+    int32_t top = MAX(rect->top, 0);
+    int32_t right = MIN(rect->right, (int32_t) grid->width);
+    int32_t bottom = MIN(rect->bottom, (int32_t) grid->height);
+
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+    span->col0 = left >> CELL_SHIFT;
+    span->col1 = (right + CELL_SIZE - 1) >> CELL_SHIFT;
+    span->row0 = top >> CELL_SHIFT;
+    span->row1 = (bottom + CELL_SIZE - 1) >> CELL_SHIFT;
+    return true;
+}
+
+static inline uint32_t time_window(const StreamGrid *grid, uint64_t time)
+{
+    return time / grid->window_time;
+}
+
+static inline bool cell_is_hot(const StreamGrid *grid, const StreamGridCell *cell,
+                               uint32_t window)
+{
+    if (cell->window == window) {
+        return MAX(cell->updates, cell->prev_updates) >= grid->hot_updates;
+    }
+    /* only the previous window is complete */
+    return cell->window + 1 == window && cell->updates >= grid->hot_updates;
+}
+
+void stream_grid_update(StreamGrid *grid, const SpiceRect *rect, uint64_t time)
+{
+    uint32_t window = time_window(grid, time);
+    CellSpan span;
+    uint32_t row, col;
+
+    if (!span_touched(grid, rect, &span)) {
+        return;
+    }
+    for (row = span.row0; row < span.row1; row++) {
+        StreamGridCell *cell = &grid->cells[(size_t) row * grid->cols + span.col0];
+
+        for (col = span.col0; col < span.col1; col++, cell++) {
+            if (cell->window != window) {
+                cell->prev_updates = cell->window + 1 == window ? cell->updates : 0;
+                cell->updates = 0;
+                cell->window = window;
+            }
+            if (cell->updates < G_MAXUINT16) {
+                cell->updates++;
+            }
+        }
+    }
+}
+
+bool stream_grid_get_hot_area(StreamGrid *grid, const SpiceRect *rect, uint64_t time,
+                              SpiceRect *out_area)
+{
+    uint32_t window = time_window(grid, time);
+    uint32_t head = 0, tail = 0;
+    CellSpan span, area;
+    uint32_t row, col;
+
+    if (!span_touched(grid, rect, &span)) {
+        return false;
+    }
+    for (row = span.row0; row < span.row1; row++) {
+        for (col = span.col0; col < span.col1; col++) {
+            if (!cell_is_hot(grid, &grid->cells[(size_t) row * grid->cols + col], window)) {
+                return false;
+            }
+        }
+    }
+
+    /* flood the hot cells from the ones of @rect */
+    if (++grid->visit == 0) {
+        uint32_t i;
+
+        for (i = 0; i < grid->cols * grid->rows; i++) {
+            grid->cells[i].visit = 0;
+        }
+        grid->visit = 1;
+    }
+    area = span;
+    for (row = span.row0; row < span.row1; row++) {
+        for (col = span.col0; col < span.col1; col++) {
+            uint32_t index = row * grid->cols + col;
+
+            grid->cells[index].visit = grid->visit;
+            grid->queue[tail++] = index;
+        }
+    }
+    while (head < tail) {
+        uint32_t index = grid->queue[head++];
+        uint32_t neighbours[4];
+        unsigned int i, n = 0;
+
+        row = index / grid->cols;
+        col = index % grid->cols;
+        area.col0 = MIN(area.col0, col);
+        area.col1 = MAX(area.col1, col + 1);
+        area.row0 = MIN(area.row0, row);
+        area.row1 = MAX(area.row1, row + 1);
+        if (col > 0) {
+            neighbours[n++] = index - 1;
+        }
+        if (col + 1 < grid->cols) {
+            neighbours[n++] = index + 1;
+        }
+        if (row > 0) {
+            neighbours[n++] = index - grid->cols;
+        }
+        if (row + 1 < grid->rows) {
+            neighbours[n++] = index + grid->cols;
+        }
+        for (i = 0; i < n; i++) {
+            StreamGridCell *cell = &grid->cells[neighbours[i]];
+
+            if (cell->visit != grid->visit && cell_is_hot(grid, cell, window)) {
+                cell->visit = grid->visit;
+                grid->queue[tail++] = neighbours[i];
+            }
+        }
+    }
+
+    out_area->left = area.col0 << CELL_SHIFT;
+    out_area->top = area.row0 << CELL_SHIFT;
+    out_area->right = MIN(area.col1 << CELL_SHIFT, grid->width);
+    out_area->bottom = MIN(area.row1 << CELL_SHIFT, grid->height);
+    return true;
+}
@@ -0,0 +1,80 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAM_GRID_H_
+#define STREAM_GRID_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <spice/macros.h>
+#include <common/draw.h>
+
+SPICE_BEGIN_DECLS
+
+/* Update frequency of the areas of a surface, tracked on a coarse grid of
+ * cells. The time is split in windows and each cell counts the updates of
+ * the current and of the previous window. A cell is hot when one of these
+ * counts reaches the threshold, so an area updated at a steady rate stays
+ * hot for up to 2 windows after its last update.
+ *
+ * The hot cells connected to the ones of a drawing give the area of a
+ * video even when it is painted in several parts, or resized or moved a
+ * little from frame to frame.
+ */
+#define STREAM_GRID_CELL_SHIFT 6
+#define STREAM_GRID_CELL_SIZE (1 << STREAM_GRID_CELL_SHIFT)
+
+typedef struct StreamGridCell {
+    /* index of the window of the last update */
+    uint32_t window;
+    uint16_t updates;
+    uint16_t prev_updates;
+    /* serial of the last search going through the cell */
+    uint32_t visit;
+} StreamGridCell;
+
+typedef struct StreamGrid {
+    uint32_t width;
+    uint32_t height;
+    uint32_t cols;
+    uint32_t rows;
+    uint64_t window_time;
+    uint32_t hot_updates;
+    uint32_t visit;
+    StreamGridCell *cells;
+    /* cells left to visit by a search */
+    uint32_t *queue;
+} StreamGrid;
+
+/* @grid must be zeroed or destroyed. A cell is hot when it is updated at
+ * least @hot_updates times in a window of @window_time ns */
+void stream_grid_init(StreamGrid *grid, uint32_t width, uint32_t height,
+                      uint64_t window_time, uint32_t hot_updates);
+void stream_grid_destroy(StreamGrid *grid);
+
+/* counts an update of the cells touched by @rect at @time, the times
+ * must not go backwards */
+void stream_grid_update(StreamGrid *grid, const SpiceRect *rect, uint64_t time);
+/* returns whether all the cells touched by @rect are hot at @time, with the
+ * bounding box of the hot cells connected to them in @out_area */
+bool stream_grid_get_hot_area(StreamGrid *grid, const SpiceRect *rect, uint64_t time,
+                              SpiceRect *out_area);
+
+SPICE_END_DECLS
+
+#endif /* STREAM_GRID_H_ */
@@ -0,0 +1,689 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifndef _WIN32
+#include <poll.h>
+#endif
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/x509.h>
+#include <spice/protocol.h>
+
+#include "sys-socket.h"
+#include "null-client.h"
+
+#ifdef _WIN32
+#define poll WSAPoll
+#endif
+
+/* larger than any message the server sends */
+#define MAX_MESSAGE_SIZE (256 * 1024 * 1024)
+/* the defaults of spice-gtk, in pixels */
+#define PIXMAP_CACHE_SIZE (1024 * 1024 * 80 / 4)
+#define GLZ_WINDOW_SIZE (1024 * 1024 * 12 / 4)
+/* commands kept waiting for their message, the older ones were most likely
+ * dropped by the server */
+#define MAX_PENDING_COMMANDS 65536
+
+#include <spice/start-packed.h>
+typedef struct SPICE_ATTR_PACKED NullLinkMessage {
+    SpiceLinkHeader header;
+    SpiceLinkMess mess;
+    uint32_t common_caps;
+    uint32_t channel_caps;
+} NullLinkMessage;
+
+typedef struct SPICE_ATTR_PACKED NullDisplayInit {
+    uint8_t pixmap_cache_id;
+    int64_t pixmap_cache_size;
+    uint8_t glz_dictionary_id;
+    int32_t glz_dictionary_window_size;
+} NullDisplayInit;
+#include <spice/end-packed.h>
+
+typedef struct PendingCommand {
+    uint32_t surface_id;
+    SpiceRect box;
+    uint64_t time;
+} PendingCommand;
+
+typedef struct NullChannel {
+    int fd;
+    uint32_t ack_window;
+    uint32_t ack_count;
+    GByteArray *message;
+} NullChannel;
+
+struct NullClient {
+    bool decode;
+    NullChannel main;
+    NullChannel display;
+    GThread *thread;
+
+    /* protects the fields below */
+    pthread_mutex_t lock;
+    bool running;
+    bool linked;
+    GQueue pending_commands;
+    NullClientStats stats;
+};
+
+static uint64_t now_ns(void)
+{
+    return g_get_monotonic_time() * 1000;
+}
+
+static uint32_t get_u32(const uint8_t *data)
+{
+    uint32_t value;
+
+    memcpy(&value, data, sizeof(value));
+    return GUINT32_FROM_LE(value);
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+    uint8_t *pos = (uint8_t *) buf;
+
+    while (len > 0) {
+        ssize_t n = socket_read(fd, pos, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        pos += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+    const uint8_t *pos = (const uint8_t *) buf;
+
+    while (len > 0) {
+        ssize_t n = socket_write(fd, pos, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        pos += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool write_u32(int fd, uint32_t value)
+{
+    value = GUINT32_TO_LE(value);
+    return write_all(fd, &value, sizeof(value));
+}
+
+static bool channel_send(NullChannel *channel, uint16_t type, const void *data, uint32_t size)
+{
+    SpiceMiniDataHeader header;
+
+    header.type = GUINT16_TO_LE(type);
+    header.size = GUINT32_TO_LE(size);
+    return write_all(channel->fd, &header, sizeof(header)) &&
+           (size == 0 || write_all(channel->fd, data, size));
+}
+
+/* the server of the replay does not check the ticket, an empty one is
+ * encrypted with the key of the link */
+static bool encrypt_ticket(const SpiceLinkReply *reply, uint8_t **ticket, size_t *size)
+{
+    static const unsigned char password[] = "";
+    const unsigned char *key = reply->pub_key;
+    EVP_PKEY *pkey = d2i_PUBKEY(NULL, &key, sizeof(reply->pub_key));
+    EVP_PKEY_CTX *ctx;
+    bool success = false;
+
+    if (pkey == NULL) {
+        return false;
+    }
+    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (ctx != NULL && EVP_PKEY_encrypt_init(ctx) > 0 &&
+        EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) > 0 &&
+        EVP_PKEY_encrypt(ctx, NULL, size, password, sizeof(password)) > 0) {
+        *ticket = (uint8_t *) g_malloc(*size);
+        success = EVP_PKEY_encrypt(ctx, *ticket, size, password, sizeof(password)) > 0;
+        if (!success) {
+            g_free(*ticket);
+        }
+    }
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
+    return success;
+}
+
+static bool channel_link(NullChannel *channel, uint32_t connection_id, uint8_t type,
+                         uint32_t channel_caps)
+{
+    NullLinkMessage link;
+    SpiceLinkHeader header;
+    SpiceLinkReply reply;
+    uint8_t *ticket;
+    size_t ticket_size;
+    uint32_t result;
+    bool sent;
+
+    memset(&link, 0, sizeof(link));
+    link.header.magic = SPICE_MAGIC;
+    link.header.major_version = GUINT32_TO_LE(SPICE_VERSION_MAJOR);
+    link.header.minor_version = GUINT32_TO_LE(SPICE_VERSION_MINOR);
+    link.header.size = GUINT32_TO_LE(sizeof(link) - sizeof(link.header));
+    link.mess.connection_id = GUINT32_TO_LE(connection_id);
+    link.mess.channel_type = type;
+    link.mess.num_common_caps = GUINT32_TO_LE(1);
+    link.mess.num_channel_caps = GUINT32_TO_LE(1);
+    link.mess.caps_offset = GUINT32_TO_LE(sizeof(link.mess));
+    link.common_caps = GUINT32_TO_LE((1 << SPICE_COMMON_CAP_PROTOCOL_AUTH_SELECTION) |
+                                     (1 << SPICE_COMMON_CAP_AUTH_SPICE) |
+                                     (1 << SPICE_COMMON_CAP_MINI_HEADER));
+    link.channel_caps = GUINT32_TO_LE(channel_caps);
+    if (!write_all(channel->fd, &link, sizeof(link))) {
+        return false;
+    }
+
+    /* the reply, followed by the capabilities of the server */
+    if (!read_all(channel->fd, &header, sizeof(header)) ||
+        header.magic != SPICE_MAGIC || GUINT32_FROM_LE(header.size) < sizeof(reply) ||
+        GUINT32_FROM_LE(header.size) > 4096) {
+        return false;
+    }
+    g_byte_array_set_size(channel->message, GUINT32_FROM_LE(header.size));
+    if (!read_all(channel->fd, channel->message->data, channel->message->len)) {
+        return false;
+    }
+    memcpy(&reply, channel->message->data, sizeof(reply));
+    if (GUINT32_FROM_LE(reply.error) != SPICE_LINK_ERR_OK) {
+        return false;
+    }
+
+    if (!write_u32(channel->fd, SPICE_COMMON_CAP_AUTH_SPICE) ||
+        !encrypt_ticket(&reply, &ticket, &ticket_size)) {
+        return false;
+    }
+    sent = write_all(channel->fd, ticket, ticket_size);
+    g_free(ticket);
+    return sent && read_all(channel->fd, &result, sizeof(result)) &&
+           GUINT32_FROM_LE(result) == SPICE_LINK_ERR_OK;
+}
+
+/* reads a message, handling the ones common to all the channels */
+static bool channel_read_message(NullChannel *channel, uint16_t *type)
+{
+    SpiceMiniDataHeader header;
+    uint32_t size;
+    const uint8_t *data;
+
+    if (!read_all(channel->fd, &header, sizeof(header))) {
+        return false;
+    }
+    size = GUINT32_FROM_LE(header.size);
+    if (size > MAX_MESSAGE_SIZE) {
+        return false;
+    }
+    g_byte_array_set_size(channel->message, size);
+    if (!read_all(channel->fd, channel->message->data, size)) {
+        return false;
+    }
+    *type = GUINT16_FROM_LE(header.type);
+    data = channel->message->data;
+
+    switch (*type) {
+    case SPICE_MSG_SET_ACK: {
+        uint32_t generation;
+
+        if (size < 2 * sizeof(uint32_t)) {
+            return false;
+        }
+        generation = GUINT32_TO_LE(get_u32(data));
+        channel->ack_window = get_u32(data + sizeof(uint32_t));
+        channel->ack_count = 0;
+        return channel_send(channel, SPICE_MSGC_ACK_SYNC, &generation, sizeof(generation));
+    }
+    case SPICE_MSG_PING:
+        /* the id and the timestamp are sent back */
+        if (size < sizeof(uint32_t) + sizeof(uint64_t)) {
+            return false;
+        }
+        return channel_send(channel, SPICE_MSGC_PONG, data, sizeof(uint32_t) + sizeof(uint64_t));
+    default:
+        break;
+    }
+
+    if (channel->ack_window && ++channel->ack_count == channel->ack_window) {
+        channel->ack_count = 0;
+        return channel_send(channel, SPICE_MSGC_ACK, NULL, 0);
+    }
+    return true;
+}
+
+static bool link_channels(NullClient *client)
+{
+    NullDisplayInit init;
+    uint32_t session_id;
+    uint16_t type;
+
+    if (!channel_link(&client->main, 0, SPICE_CHANNEL_MAIN, 0)) {
+        return false;
+    }
+    do {
+        if (!channel_read_message(&client->main, &type)) {
+            return false;
+        }
+    } while (type != SPICE_MSG_MAIN_INIT);
+    if (client->main.message->len < sizeof(uint32_t)) {
+        return false;
+    }
+    session_id = get_u32(client->main.message->data);
+
+    if (!channel_link(&client->display, session_id, SPICE_CHANNEL_DISPLAY,
+                      (1 << SPICE_DISPLAY_CAP_SIZED_STREAM) |
+                      (1 << SPICE_DISPLAY_CAP_MONITORS_CONFIG) |
+                      (1 << SPICE_DISPLAY_CAP_COMPOSITE) |
+                      (1 << SPICE_DISPLAY_CAP_A8_SURFACE) |
+                      (1 << SPICE_DISPLAY_CAP_LZ4_COMPRESSION) |
+                      (1 << SPICE_DISPLAY_CAP_MULTI_CODEC) |
+                      (1 << SPICE_DISPLAY_CAP_CODEC_MJPEG))) {
+        return false;
+    }
+    init.pixmap_cache_id = 1;
+    init.pixmap_cache_size = GINT64_TO_LE(PIXMAP_CACHE_SIZE);
+    init.glz_dictionary_id = 1;
+    init.glz_dictionary_window_size = GINT32_TO_LE(GLZ_WINDOW_SIZE);
+    return channel_send(&client->display, SPICE_MSGC_DISPLAY_INIT, &init, sizeof(init));
+}
+
+static NullClientCodec image_codec(const uint8_t *data, uint32_t size, uint32_t image)
+{
+    /* the type follows the 64 bits id of the image descriptor */
+    if (image == 0 || size < sizeof(uint64_t) + 1 || image > size - sizeof(uint64_t) - 1) {
+        return NULL_CLIENT_CODEC_NONE;
+    }
+    switch (data[image + sizeof(uint64_t)]) {
+    case SPICE_IMAGE_TYPE_BITMAP:
+        return NULL_CLIENT_CODEC_BITMAP;
+    case SPICE_IMAGE_TYPE_QUIC:
+        return NULL_CLIENT_CODEC_QUIC;
+    case SPICE_IMAGE_TYPE_LZ_PLT:
+    case SPICE_IMAGE_TYPE_LZ_RGB:
+        return NULL_CLIENT_CODEC_LZ;
+    case SPICE_IMAGE_TYPE_GLZ_RGB:
+        return NULL_CLIENT_CODEC_GLZ;
+    case SPICE_IMAGE_TYPE_ZLIB_GLZ_RGB:
+        return NULL_CLIENT_CODEC_ZLIB_GLZ;
+    case SPICE_IMAGE_TYPE_LZ4:
+        return NULL_CLIENT_CODEC_LZ4;
+    case SPICE_IMAGE_TYPE_JPEG:
+        return NULL_CLIENT_CODEC_JPEG;
+    case SPICE_IMAGE_TYPE_JPEG_ALPHA:
+        return NULL_CLIENT_CODEC_JPEG_ALPHA;
+    case SPICE_IMAGE_TYPE_FROM_CACHE:
+    case SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS:
+        return NULL_CLIENT_CODEC_CACHE;
+    case SPICE_IMAGE_TYPE_SURFACE:
+        return NULL_CLIENT_CODEC_SURFACE;
+    default:
+        return NULL_CLIENT_CODEC_NONE;
+    }
+}
+
+/* Reads the SpiceMsgDisplayBase starting the drawing messages, returns the
+ * position of the data following it */
+static bool read_display_base(const uint8_t *data, uint32_t size, uint32_t *surface_id,
+                              SpiceRect *box, uint32_t *pos)
+{
+    const uint32_t base_size = sizeof(uint32_t) + 4 * sizeof(int32_t) + 1;
+
+    if (size < base_size) {
+        return false;
+    }
+    *surface_id = get_u32(data);
+    box->top = (int32_t) get_u32(data + 4);
+    box->left = (int32_t) get_u32(data + 8);
+    box->bottom = (int32_t) get_u32(data + 12);
+    box->right = (int32_t) get_u32(data + 16);
+    *pos = base_size;
+    if (data[base_size - 1] == SPICE_CLIP_TYPE_RECTS) {
+        uint32_t num_rects;
+
+        if (size - *pos < sizeof(uint32_t)) {
+            return false;
+        }
+        num_rects = get_u32(data + *pos);
+        *pos += sizeof(uint32_t);
+        if (num_rects > (size - *pos) / (4 * sizeof(int32_t))) {
+            return false;
+        }
+        *pos += num_rects * 4 * sizeof(int32_t);
+    }
+    return true;
+}
+
+/* The messages are sent in the order of the commands, the commands before
+ * the one matched were not sent. Called with the lock held. */
+static void match_command(NullClient *client, uint32_t surface_id, const SpiceRect *box,
+                          uint64_t now)
+{
+    GList *l;
+
+    for (l = client->pending_commands.head; l != NULL; l = l->next) {
+        PendingCommand *command = (PendingCommand *) l->data;
+        if (command->surface_id == surface_id && command->box.top == box->top &&
+            command->box.left == box->left && command->box.bottom == box->bottom &&
+            command->box.right == box->right) {
+            break;
+        }
+    }
+    if (l == NULL) {
+        return;
+    }
+    for (;;) {
+        PendingCommand *command = (PendingCommand *) g_queue_pop_head(&client->pending_commands);
+        bool matched = command == l->data;
+
+        if (matched) {
+            uint64_t latency = now - MIN(now, command->time);
+            g_array_append_val(client->stats.latencies, latency);
+        } else {
+            client->stats.unmatched_commands++;
+        }
+        g_free(command);
+        if (matched) {
+            break;
+        }
+    }
+}
+
+/* Called with the lock held */
+static void decode_display_message(NullClient *client, uint16_t type, uint64_t now)
+{
+    const uint8_t *data = client->display.message->data;
+    uint32_t size = client->display.message->len;
+    NullClientCodec codec = NULL_CLIENT_CODEC_NONE;
+    uint32_t surface_id, pos, image_pos = 0;
+    SpiceRect box;
+
+    switch (type) {
+    case SPICE_MSG_DISPLAY_STREAM_DATA:
+    case SPICE_MSG_DISPLAY_STREAM_DATA_SIZED:
+        codec = NULL_CLIENT_CODEC_VIDEO;
+        break;
+    case SPICE_MSG_DISPLAY_COPY_BITS:
+    case SPICE_MSG_DISPLAY_DRAW_FILL:
+    case SPICE_MSG_DISPLAY_DRAW_OPAQUE:
+    case SPICE_MSG_DISPLAY_DRAW_COPY:
+    case SPICE_MSG_DISPLAY_DRAW_BLEND:
+    case SPICE_MSG_DISPLAY_DRAW_BLACKNESS:
+    case SPICE_MSG_DISPLAY_DRAW_WHITENESS:
+    case SPICE_MSG_DISPLAY_DRAW_INVERS:
+    case SPICE_MSG_DISPLAY_DRAW_ROP3:
+    case SPICE_MSG_DISPLAY_DRAW_STROKE:
+    case SPICE_MSG_DISPLAY_DRAW_TEXT:
+    case SPICE_MSG_DISPLAY_DRAW_TRANSPARENT:
+    case SPICE_MSG_DISPLAY_DRAW_ALPHA_BLEND:
+    case SPICE_MSG_DISPLAY_DRAW_COMPOSITE:
+        if (!read_display_base(data, size, &surface_id, &box, &pos)) {
+            break;
+        }
+        match_command(client, surface_id, &box, now);
+        /* the offset of the source image in the message */
+        switch (type) {
+        case SPICE_MSG_DISPLAY_DRAW_OPAQUE:
+        case SPICE_MSG_DISPLAY_DRAW_COPY:
+        case SPICE_MSG_DISPLAY_DRAW_BLEND:
+        case SPICE_MSG_DISPLAY_DRAW_TRANSPARENT:
+            image_pos = pos;
+            break;
+        case SPICE_MSG_DISPLAY_DRAW_ALPHA_BLEND:
+            /* after the alpha flags and the alpha */
+            image_pos = pos + 2;
+            break;
+        case SPICE_MSG_DISPLAY_DRAW_COMPOSITE:
+            /* after the flags */
+            image_pos = pos + sizeof(uint32_t);
+            break;
+        default:
+            break;
+        }
+        if (image_pos && size >= sizeof(uint32_t) && image_pos <= size - sizeof(uint32_t)) {
+            codec = image_codec(data, size, get_u32(data + image_pos));
+        }
+        break;
+    default:
+        break;
+    }
+    client->stats.codec_bytes[codec] += sizeof(SpiceMiniDataHeader) + size;
+}
+
+static gpointer null_client_run(gpointer user_data)
+{
+    NullClient *client = (NullClient *) user_data;
+    bool linked = link_channels(client);
+
+    pthread_mutex_lock(&client->lock);
+    client->linked = linked;
+    pthread_mutex_unlock(&client->lock);
+
+    while (linked) {
+        struct pollfd fds[2] = {
+            { client->main.fd, POLLIN, 0 },
+            { client->display.fd, POLLIN, 0 },
+        };
+        uint16_t type;
+
+        if (poll(fds, G_N_ELEMENTS(fds), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (fds[0].revents && !channel_read_message(&client->main, &type)) {
+            break;
+        }
+        if (fds[1].revents) {
+            uint64_t now;
+
+            if (!channel_read_message(&client->display, &type)) {
+                break;
+            }
+            now = now_ns();
+            pthread_mutex_lock(&client->lock);
+            if (client->stats.messages++ == 0) {
+                client->stats.first_message_time = now;
+            }
+            client->stats.last_message_time = now;
+            client->stats.bytes += sizeof(SpiceMiniDataHeader) + client->display.message->len;
+            if (client->decode) {
+                decode_display_message(client, type, now);
+            }
+            pthread_mutex_unlock(&client->lock);
+        }
+    }
+
+    pthread_mutex_lock(&client->lock);
+    client->running = false;
+    pthread_mutex_unlock(&client->lock);
+    return NULL;
+}
+
+static bool channel_connect(NullChannel *channel, SpiceServer *server)
+{
+    int sv[2];
+
+    channel->message = g_byte_array_new();
+    if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sv) < 0) {
+        return false;
+    }
+    if (spice_server_add_client(server, sv[0], 0) != 0) {
+        socket_close(sv[0]);
+        socket_close(sv[1]);
+        return false;
+    }
+    channel->fd = sv[1];
+    return true;
+}
+
+NullClient *null_client_new(SpiceServer *server, bool decode)
+{
+    NullClient *client = g_new0(NullClient, 1);
+
+    client->decode = decode;
+    client->main.fd = -1;
+    client->display.fd = -1;
+    pthread_mutex_init(&client->lock, NULL);
+    g_queue_init(&client->pending_commands);
+    client->stats.latencies = g_array_new(FALSE, FALSE, sizeof(uint64_t));
+
+    /* the display channel is linked once the main one is */
+    if (!channel_connect(&client->main, server) || !channel_connect(&client->display, server)) {
+        null_client_destroy(client);
+        return NULL;
+    }
+    client->running = true;
+    client->thread = g_thread_new("null-client", null_client_run, client);
+    return client;
+}
+
+void null_client_add_command(NullClient *client, const QXLCommandExt *cmd)
+{
+    const QXLDrawable *drawable;
+    PendingCommand *command;
+
+    if (!client->decode || cmd->cmd.type != QXL_CMD_DRAW ||
+        (cmd->flags & QXL_COMMAND_FLAG_COMPAT)) {
+        return;
+    }
+    /* the commands are in the memory of the process */
+    drawable = (const QXLDrawable *)(uintptr_t) cmd->cmd.data;
+    command = g_new(PendingCommand, 1);
+    command->surface_id = drawable->surface_id;
+    command->box.top = drawable->bbox.top;
+    command->box.left = drawable->bbox.left;
+    command->box.bottom = drawable->bbox.bottom;
+    command->box.right = drawable->bbox.right;
+    command->time = now_ns();
+
+    pthread_mutex_lock(&client->lock);
+    g_queue_push_tail(&client->pending_commands, command);
+    if (client->pending_commands.length > MAX_PENDING_COMMANDS) {
+        g_free(g_queue_pop_head(&client->pending_commands));
+        client->stats.unmatched_commands++;
+    }
+    pthread_mutex_unlock(&client->lock);
+}
+
+void null_client_wait_idle(NullClient *client, unsigned int idle_ms)
+{
+    uint64_t start = now_ns();
+
+    for (;;) {
+        uint64_t last;
+        bool running;
+
+        pthread_mutex_lock(&client->lock);
+        last = MAX(start, client->stats.last_message_time);
+        running = client->running;
+        pthread_mutex_unlock(&client->lock);
+        if (!running || now_ns() - last >= (uint64_t) idle_ms * 1000 * 1000) {
+            break;
+        }
+        g_usleep(idle_ms * 1000 / 10);
+    }
+}
+
+static gint compare_latencies(gconstpointer a, gconstpointer b)
+{
+    uint64_t latency_a = *(const uint64_t *) a;
+    uint64_t latency_b = *(const uint64_t *) b;
+
+    return latency_a < latency_b ? -1 : latency_a > latency_b;
+}
+
+bool null_client_get_stats(NullClient *client, NullClientStats *stats)
+{
+    bool linked;
+
+    pthread_mutex_lock(&client->lock);
+    g_array_sort(client->stats.latencies, compare_latencies);
+    *stats = client->stats;
+    stats->unmatched_commands += client->pending_commands.length;
+    linked = client->linked;
+    pthread_mutex_unlock(&client->lock);
+    return linked;
+}
+
+const char *null_client_codec_name(NullClientCodec codec)
+{
+    static const char *const names[NULL_CLIENT_CODEC_LAST] = {
+        "none",
+        "bitmap",
+        "quic",
+        "lz",
+        "glz",
+        "zlib_glz",
+        "lz4",
+        "jpeg",
+        "jpeg_alpha",
+        "cache",
+        "surface",
+        "video",
+    };
+
+    return names[codec];
+}
+
+static void channel_close(NullChannel *channel)
+{
+    if (channel->fd >= 0) {
+        socket_close(channel->fd);
+    }
+    if (channel->message) {
+        g_byte_array_free(channel->message, TRUE);
+    }
+}
+
+void null_client_destroy(NullClient *client)
+{
+    if (client->thread) {
+        /* wakes up the thread, the server sees the client leave */
+        shutdown(client->main.fd, SHUT_RDWR);
+        shutdown(client->display.fd, SHUT_RDWR);
+        g_thread_join(client->thread);
+    }
+    channel_close(&client->main);
+    channel_close(&client->display);
+    g_queue_foreach(&client->pending_commands, (GFunc) g_free, NULL);
+    g_queue_clear(&client->pending_commands);
+    g_array_free(client->stats.latencies, TRUE);
+    pthread_mutex_destroy(&client->lock);
+    g_free(client);
+}
@@ -0,0 +1,86 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NULL_CLIENT_H_
+#define NULL_CLIENT_H_
+
+#include <stdbool.h>
+#include <spice.h>
+#include <glib.h>
+
+SPICE_BEGIN_DECLS
+
+/*
+ * A client running in a thread of the server process, connected with
+ * socket pairs. It links the main and the display channels, acknowledges
+ * the messages and reads all of them without drawing anything, so that the
+ * server can be measured without a network or a remote client.
+ *
+ * When decoding, the messages drawing an image are accounted to the
+ * compression of the image and matched with the drawing commands given to
+ * null_client_add_command() to measure the latency from the command to the
+ * client.
+ */
+typedef struct NullClient NullClient;
+
+typedef enum {
+    NULL_CLIENT_CODEC_NONE,
+    NULL_CLIENT_CODEC_BITMAP,
+    NULL_CLIENT_CODEC_QUIC,
+    NULL_CLIENT_CODEC_LZ,
+    NULL_CLIENT_CODEC_GLZ,
+    NULL_CLIENT_CODEC_ZLIB_GLZ,
+    NULL_CLIENT_CODEC_LZ4,
+    NULL_CLIENT_CODEC_JPEG,
+    NULL_CLIENT_CODEC_JPEG_ALPHA,
+    NULL_CLIENT_CODEC_CACHE,
+    NULL_CLIENT_CODEC_SURFACE,
+    NULL_CLIENT_CODEC_VIDEO,
+    NULL_CLIENT_CODEC_LAST
+} NullClientCodec;
+
+typedef struct NullClientStats {
+    uint64_t messages;
+    uint64_t bytes;
+    /* monotonic time of the first and last display messages */
+    uint64_t first_message_time;
+    uint64_t last_message_time;
+    /* bytes of the messages, by compression of their image */
+    uint64_t codec_bytes[NULL_CLIENT_CODEC_LAST];
+    /* nanoseconds from the commands to the messages drawing them, sorted,
+     * owned by the client */
+    GArray *latencies;
+    /* commands never matched with a message */
+    uint64_t unmatched_commands;
+} NullClientStats;
+
+/* connects a client to @server, its main loop must be running for the
+ * channels to be linked */
+NullClient *null_client_new(SpiceServer *server, bool decode);
+/* notes the time a command was given to the server, from any thread */
+void null_client_add_command(NullClient *client, const QXLCommandExt *cmd);
+/* waits until no message has been received for @idle_ms milliseconds */
+void null_client_wait_idle(NullClient *client, unsigned int idle_ms);
+/* returns false if the client failed to link its channels */
+bool null_client_get_stats(NullClient *client, NullClientStats *stats);
+const char *null_client_codec_name(NullClientCodec codec);
+void null_client_destroy(NullClient *client);
+
+SPICE_END_DECLS
+
+#endif /* NULL_CLIENT_H_ */
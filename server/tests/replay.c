@@ -17,6 +17,9 @@
 */
 
 /* Replay a previously recorded file (via SPICE_WORKER_RECORD_FILENAME)
+ *
+ * With --benchmark the commands are replayed as fast as possible to a client
+ * running in the process, and the throughput is printed in JSON.
  */
 
 #include <config.h>
@@ -34,10 +37,17 @@
 #include <fcntl.h>
 #include <glib.h>
 #include <pthread.h>
+#if defined(RED_STATISTICS) && !defined(_WIN32)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <spice/stats.h>
+#endif
 
 #include <spice/macros.h>
 #include "test-display-base.h"
 #include "test-glib-compat.h"
+#include "red-record-format.h"
+#include "null-client.h"
 #include <common/log.h>
 
 static SpiceCoreInterface *core;
@@ -54,6 +64,9 @@ static GMainLoop *loop = NULL;
 static GAsyncQueue *display_queue = NULL;
 static GAsyncQueue *cursor_queue = NULL;
 static long total_size;
+static NullClient *null_client;
+/* time the first command was given to the server */
+static uint64_t first_command_time;
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static GSource *fill_source = NULL;
@@ -177,6 +190,12 @@ static int get_command_from(QXLInstance *qin, QXLCommandExt *ext, GAsyncQueue *q
         return FALSE;
     }
 
+    if (null_client) {
+        if (first_command_time == 0) {
+            first_command_time = g_get_monotonic_time() * 1000;
+        }
+        null_client_add_command(null_client, cmd);
+    }
     *ext = *cmd;
 
     return TRUE;
@@ -268,6 +287,7 @@ static void replay_channel_event(int event, SpiceChannelEventInfo *info)
     if (info->type == SPICE_CHANNEL_DISPLAY &&
         event == SPICE_CHANNEL_EVENT_INITIALIZED) {
         started = TRUE;
+        fill_queue();
     }
 }
 
@@ -313,6 +333,148 @@ static void free_queue(GAsyncQueue *queue)
     g_async_queue_unref(queue);
 }
 
+static double latency_percentile_us(GArray *latencies, unsigned int percent)
+{
+    guint index;
+
+    if (latencies->len == 0) {
+        return 0;
+    }
+    /* nearest rank */
+    index = (latencies->len * percent + 99) / 100;
+    index = CLAMP(index, 1, latencies->len) - 1;
+    return g_array_index(latencies, uint64_t, index) / 1000.0;
+}
+
+static const char *const stage_names[] = { "parse", "tree", "render", "compress", "marshall" };
+
+/* reads the "stage_time" counters of the display channels from the
+ * statistics of this process, in nanoseconds */
+static gboolean read_stage_times(uint64_t stage_times[G_N_ELEMENTS(stage_names)])
+{
+#if defined(RED_STATISTICS) && !defined(_WIN32)
+    gchar *shm_name = g_strdup_printf(SPICE_STAT_SHM_NAME, getpid());
+    SpiceStat *stat;
+    struct stat st;
+    size_t num_nodes, i;
+    uint32_t child;
+    int fd;
+
+    fd = shm_open(shm_name, O_RDONLY, 0444);
+    g_free(shm_name);
+    if (fd == -1) {
+        return FALSE;
+    }
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t) sizeof(SpiceStat)) {
+        close(fd);
+        return FALSE;
+    }
+    stat = (SpiceStat *) mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stat == (SpiceStat *) MAP_FAILED) {
+        return FALSE;
+    }
+
+    memset(stage_times, 0, sizeof(uint64_t) * G_N_ELEMENTS(stage_names));
+    num_nodes = (st.st_size - sizeof(SpiceStat)) / sizeof(SpiceStatNode);
+    for (i = 0; i < num_nodes; i++) {
+        const SpiceStatNode *node = &stat->nodes[i];
+
+        if (!(node->flags & SPICE_STAT_NODE_FLAG_ENABLED) ||
+            strncmp(node->name, "stage_time", sizeof(node->name)) != 0) {
+            continue;
+        }
+        for (child = node->first_child_index; child < num_nodes;
+             child = stat->nodes[child].next_sibling_index) {
+            const SpiceStatNode *counter = &stat->nodes[child];
+            guint stage;
+
+            for (stage = 0; stage < G_N_ELEMENTS(stage_names); stage++) {
+                if (strncmp(counter->name, stage_names[stage], sizeof(counter->name)) == 0) {
+                    stage_times[stage] += counter->value;
+                }
+            }
+        }
+    }
+    munmap(stat, st.st_size);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+static void append_json_string(GString *json, const char *str)
+{
+    g_string_append_c(json, '"');
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            g_string_append_c(json, '\\');
+        } else if ((guchar) *str < 0x20) {
+            g_string_append_printf(json, "\\u%04x", (guchar) *str);
+            continue;
+        }
+        g_string_append_c(json, *str);
+    }
+    g_string_append_c(json, '"');
+}
+
+static void print_benchmark(const char *recording, gboolean decode)
+{
+    NullClientStats stats;
+    GString *json = g_string_new("{\n");
+    uint64_t stage_times[G_N_ELEMENTS(stage_names)];
+    double seconds = 0;
+    guint i;
+
+    if (!null_client_get_stats(null_client, &stats)) {
+        g_printerr("the benchmark client failed to connect\n");
+    }
+    if (first_command_time && stats.last_message_time > first_command_time) {
+        seconds = (stats.last_message_time - first_command_time) / 1e9;
+    }
+
+    g_string_append(json, "  \"recording\": ");
+    append_json_string(json, recording);
+    g_string_append(json, ",\n");
+    g_string_append_printf(json, "  \"commands\": %u,\n", ncommands);
+    g_string_append_printf(json, "  \"seconds\": %.6f,\n", seconds);
+    g_string_append_printf(json, "  \"commands_per_second\": %.1f,\n",
+                           seconds > 0 ? ncommands / seconds : 0);
+    g_string_append_printf(json, "  \"messages\": %" G_GUINT64_FORMAT ",\n", stats.messages);
+    g_string_append_printf(json, "  \"bytes\": %" G_GUINT64_FORMAT, stats.bytes);
+
+    if (decode) {
+        g_string_append(json, ",\n  \"codec_bytes\": {");
+        for (i = 0; i < NULL_CLIENT_CODEC_LAST; i++) {
+            g_string_append_printf(json, "%s\n    \"%s\": %" G_GUINT64_FORMAT,
+                                   i ? "," : "",
+                                   null_client_codec_name((NullClientCodec) i),
+                                   stats.codec_bytes[i]);
+        }
+        g_string_append(json, "\n  },\n  \"latency_us\": {");
+        g_string_append_printf(json, "\n    \"matched\": %u,", stats.latencies->len);
+        g_string_append_printf(json, "\n    \"unmatched\": %" G_GUINT64_FORMAT ",",
+                               stats.unmatched_commands);
+        g_string_append_printf(json, "\n    \"p50\": %.1f,",
+                               latency_percentile_us(stats.latencies, 50));
+        g_string_append_printf(json, "\n    \"p99\": %.1f\n  }",
+                               latency_percentile_us(stats.latencies, 99));
+    }
+
+    if (read_stage_times(stage_times)) {
+        g_string_append(json, ",\n  \"stage_seconds\": {");
+        for (i = 0; i < G_N_ELEMENTS(stage_names); i++) {
+            g_string_append_printf(json, "%s\n    \"%s\": %.6f", i ? "," : "",
+                                   stage_names[i], stage_times[i] / 1e9);
+        }
+        g_string_append(json, "\n  }");
+    }
+    g_string_append(json, "\n}\n");
+
+    g_print("%s", json->str);
+    g_string_free(json, TRUE);
+}
+
 int main(int argc, char **argv)
 {
     GError *error = NULL;
@@ -320,9 +482,12 @@ int main(int argc, char **argv)
     gchar *client = NULL, *codecs = NULL, **file = NULL;
     gint port = 5000, compression = SPICE_IMAGE_COMPRESSION_AUTO_GLZ;
     gint streaming = SPICE_STREAM_VIDEO_FILTER;
-    gboolean wait = FALSE;
+    gboolean wait = FALSE, scroll_detection = FALSE;
     gint tls_port = 0;
     gchar *cacert_file = NULL, *cert_file = NULL, *key_file = NULL;
+    gchar *convert_file = NULL;
+    gboolean benchmark = FALSE, decode = FALSE;
+    gchar *recording = NULL;
 
     FILE *fd;
 
@@ -332,6 +497,7 @@ int main(int argc, char **argv)
         { "streaming", 'S', 0, G_OPTION_ARG_INT, &streaming, "Streaming (default 3)", "INT" },
         { "video-codecs", 'v', 0, G_OPTION_ARG_STRING, &codecs, "Video codecs", "STRING" },
         { "port", 'p', 0, G_OPTION_ARG_INT, &port, "Server port (default 5000)", "PORT" },
+        { "scroll-detection", 0, 0, G_OPTION_ARG_NONE, &scroll_detection, "Detect the scrolling of repainted areas", NULL },
         { "wait", 'w', 0, G_OPTION_ARG_NONE, &wait, "Wait for client", NULL },
         { "slow", 's', 0, G_OPTION_ARG_INT, &slow, "Slow down replay. Delays USEC microseconds before each command", "USEC" },
         { "skip", 0, 0, G_OPTION_ARG_INT, &skip, "Skip 'slow' for the first n commands", NULL },
@@ -340,13 +506,16 @@ int main(int argc, char **argv)
         { "cacert-file", 0, 0, G_OPTION_ARG_FILENAME, &cacert_file, "TLS CA certificate", "FILE" },
         { "cert-file", 0, 0, G_OPTION_ARG_FILENAME, &cert_file, "TLS server certificate", "FILE" },
         { "key-file", 0, 0, G_OPTION_ARG_FILENAME, &key_file, "TLS server private key", "FILE" },
+        { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Replay as fast as possible to a client in the process and print the results in JSON", NULL },
+        { "decode", 0, 0, G_OPTION_ARG_NONE, &decode, "With --benchmark, account the bytes by codec and measure the latency of the commands", NULL },
+        { "convert", 0, 0, G_OPTION_ARG_FILENAME, &convert_file, "Convert a text recording to the binary format in FILE, then exit", "FILE" },
         { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &file, "replay file", "FILE" },
         { NULL }
     };
 
     static const char description[] =
         "Compression values:\n"
-        "\t1=off 2=auto_glz 3=auto_lz 4=quic 5=glz 6=lz 7=lz4\n"
+        "\t1=off 2=auto_glz 3=auto_lz 4=quic 5=glz 6=lz 7=lz4 15=auto_adaptive\n"
         "\n"
         "Streaming values:\n"
         "\t1=off 2=all 3=filter";
@@ -363,6 +532,7 @@ int main(int argc, char **argv)
     SPICE_VERIFY(SPICE_IMAGE_COMPRESSION_GLZ == 5);
     SPICE_VERIFY(SPICE_IMAGE_COMPRESSION_LZ == 6);
     SPICE_VERIFY(SPICE_IMAGE_COMPRESSION_LZ4 == 7);
+    SPICE_VERIFY(SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE == 15);
 
     context = g_option_context_new("- replay spice server recording");
     g_option_context_add_main_entries(context, entries, NULL);
@@ -379,7 +549,8 @@ int main(int argc, char **argv)
     context = NULL;
 
     if (compression <= SPICE_IMAGE_COMPRESSION_INVALID
-        || compression >= SPICE_IMAGE_COMPRESSION_ENUM_END) {
+        || (compression >= SPICE_IMAGE_COMPRESSION_ENUM_END
+            && compression != SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE)) {
         g_printerr("invalid compression value\n");
         exit(1);
     }
@@ -400,6 +571,7 @@ int main(int argc, char **argv)
         g_printerr("error opening %s\n", file[0]);
         exit(1);
     }
+    recording = g_strdup(file[0]);
     g_strfreev(file);
     file = NULL;
 #ifndef _WIN32
@@ -411,7 +583,26 @@ int main(int argc, char **argv)
     fseek(fd, 0L, SEEK_END);
     total_size = ftell(fd);
     fseek(fd, 0L, SEEK_SET);
-    if (total_size > 0)
+
+    if (convert_file) {
+        FILE *out = fopen(convert_file, "wb");
+        gboolean converted;
+
+        if (out == NULL) {
+            g_printerr("error opening %s\n", convert_file);
+            exit(1);
+        }
+        converted = record_convert_text(fd, out);
+        if (fclose(out) != 0 || !converted) {
+            g_printerr("error converting to %s\n", convert_file);
+            exit(1);
+        }
+        fclose(fd);
+        g_free(convert_file);
+        g_free(recording);
+        return 0;
+    }
+    if (total_size > 0 && !benchmark)
         g_timeout_add_seconds(1, progress_timer, fd);
     replay = spice_replay_new(fd, MAX_SURFACE_NUM);
     if (replay == NULL) {
@@ -427,6 +618,7 @@ int main(int argc, char **argv)
     server = spice_server_new();
     spice_server_set_image_compression(server, (SpiceImageCompression) compression);
     spice_server_set_streaming_video(server, streaming);
+    spice_server_set_display_scroll_detection(server, scroll_detection);
 
     if (codecs != NULL) {
         if (spice_server_set_video_codecs(server, codecs) != 0) {
@@ -448,15 +640,28 @@ int main(int argc, char **argv)
     g_free(key_file);
     cacert_file = cert_file = key_file = NULL;
 
-    spice_server_set_port(server, port);
+    if (!benchmark) {
+        spice_server_set_port(server, port);
+    }
     spice_server_set_noauth(server);
 
-    g_print("listening on port %d (insecure)\n", port);
+    if (!benchmark) {
+        g_print("listening on port %d (insecure)\n", port);
+    }
     spice_server_init(server, core);
 
     display_sin.base.sif = &display_sif.base;
     spice_server_add_interface(server, &display_sin.base);
 
+    if (benchmark) {
+        null_client = null_client_new(server, decode);
+        if (null_client == NULL) {
+            g_printerr("error connecting the benchmark client\n");
+            exit(1);
+        }
+        wait = TRUE;
+    }
+
     if (client) {
         start_client(client, &error);
         wait = TRUE;
@@ -475,7 +680,18 @@ int main(int argc, char **argv)
     if (print_count)
         g_print("Counted %d commands\n", ncommands);
 
+    if (null_client) {
+        /* the last commands may still be in the pipes of the client */
+        null_client_wait_idle(null_client, 500);
+        print_benchmark(recording, decode);
+    }
+
     spice_server_destroy(server);
+    if (null_client) {
+        null_client_destroy(null_client);
+        null_client = NULL;
+    }
+    g_free(recording);
     free_queue(display_queue);
     free_queue(cursor_queue);
     end_replay();
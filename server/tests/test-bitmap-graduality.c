@@ -0,0 +1,223 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check that all the implementations of the graduality score give the
+ * same results. Run with -m perf to compare their speed.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "spice-bitmap-utils.h"
+#include "test-glib-compat.h"
+
+typedef enum {
+    PATTERN_RANDOM,
+    PATTERN_GRADIENT,
+    PATTERN_FLAT,
+    PATTERN_NOISY_GRADIENT,
+} Pattern;
+
+static const BitmapGradualityImpl impls[] = {
+    BITMAP_GRADUALITY_IMPL_SCALAR,
+    BITMAP_GRADUALITY_IMPL_SSE2,
+    BITMAP_GRADUALITY_IMPL_AVX2,
+};
+
+static const char *const impl_names[] = {
+    "auto", "scalar", "sse2", "avx2",
+};
+
+static unsigned int format_bpp(uint8_t format)
+{
+    switch (format) {
+    case SPICE_BITMAP_FMT_16BIT:
+        return 2;
+    case SPICE_BITMAP_FMT_24BIT:
+        return 3;
+    default:
+        return 4;
+    }
+}
+
+static void set_pixel(uint8_t *dest, uint8_t format, uint8_t r, uint8_t g, uint8_t b)
+{
+    uint16_t pix16;
+
+    switch (format) {
+    case SPICE_BITMAP_FMT_16BIT:
+        pix16 = ((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3);
+        memcpy(dest, &pix16, sizeof(pix16));
+        break;
+    case SPICE_BITMAP_FMT_24BIT:
+        dest[0] = b;
+        dest[1] = g;
+        dest[2] = r;
+        break;
+    default:
+        dest[0] = b;
+        dest[1] = g;
+        dest[2] = r;
+        dest[3] = 0;
+        break;
+    }
+}
+
+/* create a bitmap split in num_chunks chunks of whole lines */
+static SpiceBitmap *create_bitmap(uint8_t format, uint32_t width, uint32_t height,
+                                  Pattern pattern, unsigned int num_chunks, GRand *rand)
+{
+    SpiceBitmap *bitmap = g_new0(SpiceBitmap, 1);
+    uint32_t stride = width * format_bpp(format);
+    uint8_t *data = g_malloc(stride * height);
+    uint32_t x, y, line, i;
+
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint8_t *dest = data + y * stride + x * format_bpp(format);
+            uint8_t noise = g_rand_int_range(rand, 0, 4);
+            switch (pattern) {
+            case PATTERN_RANDOM:
+                set_pixel(dest, format, g_rand_int_range(rand, 0, 256),
+                          g_rand_int_range(rand, 0, 256), g_rand_int_range(rand, 0, 256));
+                break;
+            case PATTERN_GRADIENT:
+                set_pixel(dest, format, x * 255 / width, y * 255 / height, 0x80);
+                break;
+            case PATTERN_FLAT:
+                set_pixel(dest, format, 0x10, 0x20, 0x30);
+                break;
+            case PATTERN_NOISY_GRADIENT:
+                set_pixel(dest, format, (x * 255 / width) ^ noise, 0x40, (y & 0x40) ? 0xff : 0);
+                break;
+            }
+        }
+    }
+
+    bitmap->format = format;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = stride;
+    bitmap->data = spice_chunks_new(num_chunks);
+    bitmap->data->data_size = stride * height;
+    for (i = 0, line = 0; i < num_chunks; i++) {
+        uint32_t lines = (i == num_chunks - 1) ? height - line : height / num_chunks;
+        bitmap->data->chunk[i].data = data + line * stride;
+        bitmap->data->chunk[i].len = lines * stride;
+        line += lines;
+    }
+    return bitmap;
+}
+
+static void free_bitmap(SpiceBitmap *bitmap)
+{
+    g_free(bitmap->data->chunk[0].data);
+    spice_chunks_destroy(bitmap->data);
+    g_free(bitmap);
+}
+
+static void check_bitmap(SpiceBitmap *bitmap)
+{
+    double expected = bitmap_get_graduality_score(bitmap, BITMAP_GRADUALITY_IMPL_SCALAR);
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(impls); i++) {
+        if (!bitmap_graduality_impl_available(impls[i])) {
+            continue;
+        }
+        g_assert_cmpfloat(bitmap_get_graduality_score(bitmap, impls[i]), ==, expected);
+    }
+    g_assert_cmpfloat(bitmap_get_graduality_score(bitmap, BITMAP_GRADUALITY_IMPL_AUTO), ==,
+                      expected);
+}
+
+static void test_graduality_impls(void)
+{
+    static const uint8_t formats[] = {
+        SPICE_BITMAP_FMT_16BIT, SPICE_BITMAP_FMT_24BIT,
+        SPICE_BITMAP_FMT_32BIT, SPICE_BITMAP_FMT_RGBA,
+    };
+    /* include sizes giving partial batches and partial vectors */
+    static const uint32_t sizes[][2] = {
+        { 1, 1 }, { 2, 2 }, { 15, 3 }, { 16, 16 }, { 97, 33 }, { 640, 480 },
+    };
+    GRand *rand = g_rand_new_with_seed(0x5eed);
+    unsigned int f, s, num_chunks;
+    Pattern pattern;
+
+    for (f = 0; f < G_N_ELEMENTS(formats); f++) {
+        for (s = 0; s < G_N_ELEMENTS(sizes); s++) {
+            for (pattern = PATTERN_RANDOM; pattern <= PATTERN_NOISY_GRADIENT; pattern++) {
+                for (num_chunks = 1; num_chunks <= 3; num_chunks++) {
+                    SpiceBitmap *bitmap;
+                    if (num_chunks > sizes[s][1]) {
+                        break;
+                    }
+                    bitmap = create_bitmap(formats[f], sizes[s][0], sizes[s][1],
+                                           pattern, num_chunks, rand);
+                    check_bitmap(bitmap);
+                    free_bitmap(bitmap);
+                }
+            }
+        }
+    }
+    g_rand_free(rand);
+}
+
+static void test_graduality_perf(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x5eed);
+    SpiceBitmap *bitmap = create_bitmap(SPICE_BITMAP_FMT_32BIT, 1920, 1080,
+                                        PATTERN_NOISY_GRADIENT, 1, rand);
+    BitmapGradualityImpl impl;
+    const unsigned int iterations = 200;
+
+    for (impl = BITMAP_GRADUALITY_IMPL_SCALAR; impl <= BITMAP_GRADUALITY_IMPL_AVX2; impl++) {
+        unsigned int i;
+        double elapsed;
+
+        if (!bitmap_graduality_impl_available(impl)) {
+            g_test_message("%s: not available", impl_names[impl]);
+            continue;
+        }
+        g_test_timer_start();
+        for (i = 0; i < iterations; i++) {
+            bitmap_get_graduality_score(bitmap, impl);
+        }
+        elapsed = g_test_timer_elapsed();
+        g_test_message("%s: %.3f ms per 1920x1080 bitmap", impl_names[impl],
+                       elapsed * 1000 / iterations);
+    }
+
+    free_bitmap(bitmap);
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/bitmap-graduality/impls", test_graduality_impls);
+    if (g_test_perf()) {
+        g_test_add_func("/server/bitmap-graduality/perf", test_graduality_perf);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,297 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Test the RedPipe used by RedChannelClient.
+ * Run with -m perf to measure the throughput of items going through a channel.
+ */
+#include <config.h>
+#include <unistd.h>
+#include <spice.h>
+
+#include "test-glib-compat.h"
+#include "basic-event-loop.h"
+#include "reds.h"
+#include "red-client.h"
+#include "main-channel.h"
+#include "red-pipe-item.h"
+#include "net-utils.h"
+#include "push-visibility.h"
+
+#define NUM_ITEMS 8
+
+static void item_free_nop(RedPipeItem *item)
+{
+}
+
+static void init_items(RedPipeItem *items, int num_items)
+{
+    for (int i = 0; i < num_items; ++i) {
+        red_pipe_item_init_full(&items[i], i, item_free_nop);
+    }
+}
+
+static void check_pipe(RedPipe *pipe, const int *types, unsigned num_types)
+{
+    RedPipeLink *link;
+    unsigned n;
+
+    g_assert_cmpuint(pipe->length, ==, num_types);
+    // check forward and backward links
+    for (link = pipe->head, n = 0; link != NULL; link = link->next, ++n) {
+        g_assert_cmpuint(n, <, num_types);
+        g_assert_cmpint(link->item->type, ==, types[n]);
+        g_assert_true(link->pipe == pipe);
+        if (n == 0) {
+            g_assert_null(link->prev);
+        } else {
+            g_assert_true(link->prev->next == link);
+        }
+    }
+    g_assert_cmpuint(n, ==, num_types);
+    for (link = pipe->tail; link != NULL; link = link->prev) {
+        g_assert_cmpuint(n, >, 0);
+        g_assert_cmpint(link->item->type, ==, types[--n]);
+    }
+    g_assert_cmpuint(n, ==, 0);
+}
+
+static void test_pipe_order(void)
+{
+    RedPipeItem items[NUM_ITEMS];
+    RedPipe pipe;
+
+    init_items(items, NUM_ITEMS);
+    red_pipe_init(&pipe);
+    g_assert_true(red_pipe_is_empty(&pipe));
+
+    red_pipe_push_head(&pipe, &items[1]);
+    red_pipe_push_head(&pipe, &items[2]);
+    red_pipe_push_tail(&pipe, &items[0]);
+    static const int types1[] = { 2, 1, 0 };
+    check_pipe(&pipe, types1, G_N_ELEMENTS(types1));
+
+    RedPipeLink *pos = red_pipe_find(&pipe, &items[1]);
+    g_assert_true(pos == &items[1].link);
+    red_pipe_insert_after(&pipe, pos, &items[3]);
+    red_pipe_insert_before(&pipe, pos, &items[4]);
+    red_pipe_insert_after(&pipe, pipe.tail, &items[5]);
+    red_pipe_insert_before(&pipe, pipe.head, &items[6]);
+    static const int types2[] = { 6, 2, 4, 1, 3, 0, 5 };
+    check_pipe(&pipe, types2, G_N_ELEMENTS(types2));
+
+    // remove in the middle and at both ends
+    g_assert_true(red_pipe_remove_link(&pipe, pos) == &items[1]);
+    g_assert_null(red_pipe_find(&pipe, &items[1]));
+    g_assert_true(red_pipe_pop_tail(&pipe) == &items[5]);
+    g_assert_true(red_pipe_pop_head(&pipe) == &items[6]);
+    static const int types3[] = { 2, 4, 3, 0 };
+    check_pipe(&pipe, types3, G_N_ELEMENTS(types3));
+
+    while (red_pipe_pop_tail(&pipe)) {
+        continue;
+    }
+    g_assert_true(red_pipe_is_empty(&pipe));
+    g_assert_null(pipe.tail);
+    g_assert_null(red_pipe_pop_head(&pipe));
+    red_pipe_destroy(&pipe);
+
+    for (int i = 0; i < NUM_ITEMS; ++i) {
+        g_assert_cmpuint(items[i].num_links, ==, 0);
+    }
+}
+
+// the same item can be queued in multiple pipes, like broadcast items
+static void test_pipe_shared_item(void)
+{
+    RedPipeItem items[NUM_ITEMS];
+    RedPipe pipes[3];
+
+    init_items(items, NUM_ITEMS);
+    for (auto &pipe: pipes) {
+        red_pipe_init(&pipe);
+        red_pipe_push_head(&pipe, &items[1]);
+    }
+    for (auto &pipe: pipes) {
+        red_pipe_push_head(&pipe, &items[0]);
+        red_pipe_push_tail(&pipe, &items[2]);
+    }
+    g_assert_cmpuint(items[0].num_links, ==, 3);
+    g_assert_true(items[0].link.pipe == &pipes[0]);
+
+    static const int types[] = { 0, 1, 2 };
+    for (auto &pipe: pipes) {
+        check_pipe(&pipe, types, G_N_ELEMENTS(types));
+        g_assert_true(red_pipe_find(&pipe, &items[1])->item == &items[1]);
+    }
+
+    // free the embedded link, the others must still be found
+    red_pipe_remove_link(&pipes[0], red_pipe_find(&pipes[0], &items[1]));
+    g_assert_null(items[1].link.pipe);
+    g_assert_null(red_pipe_find(&pipes[0], &items[1]));
+    g_assert_nonnull(red_pipe_find(&pipes[1], &items[1]));
+    g_assert_nonnull(red_pipe_find(&pipes[2], &items[1]));
+
+    for (auto &pipe: pipes) {
+        while (red_pipe_pop_head(&pipe)) {
+            continue;
+        }
+        red_pipe_destroy(&pipe);
+    }
+    for (int i = 0; i < NUM_ITEMS; ++i) {
+        g_assert_cmpuint(items[i].num_links, ==, 0);
+    }
+}
+
+/*
+ * Channel used for the benchmark, items are not sent to the network
+ */
+struct RedTestChannel final: public RedChannel
+{
+    using RedChannel::RedChannel;
+    void on_connect(RedClient *client, RedStream *stream,
+                    int migration, RedChannelCapabilities *caps) override;
+    red::shared_ptr<RedChannelClient> rcc;
+};
+
+class RedTestChannelClient final: public RedChannelClient
+{
+public:
+    using RedChannelClient::RedChannelClient;
+    uint64_t num_sent = 0;
+protected:
+    virtual uint8_t * alloc_recv_buf(uint16_t type, uint32_t size) override;
+    virtual void release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg) override;
+    virtual void send_item(RedPipeItem *item) override;
+};
+
+void
+RedTestChannel::on_connect(RedClient *client, RedStream *stream,
+                           int migration, RedChannelCapabilities *caps)
+{
+    rcc = red::make_shared<RedTestChannelClient>(this, client, stream, caps);
+    g_assert_true(rcc->init());
+}
+
+uint8_t *
+RedTestChannelClient::alloc_recv_buf(uint16_t type, uint32_t size)
+{
+    return (uint8_t*) g_malloc(size);
+}
+
+void
+RedTestChannelClient::release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg)
+{
+    g_free(msg);
+}
+
+void
+RedTestChannelClient::send_item(RedPipeItem *item)
+{
+    num_sent++;
+}
+
+static RedStream *create_dummy_stream(SpiceServer *server)
+{
+    int sv[2];
+    g_assert_cmpint(socketpair(AF_LOCAL, SOCK_STREAM, 0, sv), ==, 0);
+    red_socket_set_non_blocking(sv[0], true);
+
+    RedStream * stream = red_stream_new(server, sv[0]);
+    g_assert_nonnull(stream);
+
+    return stream;
+}
+
+#define BENCH_NUM_ITEMS (4 * 1000 * 1000)
+#define BENCH_BATCH 64
+
+static void test_pipe_throughput(void)
+{
+    SpiceCoreInterface *core;
+    SpiceServer *server = spice_server_new();
+
+    g_assert_nonnull(server);
+    core = basic_event_loop_init();
+    g_assert_nonnull(core);
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    auto channel = red::make_shared<RedTestChannel>(server, SPICE_CHANNEL_PORT, 0);
+
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+
+    RedClient *client = red_client_new(server, FALSE);
+    g_assert_nonnull(client);
+
+    red::shared_ptr<MainChannel> main_channel(main_channel_new(server));
+    g_assert(main_channel);
+    MainChannelClient *mcc;
+    mcc = main_channel_link(main_channel.get(), client, create_dummy_stream(server),
+                            0, FALSE, &caps);
+    g_assert_nonnull(mcc);
+
+    channel->connect(client, create_dummy_stream(server), FALSE, &caps);
+    auto rcc = static_cast<RedTestChannelClient*>(channel->rcc.get());
+    g_assert_nonnull(rcc);
+
+    // the items are reused so only the pipe is measured
+    RedPipeItem items[BENCH_BATCH];
+    init_items(items, BENCH_BATCH);
+    for (auto &item: items) {
+        item.type = RED_PIPE_ITEM_TYPE_CHANNEL_BASE;
+    }
+
+    g_test_timer_start();
+    for (unsigned n = 0; n < BENCH_NUM_ITEMS; n += BENCH_BATCH) {
+        for (auto &item: items) {
+            red_pipe_item_ref(&item);
+            rcc->pipe_add(&item);
+        }
+        // drop some items, like the display channel does when replacing drawables
+        rcc->pipe_remove_and_release(&items[BENCH_BATCH / 2]);
+        rcc->push();
+    }
+    double elapsed = g_test_timer_elapsed();
+    g_assert_true(rcc->pipe_is_empty());
+    g_assert_cmpuint(rcc->num_sent, ==, BENCH_NUM_ITEMS / BENCH_BATCH * (BENCH_BATCH - 1));
+
+    g_test_minimized_result(elapsed, "%u items through the pipe in %.3f s",
+                            BENCH_NUM_ITEMS, elapsed);
+    g_test_message("%.1f million items/s", BENCH_NUM_ITEMS / elapsed / 1e6);
+
+    client->destroy();
+    channel->rcc.reset();
+    main_channel.reset();
+    channel.reset();
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/channel-pipe/order", test_pipe_order);
+    g_test_add_func("/server/channel-pipe/shared-item", test_pipe_shared_item);
+    if (g_test_perf()) {
+        g_test_add_func("/server/channel-pipe/throughput", test_pipe_throughput);
+    }
+
+    return g_test_run();
+}
@@ -270,11 +270,157 @@ static void channel_loop(void)
     basic_event_loop_destroy();
 }
 
+/*
+ * Channel sending a message made of many small chunks, more than
+ * an iovec can hold (IOV_MAX is 1024 on Linux), through a socket
+ * with a small buffer
+ */
+#define WRITES_CHUNK_SIZE 512
+#define WRITES_NUM_CHUNKS 2051
+
+static uint8_t *writes_payload;
+
+struct RedWritesTestChannel final: public RedChannel
+{
+    using RedChannel::RedChannel;
+    void on_connect(RedClient *client, RedStream *stream,
+                    int migration, RedChannelCapabilities *caps) override;
+    red::shared_ptr<RedChannelClient> rcc;
+};
+
+class RedWritesTestChannelClient final: public RedChannelClient
+{
+    using RedChannelClient::RedChannelClient;
+    virtual uint8_t * alloc_recv_buf(uint16_t type, uint32_t size) override;
+    virtual void release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg) override;
+    virtual void send_item(RedPipeItem *item) override;
+};
+
+void
+RedWritesTestChannel::on_connect(RedClient *client, RedStream *stream,
+                                 int migration, RedChannelCapabilities *caps)
+{
+    rcc = red::make_shared<RedWritesTestChannelClient>(this, client, stream, caps);
+    g_assert_true(rcc->init());
+}
+
+uint8_t *
+RedWritesTestChannelClient::alloc_recv_buf(uint16_t type, uint32_t size)
+{
+    return (uint8_t*) g_malloc(size);
+}
+
+void
+RedWritesTestChannelClient::release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg)
+{
+    g_free(msg);
+}
+
+void
+RedWritesTestChannelClient::send_item(RedPipeItem *item)
+{
+    SpiceMarshaller *m = get_marshaller();
+
+    init_send_data(SPICE_MSG_MIGRATE_DATA);
+    for (int i = 0; i < WRITES_NUM_CHUNKS; ++i) {
+        spice_marshaller_add_by_ref(m, writes_payload + i * WRITES_CHUNK_SIZE,
+                                    WRITES_CHUNK_SIZE);
+    }
+    begin_send_message();
+}
+
+static void channel_partial_writes(void)
+{
+    SpiceCoreInterface *core;
+    SpiceServer *server = spice_server_new();
+    const size_t payload_size = WRITES_CHUNK_SIZE * WRITES_NUM_CHUNKS;
+
+    g_assert_nonnull(server);
+    core = basic_event_loop_init();
+    g_assert_nonnull(core);
+    g_assert_cmpint(spice_server_init(server, core), ==, 0);
+
+    writes_payload = (uint8_t *) g_malloc(payload_size);
+    for (size_t i = 0; i < payload_size; ++i) {
+        writes_payload[i] = i * 7 + i / 251;
+    }
+
+    auto channel = red::make_shared<RedWritesTestChannel>(server, SPICE_CHANNEL_PORT, 0);
+
+    RedChannelCapabilities caps;
+    memset(&caps, 0, sizeof(caps));
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+    caps.num_common_caps = 1;
+    caps.common_caps = (uint32_t*) spice_memdup(&common_caps, sizeof(common_caps));
+
+    RedClient *client = red_client_new(server, FALSE);
+    g_assert_nonnull(client);
+
+    red::shared_ptr<MainChannel> main_channel(main_channel_new(server));
+    g_assert(main_channel);
+    MainChannelClient *mcc;
+    mcc = main_channel_link(main_channel.get(), client, create_dummy_stream(server, NULL),
+                            0, FALSE, &caps);
+    g_assert_nonnull(mcc);
+
+    // a small socket buffer forces the message to be written in many parts
+    RedStream *stream = create_dummy_stream(server, &client_socket);
+    int sndbuf = 4096;
+    g_assert_cmpint(setsockopt(stream->socket, SOL_SOCKET, SO_SNDBUF,
+                               &sndbuf, sizeof(sndbuf)), ==, 0);
+    channel->connect(client, stream, FALSE, &caps);
+    red_channel_capabilities_reset(&caps);
+    auto rcc = channel->rcc;
+    g_assert_nonnull(rcc);
+
+    rcc->pipe_add_type(RED_PIPE_ITEM_TYPE_CHANNEL_BASE);
+    rcc->push();
+    g_assert_true(rcc->is_blocked());
+
+    // read the mini header and the payload, unblocking the channel when needed
+    const size_t msg_size = sizeof(SpiceMiniDataHeader) + payload_size;
+    uint8_t *msg = (uint8_t *) g_malloc(msg_size);
+    size_t got = 0;
+    while (got < msg_size) {
+        ssize_t len = socket_read(client_socket, msg + got, msg_size - got);
+        if (len < 0) {
+            g_assert_cmpint(errno, ==, EAGAIN);
+            g_assert_true(rcc->is_blocked());
+            rcc->push();
+            continue;
+        }
+        g_assert_cmpint(len, >, 0);
+        got += len;
+    }
+    g_assert_false(rcc->is_blocked());
+    g_assert_true(rcc->no_item_being_sent());
+
+    SpiceMiniDataHeader header;
+    memcpy(&header, msg, sizeof(header));
+    g_assert_cmpuint(GUINT16_FROM_LE(header.type), ==, SPICE_MSG_MIGRATE_DATA);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.size), ==, payload_size);
+    g_assert_true(memcmp(msg + sizeof(header), writes_payload, payload_size) == 0);
+    g_free(msg);
+
+    client->destroy();
+    channel->rcc.reset();
+    rcc.reset();
+    main_channel.reset();
+    channel.reset();
+    socket_close(client_socket);
+    client_socket = -1;
+    g_free(writes_payload);
+
+    spice_server_destroy(server);
+    basic_event_loop_destroy();
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/server/channel", channel_loop);
+    g_test_add_func("/server/channel/partial-writes", channel_partial_writes);
 
     return g_test_run();
 }
@@ -0,0 +1,201 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the choices of the compression selector used by the
+ * SPICE_IMAGE_COMPRESSION_AUTO_ADAPTIVE mode with simulated codecs.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "compression-selector.h"
+#include "test-glib-compat.h"
+
+#define IMAGE_SIZE (512 * 1024)
+#define NUM_CHOICES 256
+
+/* simulated cost of the codecs: encoding time and compression ratio */
+static const struct {
+    double ns_per_byte;
+    double ratio;
+} codec_costs[COMPRESSION_CODEC_NUM] = {
+    [COMPRESSION_CODEC_QUIC] = { 8.0, 0.10 },
+    [COMPRESSION_CODEC_JPEG] = { 6.0, 0.05 },
+    [COMPRESSION_CODEC_LZ]   = { 3.0, 0.40 },
+    [COMPRESSION_CODEC_LZ4]  = { 0.5, 0.60 },
+    [COMPRESSION_CODEC_GLZ]  = { 4.0, 0.30 },
+};
+
+#define ALL_CODECS ((1u << COMPRESSION_CODEC_NUM) - 1)
+
+/* choose a codec and compress a simulated image with it, returns the
+ * number of times each codec was chosen in @counts */
+static void run_choices(CompressionSelector *selector, BitmapGradualType level,
+                        uint32_t candidates, unsigned int num_choices, unsigned int *counts)
+{
+    unsigned int i;
+
+    memset(counts, 0, sizeof(counts[0]) * COMPRESSION_CODEC_NUM);
+    for (i = 0; i < num_choices; i++) {
+        CompressionCodec codec = compression_selector_choose(selector, level, IMAGE_SIZE,
+                                                             candidates);
+        g_assert_cmpint(codec, <, COMPRESSION_CODEC_NUM);
+        g_assert_true(candidates & COMPRESSION_CODEC_MASK(codec));
+        counts[codec]++;
+        compression_selector_add_sample(selector, level, IMAGE_SIZE, codec,
+                                        IMAGE_SIZE * codec_costs[codec].ratio,
+                                        IMAGE_SIZE * codec_costs[codec].ns_per_byte);
+    }
+}
+
+static CompressionCodec most_chosen(const unsigned int *counts)
+{
+    CompressionCodec codec, best = 0;
+
+    for (codec = 0; codec < COMPRESSION_CODEC_NUM; codec++) {
+        if (counts[codec] > counts[best]) {
+            best = codec;
+        }
+    }
+    return best;
+}
+
+static void test_selector_exploration(void)
+{
+    CompressionSelector *selector = compression_selector_new();
+    unsigned int counts[COMPRESSION_CODEC_NUM];
+    CompressionCodec codec;
+
+    /* all the codecs are tried before any estimation is trusted */
+    run_choices(selector, BITMAP_GRADUAL_LOW, ALL_CODECS, 2 * COMPRESSION_CODEC_NUM, counts);
+    for (codec = 0; codec < COMPRESSION_CODEC_NUM; codec++) {
+        g_assert_cmpuint(counts[codec], ==, 2);
+        g_assert_cmpfloat(compression_selector_estimate_ns(selector, BITMAP_GRADUAL_LOW,
+                                                           IMAGE_SIZE, codec), >, 0);
+    }
+
+    /* the worse codecs are still tried from time to time */
+    run_choices(selector, BITMAP_GRADUAL_LOW, ALL_CODECS, NUM_CHOICES, counts);
+    for (codec = 0; codec < COMPRESSION_CODEC_NUM; codec++) {
+        g_assert_cmpuint(counts[codec], >, 0);
+    }
+
+    compression_selector_free(selector);
+}
+
+static void test_selector_fast_link(void)
+{
+    CompressionSelector *selector = compression_selector_new();
+    unsigned int counts[COMPRESSION_CODEC_NUM];
+
+    /* unknown bitrate, only the encoding time matters */
+    run_choices(selector, BITMAP_GRADUAL_MEDIUM, ALL_CODECS, NUM_CHOICES, counts);
+    g_assert_cmpint(most_chosen(counts), ==, COMPRESSION_CODEC_LZ4);
+    g_assert_cmpuint(counts[COMPRESSION_CODEC_LZ4], >, NUM_CHOICES * 3 / 4);
+
+    /* 10 Gbps */
+    compression_selector_set_link(selector, UINT64_C(10000000000), 1);
+    run_choices(selector, BITMAP_GRADUAL_MEDIUM, ALL_CODECS, NUM_CHOICES, counts);
+    g_assert_cmpint(most_chosen(counts), ==, COMPRESSION_CODEC_LZ4);
+
+    compression_selector_free(selector);
+}
+
+static void test_selector_slow_link(void)
+{
+    CompressionSelector *selector = compression_selector_new();
+    unsigned int counts[COMPRESSION_CODEC_NUM];
+
+    /* 10 Mbps, the transmission time dominates */
+    compression_selector_set_link(selector, 10 * 1000 * 1000, 50);
+    run_choices(selector, BITMAP_GRADUAL_HIGH, ALL_CODECS, NUM_CHOICES, counts);
+    g_assert_cmpint(most_chosen(counts), ==, COMPRESSION_CODEC_JPEG);
+
+    /* lossless only */
+    run_choices(selector, BITMAP_GRADUAL_HIGH,
+                ALL_CODECS & ~COMPRESSION_CODEC_MASK(COMPRESSION_CODEC_JPEG), NUM_CHOICES, counts);
+    g_assert_cmpint(most_chosen(counts), ==, COMPRESSION_CODEC_QUIC);
+    g_assert_cmpuint(counts[COMPRESSION_CODEC_JPEG], ==, 0);
+
+    /* the link gets faster */
+    compression_selector_set_link(selector, UINT64_C(100000000000), 1);
+    run_choices(selector, BITMAP_GRADUAL_HIGH, ALL_CODECS, NUM_CHOICES, counts);
+    g_assert_cmpint(most_chosen(counts), ==, COMPRESSION_CODEC_LZ4);
+
+    compression_selector_free(selector);
+}
+
+static void test_selector_candidates(void)
+{
+    CompressionSelector *selector = compression_selector_new();
+    unsigned int counts[COMPRESSION_CODEC_NUM];
+    CompressionCodec codec;
+
+    g_assert_cmpint(compression_selector_choose(selector, BITMAP_GRADUAL_LOW, IMAGE_SIZE, 0),
+                    ==, COMPRESSION_CODEC_INVALID);
+
+    for (codec = 0; codec < COMPRESSION_CODEC_NUM; codec++) {
+        run_choices(selector, BITMAP_GRADUAL_LOW, COMPRESSION_CODEC_MASK(codec),
+                    NUM_CHOICES, counts);
+        g_assert_cmpuint(counts[codec], ==, NUM_CHOICES);
+    }
+
+    compression_selector_free(selector);
+}
+
+static void test_selector_classes(void)
+{
+    CompressionSelector *selector = compression_selector_new();
+    unsigned int counts[COMPRESSION_CODEC_NUM];
+
+    run_choices(selector, BITMAP_GRADUAL_HIGH, ALL_CODECS, NUM_CHOICES, counts);
+
+    /* nothing is known yet about the other classes */
+    g_assert_cmpfloat(compression_selector_estimate_ns(selector, BITMAP_GRADUAL_LOW, IMAGE_SIZE,
+                                                       COMPRESSION_CODEC_LZ4), <, 0);
+    g_assert_cmpfloat(compression_selector_estimate_ns(selector, BITMAP_GRADUAL_HIGH, 1024,
+                                                       COMPRESSION_CODEC_LZ4), <, 0);
+    g_assert_cmpfloat(compression_selector_estimate_ns(selector, BITMAP_GRADUAL_HIGH, IMAGE_SIZE,
+                                                       COMPRESSION_CODEC_LZ4), >, 0);
+
+    /* invalid levels are handled as not available */
+    compression_selector_add_sample(selector, BITMAP_GRADUAL_INVALID, IMAGE_SIZE,
+                                    COMPRESSION_CODEC_LZ, IMAGE_SIZE / 2, IMAGE_SIZE);
+    compression_selector_add_sample(selector, BITMAP_GRADUAL_INVALID, IMAGE_SIZE,
+                                    COMPRESSION_CODEC_LZ, IMAGE_SIZE / 2, IMAGE_SIZE);
+    g_assert_cmpfloat(compression_selector_estimate_ns(selector, BITMAP_GRADUAL_NOT_AVAIL,
+                                                       IMAGE_SIZE, COMPRESSION_CODEC_LZ),
+                      ==, IMAGE_SIZE);
+
+    compression_selector_free(selector);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/compression-selector/exploration", test_selector_exploration);
+    g_test_add_func("/server/compression-selector/fast-link", test_selector_fast_link);
+    g_test_add_func("/server/compression-selector/slow-link", test_selector_slow_link);
+    g_test_add_func("/server/compression-selector/candidates", test_selector_candidates);
+    g_test_add_func("/server/compression-selector/classes", test_selector_classes);
+
+    return g_test_run();
+}
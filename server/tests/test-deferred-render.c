@@ -0,0 +1,207 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check that deferring the rendering of the drawings leaving the tree
+ * gives the same pixels as rendering them right away, in the worker or
+ * in render threads.
+ *
+ * The primary surface is filled with small cells, more than the tree
+ * holds, so the oldest ones are deferred. A drawing then covers part of
+ * the deferred cells, which are dropped from the journal once it is
+ * deferred in turn, and more cells make the journal reach its size limit
+ * so its oldest drawings are rendered before the whole surface is read.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "test-display-base.h"
+#include "test-glib-compat.h"
+
+#define WIDTH 640
+#define HEIGHT 320
+#define CELL_SIZE 8
+/* more than the drawables the display channel keeps in its tree */
+#define NUM_CELLS_BEFORE 1100
+#define NUM_CELLS_AFTER 1200
+
+static const int width = WIDTH, height = HEIGHT;
+static uint32_t expected[WIDTH * HEIGHT];
+static uint32_t *pixels;
+static Command *done_commands;
+
+static void fill_expected(const QXLRect *bbox, uint32_t color)
+{
+    int x, y;
+
+    for (y = bbox->top; y < bbox->bottom; y++) {
+        for (x = bbox->left; x < bbox->right; x++) {
+            expected[y * width + x] = color;
+        }
+    }
+}
+
+static void add_solid(Command *command, int left, int top, int right, int bottom,
+                      uint32_t color)
+{
+    command->command = SIMPLE_DRAW_SOLID;
+    command->solid.surface_id = 0;
+    command->solid.bbox.left = left;
+    command->solid.bbox.top = top;
+    command->solid.bbox.right = right;
+    command->solid.bbox.bottom = bottom;
+    command->solid.color = color;
+    fill_expected(&command->solid.bbox, color);
+}
+
+static void add_cell(Command *command, int cell, uint32_t color)
+{
+    int cols = width / CELL_SIZE;
+    int x = (cell % cols) * CELL_SIZE;
+    int y = (cell / cols) * CELL_SIZE;
+
+    add_solid(command, x, y, x + CELL_SIZE, y + CELL_SIZE, color);
+}
+
+static uint32_t cell_color(int i)
+{
+    return (i * 0x9e3779b1u) & 0xffffff;
+}
+
+static void done(Test *test, SPICE_GNUC_UNUSED Command *command)
+{
+    int y;
+
+    /* the primary surface is bottom up */
+    pixels = g_new(uint32_t, width * height);
+    for (y = 0; y < height; y++) {
+        memcpy(pixels + y * width,
+               test->primary_surface + (height - 1 - y) * width * 4, width * 4);
+    }
+
+    /* keep the list, the command is still in use, and stop drawing */
+    done_commands = test->commands;
+    test->commands = g_new0(Command, 1);
+    test->commands[0].command = PATH_PROGRESS;
+    test->num_commands = 1;
+    test->cmd_index = 0;
+
+    basic_event_loop_quit();
+}
+
+static Command *create_commands(int *num_commands)
+{
+    int cols = width / CELL_SIZE;
+    int n = 2 + NUM_CELLS_BEFORE + 1 + NUM_CELLS_AFTER + 2;
+    Command *commands = g_new0(Command, n);
+    Command *command = commands;
+    int i;
+
+    memset(expected, 0, sizeof(expected));
+
+    (command++)->command = DESTROY_PRIMARY;
+    command->command = CREATE_PRIMARY;
+    command->create_primary.width = width;
+    command->create_primary.height = height;
+    command++;
+
+    for (i = 0; i < NUM_CELLS_BEFORE; i++) {
+        add_cell(command++, i, cell_color(i));
+    }
+    /* covers all the cells still in the tree and some deferred ones */
+    add_solid(command++, 0, CELL_SIZE, width,
+              (NUM_CELLS_BEFORE + cols - 1) / cols * CELL_SIZE, 0x123456);
+    for (i = 0; i < NUM_CELLS_AFTER; i++) {
+        int cell = (NUM_CELLS_BEFORE + cols - 1) / cols * cols + i;
+        add_cell(command++, cell, cell_color(NUM_CELLS_BEFORE + i));
+    }
+    (command++)->command = SIMPLE_UPDATE;
+    command->command = PATH_PROGRESS;
+    command->cb = done;
+
+    *num_commands = n;
+    return commands;
+}
+
+static uint32_t *render(bool deferred, unsigned int render_threads)
+{
+    SpiceCoreInterface *core = basic_event_loop_init();
+    Test *test = test_new(core);
+    Command *commands;
+    int num_commands;
+    uint32_t *result;
+
+    spice_server_set_display_deferred_render(test->server, deferred);
+    g_assert_cmpint(spice_server_set_display_render_threads(test->server, render_threads), ==, 0);
+
+    commands = create_commands(&num_commands);
+    test_set_command_list(test, commands, num_commands);
+    test_add_display_interface(test);
+
+    basic_event_loop_mainloop();
+
+    test_destroy(test);
+    basic_event_loop_destroy();
+    g_free(done_commands);
+    done_commands = NULL;
+
+    result = pixels;
+    pixels = NULL;
+    return result;
+}
+
+static void assert_pixels(const uint32_t *result)
+{
+    int i;
+
+    for (i = 0; i < width * height; i++) {
+        if ((result[i] & 0xffffff) != expected[i]) {
+            g_error("pixel %d,%d is %06x instead of %06x", i % width, i / width,
+                    result[i] & 0xffffff, expected[i]);
+        }
+    }
+}
+
+static void test_deferred_render(void)
+{
+    uint32_t *eager, *deferred, *threaded;
+
+    eager = render(false, 0);
+    assert_pixels(eager);
+
+    deferred = render(true, 0);
+    assert_pixels(deferred);
+
+    threaded = render(true, 2);
+    assert_pixels(threaded);
+
+    g_free(threaded);
+    g_free(deferred);
+    g_free(eager);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/deferred-render", test_deferred_render);
+
+    return g_test_run();
+}
@@ -0,0 +1,384 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the slab allocator used for the objects allocated for every
+ * drawing command.
+ *
+ * With -m perf a recorded session is parsed, the recording to use can be
+ * set with SPICE_SLAB_REPLAY_FILE, by default a synthetic one is recorded.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <spice/macros.h>
+#include <spice.h>
+#include "memslot.h"
+#include "red-parse-qxl.h"
+#include "red-record-qxl.h"
+#include "test-glib-compat.h"
+
+#define NUM_OBJECTS 100
+#define NUM_COMMANDS 1000
+#define BITMAP_WIDTH 64
+#define BITMAP_HEIGHT 64
+
+static QXLPHYSICAL
+to_physical(const void *ptr)
+{
+    return (uintptr_t) ptr;
+}
+
+static void init_meminfo(RedMemSlotInfo *mem_info)
+{
+    memslot_info_init(mem_info, 1 /* groups */, 1 /* slots */, 1, 1, 0);
+    memslot_info_add_slot(mem_info, 0, 0, 0 /* delta */, 0 /* start */, ~0ul /* end */, 0 /* generation */);
+}
+
+static void test_slab_reuse(void)
+{
+    RedSlab *slab = red_slab_new(40, 16);
+    RedSlabStats stats;
+    void *objects[NUM_OBJECTS];
+    void *first;
+    int i;
+
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        objects[i] = red_slab_alloc0(slab);
+        g_assert_nonnull(objects[i]);
+        g_assert_cmpuint(((uintptr_t) objects[i]) % 16, ==, 0);
+        memset(objects[i], i, 40);
+    }
+    for (i = 1; i < NUM_OBJECTS; i++) {
+        g_assert_true(objects[i] != objects[i - 1]);
+    }
+
+    red_slab_get_stats(slab, &stats);
+    g_assert_cmpuint(stats.allocs, ==, NUM_OBJECTS);
+    g_assert_cmpuint(stats.frees, ==, 0);
+    g_assert_cmpuint(stats.in_use, ==, NUM_OBJECTS);
+    g_assert_cmpuint(stats.heap_allocs, ==, (NUM_OBJECTS + 15) / 16);
+    g_assert_cmpuint(stats.capacity, ==, stats.heap_allocs * 16);
+
+    for (i = 0; i < NUM_OBJECTS; i++) {
+        red_slab_free(objects[i]);
+    }
+    red_slab_free(NULL);
+
+    /* the objects are reused without allocating any more memory */
+    first = objects[NUM_OBJECTS - 1];
+    for (i = 0; i < 10 * NUM_OBJECTS; i++) {
+        void *obj = red_slab_alloc(slab);
+        g_assert_true(obj == first);
+        red_slab_free(obj);
+    }
+    red_slab_get_stats(slab, &stats);
+    g_assert_cmpuint(stats.allocs, ==, 11 * NUM_OBJECTS);
+    g_assert_cmpuint(stats.frees, ==, 11 * NUM_OBJECTS);
+    g_assert_cmpuint(stats.in_use, ==, 0);
+    g_assert_cmpuint(stats.heap_allocs, ==, (NUM_OBJECTS + 15) / 16);
+
+    red_slab_destroy(slab);
+}
+
+static void test_slab_destroy_in_use(void)
+{
+    RedSlab *slab = red_slab_new(sizeof(uint64_t), 4);
+    uint64_t *a, *b;
+
+    a = (uint64_t *) red_slab_alloc(slab);
+    b = (uint64_t *) red_slab_alloc(slab);
+    *a = 1;
+    *b = 2;
+
+    /* the objects can still be used and freed after the slab is destroyed */
+    red_slab_destroy(slab);
+    g_assert_cmpuint(*a + *b, ==, 3);
+    red_slab_free(a);
+    red_slab_free(b);
+
+    red_slab_destroy(NULL);
+}
+
+typedef struct {
+    QXLDrawable drawable;
+    QXLImage image;
+    QXLClipRects clip_rects;
+    QXLRect rects[2];
+    uint32_t pixels[BITMAP_WIDTH * BITMAP_HEIGHT];
+} TestCopyCommand;
+
+static void init_rect(QXLRect *rect, int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    rect->left = left;
+    rect->top = top;
+    rect->right = right;
+    rect->bottom = bottom;
+}
+
+/* a copy of a bitmap, as issued by most guests for every update */
+static void init_copy_command(TestCopyCommand *cmd, int n, bool clipped)
+{
+    QXLDrawable *drawable = &cmd->drawable;
+    QXLImage *image = &cmd->image;
+
+    memset(cmd, 0, sizeof(*cmd));
+    memset(cmd->pixels, n, sizeof(cmd->pixels));
+
+    image->descriptor.id = n;
+    image->descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    image->descriptor.width = BITMAP_WIDTH;
+    image->descriptor.height = BITMAP_HEIGHT;
+    image->bitmap.flags = QXL_BITMAP_DIRECT | QXL_BITMAP_TOP_DOWN;
+    image->bitmap.format = SPICE_BITMAP_FMT_32BIT;
+    image->bitmap.x = BITMAP_WIDTH;
+    image->bitmap.y = BITMAP_HEIGHT;
+    image->bitmap.stride = BITMAP_WIDTH * 4;
+    image->bitmap.data = to_physical(cmd->pixels);
+
+    drawable->surface_id = 0;
+    drawable->effect = QXL_EFFECT_OPAQUE;
+    drawable->type = QXL_DRAW_COPY;
+    drawable->self_bitmap = 0;
+    drawable->surfaces_dest[0] = -1;
+    drawable->surfaces_dest[1] = -1;
+    drawable->surfaces_dest[2] = -1;
+    init_rect(&drawable->bbox, n % 512, n % 256,
+              n % 512 + BITMAP_WIDTH, n % 256 + BITMAP_HEIGHT);
+    drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    if (clipped) {
+        cmd->clip_rects.num_rects = 2;
+        cmd->clip_rects.chunk.data_size = sizeof(cmd->rects);
+        init_rect(&cmd->rects[0], 0, 0, 32, 32);
+        init_rect(&cmd->rects[1], 32, 32, 64, 64);
+        drawable->clip.type = SPICE_CLIP_TYPE_RECTS;
+        drawable->clip.data = to_physical(&cmd->clip_rects);
+    }
+    drawable->u.copy.src_bitmap = to_physical(image);
+    init_rect(&drawable->u.copy.src_area, 0, 0, BITMAP_WIDTH, BITMAP_HEIGHT);
+    drawable->u.copy.rop_descriptor = SPICE_ROPD_OP_PUT;
+    drawable->u.copy.scale_mode = SPICE_IMAGE_SCALE_MODE_NEAREST;
+}
+
+static void test_slab_drawables_steady_state(void)
+{
+    RedMemSlotInfo mem_info;
+    RedDrawableSlabs slabs;
+    RedSlabStats drawable_stats, image_stats;
+    TestCopyCommand *cmd = g_new(TestCopyCommand, 1);
+    RedDrawable *pending[4];
+    uint64_t heap_allocs;
+    unsigned int i;
+
+    init_meminfo(&mem_info);
+    red_drawable_slabs_init(&slabs);
+
+    /* keep some drawables alive like the display channel does */
+    init_copy_command(cmd, 0, false);
+    for (i = 0; i < G_N_ELEMENTS(pending); i++) {
+        pending[i] = red_drawable_new(NULL, &mem_info, 0, &slabs, to_physical(cmd), 0);
+        g_assert_nonnull(pending[i]);
+    }
+
+    red_slab_get_stats(slabs.drawables, &drawable_stats);
+    red_slab_get_stats(slabs.images, &image_stats);
+    heap_allocs = drawable_stats.heap_allocs + image_stats.heap_allocs;
+    g_assert_cmpuint(heap_allocs, ==, 2);
+
+    for (i = 0; i < NUM_COMMANDS; i++) {
+        RedDrawable *red;
+
+        init_copy_command(cmd, i, false);
+        red = red_drawable_new(NULL, &mem_info, 0, &slabs, to_physical(cmd), 0);
+        g_assert_nonnull(red);
+        g_assert_cmpint(red->type, ==, QXL_DRAW_COPY);
+        g_assert_cmpint(red->u.copy.src_bitmap->descriptor.id, ==, i);
+        g_assert_cmpint(red->u.copy.src_bitmap->u.bitmap.data->num_chunks, ==, 1);
+        g_assert_true(red->u.copy.src_bitmap->u.bitmap.data->chunk[0].data ==
+                      (uint8_t *) cmd->pixels);
+
+        red_drawable_unref(pending[i % G_N_ELEMENTS(pending)]);
+        pending[i % G_N_ELEMENTS(pending)] = red;
+    }
+
+    /* no more memory was allocated for the objects */
+    red_slab_get_stats(slabs.drawables, &drawable_stats);
+    red_slab_get_stats(slabs.images, &image_stats);
+    g_assert_cmpuint(drawable_stats.heap_allocs + image_stats.heap_allocs, ==, heap_allocs);
+    g_assert_cmpuint(drawable_stats.allocs, ==, NUM_COMMANDS + G_N_ELEMENTS(pending));
+    g_assert_cmpuint(image_stats.allocs, ==, NUM_COMMANDS + G_N_ELEMENTS(pending));
+    g_assert_cmpuint(drawable_stats.in_use, ==, G_N_ELEMENTS(pending));
+
+    /* the drawables can be released after the slabs are destroyed */
+    red_drawable_slabs_destroy(&slabs);
+    for (i = 0; i < G_N_ELEMENTS(pending); i++) {
+        red_drawable_unref(pending[i]);
+    }
+    g_free(cmd);
+}
+
+static char *record_session(void)
+{
+    RedMemSlotInfo mem_info;
+    TestCopyCommand *cmd = g_new(TestCopyCommand, 1);
+    char *filename;
+    RedRecord *record;
+    int fd, i;
+
+    fd = g_file_open_tmp("spice-slab-XXXXXX.rec", &filename, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+
+    init_meminfo(&mem_info);
+    g_unsetenv("SPICE_WORKER_RECORD_FILTER");
+    record = red_record_new(filename);
+    for (i = 0; i < NUM_COMMANDS; i++) {
+        QXLCommandExt ext_cmd;
+
+        init_copy_command(cmd, i, i % 4 == 0);
+        memset(&ext_cmd, 0, sizeof(ext_cmd));
+        ext_cmd.cmd.type = QXL_CMD_DRAW;
+        ext_cmd.cmd.data = to_physical(cmd);
+        ext_cmd.group_id = 0;
+        ext_cmd.flags = 0;
+        red_record_qxl_command(record, &mem_info, ext_cmd);
+    }
+    red_record_unref(record);
+    g_free(cmd);
+
+    return filename;
+}
+
+/* a parsed command, the replayed memory is released with the drawable */
+typedef struct {
+    RedDrawable *red;
+    QXLCommandExt *cmd;
+} PendingDraw;
+
+static void pending_draw_release(SpiceReplay *replay, PendingDraw *pending)
+{
+    if (pending->red) {
+        red_drawable_unref(pending->red);
+    }
+    if (pending->cmd) {
+        spice_replay_free_cmd(replay, pending->cmd);
+    }
+    pending->red = NULL;
+    pending->cmd = NULL;
+}
+
+/* parse the drawing commands of a recorded session as the worker does,
+ * keeping some of them alive like the display channel */
+static void test_slab_replay_benchmark(void)
+{
+    const char *replay_file = g_getenv("SPICE_SLAB_REPLAY_FILE");
+    char *recorded = NULL;
+    RedMemSlotInfo mem_info;
+    RedDrawableSlabs slabs;
+    RedSlabStats drawable_stats, image_stats;
+    SpiceReplay *replay;
+    QXLCommandExt *cmd;
+    FILE *file;
+    PendingDraw pending[16];
+    unsigned int num_draws = 0, i;
+    uint64_t warm_heap_allocs = 0, heap_allocs;
+    gdouble parse_time = 0;
+
+    if (!replay_file) {
+        replay_file = recorded = record_session();
+    }
+    file = fopen(replay_file, "r");
+    g_assert_nonnull(file);
+    replay = spice_replay_new(file, 1024);
+    g_assert_nonnull(replay);
+
+    init_meminfo(&mem_info);
+    red_drawable_slabs_init(&slabs);
+    memset(pending, 0, sizeof(pending));
+
+    while ((cmd = spice_replay_next_cmd(replay, NULL)) != NULL) {
+        PendingDraw *slot;
+
+        if (cmd->cmd.type != QXL_CMD_DRAW) {
+            spice_replay_free_cmd(replay, cmd);
+            continue;
+        }
+        slot = &pending[num_draws % G_N_ELEMENTS(pending)];
+
+        g_test_timer_start();
+        pending_draw_release(replay, slot);
+        slot->red = red_drawable_new(NULL, &mem_info, cmd->group_id, &slabs,
+                                     cmd->cmd.data, cmd->flags);
+        parse_time += g_test_timer_elapsed();
+        slot->cmd = cmd;
+
+        if (++num_draws == G_N_ELEMENTS(pending)) {
+            red_slab_get_stats(slabs.drawables, &drawable_stats);
+            red_slab_get_stats(slabs.images, &image_stats);
+            warm_heap_allocs = drawable_stats.heap_allocs + image_stats.heap_allocs;
+        }
+    }
+    for (i = 0; i < G_N_ELEMENTS(pending); i++) {
+        pending_draw_release(replay, &pending[i]);
+    }
+
+    red_slab_get_stats(slabs.drawables, &drawable_stats);
+    red_slab_get_stats(slabs.images, &image_stats);
+    heap_allocs = drawable_stats.heap_allocs + image_stats.heap_allocs;
+    g_test_message("%u drawing commands, %.3f us per command, %" G_GUINT64_FORMAT
+                   " drawables and %" G_GUINT64_FORMAT " images, %" G_GUINT64_FORMAT
+                   " blocks allocated after warm up",
+                   num_draws, num_draws ? parse_time * 1000000 / num_draws : 0,
+                   drawable_stats.allocs, image_stats.allocs,
+                   num_draws > G_N_ELEMENTS(pending) ? heap_allocs - warm_heap_allocs : 0);
+    g_test_minimized_result(num_draws ? parse_time / num_draws : 0,
+                            "%.3f us per drawing command",
+                            num_draws ? parse_time * 1000000 / num_draws : 0);
+    g_assert_cmpuint(drawable_stats.in_use, ==, 0);
+    g_assert_cmpuint(image_stats.in_use, ==, 0);
+    if (recorded) {
+        g_assert_cmpuint(num_draws, ==, NUM_COMMANDS);
+        g_assert_cmpuint(heap_allocs, ==, warm_heap_allocs);
+    }
+
+    red_drawable_slabs_destroy(&slabs);
+    spice_replay_free(replay);
+    fclose(file);
+    if (recorded) {
+        unlink(recorded);
+        g_free(recorded);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/slab/reuse", test_slab_reuse);
+    g_test_add_func("/server/slab/destroy-in-use", test_slab_destroy_in_use);
+    g_test_add_func("/server/slab/drawables-steady-state", test_slab_drawables_steady_state);
+    if (g_test_perf()) {
+        g_test_add_func("/server/slab/replay-benchmark", test_slab_replay_benchmark);
+    }
+
+    return g_test_run();
+}
@@ -0,0 +1,242 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Stress a GLZ dictionary shared by several encoders running in parallel,
+ * like the display channels of a multi-head client.
+ * Every image must be released exactly once by the dictionary.
+ * Run with -m perf to measure the scaling with the number of threads.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "glz-encoder.h"
+#include "test-glib-compat.h"
+
+#define IMAGE_WIDTH 128
+#define IMAGE_MAX_HEIGHT 128
+#define DICT_SIZE (1 << 20)
+
+typedef struct StressImage {
+    uint32_t *pixels;
+    uint32_t height;
+} StressImage;
+
+typedef struct StressEncoder {
+    GlzEncoderUsrContext usr;
+    uint8_t id;
+    GlzEncDictContext *dict;
+    unsigned int iterations;
+    uint64_t pixels_encoded;
+    uint8_t *out;
+    unsigned int out_size;
+} StressEncoder;
+
+static gint images_freed;
+
+static void SPICE_GNUC_PRINTF(2, 3)
+usr_error(GlzEncoderUsrContext *usr, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    g_logv(G_LOG_DOMAIN, G_LOG_LEVEL_ERROR, fmt, ap);
+    va_end(ap);
+}
+
+static void SPICE_GNUC_PRINTF(2, 3)
+usr_nop(GlzEncoderUsrContext *usr, const char *fmt, ...)
+{
+}
+
+static void *usr_malloc(GlzEncoderUsrContext *usr, int size)
+{
+    return g_malloc(size);
+}
+
+static void usr_free(GlzEncoderUsrContext *usr, void *ptr)
+{
+    g_free(ptr);
+}
+
+/* all the lines are given to glz_encode */
+static int usr_more_lines(GlzEncoderUsrContext *usr, uint8_t **lines)
+{
+    return 0;
+}
+
+static int usr_more_space(GlzEncoderUsrContext *usr, uint8_t **io_ptr)
+{
+    return 0;
+}
+
+static void usr_free_image(GlzEncoderUsrContext *usr, GlzUsrImageContext *image_context)
+{
+    StressImage *image = (StressImage *) image_context;
+
+    g_free(image->pixels);
+    g_free(image);
+    g_atomic_int_inc(&images_freed);
+}
+
+static void usr_init(GlzEncoderUsrContext *usr)
+{
+    memset(usr, 0, sizeof(*usr));
+    usr->error = usr_error;
+    usr->warn = usr_nop;
+    usr->info = usr_nop;
+    usr->malloc = usr_malloc;
+    usr->free = usr_free;
+    usr->more_lines = usr_more_lines;
+    usr->more_space = usr_more_space;
+    usr->free_image = usr_free_image;
+}
+
+/* text-like content, repeated across images with some changes, so
+ * the encoders find matches in the images of the other encoders */
+static StressImage *create_image(GRand *rand)
+{
+    StressImage *image = g_new(StressImage, 1);
+    uint32_t x, y, base = g_rand_int_range(rand, 0, 16);
+
+    image->height = g_rand_int_range(rand, 1, IMAGE_MAX_HEIGHT + 1);
+    image->pixels = g_new(uint32_t, IMAGE_WIDTH * image->height);
+    for (y = 0; y < image->height; y++) {
+        for (x = 0; x < IMAGE_WIDTH; x++) {
+            uint32_t pixel = ((x + base) / 8 + y / 16) % 5 ? 0xffffff : 0x202020 * (y % 4);
+            if (g_rand_int_range(rand, 0, 64) == 0) {
+                pixel = g_rand_int(rand) & 0xffffff;
+            }
+            image->pixels[y * IMAGE_WIDTH + x] = pixel;
+        }
+    }
+    return image;
+}
+
+static gpointer encoder_thread(gpointer data)
+{
+    StressEncoder *enc = data;
+    GRand *rand = g_rand_new_with_seed(enc->id);
+    GlzEncoderContext *glz;
+    unsigned int i;
+
+    glz = glz_encoder_create(enc->id, enc->dict, &enc->usr);
+    g_assert_nonnull(glz);
+
+    for (i = 0; i < enc->iterations; i++) {
+        StressImage *image = create_image(rand);
+        GlzEncDictImageContext *dict_image;
+        int size;
+
+        size = glz_encode(glz, LZ_IMAGE_TYPE_RGB32, IMAGE_WIDTH, image->height, TRUE,
+                          (uint8_t *) image->pixels, image->height, IMAGE_WIDTH * 4,
+                          enc->out, enc->out_size, image, &dict_image);
+        g_assert_cmpint(size, >, 0);
+        g_assert_nonnull(dict_image);
+        enc->pixels_encoded += IMAGE_WIDTH * image->height;
+    }
+
+    glz_encoder_destroy(glz);
+    g_rand_free(rand);
+    return NULL;
+}
+
+/* returns the number of pixels encoded per second */
+static double run_encoders(unsigned int num_threads, unsigned int iterations)
+{
+    GlzEncoderUsrContext dict_usr;
+    GlzEncDictContext *dict;
+    StressEncoder *encs = g_new0(StressEncoder, num_threads);
+    GThread **threads = g_new(GThread *, num_threads);
+    uint64_t pixels_encoded = 0;
+    double elapsed;
+    unsigned int i;
+
+    usr_init(&dict_usr);
+    dict = glz_enc_dictionary_create(DICT_SIZE, num_threads, &dict_usr);
+    g_assert_nonnull(dict);
+    g_atomic_int_set(&images_freed, 0);
+
+    for (i = 0; i < num_threads; i++) {
+        usr_init(&encs[i].usr);
+        encs[i].id = i;
+        encs[i].dict = dict;
+        encs[i].iterations = iterations;
+        // enough for the worst case, the output is not needed
+        encs[i].out_size = IMAGE_WIDTH * IMAGE_MAX_HEIGHT * 4 * 2;
+        encs[i].out = g_malloc(encs[i].out_size);
+    }
+
+    g_test_timer_start();
+    for (i = 0; i < num_threads; i++) {
+        threads[i] = g_thread_new("glz-stress", encoder_thread, &encs[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+        g_thread_join(threads[i]);
+        pixels_encoded += encs[i].pixels_encoded;
+        g_free(encs[i].out);
+    }
+    elapsed = g_test_timer_elapsed();
+
+    // the images still in the window are released with the dictionary
+    glz_enc_dictionary_destroy(dict, &dict_usr);
+    g_assert_cmpint(g_atomic_int_get(&images_freed), ==, num_threads * iterations);
+
+    g_free(threads);
+    g_free(encs);
+    return pixels_encoded / elapsed;
+}
+
+static void test_glz_dict_stress(void)
+{
+    run_encoders(4, 2000);
+}
+
+static void test_glz_dict_scaling(void)
+{
+    unsigned int max_threads = MIN(g_get_num_processors(), 16);
+    unsigned int num_threads;
+    double single = 0;
+
+    for (num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        double rate = run_encoders(num_threads, 20000);
+        if (num_threads == 1) {
+            single = rate;
+        }
+        g_test_message("%2u threads: %.1f Mpixels/s (%.2fx)", num_threads,
+                       rate / 1e6, rate / single);
+        if (num_threads * 2 > max_threads) {
+            g_test_maximized_result(rate / 1e6, "%u threads %.1f Mpixels/s",
+                                    num_threads, rate / 1e6);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/glz-dict/stress", test_glz_dict_stress);
+    if (g_test_perf()) {
+        g_test_add_func("/server/glz-dict/scaling", test_glz_dict_scaling);
+    }
+
+    return g_test_run();
+}
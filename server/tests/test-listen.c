@@ -30,6 +30,15 @@
 #ifndef _WIN32
 #include <gio/gunixsocketaddress.h>
 #endif
+#include <openssl/ssl.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <linux/tls.h>
+#endif
 
 #include "test-glib-compat.h"
 
@@ -40,6 +49,15 @@
 
 #define PKI_DIR SPICE_TOP_SRCDIR "/server/tests/pki/"
 
+/* the server can check whether the kernel encrypts the data it sends */
+#if defined(__linux__) && defined(TCP_ULP) && defined(TLS_TX) && \
+    defined(SSL_OP_ENABLE_KTLS) && defined(BIO_get_ktls_send) && !defined(OPENSSL_NO_KTLS)
+#define CHECK_KERNEL_TLS 1
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#endif
+
 static bool error_is_set(GError **error)
 {
     return ((error != NULL) && (*error != NULL));
@@ -153,6 +171,98 @@ static void check_magic(GIOStream *io_stream, GError **error)
     g_assert_cmpint(memcmp(buffer, "REDQ", 4), ==, 0);
 }
 
+#ifdef CHECK_KERNEL_TLS
+static bool kernel_supports_tls(void)
+{
+    struct sockaddr_in addr = { 0, };
+    socklen_t len = sizeof(addr);
+    int listen_fd, fd, ret = -1;
+
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (bind(listen_fd, (struct sockaddr *) &addr, len) == 0 && listen(listen_fd, 1) == 0 &&
+        getsockname(listen_fd, (struct sockaddr *) &addr, &len) == 0 &&
+        connect(fd, (struct sockaddr *) &addr, len) == 0) {
+        ret = setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls"));
+    }
+    close(fd);
+    close(listen_fd);
+
+    return ret == 0;
+}
+
+/* the server end of the connection of @stream, in this process */
+static int find_server_socket(GIOStream *stream)
+{
+    GIOStream *base_stream;
+    GSocketAddress *address;
+    uint16_t port;
+    int fd;
+
+    g_object_get(stream, "base-io-stream", &base_stream, NULL);
+    address = g_socket_connection_get_local_address(G_SOCKET_CONNECTION(base_stream), NULL);
+    g_assert_nonnull(address);
+    port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+    g_object_unref(address);
+    g_object_unref(base_stream);
+
+    for (fd = 0; fd < 1024; fd++) {
+        struct sockaddr_storage peer;
+        socklen_t len = sizeof(peer);
+
+        if (getpeername(fd, (struct sockaddr *) &peer, &len) != 0) {
+            continue;
+        }
+        if ((peer.ss_family == AF_INET &&
+             ntohs(((struct sockaddr_in *) &peer)->sin_port) == port) ||
+            (peer.ss_family == AF_INET6 &&
+             ntohs(((struct sockaddr_in6 *) &peer)->sin6_port) == port)) {
+            return fd;
+        }
+    }
+    return -1;
+}
+
+static bool socket_sends_with_kernel_tls(int fd)
+{
+    uint8_t crypto_info[256];
+    socklen_t len = sizeof(crypto_info);
+
+    /* fails with EBUSY until the keys are given to the kernel */
+    return getsockopt(fd, SOL_TLS, TLS_TX, crypto_info, &len) == 0;
+}
+#endif
+
+/* checks that the server gave the encryption of the data it sends to the
+ * kernel, when the kernel and OpenSSL support it */
+static void check_kernel_tls(GIOStream *stream)
+{
+#ifdef CHECK_KERNEL_TLS
+    GError *error = NULL;
+    int fd, i;
+
+    if (!kernel_supports_tls()) {
+        g_test_message("the kernel does not support TLS, not checking its use");
+        return;
+    }
+
+    g_tls_connection_handshake(G_TLS_CONNECTION(stream), NULL, &error);
+    g_assert_no_error(error);
+    fd = find_server_socket(stream);
+    g_assert_cmpint(fd, >=, 0);
+
+    /* the server ends the handshake on its side in the main loop */
+    for (i = 0; i < 500 && !socket_sends_with_kernel_tls(fd); i++) {
+        g_usleep(10 * 1000);
+    }
+    g_assert_true(socket_sends_with_kernel_tls(fd));
+#else
+    g_test_message("OpenSSL does not support kernel TLS, not checking its use");
+#endif
+}
+
 typedef struct
 {
     GSocketConnectable *connectable;
@@ -160,10 +270,9 @@ typedef struct
     TestEventLoop *event_loop;
 } ThreadData;
 
-static gpointer check_magic_thread(gpointer data)
+static gpointer check_magic_common(ThreadData *thread_data, bool kernel_tls)
 {
     GError *error = NULL;
-    ThreadData *thread_data = (ThreadData*) data;
     GSocketConnectable *connectable = G_SOCKET_CONNECTABLE(thread_data->connectable);
     GIOStream *stream;
 
@@ -173,6 +282,9 @@ static gpointer check_magic_thread(gpointer data)
         stream = fake_client_connect(connectable, &error);
     }
     g_assert_no_error(error);
+    if (kernel_tls) {
+        check_kernel_tls(stream);
+    }
     check_magic(stream, &error);
     g_assert_no_error(error);
 
@@ -185,6 +297,16 @@ static gpointer check_magic_thread(gpointer data)
     return NULL;
 }
 
+static gpointer check_magic_thread(gpointer data)
+{
+    return check_magic_common((ThreadData*) data, false);
+}
+
+static gpointer check_magic_kernel_tls_thread(gpointer data)
+{
+    return check_magic_common((ThreadData*) data, true);
+}
+
 static gpointer check_no_connect_thread(gpointer data)
 {
     GError *error = NULL;
@@ -256,8 +378,11 @@ static void test_connect_plain(void)
     spice_server_destroy(server);
 }
 
-static void test_connect_tls(void)
+/* with kernel_offload, the connection works whether the kernel supports
+ * TLS or not */
+static void test_connect_tls(gconstpointer data)
 {
+    bool kernel_offload = GPOINTER_TO_INT(data);
     GThread *thread;
     int result;
 
@@ -269,6 +394,7 @@ static void test_connect_tls(void)
     SpiceServer *server = spice_server_new();
     spice_server_set_name(server, "SPICE listen test");
     spice_server_set_noauth(server);
+    spice_server_set_tls_kernel_offload(server, kernel_offload);
     result = spice_server_set_tls(server, BASE_PORT,
                                   PKI_DIR "ca-cert.pem",
                                   PKI_DIR "server-cert.pem",
@@ -279,7 +405,8 @@ static void test_connect_tls(void)
     g_assert_cmpint(result, ==, 0);
 
     /* fake client */
-    thread = fake_client_new(check_magic_thread, "localhost", BASE_PORT, true, &event_loop);
+    thread = fake_client_new(kernel_offload ? check_magic_kernel_tls_thread : check_magic_thread,
+                             "localhost", BASE_PORT, true, &event_loop);
     test_event_loop_run(&event_loop);
     g_assert_null(g_thread_join(thread));
 
@@ -371,7 +498,10 @@ int main(int argc, char **argv)
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/server/listen/connect_plain", test_connect_plain);
-    g_test_add_func("/server/listen/connect_tls", test_connect_tls);
+    g_test_add_data_func("/server/listen/connect_tls", GINT_TO_POINTER(FALSE),
+                         test_connect_tls);
+    g_test_add_data_func("/server/listen/connect_tls_kernel", GINT_TO_POINTER(TRUE),
+                         test_connect_tls);
     g_test_add_func("/server/listen/connect_both", test_connect_plain_and_tls);
 #ifndef _WIN32
     g_test_add_func("/server/listen/connect_unix", test_connect_unix);
@@ -0,0 +1,227 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check the streaming LZ4 meant for the spicevmc channels: the blocks read
+ * from the device and compressed in the ring of the encoder have to be
+ * decoded in the ring of the decoder, with the history of the previous
+ * blocks, as the rings wrap.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "lz4-stream.h"
+#include "red-slab.h"
+#include "test-glib-compat.h"
+
+/* the block size of the spicevmc channels (BUF_SIZE) */
+#define MAX_BLOCK_SIZE (64 * 1024 + 32)
+/* room for the compression of a block */
+#define DEST_SIZE (MAX_BLOCK_SIZE + MAX_BLOCK_SIZE / 255 + 16)
+/* a block fitting in the 64K of history */
+#define SMALL_BLOCK_SIZE (32 * 1024)
+/* enough data to wrap both rings a few times */
+#define NUM_BLOCKS 100
+
+/* data of the sizes usually read from a device, repeating parts of a
+ * small dictionary so the blocks refer to the previous ones */
+static uint32_t fill_block(GRand *rand, const uint8_t *dict, uint32_t dict_size,
+                           uint8_t *block, int n)
+{
+    uint32_t size, pos = 0;
+
+    switch (n % 4) {
+    case 0:
+        size = MAX_BLOCK_SIZE;
+        break;
+    case 1:
+        size = g_rand_int_range(rand, 1, 64);
+        break;
+    default:
+        size = g_rand_int_range(rand, 64, MAX_BLOCK_SIZE);
+        break;
+    }
+    while (pos < size) {
+        uint32_t len = MIN((uint32_t) g_rand_int_range(rand, 1, 256), size - pos);
+
+        if (g_rand_int_range(rand, 0, 8) != 0) {
+            memcpy(block + pos, dict + g_rand_int_range(rand, 0, dict_size - len), len);
+        } else {
+            uint32_t i;
+
+            for (i = 0; i < len; i++) {
+                block[pos + i] = g_rand_int(rand);
+            }
+        }
+        pos += len;
+    }
+    return size;
+}
+
+static void test_lz4_stream_round_trip(void)
+{
+    Lz4StreamEncoder *encoder = lz4_stream_encoder_new(MAX_BLOCK_SIZE);
+    Lz4StreamDecoder *decoder = lz4_stream_decoder_new(MAX_BLOCK_SIZE);
+    GRand *rand = g_rand_new_with_seed(0x4c5a34);
+    uint8_t dict[4096];
+    uint8_t *data = g_new(uint8_t, MAX_BLOCK_SIZE);
+    uint8_t *compressed = g_new(uint8_t, DEST_SIZE);
+    uint64_t total = 0, total_compressed = 0;
+    unsigned int i;
+    int n;
+
+    for (i = 0; i < sizeof(dict); i++) {
+        dict[i] = g_rand_int(rand);
+    }
+
+    for (n = 0; n < NUM_BLOCKS; n++) {
+        uint8_t *block = lz4_stream_encoder_next_block(encoder);
+        const uint8_t *decoded;
+        uint32_t size;
+        int compressed_size;
+
+        size = fill_block(rand, dict, sizeof(dict), block, n);
+        memcpy(data, block, size);
+
+        compressed_size = lz4_stream_encoder_compress(encoder, size, compressed, DEST_SIZE);
+        g_assert_cmpint(compressed_size, >, 0);
+
+        decoded = lz4_stream_decoder_decompress(decoder, compressed, compressed_size, size);
+        g_assert_nonnull(decoded);
+        g_assert_cmpmem(decoded, size, data, size);
+
+        total += size;
+        total_compressed += compressed_size;
+    }
+    /* the rings wrapped and the blocks used the history */
+    g_assert_cmpuint(total, >, 10 * (2 * MAX_BLOCK_SIZE + 64 * 1024));
+    g_assert_cmpuint(total_compressed, <, total / 2);
+
+    g_free(compressed);
+    g_free(data);
+    g_rand_free(rand);
+    lz4_stream_decoder_free(decoder);
+    lz4_stream_encoder_free(encoder);
+}
+
+static void test_lz4_stream_failure(void)
+{
+    Lz4StreamEncoder *encoder = lz4_stream_encoder_new(MAX_BLOCK_SIZE);
+    Lz4StreamDecoder *decoder = lz4_stream_decoder_new(MAX_BLOCK_SIZE);
+    GRand *rand = g_rand_new_with_seed(0x4c5a34);
+    uint8_t *data = g_new(uint8_t, MAX_BLOCK_SIZE);
+    uint8_t *compressed = g_new(uint8_t, DEST_SIZE);
+    uint8_t *block;
+    const uint8_t *decoded;
+    int compressed_size, i;
+
+    for (i = 0; i < MAX_BLOCK_SIZE; i++) {
+        data[i] = g_rand_int(rand);
+    }
+
+    /* random data does not fit, the block is still there to be sent as
+     * it is */
+    block = lz4_stream_encoder_next_block(encoder);
+    memcpy(block, data, MAX_BLOCK_SIZE);
+    g_assert_cmpint(lz4_stream_encoder_compress(encoder, MAX_BLOCK_SIZE, compressed, 16),
+                    ==, 0);
+    g_assert_true(lz4_stream_encoder_next_block(encoder) == block);
+    g_assert_cmpmem(block, MAX_BLOCK_SIZE, data, MAX_BLOCK_SIZE);
+
+    /* blocks larger than the ring allows are refused */
+    g_assert_null(lz4_stream_decoder_decompress(decoder, compressed, 16,
+                                                MAX_BLOCK_SIZE + 1));
+    lz4_stream_encoder_free(encoder);
+    lz4_stream_decoder_free(decoder);
+
+    /* a new stream works, with the history of its own blocks */
+    encoder = lz4_stream_encoder_new(MAX_BLOCK_SIZE);
+    decoder = lz4_stream_decoder_new(MAX_BLOCK_SIZE);
+    for (i = 0; i < 2; i++) {
+        block = lz4_stream_encoder_next_block(encoder);
+        memcpy(block, data, SMALL_BLOCK_SIZE);
+        compressed_size = lz4_stream_encoder_compress(encoder, SMALL_BLOCK_SIZE,
+                                                      compressed, DEST_SIZE);
+        g_assert_cmpint(compressed_size, >, 0);
+        decoded = lz4_stream_decoder_decompress(decoder, compressed, compressed_size,
+                                                SMALL_BLOCK_SIZE);
+        g_assert_nonnull(decoded);
+        g_assert_cmpmem(decoded, SMALL_BLOCK_SIZE, data, SMALL_BLOCK_SIZE);
+    }
+    /* the second block is a copy of the first one */
+    g_assert_cmpint(compressed_size, <, SMALL_BLOCK_SIZE / 100);
+
+    /* corrupted data is detected */
+    memset(compressed, 0xff, 64);
+    g_assert_null(lz4_stream_decoder_decompress(decoder, compressed, 64, MAX_BLOCK_SIZE));
+
+    g_free(compressed);
+    g_free(data);
+    g_rand_free(rand);
+    lz4_stream_decoder_free(decoder);
+    lz4_stream_encoder_free(encoder);
+}
+
+/* the channel frees its slab of items when destroyed, the items still
+ * queued to the client are freed later */
+static void test_lz4_stream_items_after_destroy(void)
+{
+    RedSlab *slab = red_slab_new(DEST_SIZE, 4);
+    void *items[10];
+    RedSlabStats stats;
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(items); i++) {
+        items[i] = red_slab_alloc(slab);
+    }
+    /* sent items */
+    for (i = 0; i < 4; i++) {
+        red_slab_free(items[i]);
+    }
+    red_slab_get_stats(slab, &stats);
+    g_assert_cmpuint(stats.allocs - stats.frees, ==, stats.in_use);
+    g_assert_cmpuint(stats.in_use, ==, G_N_ELEMENTS(items) - 4);
+
+    red_slab_destroy(slab);
+
+    for (i = 4; i < G_N_ELEMENTS(items) - 1; i++) {
+        memset(items[i], i, DEST_SIZE);
+        red_slab_free(items[i]);
+    }
+    red_slab_get_stats(slab, &stats);
+    g_assert_cmpuint(stats.allocs, ==, G_N_ELEMENTS(items));
+    g_assert_cmpuint(stats.frees, ==, G_N_ELEMENTS(items) - 1);
+    g_assert_cmpuint(stats.in_use, ==, 1);
+
+    /* the slab is released with the last item */
+    red_slab_free(items[G_N_ELEMENTS(items) - 1]);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/lz4-stream/round-trip", test_lz4_stream_round_trip);
+    g_test_add_func("/server/lz4-stream/failure", test_lz4_stream_failure);
+    g_test_add_func("/server/lz4-stream/items-after-destroy",
+                    test_lz4_stream_items_after_destroy);
+
+    return g_test_run();
+}
@@ -46,11 +46,29 @@ static void agent_options(void)
     spice_server_destroy(server);
 }
 
+static void image_compression_threads_options(void)
+{
+    SpiceServer *server = spice_server_new();
+
+    g_assert_nonnull(server);
+
+    g_assert_cmpint(spice_server_set_image_compression_threads(server, 0), ==, 0);
+    g_assert_cmpint(spice_server_set_image_compression_threads(server, 4), ==, 0);
+
+    g_test_expect_message(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING,
+                          "*too many image compression threads*");
+    g_assert_cmpint(spice_server_set_image_compression_threads(server, 1000), ==, -1);
+    g_test_assert_expected_messages();
+
+    spice_server_destroy(server);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
 
     g_test_add_func("/server/agent options", agent_options);
+    g_test_add_func("/server/image compression threads", image_compression_threads_options);
 
     return g_test_run();
 }
@@ -0,0 +1,165 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Test the lookup by content of the pixmap cache.
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "pixmap-cache.h"
+#include "spice-bitmap-utils.h"
+
+// a 32 bit bitmap, the padding of the lines is filled with garbage
+static SpiceBitmap *new_bitmap(uint32_t width, uint32_t height, uint32_t stride,
+                               uint32_t seed, int num_chunks)
+{
+    SpiceBitmap *bitmap = g_new0(SpiceBitmap, 1);
+    uint8_t *data = (uint8_t *) g_malloc(stride * height);
+    uint32_t line = 0;
+
+    for (uint32_t y = 0; y < height; y++) {
+        uint32_t *dest = (uint32_t *) (data + y * stride);
+        for (uint32_t x = 0; x < width; x++) {
+            dest[x] = (x * 0x010203u + y * 0x030201u) ^ seed;
+        }
+        memset(dest + width, 0xa5 ^ y ^ stride, stride - width * 4);
+    }
+
+    bitmap->format = SPICE_BITMAP_FMT_32BIT;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = stride;
+    bitmap->data = spice_chunks_new(num_chunks);
+    bitmap->data->data_size = stride * height;
+    for (int i = 0; i < num_chunks; i++) {
+        uint32_t lines = (i == num_chunks - 1) ? height - line : height / num_chunks;
+        bitmap->data->chunk[i].data = data + line * stride;
+        bitmap->data->chunk[i].len = lines * stride;
+        line += lines;
+    }
+    return bitmap;
+}
+
+static void free_bitmap(SpiceBitmap *bitmap)
+{
+    g_free(bitmap->data->chunk[0].data);
+    spice_chunks_destroy(bitmap->data);
+    g_free(bitmap);
+}
+
+// add an item as dcc_pixmap_cache_unlocked_add would do
+static void add_item(PixmapCache *cache, uint64_t id, SpiceBitmap *bitmap, uint64_t content_hash)
+{
+    NewCacheItem *item = g_new0(NewCacheItem, 1);
+
+    item->id = id;
+    item->size = bitmap->x * bitmap->y;
+    item->next = cache->hash_table[BITS_CACHE_HASH_KEY(id)];
+    cache->hash_table[BITS_CACHE_HASH_KEY(id)] = item;
+    ring_item_init(&item->lru_link);
+    ring_add(&cache->lru, &item->lru_link);
+    cache->items++;
+    cache->available -= item->size;
+
+    pixmap_cache_unlocked_set_content(cache, id, content_hash, bitmap);
+}
+
+static void test_pixmap_cache_content(void)
+{
+    PixmapCache *cache = pixmap_cache_get(NULL, 0, 1024 * 1024);
+    g_assert_nonnull(cache);
+
+    SpiceBitmap *cached = new_bitmap(64, 32, 64 * 4, 0, 1);
+    uint64_t cached_hash = bitmap_get_content_hash(cached);
+    add_item(cache, 1, cached, cached_hash);
+
+    // hit: same pixels with a different stride and chunks
+    SpiceBitmap *same = new_bitmap(64, 32, 64 * 4 + 12, 0, 3);
+    g_assert_cmpuint(bitmap_get_content_hash(same), ==, cached_hash);
+    NewCacheItem *item = pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(same),
+                                                            same);
+    g_assert_nonnull(item);
+    g_assert_cmpuint(item->id, ==, 1);
+
+    // miss: other pixels
+    SpiceBitmap *other = new_bitmap(64, 32, 64 * 4, 1, 1);
+    g_assert_null(pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(other),
+                                                     other));
+
+    // forced collisions, other pixels or other geometry with the same bytes
+    g_assert_null(pixmap_cache_unlocked_find_content(cache, cached_hash, other));
+    SpiceBitmap *reshaped = new_bitmap(32, 64, 32 * 4, 0, 1);
+    memcpy(reshaped->data->chunk[0].data, cached->data->chunk[0].data, 64 * 32 * 4);
+    g_assert_null(pixmap_cache_unlocked_find_content(cache, cached_hash, reshaped));
+
+    // the item is not found once removed
+    pixmap_cache_unlocked_remove_content_hash(cache, item);
+    g_assert_null(item->content);
+    g_assert_null(pixmap_cache_unlocked_find_content(cache, cached_hash, same));
+
+    free_bitmap(reshaped);
+    free_bitmap(other);
+    free_bitmap(same);
+    free_bitmap(cached);
+    pixmap_cache_unref(cache);
+}
+
+// the copies of the content are limited, the items past the limit are
+// only found by id
+static void test_pixmap_cache_content_budget(void)
+{
+    PixmapCache *cache = pixmap_cache_get(NULL, 0, 1024 * 1024);
+    g_assert_nonnull(cache);
+    g_assert_cmpint(cache->content_available, ==, PIXMAP_CACHE_CONTENT_MAX_SIZE);
+
+    SpiceBitmap *first = new_bitmap(64, 32, 64 * 4, 0, 1);
+    SpiceBitmap *second = new_bitmap(64, 32, 64 * 4, 1, 1);
+    cache->content_available = 64 * 32 * 4 + 64 * 4;
+
+    add_item(cache, 1, first, bitmap_get_content_hash(first));
+    g_assert_cmpint(cache->content_available, ==, 64 * 4);
+    add_item(cache, 2, second, bitmap_get_content_hash(second));
+    g_assert_cmpint(cache->content_available, ==, 64 * 4);
+    g_assert_nonnull(pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(first),
+                                                        first));
+    g_assert_null(pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(second),
+                                                     second));
+
+    // removing the content of an item gives its memory back
+    NewCacheItem *item = pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(first),
+                                                            first);
+    pixmap_cache_unlocked_remove_content_hash(cache, item);
+    g_assert_cmpint(cache->content_available, ==, 64 * 32 * 4 + 64 * 4);
+    pixmap_cache_unlocked_set_content(cache, 2, bitmap_get_content_hash(second), second);
+    g_assert_nonnull(pixmap_cache_unlocked_find_content(cache, bitmap_get_content_hash(second),
+                                                        second));
+
+    free_bitmap(second);
+    free_bitmap(first);
+    pixmap_cache_unref(cache);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/pixmap-cache-content", test_pixmap_cache_content);
+    g_test_add_func("/server/pixmap-cache-content-budget", test_pixmap_cache_content_budget);
+
+    return g_test_run();
+}
@@ -0,0 +1,194 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compare the latency of compressing a bitmap with QUIC as a whole and
+ * as horizontal stripes compressed in parallel by an ImageEncodersPool.
+ * Run with -m perf to use a 4K bitmap.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "image-encoders.h"
+#include "test-glib-compat.h"
+
+typedef struct StripeJob {
+    ImageEncodersPoolJob base;
+    SpiceBitmap bitmap;
+    SpiceImage image;
+    compress_send_data_t comp_send_data;
+    bool success;
+} StripeJob;
+
+static uint8_t *create_pixels(uint32_t width, uint32_t height)
+{
+    uint32_t *pixels = g_new(uint32_t, width * height);
+    GRand *rand = g_rand_new_with_seed(0x5eed);
+    uint32_t x, y;
+
+    /* smooth gradients with some noise, like a photo */
+    for (y = 0; y < height; y++) {
+        for (x = 0; x < width; x++) {
+            uint32_t noise = g_rand_int_range(rand, 0, 8);
+            uint32_t r = (x * 255 / width + noise) & 0xff;
+            uint32_t g = (y * 255 / height + noise) & 0xff;
+            uint32_t b = ((x + y) * 127 / (width + height) + noise) & 0xff;
+            pixels[y * width + x] = (r << 16) | (g << 8) | b;
+        }
+    }
+    g_rand_free(rand);
+    return (uint8_t *) pixels;
+}
+
+static void init_bitmap(SpiceBitmap *bitmap, uint8_t *pixels,
+                        uint32_t width, uint32_t height)
+{
+    memset(bitmap, 0, sizeof(*bitmap));
+    bitmap->format = SPICE_BITMAP_FMT_32BIT;
+    bitmap->flags = SPICE_BITMAP_FLAGS_TOP_DOWN;
+    bitmap->x = width;
+    bitmap->y = height;
+    bitmap->stride = width * 4;
+    bitmap->data = spice_chunks_new_linear(pixels, bitmap->stride * height);
+}
+
+static void free_comp_bufs(compress_send_data_t *comp_send_data)
+{
+    RedCompressBuf *buf = comp_send_data->comp_buf;
+
+    while (buf) {
+        RedCompressBuf *next = buf->send_next;
+        compress_buf_free(buf);
+        buf = next;
+    }
+    comp_send_data->comp_buf = NULL;
+}
+
+static void compress_stripe(ImageEncoders *enc, ImageEncodersPoolJob *base)
+{
+    StripeJob *job = SPICE_CONTAINEROF(base, StripeJob, base);
+
+    job->success = image_encoders_compress_quic(enc, &job->image, &job->bitmap,
+                                                &job->comp_send_data);
+}
+
+static uint32_t compress_whole(ImageEncoders *enc, uint8_t *pixels,
+                               uint32_t width, uint32_t height)
+{
+    SpiceBitmap bitmap;
+    SpiceImage image;
+    compress_send_data_t comp_send_data = { 0 };
+    uint32_t size;
+
+    init_bitmap(&bitmap, pixels, width, height);
+    g_assert_true(image_encoders_compress_quic(enc, &image, &bitmap, &comp_send_data));
+    size = comp_send_data.comp_buf_size;
+    free_comp_bufs(&comp_send_data);
+    spice_chunks_destroy(bitmap.data);
+    return size;
+}
+
+static uint32_t compress_stripes(ImageEncodersPool *pool, unsigned int num_stripes,
+                                 uint8_t *pixels, uint32_t width, uint32_t height)
+{
+    StripeJob *jobs = g_new0(StripeJob, num_stripes);
+    uint32_t size = 0;
+    unsigned int i;
+
+    for (i = 0; i < num_stripes; i++) {
+        uint32_t top = height * i / num_stripes;
+        uint32_t bottom = height * (i + 1) / num_stripes;
+
+        init_bitmap(&jobs[i].bitmap, pixels + top * width * 4, width, bottom - top);
+        g_assert_true(image_encoders_pool_push(pool, &jobs[i].base, compress_stripe));
+    }
+    for (i = 0; i < num_stripes; i++) {
+        image_encoders_pool_wait(pool, &jobs[i].base);
+        g_assert_true(jobs[i].success);
+        size += jobs[i].comp_send_data.comp_buf_size;
+        free_comp_bufs(&jobs[i].comp_send_data);
+        spice_chunks_destroy(jobs[i].bitmap.data);
+    }
+    g_free(jobs);
+    return size;
+}
+
+static void test_quic_stripes(void)
+{
+    uint32_t width = 256, height = 256;
+    unsigned int num_threads = 4, iterations = 1;
+    ImageEncoderSharedData shared_data;
+    ImageEncoders enc;
+    ImageEncodersPool *pool;
+    uint8_t *pixels;
+    uint32_t whole_size = 0, stripes_size = 0;
+    double whole_time, stripes_time;
+    unsigned int i;
+
+    if (g_test_perf()) {
+        width = 3840;
+        height = 2160;
+        num_threads = CLAMP(g_get_num_processors(), 1, IMAGE_ENCODERS_POOL_MAX_THREADS);
+        iterations = 10;
+    }
+
+    memset(&shared_data, 0, sizeof(shared_data));
+    image_encoder_shared_init(&shared_data);
+    image_encoders_init(&enc, &shared_data);
+    pool = image_encoders_pool_new(&shared_data, num_threads);
+    g_assert_nonnull(pool);
+    g_assert_cmpuint(image_encoders_pool_get_num_threads(pool), ==, num_threads);
+    pixels = create_pixels(width, height);
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        whole_size = compress_whole(&enc, pixels, width, height);
+    }
+    whole_time = g_test_timer_elapsed() / iterations;
+
+    g_test_timer_start();
+    for (i = 0; i < iterations; i++) {
+        stripes_size = compress_stripes(pool, num_threads, pixels, width, height);
+    }
+    stripes_time = g_test_timer_elapsed() / iterations;
+
+    g_assert_cmpuint(whole_size, >, 0);
+    g_assert_cmpuint(stripes_size, >, 0);
+    g_test_message("%ux%u whole: %.2f ms %u bytes", width, height,
+                   whole_time * 1000, whole_size);
+    g_test_message("%ux%u %u stripes: %.2f ms %u bytes", width, height, num_threads,
+                   stripes_time * 1000, stripes_size);
+    g_test_minimized_result(stripes_time, "stripes latency %.2f ms (%.1fx)",
+                            stripes_time * 1000, whole_time / stripes_time);
+
+    g_free(pixels);
+    image_encoders_pool_free(pool);
+    image_encoders_free(&enc);
+    image_encoder_shared_destroy(&shared_data);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/quic-stripes", test_quic_stripes);
+
+    return g_test_run();
+}
@@ -287,6 +287,128 @@ static void test_circular_small_chunks(void)
     memslot_info_destroy(&mem_info);
 }
 
+static void init_red_drawable(RedDrawable *red, uint8_t type, uint8_t effect,
+                              int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    memset(red, 0, sizeof(*red));
+    red->type = type;
+    red->effect = effect;
+    red->bbox.left = left;
+    red->bbox.top = top;
+    red->bbox.right = right;
+    red->bbox.bottom = bottom;
+    red->clip.type = SPICE_CLIP_TYPE_NONE;
+    red->surface_deps[0] = -1;
+    red->surface_deps[1] = -1;
+    red->surface_deps[2] = -1;
+}
+
+static void test_drawable_occlusion(void)
+{
+    RedDrawable under, later;
+    SpiceClipRects *clip;
+
+    init_red_drawable(&under, QXL_DRAW_COPY, QXL_EFFECT_OPAQUE, 10, 10, 20, 20);
+    init_red_drawable(&later, QXL_DRAW_FILL, QXL_EFFECT_OPAQUE, 0, 0, 100, 100);
+    g_assert_true(red_drawable_occludes(&later, &under));
+    g_assert_false(red_drawable_occludes(&under, &later));
+
+    /* other surface */
+    later.surface_id = 1;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.surface_id = 0;
+
+    /* partially covered */
+    later.bbox.right = 15;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.bbox.right = 100;
+
+    /* not opaque */
+    later.effect = QXL_EFFECT_BLEND;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.effect = QXL_EFFECT_OPAQUE;
+
+    /* masked */
+    later.u.fill.mask.bitmap = (SpiceImage *) &under;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.u.fill.mask.bitmap = NULL;
+
+    /* reading the surface it draws to */
+    later.surface_deps[1] = 0;
+    g_assert_true(red_drawable_reads_surface(&later, 0));
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.surface_deps[1] = -1;
+    later.self_bitmap = 1;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    later.self_bitmap = 0;
+    init_red_drawable(&later, QXL_COPY_BITS, QXL_EFFECT_OPAQUE, 0, 0, 100, 100);
+    g_assert_true(red_drawable_reads_surface(&later, 0));
+    g_assert_false(red_drawable_reads_surface(&later, 1));
+    g_assert_false(red_drawable_occludes(&later, &under));
+
+    /* clipped */
+    init_red_drawable(&later, QXL_DRAW_COPY, QXL_EFFECT_OPAQUE, 0, 0, 100, 100);
+    clip = (SpiceClipRects *) g_malloc0(sizeof(*clip) + 2 * sizeof(SpiceRect));
+    clip->num_rects = 2;
+    clip->rects[0].right = 15;
+    clip->rects[0].bottom = 100;
+    clip->rects[1].left = 15;
+    clip->rects[1].right = 100;
+    clip->rects[1].bottom = 100;
+    later.clip.type = SPICE_CLIP_TYPE_RECTS;
+    later.clip.rects = clip;
+    g_assert_false(red_drawable_occludes(&later, &under));
+    clip->rects[1].left = 5;
+    g_assert_true(red_drawable_occludes(&later, &under));
+    g_free(clip);
+}
+
+static void test_drawable_image_surfaces(void)
+{
+    RedDrawable red, under;
+    SpiceImage src, mask, pattern;
+    uint32_t surface_ids[RED_DRAWABLE_MAX_IMAGES];
+
+    memset(&src, 0, sizeof(src));
+    memset(&mask, 0, sizeof(mask));
+    memset(&pattern, 0, sizeof(pattern));
+
+    init_red_drawable(&red, QXL_DRAW_COPY, QXL_EFFECT_OPAQUE, 0, 0, 10, 10);
+    src.descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    red.u.copy.src_bitmap = &src;
+    g_assert_cmpint(red_drawable_get_image_surfaces(&red, surface_ids), ==, 0);
+    g_assert_false(red_drawable_reads_surface(&red, 2));
+
+    /* surfaces read without being in surface_deps */
+    src.descriptor.type = SPICE_IMAGE_TYPE_SURFACE;
+    src.u.surface.surface_id = 2;
+    mask.descriptor.type = SPICE_IMAGE_TYPE_SURFACE;
+    mask.u.surface.surface_id = 3;
+    red.u.copy.mask.bitmap = &mask;
+    g_assert_cmpint(red_drawable_get_image_surfaces(&red, surface_ids), ==, 2);
+    g_assert_cmpuint(surface_ids[0], ==, 2);
+    g_assert_cmpuint(surface_ids[1], ==, 3);
+    g_assert_true(red_drawable_reads_surface(&red, 2));
+    g_assert_true(red_drawable_reads_surface(&red, 3));
+    g_assert_false(red_drawable_reads_surface(&red, 1));
+
+    /* pattern of a brush */
+    init_red_drawable(&red, QXL_DRAW_FILL, QXL_EFFECT_OPAQUE, 0, 0, 10, 10);
+    red.u.fill.brush.type = SPICE_BRUSH_TYPE_SOLID;
+    g_assert_cmpint(red_drawable_get_image_surfaces(&red, surface_ids), ==, 0);
+    pattern.descriptor.type = SPICE_IMAGE_TYPE_SURFACE;
+    pattern.u.surface.surface_id = 1;
+    red.u.fill.brush.type = SPICE_BRUSH_TYPE_PATTERN;
+    red.u.fill.brush.u.pattern.pat = &pattern;
+    g_assert_cmpint(red_drawable_get_image_surfaces(&red, surface_ids), ==, 1);
+    g_assert_cmpuint(surface_ids[0], ==, 1);
+
+    /* a drawing reading its own surface does not hide the ones below */
+    init_red_drawable(&under, QXL_DRAW_COPY, QXL_EFFECT_OPAQUE, 2, 2, 8, 8);
+    g_assert_true(red_drawable_occludes(&red, &under));
+    pattern.u.surface.surface_id = 0;
+    g_assert_false(red_drawable_occludes(&red, &under));
+}
 
 int main(int argc, char *argv[])
 {
@@ -324,5 +446,11 @@ int main(int argc, char *argv[])
     /* a circular list of small chunks should not be a problems */
     g_test_add_func("/server/qxl-parsing/circular-small-chunks", test_circular_small_chunks);
 
+    /* drawables hidden by a later one in a batch of commands */
+    g_test_add_func("/server/qxl-parsing/drawable-occlusion", test_drawable_occlusion);
+
+    /* surfaces read by the images of a drawable */
+    g_test_add_func("/server/qxl-parsing/drawable-image-surfaces", test_drawable_image_surfaces);
+
     return g_test_run();
 }
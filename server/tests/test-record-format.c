@@ -0,0 +1,426 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the binary format of the recordings, and that the commands replayed
+ * from a text recording, a binary one and a converted one are the same.
+ *
+ * With -m perf the time to replay the commands of both formats is measured.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <inttypes.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "red-record-qxl.h"
+#include "red-record-format.h"
+#include "test-glib-compat.h"
+
+#define NUM_SURFACES 16
+
+typedef enum {
+    FORMAT_TEXT,
+    FORMAT_BINARY,
+    FORMAT_CONVERTED,
+} Format;
+
+static void writer_add_values(RecordWriter *writer, const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    record_writer_add_values_v(writer, format, args);
+    va_end(args);
+}
+
+static bool read_values(const uint8_t **pos, const uint8_t *end, const char *format, ...)
+{
+    va_list args;
+    bool ret;
+
+    va_start(args, format);
+    ret = record_read_values_v(pos, end, format, args);
+    va_end(args);
+    return ret;
+}
+
+static uint8_t *write_recording(size_t *size)
+{
+    FILE *file = tmpfile();
+    RecordWriter writer;
+    uint8_t data[13], *recording;
+    unsigned int i;
+
+    g_assert_nonnull(file);
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    record_writer_init(&writer, file);
+    record_writer_begin_event(&writer, 0, 1, 123, 1000);
+    writer_add_values(&writer, "%d %d %s %u\n", -1, 2, "label", 3000000000u);
+    record_writer_begin_event(&writer, 1, 0, 4, 2000);
+    writer_add_values(&writer, "size %zu id %" PRIu64 "\n",
+                      (size_t) sizeof(data), UINT64_C(0x123456789abcdef0));
+    record_writer_add_data(&writer, data, sizeof(data));
+    writer_add_values(&writer, "end %d\n", 7);
+    record_writer_begin_event(&writer, 2, 0, 5, 3000);
+    g_assert_true(record_writer_finish(&writer));
+
+    *size = ftell(file);
+    recording = g_malloc(*size);
+    rewind(file);
+    g_assert_cmpint(fread(recording, *size, 1, file), ==, 1);
+    fclose(file);
+    return recording;
+}
+
+static void check_events(const uint8_t *recording, size_t size, unsigned int num_events)
+{
+    GArray *events = record_get_events(recording, size);
+    const uint8_t *pos, *end = recording + size, *data;
+    RecordEvent event;
+    int a, b, end_value, n;
+    unsigned int c;
+    size_t data_size;
+    uint64_t id;
+
+    g_assert_cmpuint(events->len, ==, num_events);
+
+    pos = recording + g_array_index(events, uint64_t, 0);
+    g_assert_true(record_read_event_header(&pos, end, &event));
+    g_assert_cmpint(event.counter, ==, 0);
+    g_assert_cmpint(event.what, ==, 1);
+    g_assert_cmpint(event.type, ==, 123);
+    g_assert_cmpint(event.timestamp, ==, 1000);
+    g_assert_true(read_values(&pos, end, "%d %d label %u\n%n", &a, &b, &c, &n));
+    g_assert_cmpint(a, ==, -1);
+    g_assert_cmpint(b, ==, 2);
+    g_assert_cmpuint(c, ==, 3000000000u);
+    /* nothing left in the event */
+    g_assert_false(read_values(&pos, recording + g_array_index(events, uint64_t, 1),
+                               "%d", &a));
+
+    if (num_events > 1) {
+        pos = recording + g_array_index(events, uint64_t, 1);
+        g_assert_true(record_read_event_header(&pos, end, &event));
+        g_assert_cmpint(event.counter, ==, 1);
+        end = pos + event.size;
+        g_assert_true(read_values(&pos, end, "size %zu id %" SCNu64 "\n",
+                                  &data_size, &id));
+        g_assert_cmpuint(data_size, ==, 13);
+        g_assert_cmphex(id, ==, UINT64_C(0x123456789abcdef0));
+        g_assert_true(record_read_data(&pos, end, &data, &data_size));
+        g_assert_cmpuint(data_size, ==, 13);
+        g_assert_cmpint(data[12], ==, 12);
+        g_assert_cmpint((data - recording) % RECORD_VALUE_SIZE, ==, 0);
+        g_assert_true(read_values(&pos, end, "end %d\n", &end_value));
+        g_assert_cmpint(end_value, ==, 7);
+        g_assert_true(pos == end);
+    }
+
+    g_array_free(events, TRUE);
+}
+
+static void test_record_format_events(void)
+{
+    size_t size;
+    uint8_t *recording = write_recording(&size);
+    GArray *events;
+
+    g_assert_cmpstr((const char *) recording, ==, "SPICE_REPLAY 2\n");
+    check_events(recording, size, 3);
+
+    /* without the index, the events are found from their sizes */
+    recording[size - 1] ^= 0xff;
+    check_events(recording, size, 3);
+
+    /* an interrupted recording, the last event is incomplete */
+    events = record_get_events(recording, size);
+    check_events(recording, g_array_index(events, uint64_t, 2) + RECORD_EVENT_HEADER_SIZE - 1, 2);
+    g_array_free(events, TRUE);
+
+    g_free(recording);
+}
+
+typedef struct Recorder {
+    RedMemSlotInfo slots;
+    unsigned int num_commands;
+} Recorder;
+
+static QXLPHYSICAL to_physical(const void *ptr)
+{
+    return (uintptr_t) ptr;
+}
+
+static void *from_physical(QXLPHYSICAL physical)
+{
+    return (void *)(uintptr_t) physical;
+}
+
+/* a copy of a bitmap of @size pixels, in 2 chunks */
+static QXLDrawable *create_drawable(unsigned int n, int size)
+{
+    QXLDrawable *drawable = g_new0(QXLDrawable, 1);
+    QXLImage *image = g_new0(QXLImage, 1);
+    uint32_t stride = size * 4, half = size / 2 * stride, i;
+    QXLDataChunk *chunks[2];
+
+    chunks[0] = g_malloc0(sizeof(QXLDataChunk) + half);
+    chunks[1] = g_malloc0(sizeof(QXLDataChunk) + size * stride - half);
+    chunks[0]->data_size = half;
+    chunks[0]->next_chunk = to_physical(chunks[1]);
+    chunks[1]->data_size = size * stride - half;
+    chunks[1]->prev_chunk = to_physical(chunks[0]);
+    for (i = 0; i < size * stride; i++) {
+        QXLDataChunk *chunk = chunks[i >= half];
+
+        chunk->data[i - (i >= half ? half : 0)] = n * 7 + i;
+    }
+
+    image->descriptor.id = n;
+    image->descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
+    image->descriptor.width = size;
+    image->descriptor.height = size;
+    image->bitmap.format = SPICE_BITMAP_FMT_32BIT;
+    image->bitmap.flags = QXL_BITMAP_TOP_DOWN;
+    image->bitmap.x = size;
+    image->bitmap.y = size;
+    image->bitmap.stride = stride;
+    image->bitmap.data = to_physical(chunks[0]);
+
+    drawable->bbox.left = n;
+    drawable->bbox.top = n;
+    drawable->bbox.right = n + size;
+    drawable->bbox.bottom = n + size;
+    drawable->clip.type = SPICE_CLIP_TYPE_NONE;
+    drawable->effect = QXL_EFFECT_OPAQUE;
+    drawable->surfaces_dest[0] = -1;
+    drawable->surfaces_dest[1] = -1;
+    drawable->surfaces_dest[2] = -1;
+    drawable->type = QXL_DRAW_COPY;
+    drawable->u.copy.rop_descriptor = SPICE_ROPD_OP_PUT;
+    drawable->u.copy.src_bitmap = to_physical(image);
+    drawable->u.copy.src_area.right = size;
+    drawable->u.copy.src_area.bottom = size;
+    return drawable;
+}
+
+static void free_drawable(QXLDrawable *drawable)
+{
+    QXLImage *image = from_physical(drawable->u.copy.src_bitmap);
+    QXLDataChunk *chunk = from_physical(image->bitmap.data);
+
+    g_free(from_physical(chunk->next_chunk));
+    g_free(chunk);
+    g_free(image);
+    g_free(drawable);
+}
+
+static void record_command(RedRecord *record, RedMemSlotInfo *slots, uint32_t type, void *data)
+{
+    QXLCommandExt ext_cmd;
+
+    memset(&ext_cmd, 0, sizeof(ext_cmd));
+    ext_cmd.cmd.type = type;
+    ext_cmd.cmd.data = to_physical(data);
+    red_record_qxl_command(record, slots, ext_cmd);
+}
+
+/* records a surface, then @num_drawables copies of bitmaps */
+static char *create_recording(Format format, unsigned int num_drawables, int size)
+{
+    RedMemSlotInfo slots;
+    RedRecord *record;
+    QXLSurfaceCmd surface;
+    uint32_t *surface_data;
+    char *filename;
+    unsigned int n;
+    int fd;
+
+    fd = g_file_open_tmp("spice-record-XXXXXX", &filename, NULL);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+    memslot_info_init(&slots, 1, 1, 1, 1, 0);
+    memslot_info_add_slot(&slots, 0, 0, 0, 0, ~0ul, 0);
+
+    g_setenv("SPICE_WORKER_RECORD_FORMAT", format == FORMAT_BINARY ? "binary" : "text", TRUE);
+    record = red_record_new(filename);
+    g_unsetenv("SPICE_WORKER_RECORD_FORMAT");
+
+    memset(&surface, 0, sizeof(surface));
+    surface.surface_id = 1;
+    surface.type = QXL_SURFACE_CMD_CREATE;
+    surface.flags = QXL_SURF_FLAG_KEEP_DATA;
+    surface.u.surface_create.format = SPICE_SURFACE_FMT_32_xRGB;
+    surface.u.surface_create.width = 32;
+    surface.u.surface_create.height = 32;
+    surface.u.surface_create.stride = 32 * 4;
+    surface_data = g_new(uint32_t, 32 * 32);
+    for (n = 0; n < 32 * 32; n++) {
+        surface_data[n] = n;
+    }
+    surface.u.surface_create.data = to_physical(surface_data);
+    record_command(record, &slots, QXL_CMD_SURFACE, &surface);
+    g_free(surface_data);
+
+    for (n = 0; n < num_drawables; n++) {
+        QXLDrawable *drawable = create_drawable(n, size);
+
+        record_command(record, &slots, QXL_CMD_DRAW, drawable);
+        free_drawable(drawable);
+    }
+    red_record_unref(record);
+    memslot_info_destroy(&slots);
+
+    if (format == FORMAT_CONVERTED) {
+        char *converted;
+        FILE *in, *out;
+
+        fd = g_file_open_tmp("spice-record-XXXXXX", &converted, NULL);
+        g_assert_cmpint(fd, >=, 0);
+        close(fd);
+        in = fopen(filename, "rb");
+        out = fopen(converted, "wb");
+        g_assert_true(record_convert_text(in, out));
+        fclose(in);
+        fclose(out);
+        unlink(filename);
+        g_free(filename);
+        filename = converted;
+    }
+    return filename;
+}
+
+static void check_drawable(const QXLDrawable *drawable, unsigned int n, int size)
+{
+    const QXLImage *image = from_physical(drawable->u.copy.src_bitmap);
+    const QXLDataChunk *chunk = from_physical(image->bitmap.data);
+    uint32_t i, offset = 0;
+
+    g_assert_cmpint(drawable->type, ==, QXL_DRAW_COPY);
+    g_assert_cmpint(drawable->bbox.left, ==, n);
+    g_assert_cmpint(drawable->bbox.bottom, ==, n + size);
+    g_assert_cmpint(drawable->surfaces_dest[2], ==, -1);
+    g_assert_cmpint(image->descriptor.id, ==, n);
+    g_assert_cmpint(image->bitmap.stride, ==, size * 4);
+    for (; chunk; chunk = from_physical(chunk->next_chunk)) {
+        for (i = 0; i < chunk->data_size; i++) {
+            g_assert_cmpint(chunk->data[i], ==, (uint8_t) (n * 7 + offset + i));
+        }
+        offset += chunk->data_size;
+    }
+    g_assert_cmpint(offset, ==, size * size * 4);
+}
+
+static void test_record_format_replay(gconstpointer user_data)
+{
+    Format format = GPOINTER_TO_INT(user_data);
+    char *filename = create_recording(format, 10, 20);
+    SpiceReplay *replay = spice_replay_new(fopen(filename, "rb"), NUM_SURFACES);
+    QXLCommandExt *cmd;
+    QXLSurfaceCmd *surface;
+    const uint32_t *surface_data;
+    unsigned int n;
+
+    g_assert_nonnull(replay);
+
+    cmd = spice_replay_next_cmd(replay, NULL);
+    g_assert_nonnull(cmd);
+    g_assert_cmpint(cmd->cmd.type, ==, QXL_CMD_SURFACE);
+    surface = from_physical(cmd->cmd.data);
+    g_assert_cmpint(surface->u.surface_create.height, ==, 32);
+    surface_data = from_physical(surface->u.surface_create.data);
+    g_assert_cmpint(surface_data[32 * 32 - 1], ==, 32 * 32 - 1);
+    spice_replay_free_cmd(replay, cmd);
+
+    for (n = 0; n < 10; n++) {
+        cmd = spice_replay_next_cmd(replay, NULL);
+        g_assert_nonnull(cmd);
+        g_assert_cmpint(cmd->cmd.type, ==, QXL_CMD_DRAW);
+        check_drawable(from_physical(cmd->cmd.data), n, 20);
+        spice_replay_free_cmd(replay, cmd);
+    }
+    g_assert_null(spice_replay_next_cmd(replay, NULL));
+
+    spice_replay_free(replay);
+    unlink(filename);
+    g_free(filename);
+}
+
+static double replay_all(const char *filename, unsigned int num_commands)
+{
+    SpiceReplay *replay;
+    QXLCommandExt *cmd;
+    unsigned int n = 0;
+    double elapsed;
+
+    g_test_timer_start();
+    replay = spice_replay_new(fopen(filename, "rb"), NUM_SURFACES);
+    while ((cmd = spice_replay_next_cmd(replay, NULL)) != NULL) {
+        spice_replay_free_cmd(replay, cmd);
+        n++;
+    }
+    spice_replay_free(replay);
+    elapsed = g_test_timer_elapsed();
+    g_assert_cmpint(n, ==, num_commands);
+    return elapsed;
+}
+
+static void test_record_format_benchmark(void)
+{
+    static const int sizes[] = { 16, 128 };
+    unsigned int i;
+
+    for (i = 0; i < G_N_ELEMENTS(sizes); i++) {
+        unsigned int num_drawables = 256 * 1024 * 1024 / (sizes[i] * sizes[i] * 4 + 4096) / 8;
+        char *text = create_recording(FORMAT_TEXT, num_drawables, sizes[i]);
+        char *binary = create_recording(FORMAT_BINARY, num_drawables, sizes[i]);
+        double text_time = replay_all(text, num_drawables + 1);
+        double binary_time = replay_all(binary, num_drawables + 1);
+
+        g_test_message("%u copies of %dx%d bitmaps: text %.3f us, binary %.3f us per command",
+                       num_drawables, sizes[i], sizes[i],
+                       text_time * 1e6 / num_drawables, binary_time * 1e6 / num_drawables);
+        g_test_minimized_result(binary_time / num_drawables, "%dx%d: %.3f us per command",
+                                sizes[i], sizes[i], binary_time * 1e6 / num_drawables);
+        unlink(text);
+        unlink(binary);
+        g_free(text);
+        g_free(binary);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/record-format/events", test_record_format_events);
+    g_test_add_data_func("/server/record-format/replay-text",
+                         GINT_TO_POINTER(FORMAT_TEXT), test_record_format_replay);
+    g_test_add_data_func("/server/record-format/replay-binary",
+                         GINT_TO_POINTER(FORMAT_BINARY), test_record_format_replay);
+    g_test_add_data_func("/server/record-format/replay-converted",
+                         GINT_TO_POINTER(FORMAT_CONVERTED), test_record_format_replay);
+    if (g_test_perf()) {
+        g_test_add_func("/server/record-format/benchmark", test_record_format_benchmark);
+    }
+
+    return g_test_run();
+}
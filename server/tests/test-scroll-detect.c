@@ -0,0 +1,200 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the detection of the scrolling of repainted areas.
+ *
+ * With -m perf a window of text is scrolled line by line and the time to
+ * find the offsets is measured along with the share of the pixels which
+ * don't need to be sent again.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "scroll-detect.h"
+#include "test-glib-compat.h"
+
+#define LINE_HEIGHT 16
+
+/* a document of lines of text, as rows of pixels */
+typedef struct Document {
+    uint32_t width;
+    uint32_t height;
+    uint32_t *pixels;
+} Document;
+
+static void document_init(Document *doc, GRand *rand, uint32_t width, uint32_t height)
+{
+    uint32_t x, y;
+
+    doc->width = width;
+    doc->height = height;
+    doc->pixels = g_new(uint32_t, (size_t) width * height);
+    for (y = 0; y < height; y++) {
+        uint32_t *row = doc->pixels + (size_t) y * width;
+        /* a blank line between the lines of text */
+        bool blank = y % LINE_HEIGHT >= LINE_HEIGHT - 3;
+        uint32_t length = g_rand_int_range(rand, width / 4, width);
+
+        for (x = 0; x < width; x++) {
+            row[x] = 0xffffffff;
+            if (!blank && x < length && g_rand_int_range(rand, 0, 4) == 0) {
+                row[x] = 0xff000000 | g_rand_int_range(rand, 0, 0x80);
+            }
+        }
+    }
+}
+
+static void document_destroy(Document *doc)
+{
+    g_free(doc->pixels);
+}
+
+/* copies the rows of the document starting at @top into a window */
+static void document_show(const Document *doc, uint32_t top, uint32_t *window,
+                          uint32_t height, uint32_t high_byte)
+{
+    uint32_t i;
+
+    memcpy(window, doc->pixels + (size_t) top * doc->width,
+           (size_t) height * doc->width * sizeof(uint32_t));
+    for (i = 0; i < height * doc->width; i++) {
+        window[i] = (window[i] & 0x00ffffff) | high_byte;
+    }
+}
+
+static int32_t detect(const uint32_t *old_window, const uint32_t *new_window,
+                      uint32_t width, uint32_t height)
+{
+    int32_t stride = width * sizeof(uint32_t);
+
+    return scroll_detect_offset((const uint8_t *) old_window, stride,
+                                (const uint8_t *) new_window, stride,
+                                width, height, height / 2);
+}
+
+static void test_scroll_detect_offsets(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x5c7011);
+    Document doc;
+    uint32_t width = 300, height = 200;
+    uint32_t *old_window = g_new(uint32_t, width * height);
+    uint32_t *new_window = g_new(uint32_t, width * height);
+    int32_t stride = width * sizeof(uint32_t);
+
+    document_init(&doc, rand, width, 1000);
+    document_show(&doc, 300, old_window, height, 0xff000000);
+
+    /* scrolled down and up, the high byte of the pixels differs */
+    document_show(&doc, 316, new_window, height, 0);
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, 16);
+    document_show(&doc, 203, new_window, height, 0);
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, -97);
+
+    /* not further than half of the area */
+    document_show(&doc, 420, new_window, height, 0);
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, 0);
+    document_show(&doc, 300, new_window, height, 0);
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, 0);
+
+    /* a pixel changed in the part already there */
+    document_show(&doc, 310, new_window, height, 0);
+    new_window[50 * width + 10] ^= 0x10;
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, 0);
+
+    /* a bottom up image */
+    document_show(&doc, 290, new_window, height, 0);
+    {
+        uint32_t *flipped = g_new(uint32_t, width * height);
+        uint32_t y;
+
+        for (y = 0; y < height; y++) {
+            memcpy(flipped + (height - 1 - y) * width, new_window + y * width, stride);
+        }
+        g_assert_cmpint(scroll_detect_offset((const uint8_t *) old_window, stride,
+                                             (const uint8_t *) (flipped + (height - 1) * width),
+                                             -stride, width, height, height / 2), ==, -10);
+        g_free(flipped);
+    }
+
+    /* a uniform area has nothing to look up */
+    memset(old_window, 0xff, width * height * sizeof(uint32_t));
+    memset(new_window, 0xff, width * height * sizeof(uint32_t));
+    g_assert_cmpint(detect(old_window, new_window, width, height), ==, 0);
+    g_assert_cmpint(detect(old_window, new_window, width, 2), ==, 0);
+
+    document_destroy(&doc);
+    g_free(old_window);
+    g_free(new_window);
+    g_rand_free(rand);
+}
+
+static void test_scroll_detect_benchmark(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x5c7011);
+    Document doc;
+    uint32_t width = 1600, height = 900, top, num_scrolls = 0;
+    uint32_t *windows[2];
+    uint64_t saved_pixels = 0;
+    double elapsed = 0;
+
+    document_init(&doc, rand, width, 8 * height);
+    windows[0] = g_new(uint32_t, width * height);
+    windows[1] = g_new(uint32_t, width * height);
+
+    document_show(&doc, 0, windows[0], height, 0xff000000);
+    for (top = 3 * LINE_HEIGHT; top + height <= doc.height; top += 3 * LINE_HEIGHT) {
+        uint32_t *old_window = windows[num_scrolls % 2];
+        uint32_t *new_window = windows[(num_scrolls + 1) % 2];
+        int32_t dy;
+
+        document_show(&doc, top, new_window, height, 0xff000000);
+        g_test_timer_start();
+        dy = detect(old_window, new_window, width, height);
+        elapsed += g_test_timer_elapsed();
+        g_assert_cmpint(dy, ==, 3 * LINE_HEIGHT);
+        saved_pixels += (uint64_t) width * (height - dy);
+        num_scrolls++;
+    }
+
+    g_test_message("%ux%u, %u scrolls, %.3f ms per scroll, %.1f%% of the pixels not sent",
+                   width, height, num_scrolls, elapsed * 1000 / num_scrolls,
+                   saved_pixels * 100.0 / ((uint64_t) width * height * num_scrolls));
+    g_test_minimized_result(elapsed / num_scrolls, "%.3f ms per scroll",
+                            elapsed * 1000 / num_scrolls);
+
+    document_destroy(&doc);
+    g_free(windows[0]);
+    g_free(windows[1]);
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/scroll-detect/offsets", test_scroll_detect_offsets);
+    if (g_test_perf()) {
+        g_test_add_func("/server/scroll-detect/benchmark", test_scroll_detect_benchmark);
+    }
+
+    return g_test_run();
+}
@@ -20,9 +20,11 @@
 #include <unistd.h>
 #include <string.h>
 #include <spice.h>
+#include <spice/stats.h>
 
 #include "test-glib-compat.h"
 #include "stat-file.h"
+#include "stat.h"
 
 static void stat_file(void)
 {
@@ -106,6 +108,36 @@ static void stat_file_start(void)
     stat_file_free(stat_file);
 }
 
+/* the buckets of the histograms cover all the values and their names sort
+ * by their limits */
+static void stat_histogram_buckets(void)
+{
+    char name[SPICE_STAT_NODE_NAME_MAX], previous_name[SPICE_STAT_NODE_NAME_MAX] = "";
+    unsigned int bucket;
+    uint64_t value;
+
+    for (bucket = 0; bucket < STAT_HISTOGRAM_BUCKETS; bucket++) {
+        stat_histogram_bucket_name(bucket, name, sizeof(name));
+        g_assert_cmpstr(previous_name, <, name);
+        strcpy(previous_name, name);
+        if (bucket > 0) {
+            g_assert_cmpuint(stat_histogram_bucket_limit(bucket - 1), <,
+                             stat_histogram_bucket_limit(bucket));
+        }
+    }
+    g_assert_cmpstr(name, ==, "lt_inf");
+
+    for (value = 1; value < (UINT64_C(1) << 40); value += value / 7 + 1) {
+        bucket = stat_histogram_bucket(value);
+        g_assert_cmpuint(bucket, <, STAT_HISTOGRAM_BUCKETS);
+        g_assert_cmpuint(value, <, stat_histogram_bucket_limit(bucket));
+        if (bucket > 0) {
+            g_assert_cmpuint(value, >=, stat_histogram_bucket_limit(bucket - 1));
+        }
+    }
+    g_assert_cmpuint(stat_histogram_bucket(0), ==, 0);
+    g_assert_cmpuint(stat_histogram_bucket(UINT64_MAX), ==, STAT_HISTOGRAM_BUCKETS - 1);
+}
 
 int main(int argc, char *argv[])
 {
@@ -113,6 +145,7 @@ int main(int argc, char *argv[])
 
     g_test_add_func("/server/stat-file", stat_file);
     g_test_add_func("/server/stat-file-start", stat_file_start);
+    g_test_add_func("/server/stat-histogram-buckets", stat_histogram_buckets);
 
     return g_test_run();
 }
@@ -104,6 +104,8 @@ check_vmc_error_message(void)
 
 static int num_send_data_calls = 0;
 static size_t send_data_bytes = 0;
+static GPtrArray *sent_reads = NULL;
+static const uint8_t *expected_data = NULL;
 
 StreamChannel::StreamChannel(RedsState *reds, uint32_t id):
     RedChannel(reds, SPICE_CHANNEL_DISPLAY, id, RedChannel::HandleAcks)
@@ -121,6 +123,18 @@ StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
 {
     ++num_send_data_calls;
     send_data_bytes += size;
+    if (expected_data) {
+        g_assert_true(memcmp(data, expected_data, size) == 0);
+    }
+}
+
+void
+StreamChannel::send_data(GPtrArray *reads, size_t size, uint32_t mm_time)
+{
+    ++num_send_data_calls;
+    send_data_bytes += size;
+    g_assert_null(sent_reads);
+    sent_reads = reads;
 }
 
 void
@@ -166,6 +180,8 @@ static void test_stream_device_setup(TestFixture *fixture, gconstpointer user_da
 
     num_send_data_calls = 0;
     send_data_bytes = 0;
+    g_assert_null(sent_reads);
+    expected_data = NULL;
 }
 
 static void test_stream_device_teardown(TestFixture *fixture, gconstpointer user_data)
@@ -381,6 +397,156 @@ static void test_stream_device_data_message(TestFixture *fixture, gconstpointer
     g_assert_cmpint(send_data_bytes, ==, 1017);
 }
 
+// check that data read in place is sent without copying it
+static void test_stream_device_data_segments(TestFixture *fixture, gconstpointer user_data)
+{
+    vmc_emu_enable_segments(vmc);
+
+    uint8_t *p = vmc->message;
+
+    // add some messages into device buffer
+    p = add_format(p, 640, 480, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 1017);
+    uint8_t *const data = p;
+    for (int i = 0; i < 1017; ++i, ++p) {
+        *p = (uint8_t) (i * 123 + 57);
+    }
+    vmc_emu_add_read_till(vmc, vmc->message + 51);
+    vmc_emu_add_read_till(vmc, vmc->message + 123);
+    vmc_emu_add_read_till(vmc, vmc->message + 534);
+    vmc_emu_add_read_till(vmc, p);
+
+    test_kick();
+
+    // we should read all data
+    g_assert(vmc->message_sizes_curr - vmc->message_sizes == 4);
+
+    // make sure data were collapsed in a single message
+    g_assert_cmpint(num_send_data_calls, ==, 1);
+    g_assert_cmpint(send_data_bytes, ==, 1017);
+
+    // the message points to the device buffer
+    g_assert_nonnull(sent_reads);
+    size_t offset = 0;
+    for (guint i = 0; i < sent_reads->len; ++i) {
+        auto read = (RedCharDeviceRead *) g_ptr_array_index(sent_reads, i);
+        for (int n = 0; n < read->num_segments; ++n) {
+            g_assert_true(read->segments[n].data == data + offset);
+            offset += read->segments[n].len;
+        }
+    }
+    g_assert_cmpint(offset, ==, 1017);
+    g_assert_cmpint(vmc->segments_pending, ==, 1017);
+
+    // the device gets the data back once the message is freed
+    g_clear_pointer(&sent_reads, g_ptr_array_unref);
+    g_assert_cmpint(vmc->segments_pending, ==, 0);
+}
+
+// check that data read in place stays in the device removed till it is sent
+static void test_stream_device_data_segments_removed(TestFixture *fixture,
+                                                     gconstpointer user_data)
+{
+    vmc_emu_enable_segments(vmc);
+
+    uint8_t *p = vmc->message;
+
+    p = add_format(p, 640, 480, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 1017);
+    uint8_t *const data = p;
+    for (int i = 0; i < 1017; ++i, ++p) {
+        *p = (uint8_t) (i * 123 + 57);
+    }
+    vmc_emu_add_read_till(vmc, p);
+
+    test_kick();
+
+    g_assert_cmpint(num_send_data_calls, ==, 1);
+    g_assert_nonnull(sent_reads);
+    g_assert_cmpint(vmc->segments_pending, ==, 1017);
+
+    spice_server_remove_interface(&vmc->instance.base);
+
+    // the message still refers to the device buffer
+    g_assert_cmpint(vmc->segments_pending, ==, 1017);
+    size_t offset = 0;
+    for (guint i = 0; i < sent_reads->len; ++i) {
+        auto read = (RedCharDeviceRead *) g_ptr_array_index(sent_reads, i);
+        for (int n = 0; n < read->num_segments; ++n) {
+            g_assert_true(read->segments[n].data == data + offset);
+            offset += read->segments[n].len;
+        }
+    }
+    g_assert_cmpint(offset, ==, 1017);
+
+    g_clear_pointer(&sent_reads, g_ptr_array_unref);
+    g_assert_cmpint(vmc->segments_pending, ==, 0);
+}
+
+// check that a frame arriving in two parts is still sent by reference
+static void test_stream_device_data_segments_two_parts(TestFixture *fixture,
+                                                       gconstpointer user_data)
+{
+    vmc_emu_enable_segments(vmc);
+
+    uint8_t *p = vmc->message;
+
+    p = add_format(p, 640, 480, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 1017);
+    uint8_t *const data = p;
+    for (int i = 0; i < 1017; ++i, ++p) {
+        *p = (uint8_t) (i * 123 + 57);
+    }
+    // the guest wrote only part of the frame
+    vmc_emu_add_read_till(vmc, data + 500);
+
+    test_kick();
+
+    // the part read is kept in the device
+    g_assert_cmpint(num_send_data_calls, ==, 0);
+    g_assert_cmpint(vmc->segments_pending, ==, 500);
+
+    vmc_emu_add_read_till(vmc, p);
+    spice_server_char_device_wakeup(&vmc->instance);
+
+    g_assert(vmc->message_sizes_curr - vmc->message_sizes == 2);
+    g_assert_cmpint(num_send_data_calls, ==, 1);
+    g_assert_cmpint(send_data_bytes, ==, 1017);
+    g_assert_nonnull(sent_reads);
+    g_assert_cmpint(vmc->segments_pending, ==, 1017);
+
+    g_clear_pointer(&sent_reads, g_ptr_array_unref);
+    g_assert_cmpint(vmc->segments_pending, ==, 0);
+}
+
+// check that a frame the device cannot buffer is copied
+static void test_stream_device_data_segments_full(TestFixture *fixture,
+                                                  gconstpointer user_data)
+{
+    vmc_emu_enable_segments(vmc);
+    vmc->segments_capacity = 500;
+
+    uint8_t *p = vmc->message;
+
+    p = add_format(p, 640, 480, SPICE_VIDEO_CODEC_TYPE_MJPEG);
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 1017);
+    uint8_t *const data = p;
+    for (int i = 0; i < 1017; ++i, ++p) {
+        *p = (uint8_t) (i * 123 + 57);
+    }
+    vmc_emu_add_read_till(vmc, p);
+
+    expected_data = data;
+    test_kick();
+
+    // the part read in place is copied and given back to the device, the
+    // rest of the frame is read after it
+    g_assert_cmpint(num_send_data_calls, ==, 1);
+    g_assert_cmpint(send_data_bytes, ==, 1017);
+    g_assert_null(sent_reads);
+    g_assert_cmpint(vmc->segments_pending, ==, 0);
+}
+
 static void test_display_info(TestFixture *fixture, gconstpointer user_data)
 {
     // initialize a QXL interface. This must be done before receiving the display info message from
@@ -474,6 +640,14 @@ int main(int argc, char *argv[])
              test_stream_device_huge_data, NULL);
     test_add("/server/stream-device-data-message",
              test_stream_device_data_message, NULL);
+    test_add("/server/stream-device-data-segments",
+             test_stream_device_data_segments, NULL);
+    test_add("/server/stream-device-data-segments-removed",
+             test_stream_device_data_segments_removed, NULL);
+    test_add("/server/stream-device-data-segments-two-parts",
+             test_stream_device_data_segments_two_parts, NULL);
+    test_add("/server/stream-device-data-segments-full",
+             test_stream_device_data_segments_full, NULL);
     test_add("/server/display-info", test_display_info, NULL);
 
     return g_test_run();
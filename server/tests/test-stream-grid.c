@@ -0,0 +1,146 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the tracking of the update frequency of the areas of a surface
+ * used to detect the video streams.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include "stream-grid.h"
+#include "test-glib-compat.h"
+
+#define SURFACE_WIDTH 1000
+#define SURFACE_HEIGHT 600
+#define WINDOW_TIME 500
+/* 10 fps */
+#define HOT_UPDATES 5
+#define FRAME_TIME (1000 / 25)
+
+static SpiceRect make_rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    SpiceRect rect;
+
+    rect.left = left;
+    rect.top = top;
+    rect.right = right;
+    rect.bottom = bottom;
+    return rect;
+}
+
+static void assert_rect(const SpiceRect *rect,
+                        int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    g_assert_cmpint(rect->left, ==, left);
+    g_assert_cmpint(rect->top, ==, top);
+    g_assert_cmpint(rect->right, ==, right);
+    g_assert_cmpint(rect->bottom, ==, bottom);
+}
+
+static void test_stream_grid_hot(void)
+{
+    StreamGrid grid = { 0 };
+    SpiceRect rect = make_rect(100, 100, 200, 150), area;
+    uint64_t time = 10 * WINDOW_TIME;
+    unsigned int i;
+
+    stream_grid_init(&grid, SURFACE_WIDTH, SURFACE_HEIGHT, WINDOW_TIME, HOT_UPDATES);
+    g_assert_false(stream_grid_get_hot_area(&grid, &rect, time, &area));
+
+    /* hot once updated often enough in a window */
+    for (i = 0; i < HOT_UPDATES - 1; i++) {
+        stream_grid_update(&grid, &rect, time + i);
+    }
+    g_assert_false(stream_grid_get_hot_area(&grid, &rect, time + i, &area));
+    stream_grid_update(&grid, &rect, time + i);
+    g_assert_true(stream_grid_get_hot_area(&grid, &rect, time + i, &area));
+    assert_rect(&area, 64, 64, 256, 192);
+
+    /* still hot in the next window, then cools down */
+    g_assert_true(stream_grid_get_hot_area(&grid, &rect, time + WINDOW_TIME, &area));
+    g_assert_false(stream_grid_get_hot_area(&grid, &rect, time + 2 * WINDOW_TIME, &area));
+
+    /* a few updates over several windows are not enough */
+    time += 4 * WINDOW_TIME;
+    for (i = 0; i < 10; i++) {
+        stream_grid_update(&grid, &rect, time + i * WINDOW_TIME / 2);
+        g_assert_false(stream_grid_get_hot_area(&grid, &rect,
+                                                time + i * WINDOW_TIME / 2, &area));
+    }
+
+    /* all the cells of the drawing must be hot */
+    rect = make_rect(100, 100, 300, 150);
+    g_assert_false(stream_grid_get_hot_area(&grid, &rect, time + i * WINDOW_TIME / 2, &area));
+
+    /* outside of the surface */
+    rect = make_rect(SURFACE_WIDTH, 0, SURFACE_WIDTH + 100, 100);
+    stream_grid_update(&grid, &rect, time);
+    g_assert_false(stream_grid_get_hot_area(&grid, &rect, time, &area));
+
+    stream_grid_destroy(&grid);
+}
+
+/* a video painted in two halves and scrolled by a few pixels per frame */
+static void test_stream_grid_video(void)
+{
+    StreamGrid grid = { 0 };
+    SpiceRect top, bottom, area, other;
+    uint64_t time = 0;
+    unsigned int i;
+
+    stream_grid_init(&grid, SURFACE_WIDTH, SURFACE_HEIGHT, WINDOW_TIME, HOT_UPDATES);
+    other = make_rect(900, 500, 1000, 600);
+    for (i = 0; i < 25; i++, time += FRAME_TIME) {
+        int32_t y = 200 + (i % 4) * 4;
+
+        top = make_rect(300, y, 620, y + 120);
+        bottom = make_rect(300, y + 120, 620, y + 240);
+        stream_grid_update(&grid, &top, time);
+        stream_grid_update(&grid, &bottom, time);
+        /* some other area updated as often, not connected */
+        stream_grid_update(&grid, &other, time);
+    }
+
+    g_assert_true(stream_grid_get_hot_area(&grid, &top, time, &area));
+    assert_rect(&area, 256, 192, 640, 448);
+    g_assert_true(stream_grid_get_hot_area(&grid, &bottom, time, &area));
+    assert_rect(&area, 256, 192, 640, 448);
+
+    /* the areas are clamped to the surface */
+    g_assert_true(stream_grid_get_hot_area(&grid, &other, time, &area));
+    assert_rect(&area, 896, 448, SURFACE_WIDTH, SURFACE_HEIGHT);
+
+    /* resizing the surface forgets the updates */
+    stream_grid_init(&grid, SURFACE_HEIGHT, SURFACE_WIDTH, WINDOW_TIME, HOT_UPDATES);
+    g_assert_false(stream_grid_get_hot_area(&grid, &top, time, &area));
+
+    stream_grid_destroy(&grid);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/stream-grid/hot", test_stream_grid_hot);
+    g_test_add_func("/server/stream-grid/video", test_stream_grid_video);
+
+    return g_test_run();
+}
@@ -0,0 +1,333 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the tile based tracking of the dirty and lossy areas of surfaces.
+ *
+ * With -m perf the lossy bookkeeping of many small drawings (glyphs) is
+ * done with a TileRegion and with a QRegion.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/region.h>
+#include "tile-region.h"
+#include "test-glib-compat.h"
+
+#define SURFACE_WIDTH 1920
+#define SURFACE_HEIGHT 1080
+#define NUM_GLYPHS 200000
+
+static SpiceRect make_rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    SpiceRect rect;
+
+    rect.left = left;
+    rect.top = top;
+    rect.right = right;
+    rect.bottom = bottom;
+    return rect;
+}
+
+static void assert_rect(const SpiceRect *rect,
+                        int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    g_assert_cmpint(rect->left, ==, left);
+    g_assert_cmpint(rect->top, ==, top);
+    g_assert_cmpint(rect->right, ==, right);
+    g_assert_cmpint(rect->bottom, ==, bottom);
+}
+
+static void test_tile_region_add_remove(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect, extents;
+
+    tile_region_init(&region, 100, 50);
+    g_assert_true(tile_region_is_empty(&region));
+
+    /* adding marks all the touched tiles */
+    rect = make_rect(20, 10, 40, 20);
+    tile_region_add(&region, &rect);
+    g_assert_false(tile_region_is_empty(&region));
+    tile_region_extents(&region, &extents);
+    assert_rect(&extents, 16, 0, 48, 32);
+
+    /* removing an area not covering a full tile keeps it */
+    rect = make_rect(16, 0, 47, 32);
+    tile_region_remove(&region, &rect);
+    tile_region_extents(&region, &extents);
+    assert_rect(&extents, 32, 0, 48, 32);
+
+    rect = make_rect(0, 0, 100, 50);
+    tile_region_remove(&region, &rect);
+    g_assert_true(tile_region_is_empty(&region));
+
+    /* the tiles cut by the border of the surface */
+    rect = make_rect(90, 40, 200, 200);
+    tile_region_add(&region, &rect);
+    tile_region_extents(&region, &extents);
+    assert_rect(&extents, 80, 32, 100, 50);
+    rect = make_rect(80, 32, 100, 50);
+    tile_region_remove(&region, &rect);
+    g_assert_true(tile_region_is_empty(&region));
+
+    /* outside of the surface */
+    rect = make_rect(-20, -20, 0, 0);
+    tile_region_add(&region, &rect);
+    rect = make_rect(100, 0, 120, 50);
+    tile_region_add(&region, &rect);
+    g_assert_true(tile_region_is_empty(&region));
+
+    rect = make_rect(0, 0, 50, 50);
+    tile_region_add(&region, &rect);
+    tile_region_clear(&region);
+    g_assert_true(tile_region_is_empty(&region));
+
+    tile_region_destroy(&region);
+}
+
+static void test_tile_region_intersects(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect, extents;
+
+    tile_region_init(&region, 640, 480);
+    rect = make_rect(100, 100, 110, 110);
+    tile_region_add(&region, &rect);
+    rect = make_rect(290, 194, 300, 206);
+    tile_region_add(&region, &rect);
+
+    rect = make_rect(0, 0, 96, 480);
+    g_assert_false(tile_region_intersects(&region, &rect, &extents));
+    rect = make_rect(200, 0, 640, 192);
+    g_assert_false(tile_region_intersects(&region, &rect, NULL));
+
+    /* the extents are limited to the requested area */
+    rect = make_rect(105, 0, 640, 480);
+    g_assert_true(tile_region_intersects(&region, &rect, &extents));
+    assert_rect(&extents, 105, 96, 304, 208);
+    rect = make_rect(0, 0, 200, 200);
+    g_assert_true(tile_region_intersects(&region, &rect, NULL));
+
+    tile_region_destroy(&region);
+}
+
+static void test_tile_region_get_rects(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect, *rects;
+    uint32_t num_rects;
+
+    /* more than 64 columns to use several words per row */
+    tile_region_init(&region, 1300, 100);
+    num_rects = tile_region_get_rects(&region, &rects);
+    g_assert_cmpuint(num_rects, ==, 0);
+    g_free(rects);
+
+    /* a run crossing the words of the rows, coalesced over the rows */
+    rect = make_rect(1000, 10, 1300, 60);
+    tile_region_add(&region, &rect);
+    /* two runs in the same rows */
+    rect = make_rect(0, 0, 16, 16);
+    tile_region_add(&region, &rect);
+    rect = make_rect(64, 0, 80, 32);
+    tile_region_add(&region, &rect);
+
+    num_rects = tile_region_get_rects(&region, &rects);
+    g_assert_cmpuint(num_rects, ==, 3);
+    assert_rect(&rects[0], 0, 0, 16, 16);
+    assert_rect(&rects[1], 64, 0, 80, 32);
+    assert_rect(&rects[2], 992, 0, 1300, 64);
+    g_free(rects);
+
+    tile_region_destroy(&region);
+}
+
+static void test_tile_region_clipped(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect, extents;
+    SpiceClipRects *clip;
+
+    clip = (SpiceClipRects *) g_malloc0(sizeof(SpiceClipRects) + 2 * sizeof(SpiceRect));
+    clip->num_rects = 2;
+    clip->rects[0] = make_rect(0, 0, 32, 32);
+    clip->rects[1] = make_rect(200, 200, 300, 300);
+
+    tile_region_init(&region, 320, 320);
+    rect = make_rect(0, 0, 64, 64);
+    tile_region_add_clipped(&region, &rect, clip);
+    tile_region_extents(&region, &extents);
+    assert_rect(&extents, 0, 0, 32, 32);
+
+    rect = make_rect(0, 0, 320, 320);
+    tile_region_add(&region, &rect);
+    tile_region_remove_clipped(&region, &rect, clip);
+    rect = make_rect(0, 0, 32, 32);
+    g_assert_false(tile_region_intersects(&region, &rect, NULL));
+    rect = make_rect(208, 208, 288, 288);
+    g_assert_false(tile_region_intersects(&region, &rect, NULL));
+    rect = make_rect(32, 0, 48, 16);
+    g_assert_true(tile_region_intersects(&region, &rect, NULL));
+
+    tile_region_destroy(&region);
+    g_free(clip);
+}
+
+/* as is_surface_area_lossy and the lossless resend of the area by
+ * red_add_lossless_drawable_dependencies, returns whether a resend was needed */
+static bool draw_on_lossy(TileRegion *region, const SpiceRect *bbox)
+{
+    SpiceRect lossy_area;
+
+    if (!tile_region_intersects(region, bbox, &lossy_area)) {
+        return false;
+    }
+    tile_region_align_rect(region, &lossy_area);
+    tile_region_remove(region, &lossy_area);
+    return true;
+}
+
+static void test_tile_region_align_rect(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect;
+
+    tile_region_init(&region, 100, 50);
+
+    rect = make_rect(20, 10, 40, 20);
+    tile_region_align_rect(&region, &rect);
+    assert_rect(&rect, 16, 0, 48, 32);
+
+    /* clipped to the surface */
+    rect = make_rect(-5, 40, 120, 49);
+    tile_region_align_rect(&region, &rect);
+    assert_rect(&rect, 0, 32, 100, 50);
+
+    tile_region_destroy(&region);
+}
+
+/* drawings depending on a lossy area resend it once, not for every drawing */
+static void test_tile_region_repeated_resend(void)
+{
+    TileRegion region = { 0 };
+    SpiceRect rect;
+
+    tile_region_init(&region, SURFACE_WIDTH, SURFACE_HEIGHT);
+
+    /* a lossy image not aligned on the tiles */
+    rect = make_rect(13, 7, 203, 101);
+    tile_region_add(&region, &rect);
+
+    /* drawings on the edge tiles of the image */
+    for (int i = 0; i < 10; i++) {
+        rect = make_rect(10 + i, 5 + i, 22 + i, 20 + i);
+        g_assert_true(draw_on_lossy(&region, &rect) == (i == 0));
+        rect = make_rect(192 + i, 96 + i, 210, 110);
+        g_assert_true(draw_on_lossy(&region, &rect) == (i == 0));
+    }
+
+    /* the resends cleared only the touched tiles */
+    rect = make_rect(100, 50, 110, 60);
+    g_assert_true(draw_on_lossy(&region, &rect));
+    rect = make_rect(13, 7, 203, 101);
+    g_assert_true(draw_on_lossy(&region, &rect));
+    g_assert_true(tile_region_is_empty(&region));
+
+    tile_region_destroy(&region);
+}
+
+/* position of the glyphs of a screen of text, drawn over and over */
+static SpiceRect glyph_rect(unsigned int i)
+{
+    unsigned int cols = SURFACE_WIDTH / 8, rows = SURFACE_HEIGHT / 16;
+    unsigned int col = (i * 7) % cols, row = (i / cols) % rows;
+
+    return make_rect(col * 8, row * 16 + 2, col * 8 + 8, row * 16 + 15);
+}
+
+static void test_tile_region_benchmark(void)
+{
+    TileRegion tile_region = { 0 };
+    QRegion qregion;
+    unsigned int i, lossy_tile = 0, lossy_qregion = 0;
+    double tile_time, qregion_time;
+
+    tile_region_init(&tile_region, SURFACE_WIDTH, SURFACE_HEIGHT);
+    g_test_timer_start();
+    for (i = 0; i < NUM_GLYPHS; i++) {
+        SpiceRect rect = glyph_rect(i);
+
+        lossy_tile += tile_region_intersects(&tile_region, &rect, NULL);
+        if (i % 3 == 0) {
+            tile_region_add(&tile_region, &rect);
+        } else {
+            tile_region_remove(&tile_region, &rect);
+        }
+    }
+    tile_time = g_test_timer_elapsed();
+    tile_region_destroy(&tile_region);
+
+    region_init(&qregion);
+    g_test_timer_start();
+    for (i = 0; i < NUM_GLYPHS; i++) {
+        SpiceRect rect = glyph_rect(i);
+        QRegion lossy;
+
+        region_init(&lossy);
+        region_add(&lossy, &rect);
+        region_and(&lossy, &qregion);
+        lossy_qregion += !region_is_empty(&lossy);
+        region_destroy(&lossy);
+        if (i % 3 == 0) {
+            region_add(&qregion, &rect);
+        } else {
+            region_remove(&qregion, &rect);
+        }
+    }
+    qregion_time = g_test_timer_elapsed();
+    region_destroy(&qregion);
+
+    g_test_message("%u glyphs, tiles %.3f us (%u lossy), QRegion %.3f us (%u lossy) per glyph",
+                   NUM_GLYPHS, tile_time * 1000000 / NUM_GLYPHS, lossy_tile,
+                   qregion_time * 1000000 / NUM_GLYPHS, lossy_qregion);
+    g_test_minimized_result(tile_time / NUM_GLYPHS, "%.3f us per glyph",
+                            tile_time * 1000000 / NUM_GLYPHS);
+    /* the tracking is conservative */
+    g_assert_cmpuint(lossy_tile, >=, lossy_qregion);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/tile-region/add-remove", test_tile_region_add_remove);
+    g_test_add_func("/server/tile-region/intersects", test_tile_region_intersects);
+    g_test_add_func("/server/tile-region/get-rects", test_tile_region_get_rects);
+    g_test_add_func("/server/tile-region/clipped", test_tile_region_clipped);
+    g_test_add_func("/server/tile-region/align-rect", test_tile_region_align_rect);
+    g_test_add_func("/server/tile-region/repeated-resend", test_tile_region_repeated_resend);
+    if (g_test_perf()) {
+        g_test_add_func("/server/tile-region/benchmark", test_tile_region_benchmark);
+    }
+
+    return g_test_run();
+}
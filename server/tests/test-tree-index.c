@@ -0,0 +1,305 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Check the spatial index of the items of the current tree.
+ *
+ * With -m perf the cost of inserting items and of finding the ones
+ * intersecting an area is measured as the number of items grows, both with
+ * the index and by walking a ring of items.
+ */
+#include <config.h>
+
+#undef NDEBUG
+#include <string.h>
+#include <stdlib.h>
+
+#include <common/rect.h>
+#include "tree.h"
+#include "test-glib-compat.h"
+
+#define SURFACE_WIDTH 1920
+#define SURFACE_HEIGHT 1080
+#define NUM_QUERIES 20000
+
+static SpiceRect make_rect(int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    SpiceRect rect;
+
+    rect.left = left;
+    rect.top = top;
+    rect.right = right;
+    rect.bottom = bottom;
+    return rect;
+}
+
+static SpiceRect random_rect(GRand *rand, int32_t max_size)
+{
+    int32_t left = g_rand_int_range(rand, 0, SURFACE_WIDTH - 1);
+    int32_t top = g_rand_int_range(rand, 0, SURFACE_HEIGHT - 1);
+
+    return make_rect(left, top,
+                     MIN(SURFACE_WIDTH, left + g_rand_int_range(rand, 1, max_size)),
+                     MIN(SURFACE_HEIGHT, top + g_rand_int_range(rand, 1, max_size)));
+}
+
+static TreeItem *tree_item_new(const SpiceRect *rect)
+{
+    TreeItem *item = g_new0(TreeItem, 1);
+
+    item->type = TREE_ITEM_TYPE_DRAWABLE;
+    ring_item_init(&item->siblings_link);
+    region_init(&item->rgn);
+    region_add(&item->rgn, rect);
+    return item;
+}
+
+static void tree_item_free(TreeItem *item)
+{
+    region_destroy(&item->rgn);
+    g_free(item);
+}
+
+static bool collect_item(TreeItem *item, void *opaque)
+{
+    g_ptr_array_add((GPtrArray *) opaque, item);
+    return true;
+}
+
+static bool count_item(SPICE_GNUC_UNUSED TreeItem *item, void *opaque)
+{
+    (*(unsigned int *) opaque)++;
+    return true;
+}
+
+static void test_tree_index_foreach(void)
+{
+    TreeIndex index;
+    GRand *rand = g_rand_new_with_seed(0x7ee);
+    GPtrArray *items = g_ptr_array_new();
+    GPtrArray *found = g_ptr_array_new();
+    unsigned int i, j;
+
+    tree_index_init(&index, SURFACE_WIDTH, SURFACE_HEIGHT);
+    for (i = 0; i < 500; i++) {
+        /* some of them are large enough to not be kept in the cells */
+        SpiceRect rect = random_rect(rand, i % 10 ? 100 : 1000);
+        TreeItem *item = tree_item_new(&rect);
+
+        tree_index_add(&index, item);
+        g_assert_true(item->index == &index);
+        g_ptr_array_add(items, item);
+    }
+    g_assert_cmpuint(index.num_items, ==, 500);
+
+    /* every other item removed */
+    for (i = 0; i < items->len; i += 2) {
+        tree_index_remove((TreeItem *) g_ptr_array_index(items, i));
+    }
+    g_assert_cmpuint(index.num_items, ==, 250);
+
+    for (i = 0; i < 200; i++) {
+        SpiceRect area = random_rect(rand, 300);
+        unsigned int expected = 0;
+
+        g_ptr_array_set_size(found, 0);
+        tree_index_foreach(&index, &area, collect_item, found);
+        for (j = 0; j < items->len; j++) {
+            TreeItem *item = (TreeItem *) g_ptr_array_index(items, j);
+            SpiceRect box;
+            bool intersects;
+
+            region_extents(&item->rgn, &box);
+            intersects = item->index && rect_intersects(&box, &area);
+            expected += intersects;
+            /* each one is visited once */
+            g_assert_true(intersects == g_ptr_array_remove(found, item));
+            g_assert_false(g_ptr_array_remove(found, item));
+        }
+        g_assert_cmpuint(found->len, ==, 0);
+        g_assert_true(tree_index_intersects(&index, &area) == (expected != 0));
+    }
+
+    for (i = 1; i < items->len; i += 2) {
+        tree_index_remove((TreeItem *) g_ptr_array_index(items, i));
+    }
+    g_assert_cmpuint(index.num_items, ==, 0);
+    g_assert_false(tree_index_intersects(&index, &(SpiceRect) { 0, 0, SURFACE_WIDTH, SURFACE_HEIGHT }));
+
+    g_ptr_array_foreach(items, (GFunc) tree_item_free, NULL);
+    g_ptr_array_free(items, TRUE);
+    g_ptr_array_free(found, TRUE);
+    tree_index_destroy(&index);
+    g_rand_free(rand);
+}
+
+static void test_tree_index_borders(void)
+{
+    TreeIndex index;
+    SpiceRect rect = make_rect(SURFACE_WIDTH - 10, -20, SURFACE_WIDTH + 40, 10);
+    TreeItem *item = tree_item_new(&rect);
+    unsigned int count = 0;
+
+    tree_index_init(&index, SURFACE_WIDTH, SURFACE_HEIGHT);
+    tree_index_add(&index, item);
+
+    /* the areas outside of the surface are clamped to its cells */
+    rect = make_rect(SURFACE_WIDTH + 20, -10, SURFACE_WIDTH + 30, 0);
+    g_assert_true(tree_index_intersects(&index, &rect));
+    rect = make_rect(SURFACE_WIDTH + 40, 0, SURFACE_WIDTH + 50, 10);
+    g_assert_false(tree_index_intersects(&index, &rect));
+    rect = make_rect(0, 0, SURFACE_WIDTH - 10, SURFACE_HEIGHT);
+    g_assert_false(tree_index_intersects(&index, &rect));
+
+    /* a query covering more cells than there are items */
+    g_assert_false(tree_index_is_selective(&index, &rect));
+    rect = make_rect(0, 0, 1, 1);
+    g_assert_false(tree_index_is_selective(&index, &rect));
+    tree_index_foreach(&index, &rect, count_item, &count);
+    g_assert_cmpuint(count, ==, 0);
+
+    tree_index_remove(item);
+    tree_index_remove(item);
+    g_assert_null(item->index);
+    tree_item_free(item);
+    tree_index_destroy(&index);
+}
+
+static void test_tree_index_container(void)
+{
+    TreeIndex index;
+    Ring ring;
+    SpiceRect rect = make_rect(100, 100, 200, 200);
+    DrawItem *draw_item = g_new0(DrawItem, 1);
+    Container *container;
+
+    ring_init(&ring);
+    draw_item->base.type = TREE_ITEM_TYPE_DRAWABLE;
+    region_init(&draw_item->base.rgn);
+    region_add(&draw_item->base.rgn, &rect);
+    ring_item_init(&draw_item->base.siblings_link);
+    ring_add(&ring, &draw_item->base.siblings_link);
+
+    tree_index_init(&index, SURFACE_WIDTH, SURFACE_HEIGHT);
+    tree_index_add(&index, &draw_item->base);
+
+    /* the container is indexed along with the item it holds */
+    container = container_new(draw_item);
+    g_assert_true(container->base.index == &index);
+    g_assert_cmpuint(index.num_items, ==, 2);
+
+    tree_index_remove(&draw_item->base);
+    ring_remove(&draw_item->base.siblings_link);
+    container_cleanup(container);
+    g_assert_cmpuint(index.num_items, ==, 0);
+    g_assert_true(ring_is_empty(&ring));
+
+    region_destroy(&draw_item->base.rgn);
+    g_free(draw_item);
+    tree_index_destroy(&index);
+}
+
+static void benchmark_depth(GRand *rand, unsigned int num_items)
+{
+    TreeIndex index;
+    Ring ring;
+    TreeItem **items = g_new(TreeItem *, num_items);
+    SpiceRect *areas = g_new(SpiceRect, NUM_QUERIES);
+    unsigned int i, found_index = 0, found_ring = 0;
+    double insert_time, index_time, ring_time;
+
+    for (i = 0; i < num_items; i++) {
+        /* mostly small drawings like glyphs, and a few windows */
+        SpiceRect rect = random_rect(rand, i % 32 ? 24 : 400);
+
+        items[i] = tree_item_new(&rect);
+    }
+    for (i = 0; i < NUM_QUERIES; i++) {
+        areas[i] = random_rect(rand, 32);
+    }
+
+    tree_index_init(&index, SURFACE_WIDTH, SURFACE_HEIGHT);
+    ring_init(&ring);
+    g_test_timer_start();
+    for (i = 0; i < num_items; i++) {
+        tree_index_add(&index, items[i]);
+        ring_add(&ring, &items[i]->siblings_link);
+    }
+    insert_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (i = 0; i < NUM_QUERIES; i++) {
+        tree_index_foreach(&index, &areas[i], count_item, &found_index);
+    }
+    index_time = g_test_timer_elapsed();
+
+    g_test_timer_start();
+    for (i = 0; i < NUM_QUERIES; i++) {
+        QRegion rgn;
+        RingItem *now;
+
+        region_init(&rgn);
+        region_add(&rgn, &areas[i]);
+        RING_FOREACH(now, &ring) {
+            TreeItem *item = SPICE_CONTAINEROF(now, TreeItem, siblings_link);
+
+            found_ring += region_bounds_intersects(&rgn, &item->rgn);
+        }
+        region_destroy(&rgn);
+    }
+    ring_time = g_test_timer_elapsed();
+
+    g_test_message("%6u items: insert %.3f us, query index %.3f us, ring walk %.3f us",
+                   num_items, insert_time * 1000000 / num_items,
+                   index_time * 1000000 / NUM_QUERIES, ring_time * 1000000 / NUM_QUERIES);
+    /* the index gives the same candidates as the bounds of the regions */
+    g_assert_cmpuint(found_index, ==, found_ring);
+
+    for (i = 0; i < num_items; i++) {
+        tree_index_remove(items[i]);
+        ring_remove(&items[i]->siblings_link);
+        tree_item_free(items[i]);
+    }
+    tree_index_destroy(&index);
+    g_free(items);
+    g_free(areas);
+}
+
+static void test_tree_index_benchmark(void)
+{
+    GRand *rand = g_rand_new_with_seed(0x7ee);
+    unsigned int num_items;
+
+    for (num_items = 16; num_items <= 16384; num_items *= 4) {
+        benchmark_depth(rand, num_items);
+    }
+    g_rand_free(rand);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/tree-index/foreach", test_tree_index_foreach);
+    g_test_add_func("/server/tree-index/borders", test_tree_index_borders);
+    g_test_add_func("/server/tree-index/container", test_tree_index_container);
+    if (g_test_perf()) {
+        g_test_add_func("/server/tree-index/benchmark", test_tree_index_benchmark);
+    }
+
+    return g_test_run();
+}
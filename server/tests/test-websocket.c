@@ -18,7 +18,9 @@
 /* Utility to allow checking our websocket implementaion using Autobahn
  * Test Suite.
  * This suite require a WebSocket server implementation echoing
- * data sent to it
+ * data sent to it.
+ * With --benchmark the throughput of the reading and of the writing of
+ * frames of several sizes is measured over a local socket pair instead.
  */
 #undef NDEBUG
 #include <config.h>
@@ -61,6 +63,7 @@ static gboolean non_blocking = false;
 static gboolean debug = false;
 static volatile bool got_term = false;
 static unsigned int num_connections = 0;
+static gboolean benchmark = false;
 
 static GOptionEntry cmd_entries[] = {
   {"port", 'p', 0, G_OPTION_ARG_INT, &port,
@@ -69,10 +72,13 @@ static GOptionEntry cmd_entries[] = {
    "Enable non-blocking i/o", NULL},
   {"debug", 0, 0, G_OPTION_ARG_NONE, &debug,
    "Enable debug output", NULL},
+  {"benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark,
+   "Measure the throughput of the implementation and exit", NULL},
   {NULL}
 };
 
 static void handle_client(int new_sock);
+static void run_benchmark(void);
 
 static int
 wait_for(int sock, short events)
@@ -140,6 +146,11 @@ main(int argc, char **argv)
         errx(1, "%s: %s\n", argv[0], error->message);
     }
 
+    if (benchmark) {
+        run_benchmark();
+        return 0;
+    }
+
     int sock = socket(AF_INET, SOCK_STREAM, 0);
     if (sock < 0) {
         err(1, "socket");
@@ -294,3 +305,227 @@ handle_client(int new_sock)
         printf("connection closed\n");
     }
 }
+
+#define BENCHMARK_BYTES (256 * 1024 * 1024)
+
+typedef struct {
+    int sock;
+    const uint8_t *data;
+    size_t len;
+    size_t total;
+} BenchmarkPeer;
+
+/* send the same frames over and over */
+static gpointer
+benchmark_send(gpointer opaque)
+{
+    BenchmarkPeer *peer = opaque;
+    size_t sent = 0;
+
+    while (sent < peer->total) {
+        size_t pos = 0;
+        while (pos < peer->len) {
+            ssize_t rc = send(peer->sock, peer->data + pos, peer->len - pos, MSG_NOSIGNAL);
+            if (rc <= 0) {
+                err(1, "send");
+            }
+            pos += rc;
+        }
+        sent += peer->len;
+    }
+    return NULL;
+}
+
+static gpointer
+benchmark_receive(gpointer opaque)
+{
+    BenchmarkPeer *peer = opaque;
+    uint8_t buf[65536];
+    ssize_t rc;
+
+    /* until the writer shuts the connection down */
+    while ((rc = recv(peer->sock, buf, sizeof(buf), 0)) != 0) {
+        if (rc < 0) {
+            err(1, "recv");
+        }
+    }
+    return NULL;
+}
+
+static RedsWebSocket *
+benchmark_websocket_new(int sock, int peer_sock)
+{
+    static const char request[] =
+        "GET / HTTP/1.1\r\n"
+        "Host: localhost\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+        "Sec-WebSocket-Protocol: binary\r\n"
+        "Sec-WebSocket-Version: 13\r\n\r\n";
+    char reply[1024];
+
+    if (send(peer_sock, request, strlen(request), MSG_NOSIGNAL) != strlen(request)) {
+        err(1, "send");
+    }
+    RedsWebSocket *ws = websocket_new("", 0, GINT_TO_POINTER(sock),
+                                      ws_read, ws_write, ws_writev);
+    assert(ws);
+    if (recv(peer_sock, reply, sizeof(reply), 0) <= 0) {
+        err(1, "recv");
+    }
+    return ws;
+}
+
+/* read masked frames of @frame_size bytes, as sent by the clients */
+static void
+benchmark_read(size_t frame_size)
+{
+    int socks[2];
+    BenchmarkPeer peer;
+    GByteArray *frames = g_byte_array_new();
+    const size_t num_frames = MAX(1, 1024 * 1024 / frame_size);
+    uint8_t *buf = g_malloc(frame_size);
+    size_t i, j, num_reads, total = 0;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+        err(1, "socketpair");
+    }
+    RedsWebSocket *ws = benchmark_websocket_new(socks[0], socks[1]);
+
+    for (i = 0; i < num_frames; i++) {
+        uint8_t header[14] = { WEBSOCKET_BINARY_FINAL, 0x80 };
+        const uint8_t mask[4] = { 0x12, 0x34, 0x56, i };
+        size_t header_len = 2;
+
+        if (frame_size < 126) {
+            header[1] |= frame_size;
+        } else if (frame_size < 65536) {
+            header[1] |= 126;
+            header[header_len++] = frame_size >> 8;
+            header[header_len++] = frame_size & 0xff;
+        } else {
+            header[1] |= 127;
+            for (j = 0; j < 8; j++) {
+                header[header_len++] = (uint64_t) frame_size >> (56 - j * 8);
+            }
+        }
+        memcpy(header + header_len, mask, sizeof(mask));
+        header_len += sizeof(mask);
+        g_byte_array_append(frames, header, header_len);
+        for (j = 0; j < frame_size; j++) {
+            buf[j] = (i + j) ^ mask[j % 4];
+        }
+        g_byte_array_append(frames, buf, frame_size);
+    }
+
+    peer.sock = socks[1];
+    peer.data = frames->data;
+    peer.len = frames->len;
+    peer.total = MAX(frames->len, (size_t) BENCHMARK_BYTES / (frame_size < 1024 ? 8 : 1));
+    peer.total -= peer.total % frames->len;
+    GThread *thread = g_thread_new("benchmark-send", benchmark_send, &peer);
+
+    num_reads = peer.total / frames->len * num_frames;
+    gint64 start = g_get_monotonic_time();
+    for (i = 0; i < num_reads; i++) {
+        size_t len = 0;
+        unsigned flags = 0;
+
+        while (!(flags & WEBSOCKET_FINAL)) {
+            int rc = websocket_read(ws, buf + len, frame_size - len, &flags);
+            if (rc < 0) {
+                err(1, "websocket_read");
+            }
+            len += rc;
+        }
+        assert(len == frame_size);
+        assert(buf[frame_size - 1] == (uint8_t) (i % num_frames + frame_size - 1));
+        total += len;
+    }
+    double elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+    g_thread_join(thread);
+
+    printf("read  %7zu byte frames: %9.1f MB/s, %10.0f frames/s\n", frame_size,
+           total / elapsed / (1024 * 1024), num_reads / elapsed);
+
+    websocket_free(ws);
+    socket_close(socks[0]);
+    socket_close(socks[1]);
+    g_byte_array_free(frames, TRUE);
+    g_free(buf);
+}
+
+/* write messages of @msg_size bytes split over @num_iov buffers, as the
+ * channels do */
+static void
+benchmark_write(size_t msg_size, int num_iov)
+{
+    int socks[2];
+    BenchmarkPeer peer;
+    uint8_t *data = g_malloc0(msg_size);
+    struct iovec *iov = g_new(struct iovec, num_iov);
+    size_t total = 0, sent = 0;
+    const size_t total_bytes = BENCHMARK_BYTES / (msg_size < 1024 ? 8 : 1);
+    int i;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, socks) < 0) {
+        err(1, "socketpair");
+    }
+    RedsWebSocket *ws = benchmark_websocket_new(socks[0], socks[1]);
+
+    peer.sock = socks[1];
+    GThread *thread = g_thread_new("benchmark-receive", benchmark_receive, &peer);
+
+    gint64 start = g_get_monotonic_time();
+    unsigned int num_msgs = 0;
+    while (total < total_bytes || sent != 0) {
+        int cnt = 0;
+        size_t pos = sent, chunk = msg_size / num_iov;
+
+        for (i = 0; i < num_iov && pos < msg_size; i++) {
+            iov[cnt].iov_base = data + pos;
+            iov[cnt].iov_len = i == num_iov - 1 ? msg_size - pos : MIN(chunk, msg_size - pos);
+            pos += iov[cnt++].iov_len;
+        }
+        int rc = websocket_writev(ws, iov, cnt, WEBSOCKET_BINARY_FINAL);
+        if (rc < 0) {
+            if (errno == EAGAIN || errno == EINTR) {
+                continue;
+            }
+            err(1, "websocket_writev");
+        }
+        sent += rc;
+        total += rc;
+        if (sent == msg_size) {
+            sent = 0;
+            num_msgs++;
+        }
+    }
+    shutdown(socks[0], SHUT_WR);
+    g_thread_join(thread);
+    double elapsed = (g_get_monotonic_time() - start) / 1000000.0;
+
+    printf("write %7zu byte frames: %9.1f MB/s, %10.0f frames/s (%d buffers)\n", msg_size,
+           total / elapsed / (1024 * 1024), num_msgs / elapsed, num_iov);
+
+    websocket_free(ws);
+    socket_close(socks[0]);
+    socket_close(socks[1]);
+    g_free(iov);
+    g_free(data);
+}
+
+static void
+run_benchmark(void)
+{
+    static const size_t frame_sizes[] = { 16, 256, 4096, 65536, 1024 * 1024 };
+    size_t i;
+
+    for (i = 0; i < G_N_ELEMENTS(frame_sizes); i++) {
+        benchmark_read(frame_sizes[i]);
+    }
+    for (i = 0; i < G_N_ELEMENTS(frame_sizes); i++) {
+        benchmark_write(frame_sizes[i], frame_sizes[i] < 256 ? 1 : 8);
+    }
+}
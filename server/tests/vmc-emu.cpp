@@ -37,10 +37,9 @@ static int vmc_write(SpiceCharDeviceInstance *sin,
     return len;
 }
 
-static int vmc_read(SpiceCharDeviceInstance *sin,
-                    uint8_t *buf, int len)
+// consume up to len bytes from vmc->pos, returns the number of bytes
+static int vmc_consume(VmcEmu *vmc, int len)
 {
-    VmcEmu *const vmc = SPICE_CONTAINEROF(sin, VmcEmu, instance);
     int ret;
 
     if (vmc->pos >= *vmc->message_sizes_curr && vmc->message_sizes_curr < vmc->message_sizes_end) {
@@ -50,7 +49,6 @@ static int vmc_read(SpiceCharDeviceInstance *sin,
         return 0;
     }
     ret = MIN(*vmc->message_sizes_curr - vmc->pos, len);
-    memcpy(buf, &vmc->message[vmc->pos], ret);
     vmc->pos += ret;
     // kick off next message read
     // currently Qemu kicks the device so we need to do it manually
@@ -63,6 +61,57 @@ static int vmc_read(SpiceCharDeviceInstance *sin,
     return ret;
 }
 
+static int vmc_read(SpiceCharDeviceInstance *sin,
+                    uint8_t *buf, int len)
+{
+    VmcEmu *const vmc = SPICE_CONTAINEROF(sin, VmcEmu, instance);
+    const uint8_t *data = &vmc->message[vmc->pos];
+
+    int ret = vmc_consume(vmc, len);
+    if (ret > 0) {
+        memcpy(buf, data, ret);
+    }
+    return ret;
+}
+
+// return the data as read would, in segments of at most 100 bytes,
+// holding at most segments_capacity bytes
+static int vmc_read_segments(SpiceCharDeviceInstance *sin, SpiceCharDeviceSegment *segments,
+                             int max_segments, size_t len)
+{
+    VmcEmu *const vmc = SPICE_CONTAINEROF(sin, VmcEmu, instance);
+    int num_segments = 0;
+
+    while (num_segments < max_segments && len > 0) {
+        size_t room = len;
+        if (vmc->segments_capacity) {
+            room = MIN(room, vmc->segments_capacity - vmc->segments_pending);
+        }
+        if (room == 0) {
+            return num_segments ? num_segments : SPICE_CHAR_DEVICE_SEGMENTS_FULL;
+        }
+        const uint8_t *data = &vmc->message[vmc->pos];
+        int ret = vmc_consume(vmc, MIN(room, 100));
+        if (ret <= 0) {
+            break;
+        }
+        segments[num_segments].data = data;
+        segments[num_segments].len = ret;
+        ++num_segments;
+        vmc->segments_pending += ret;
+        len -= ret;
+    }
+    return num_segments;
+}
+
+static void vmc_release_segments(SpiceCharDeviceInstance *sin, size_t len)
+{
+    VmcEmu *const vmc = SPICE_CONTAINEROF(sin, VmcEmu, instance);
+
+    g_assert_cmpint(len, <=, vmc->segments_pending);
+    vmc->segments_pending -= len;
+}
+
 static void vmc_state(SpiceCharDeviceInstance *sin,
                       int connected)
 {
@@ -105,11 +154,21 @@ void vmc_emu_destroy(VmcEmu *vmc)
 void vmc_emu_reset(VmcEmu *vmc)
 {
     vmc->pos = 0;
+    vmc->segments_pending = 0;
+    vmc->segments_capacity = 0;
     vmc->write_pos = 0;
     vmc->message_sizes_curr = vmc->message_sizes;
     vmc->message_sizes_end = vmc->message_sizes;
 }
 
+void vmc_emu_enable_segments(VmcEmu *vmc)
+{
+    vmc->vmc_interface.flags =
+        (spice_char_device_flags) (vmc->vmc_interface.flags | SPICE_CHAR_DEVICE_READ_SEGMENTS);
+    vmc->vmc_interface.read_segments = vmc_read_segments;
+    vmc->vmc_interface.release_segments = vmc_release_segments;
+}
+
 void vmc_emu_add_read_till(VmcEmu *vmc, uint8_t *end)
 {
     g_assert(vmc->message_sizes_end - vmc->message_sizes < G_N_ELEMENTS(vmc->message_sizes));
@@ -40,6 +40,11 @@ struct VmcEmu {
 
     bool device_enabled;
 
+    // bytes read in place and not released yet
+    unsigned segments_pending;
+    // limit of segments_pending, 0 for no limit
+    unsigned segments_capacity;
+
     unsigned write_pos;
     uint8_t write_buf[2048];
 
@@ -51,5 +56,7 @@ VmcEmu *vmc_emu_new(const char *subtype, const char *portname);
 void vmc_emu_destroy(VmcEmu *vmc);
 void vmc_emu_reset(VmcEmu *vmc);
 void vmc_emu_add_read_till(VmcEmu *vmc, uint8_t *end);
+// let the server read the data in place with read_segments
+void vmc_emu_enable_segments(VmcEmu *vmc);
 
 #include "pop-visibility.h"
@@ -0,0 +1,363 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <string.h>
+#include <glib.h>
+
+#include "tile-region.h"
+
+#define TILE_SIZE TILE_REGION_TILE_SIZE
+#define TILE_SHIFT TILE_REGION_TILE_SHIFT
+
+/* span of tiles, end excluded */
+typedef struct TileSpan {
+    uint32_t col0, col1;
+    uint32_t row0, row1;
+} TileSpan;
+
+void tile_region_init(TileRegion *region, uint32_t width, uint32_t height)
+{
+    g_free(region->tiles);
+    region->width = width;
+    region->height = height;
+    region->cols = (width + TILE_SIZE - 1) >> TILE_SHIFT;
+    region->rows = (height + TILE_SIZE - 1) >> TILE_SHIFT;
+    region->words_per_row = (region->cols + 63) / 64;
+    region->tiles = g_new0(uint64_t, (size_t) region->words_per_row * region->rows);
+}
+
+void tile_region_destroy(TileRegion *region)
+{
+    g_free(region->tiles);
+    memset(region, 0, sizeof(*region));
+}
+
+void tile_region_clear(TileRegion *region)
+{
+    if (region->tiles == NULL) {
+        return;
+    }
+    memset(region->tiles, 0, sizeof(uint64_t) * region->words_per_row * region->rows);
+}
+
+static inline uint64_t *tile_region_row(const TileRegion *region, uint32_t row)
+{
+    return region->tiles + (size_t) row * region->words_per_row;
+}
+
+/* mask of the bits [start, end) of the word @word of a row */
+static inline uint64_t word_mask(uint32_t word, uint32_t start, uint32_t end)
+{
+    uint32_t first = word * 64;
+    uint64_t mask = ~UINT64_C(0);
+
+    if (start > first) {
+        mask <<= start - first;
+    }
+    if (end < first + 64) {
+        mask &= ~UINT64_C(0) >> (first + 64 - end);
+    }
+    return mask;
+}
+
+/* tiles touched by @rect, returns false if there are none */
+static bool span_touched(const TileRegion *region, const SpiceRect *rect, TileSpan *span)
+{
+    int32_t left = MAX(rect->left, 0);
+    int32_t top = MAX(rect->top, 0);
+    int32_t right = MIN(rect->right, (int32_t) region->width);
+    int32_t bottom = MIN(rect->bottom, (int32_t) region->height);
+
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+    span->col0 = left >> TILE_SHIFT;
+    span->col1 = (right + TILE_SIZE - 1) >> TILE_SHIFT;
+    span->row0 = top >> TILE_SHIFT;
+    span->row1 = (bottom + TILE_SIZE - 1) >> TILE_SHIFT;
+    return true;
+}
+
+/* tiles fully covered by @rect, the tiles cut by the border of the surface
+ * are covered if their part inside the surface is */
+static bool span_covered(const TileRegion *region, const SpiceRect *rect, TileSpan *span)
+{
+    int32_t left = MAX(rect->left, 0);
+    int32_t top = MAX(rect->top, 0);
+    int32_t right = MIN(rect->right, (int32_t) region->width);
+    int32_t bottom = MIN(rect->bottom, (int32_t) region->height);
+
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+    span->col0 = (left + TILE_SIZE - 1) >> TILE_SHIFT;
+    span->col1 = right == (int32_t) region->width ? region->cols : right >> TILE_SHIFT;
+    span->row0 = (top + TILE_SIZE - 1) >> TILE_SHIFT;
+    span->row1 = bottom == (int32_t) region->height ? region->rows : bottom >> TILE_SHIFT;
+    return span->col0 < span->col1 && span->row0 < span->row1;
+}
+
+static void span_set(TileRegion *region, const TileSpan *span, bool set)
+{
+    uint32_t first_word = span->col0 / 64;
+    uint32_t last_word = (span->col1 - 1) / 64;
+    uint32_t row, word;
+
+    for (row = span->row0; row < span->row1; row++) {
+        uint64_t *words = tile_region_row(region, row);
+
+        for (word = first_word; word <= last_word; word++) {
+            uint64_t mask = word_mask(word, span->col0, span->col1);
+
+            if (set) {
+                words[word] |= mask;
+            } else {
+                words[word] &= ~mask;
+            }
+        }
+    }
+}
+
+void tile_region_add(TileRegion *region, const SpiceRect *rect)
+{
+    TileSpan span;
+
+    if (span_touched(region, rect, &span)) {
+        span_set(region, &span, true);
+    }
+}
+
+void tile_region_remove(TileRegion *region, const SpiceRect *rect)
+{
+    TileSpan span;
+
+    if (span_covered(region, rect, &span)) {
+        span_set(region, &span, false);
+    }
+}
+
+static bool rect_intersect(const SpiceRect *a, const SpiceRect *b, SpiceRect *out)
+{
+    out->left = MAX(a->left, b->left);
+    out->top = MAX(a->top, b->top);
+    out->right = MIN(a->right, b->right);
+    out->bottom = MIN(a->bottom, b->bottom);
+    return out->left < out->right && out->top < out->bottom;
+}
+
+void tile_region_add_clipped(TileRegion *region, const SpiceRect *rect,
+                             const SpiceClipRects *clip)
+{
+    SpiceRect part;
+    uint32_t i;
+
+    for (i = 0; i < clip->num_rects; i++) {
+        if (rect_intersect(rect, &clip->rects[i], &part)) {
+            tile_region_add(region, &part);
+        }
+    }
+}
+
+void tile_region_remove_clipped(TileRegion *region, const SpiceRect *rect,
+                                const SpiceClipRects *clip)
+{
+    SpiceRect part;
+    uint32_t i;
+
+    for (i = 0; i < clip->num_rects; i++) {
+        if (rect_intersect(rect, &clip->rects[i], &part)) {
+            tile_region_remove(region, &part);
+        }
+    }
+}
+
+bool tile_region_is_empty(const TileRegion *region)
+{
+    size_t i, n = (size_t) region->words_per_row * region->rows;
+
+    for (i = 0; i < n; i++) {
+        if (region->tiles[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* extents, in tiles, of the tiles set in @span, returns false if none */
+static bool span_extents(const TileRegion *region, const TileSpan *span, TileSpan *out)
+{
+    uint32_t first_word = span->col0 / 64;
+    uint32_t last_word = (span->col1 - 1) / 64;
+    uint32_t row, word;
+    bool found = false;
+
+    out->col0 = UINT32_MAX;
+    out->col1 = 0;
+    for (row = span->row0; row < span->row1; row++) {
+        const uint64_t *words = tile_region_row(region, row);
+        bool row_found = false;
+
+        for (word = first_word; word <= last_word; word++) {
+            uint64_t bits = words[word] & word_mask(word, span->col0, span->col1);
+
+            if (!bits) {
+                continue;
+            }
+            out->col0 = MIN(out->col0, word * 64 + __builtin_ctzll(bits));
+            out->col1 = MAX(out->col1, word * 64 + 64 - __builtin_clzll(bits));
+            row_found = true;
+        }
+        if (row_found) {
+            if (!found) {
+                out->row0 = row;
+                found = true;
+            }
+            out->row1 = row + 1;
+        }
+    }
+    return found;
+}
+
+static void span_to_rect(const TileRegion *region, const TileSpan *span, SpiceRect *rect)
+{
+    rect->left = span->col0 << TILE_SHIFT;
+    rect->top = span->row0 << TILE_SHIFT;
+    rect->right = MIN(span->col1 << TILE_SHIFT, region->width);
+    rect->bottom = MIN(span->row1 << TILE_SHIFT, region->height);
+}
+
+void tile_region_align_rect(const TileRegion *region, SpiceRect *rect)
+{
+    TileSpan span;
+
+    if (span_touched(region, rect, &span)) {
+        span_to_rect(region, &span, rect);
+    }
+}
+
+bool tile_region_intersects(const TileRegion *region, const SpiceRect *rect,
+                            SpiceRect *out_extents)
+{
+    TileSpan span, extents;
+    SpiceRect tiles_rect;
+
+    if (!span_touched(region, rect, &span) ||
+        !span_extents(region, &span, &extents)) {
+        return false;
+    }
+    if (out_extents) {
+        span_to_rect(region, &extents, &tiles_rect);
+        rect_intersect(&tiles_rect, rect, out_extents);
+    }
+    return true;
+}
+
+void tile_region_extents(const TileRegion *region, SpiceRect *out_extents)
+{
+    TileSpan span = { 0, region->cols, 0, region->rows };
+    TileSpan extents;
+
+    if (region->cols == 0 || region->rows == 0 ||
+        !span_extents(region, &span, &extents)) {
+        memset(out_extents, 0, sizeof(*out_extents));
+        return;
+    }
+    span_to_rect(region, &extents, out_extents);
+}
+
+/* run of set tiles of the previous row and the rectangle it belongs to */
+typedef struct TileRun {
+    uint32_t col0, col1;
+    uint32_t rect;
+} TileRun;
+
+uint32_t tile_region_get_rects(const TileRegion *region, SpiceRect **out_rects)
+{
+    GArray *rects = g_array_new(FALSE, FALSE, sizeof(SpiceRect));
+    TileRun *prev_runs = g_new(TileRun, region->cols / 2 + 1);
+    TileRun *runs = g_new(TileRun, region->cols / 2 + 1);
+    uint32_t num_prev_runs = 0;
+    uint32_t num_rects;
+    uint32_t row;
+
+    for (row = 0; row < region->rows; row++) {
+        const uint64_t *words = tile_region_row(region, row);
+        uint32_t num_runs = 0, prev = 0;
+        uint32_t col = 0;
+
+        while (col < region->cols) {
+            uint64_t bits = words[col / 64] >> (col % 64);
+            uint32_t col0, col1;
+            TileRun *run;
+
+            if (!bits) {
+                col = (col / 64 + 1) * 64;
+                continue;
+            }
+            col0 = col + __builtin_ctzll(bits);
+            /* end of the run of set bits, possibly in the next words */
+            col1 = col0;
+            while (col1 < region->cols) {
+                uint64_t rest = ~(words[col1 / 64] >> (col1 % 64));
+                uint32_t len = rest ? __builtin_ctzll(rest) : 64 - col1 % 64;
+
+                len = MIN(len, 64 - col1 % 64);
+                col1 += len;
+                if (col1 % 64 != 0) {
+                    break;
+                }
+            }
+            col1 = MIN(col1, region->cols);
+            col = col1;
+
+            run = &runs[num_runs++];
+            run->col0 = col0;
+            run->col1 = col1;
+
+            /* extend the rectangle of the same run in the previous row */
+            while (prev < num_prev_runs && prev_runs[prev].col0 < col0) {
+                prev++;
+            }
+            if (prev < num_prev_runs &&
+                prev_runs[prev].col0 == col0 && prev_runs[prev].col1 == col1) {
+                run->rect = prev_runs[prev].rect;
+                g_array_index(rects, SpiceRect, run->rect).bottom =
+                    MIN((row + 1) << TILE_SHIFT, region->height);
+            } else {
+                TileSpan span = { col0, col1, row, row + 1 };
+                SpiceRect rect;
+
+                span_to_rect(region, &span, &rect);
+                run->rect = rects->len;
+                g_array_append_val(rects, rect);
+            }
+        }
+
+        TileRun *tmp = prev_runs;
+        prev_runs = runs;
+        runs = tmp;
+        num_prev_runs = num_runs;
+    }
+    g_free(prev_runs);
+    g_free(runs);
+
+    num_rects = rects->len;
+    *out_rects = (SpiceRect *) g_array_free(rects, FALSE);
+    return num_rects;
+}
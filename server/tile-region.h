@@ -0,0 +1,78 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2020 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TILE_REGION_H_
+#define TILE_REGION_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <spice/macros.h>
+#include <common/draw.h>
+
+SPICE_BEGIN_DECLS
+
+/* Area of a surface tracked with a bitmap of square tiles, used instead of
+ * a QRegion for the bookkeeping of the areas touched by many small drawings
+ * (dirty or lossy areas). Updates and lookups cost a few bit operations per
+ * row of tiles whatever the number of drawings.
+ *
+ * The tracking is conservative: adding an area marks all the tiles it
+ * touches while removing an area only clears the tiles it fully covers,
+ * so the tracked area always contains the exact one.
+ */
+#define TILE_REGION_TILE_SHIFT 4
+#define TILE_REGION_TILE_SIZE (1 << TILE_REGION_TILE_SHIFT)
+
+typedef struct TileRegion {
+    uint32_t width;
+    uint32_t height;
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t words_per_row;
+    uint64_t *tiles;
+} TileRegion;
+
+/* @region must be zeroed or destroyed */
+void tile_region_init(TileRegion *region, uint32_t width, uint32_t height);
+void tile_region_destroy(TileRegion *region);
+void tile_region_clear(TileRegion *region);
+
+void tile_region_add(TileRegion *region, const SpiceRect *rect);
+void tile_region_remove(TileRegion *region, const SpiceRect *rect);
+/* add or remove the part of @rect inside @clip */
+void tile_region_add_clipped(TileRegion *region, const SpiceRect *rect,
+                             const SpiceClipRects *clip);
+void tile_region_remove_clipped(TileRegion *region, const SpiceRect *rect,
+                                const SpiceClipRects *clip);
+
+bool tile_region_is_empty(const TileRegion *region);
+/* returns whether @rect intersects the region, with the extents of the
+ * intersection in @out_extents if not NULL */
+bool tile_region_intersects(const TileRegion *region, const SpiceRect *rect,
+                            SpiceRect *out_extents);
+void tile_region_extents(const TileRegion *region, SpiceRect *out_extents);
+/* expands @rect to the tiles it touches, clipped to the surface, so that
+ * removing it clears all of them */
+void tile_region_align_rect(const TileRegion *region, SpiceRect *rect);
+/* returns the number of rectangles covering the region in a newly allocated
+ * array, rows of tiles with the same runs are coalesced */
+uint32_t tile_region_get_rects(const TileRegion *region, SpiceRect **out_rects);
+
+SPICE_END_DECLS
+
+#endif /* TILE_REGION_H_ */
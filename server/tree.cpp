@@ -197,6 +197,7 @@ Shadow* shadow_new(DrawItem *item, const SpicePoint *delta)
 
     shadow->base.type = TREE_ITEM_TYPE_SHADOW;
     shadow->base.container = NULL;
+    shadow->base.index = NULL;
     region_clone(&shadow->base.rgn, &item->base.rgn);
     region_offset(&shadow->base.rgn, delta->x, delta->y);
     ring_item_init(&shadow->base.siblings_link);
@@ -220,6 +221,10 @@ Container* container_new(DrawItem *item)
     item->base.container = container;
     item->container_root = TRUE;
     region_clone(&container->base.rgn, &item->base.rgn);
+    container->base.index = NULL;
+    if (item->base.index) {
+        tree_index_add(item->base.index, &container->base);
+    }
     ring_item_init(&container->base.siblings_link);
     ring_add_after(&container->base.siblings_link, &item->base.siblings_link);
     ring_remove(&item->base.siblings_link);
@@ -233,6 +238,7 @@ void container_free(Container *container)
 {
     spice_return_if_fail(ring_is_empty(&container->items));
 
+    tree_index_remove(&container->base);
     ring_remove(&container->base.siblings_link);
     region_destroy(&container->base.rgn);
     g_free(container);
@@ -303,8 +309,183 @@ void draw_item_remove_shadow(DrawItem *item)
     }
     shadow = item->shadow;
     item->shadow = NULL;
+    tree_index_remove(&shadow->base);
     ring_remove(&shadow->base.siblings_link);
     region_destroy(&shadow->base.rgn);
     region_destroy(&shadow->on_hold);
     g_free(shadow);
 }
+
+#define TREE_INDEX_CELL_SHIFT 6
+#define TREE_INDEX_CELL_SIZE (1 << TREE_INDEX_CELL_SHIFT)
+/* items overlapping more cells are kept in TreeIndex::large_items */
+#define TREE_INDEX_MAX_ITEM_CELLS 64
+
+void tree_index_init(TreeIndex *index, uint32_t width, uint32_t height)
+{
+    index->cols = MAX(1, (width + TREE_INDEX_CELL_SIZE - 1) >> TREE_INDEX_CELL_SHIFT);
+    index->rows = MAX(1, (height + TREE_INDEX_CELL_SIZE - 1) >> TREE_INDEX_CELL_SHIFT);
+    index->cells = g_new0(GPtrArray *, index->cols * index->rows);
+    index->large_items = g_ptr_array_new();
+    index->num_items = 0;
+    index->stamp = 0;
+}
+
+void tree_index_destroy(TreeIndex *index)
+{
+    uint32_t i;
+
+    spice_warn_if_fail(index->num_items == 0);
+    for (i = 0; i < index->cols * index->rows; i++) {
+        if (index->cells[i]) {
+            g_ptr_array_free(index->cells[i], TRUE);
+        }
+    }
+    g_free(index->cells);
+    index->cells = NULL;
+    g_ptr_array_free(index->large_items, TRUE);
+    index->large_items = NULL;
+}
+
+/* computes the cells overlapped by @box, the ones outside of the grid are
+ * clamped to its border */
+static void tree_index_get_cells(const TreeIndex *index, const SpiceRect *box,
+                                 uint32_t *col0, uint32_t *col1,
+                                 uint32_t *row0, uint32_t *row1)
+{
+    int32_t right = MAX(box->left, box->right - 1);
+    int32_t bottom = MAX(box->top, box->bottom - 1);
+
+    *col0 = CLAMP(box->left >> TREE_INDEX_CELL_SHIFT, 0, (int32_t) index->cols - 1);
+    *col1 = CLAMP(right >> TREE_INDEX_CELL_SHIFT, 0, (int32_t) index->cols - 1);
+    *row0 = CLAMP(box->top >> TREE_INDEX_CELL_SHIFT, 0, (int32_t) index->rows - 1);
+    *row1 = CLAMP(bottom >> TREE_INDEX_CELL_SHIFT, 0, (int32_t) index->rows - 1);
+}
+
+static bool tree_index_is_large(uint32_t col0, uint32_t col1, uint32_t row0, uint32_t row1)
+{
+    return (col1 - col0 + 1) * (row1 - row0 + 1) > TREE_INDEX_MAX_ITEM_CELLS;
+}
+
+void tree_index_add(TreeIndex *index, TreeItem *item)
+{
+    uint32_t col0, col1, row0, row1, col, row;
+
+    spice_return_if_fail(item->index == NULL);
+
+    region_extents(&item->rgn, &item->index_box);
+    item->index = index;
+    item->index_stamp = index->stamp;
+    index->num_items++;
+
+    tree_index_get_cells(index, &item->index_box, &col0, &col1, &row0, &row1);
+    if (tree_index_is_large(col0, col1, row0, row1)) {
+        g_ptr_array_add(index->large_items, item);
+        return;
+    }
+    for (row = row0; row <= row1; row++) {
+        for (col = col0; col <= col1; col++) {
+            GPtrArray **cell = &index->cells[row * index->cols + col];
+
+            if (!*cell) {
+                *cell = g_ptr_array_new();
+            }
+            g_ptr_array_add(*cell, item);
+        }
+    }
+}
+
+void tree_index_remove(TreeItem *item)
+{
+    TreeIndex *index = item->index;
+    uint32_t col0, col1, row0, row1, col, row;
+
+    if (!index) {
+        return;
+    }
+    item->index = NULL;
+    index->num_items--;
+
+    tree_index_get_cells(index, &item->index_box, &col0, &col1, &row0, &row1);
+    if (tree_index_is_large(col0, col1, row0, row1)) {
+        g_ptr_array_remove_fast(index->large_items, item);
+        return;
+    }
+    for (row = row0; row <= row1; row++) {
+        for (col = col0; col <= col1; col++) {
+            g_ptr_array_remove_fast(index->cells[row * index->cols + col], item);
+        }
+    }
+}
+
+static inline bool tree_index_box_intersects(const SpiceRect *box, const SpiceRect *area)
+{
+    return box->left < area->right && area->left < box->right &&
+           box->top < area->bottom && area->top < box->bottom;
+}
+
+/* calls @func once for each item whose box intersects @area, in no specific
+ * order. The index must not be modified by @func. */
+void tree_index_foreach(TreeIndex *index, const SpiceRect *area,
+                        TreeIndexFunc func, void *opaque)
+{
+    uint32_t col0, col1, row0, row1, col, row, i;
+    uint32_t stamp;
+
+    for (i = 0; i < index->large_items->len; i++) {
+        TreeItem *item = (TreeItem *) g_ptr_array_index(index->large_items, i);
+
+        if (tree_index_box_intersects(&item->index_box, area) && !func(item, opaque)) {
+            return;
+        }
+    }
+
+    /* the stamp marks the items already visited through another cell */
+    stamp = ++index->stamp;
+    tree_index_get_cells(index, area, &col0, &col1, &row0, &row1);
+    for (row = row0; row <= row1; row++) {
+        for (col = col0; col <= col1; col++) {
+            GPtrArray *cell = index->cells[row * index->cols + col];
+
+            if (!cell) {
+                continue;
+            }
+            for (i = 0; i < cell->len; i++) {
+                TreeItem *item = (TreeItem *) g_ptr_array_index(cell, i);
+
+                if (item->index_stamp == stamp) {
+                    continue;
+                }
+                item->index_stamp = stamp;
+                if (tree_index_box_intersects(&item->index_box, area) && !func(item, opaque)) {
+                    return;
+                }
+            }
+        }
+    }
+}
+
+static bool tree_index_found(SPICE_GNUC_UNUSED TreeItem *item, void *opaque)
+{
+    *(bool *) opaque = true;
+    return false;
+}
+
+/* returns whether the box of any item intersects @area */
+bool tree_index_intersects(TreeIndex *index, const SpiceRect *area)
+{
+    bool found = false;
+
+    tree_index_foreach(index, area, tree_index_found, &found);
+    return found;
+}
+
+/* returns whether querying the index for @area is expected to be cheaper than
+ * visiting all the items */
+bool tree_index_is_selective(const TreeIndex *index, const SpiceRect *area)
+{
+    uint32_t col0, col1, row0, row1;
+
+    tree_index_get_cells(index, area, &col0, &col1, &row0, &row1);
+    return (col1 - col0 + 1) * (row1 - row0 + 1) < index->num_items;
+}
@@ -40,6 +40,7 @@ typedef struct TreeItem TreeItem;
 typedef struct Shadow Shadow;
 typedef struct Container Container;
 typedef struct DrawItem DrawItem;
+typedef struct TreeIndex TreeIndex;
 
 /* TODO consider GNode instead */
 struct TreeItem {
@@ -50,6 +51,10 @@ struct TreeItem {
      * tree, this region may be modified to exclude the portion of the item
      * that is obscured by other items */
     QRegion rgn;
+    /* the TreeIndex holding the item, if any, and the box it is indexed by */
+    TreeIndex *index;
+    SpiceRect index_box;
+    uint32_t index_stamp;
 };
 
 /* A region "below" a copy, or the src region of the copy */
@@ -99,6 +104,34 @@ Container* container_new                            (DrawItem *item);
 void       container_free                           (Container *container);
 void       container_cleanup                        (Container *container);
 
+/* A uniform grid of the bounding boxes of the items of a tree, so that the
+ * items intersecting an area are found without walking all the rings of the
+ * tree. An item is indexed by the extents of its region when it is added;
+ * as the region of an item only shrinks while it is in the tree the box
+ * stays conservative. */
+struct TreeIndex {
+    uint32_t cols;
+    uint32_t rows;
+    /* for each cell the GPtrArray of the items overlapping it, if any */
+    GPtrArray **cells;
+    /* the items overlapping too many cells to be put in each of them */
+    GPtrArray *large_items;
+    uint32_t num_items;
+    uint32_t stamp;
+};
+
+/* called for each item whose box intersects the area, return FALSE to stop */
+typedef bool (*TreeIndexFunc)(TreeItem *item, void *opaque);
+
+void       tree_index_init                          (TreeIndex *index, uint32_t width, uint32_t height);
+void       tree_index_destroy                       (TreeIndex *index);
+void       tree_index_add                           (TreeIndex *index, TreeItem *item);
+void       tree_index_remove                        (TreeItem *item);
+void       tree_index_foreach                       (TreeIndex *index, const SpiceRect *area,
+                                                     TreeIndexFunc func, void *opaque);
+bool       tree_index_intersects                    (TreeIndex *index, const SpiceRect *area);
+bool       tree_index_is_selective                  (const TreeIndex *index, const SpiceRect *area);
+
 SPICE_END_DECLS
 
 #endif /* TREE_H_ */
@@ -123,6 +123,10 @@ void video_stream_stop(DisplayChannel *display, VideoStream *stream)
         dcc->pipe_add(video_stream_destroy_item_new(stream_agent));
         video_stream_agent_stats_print(stream_agent);
     }
+    if (stream->region_detected && stream->num_frames < RED_STREAM_FRAMES_START_CONDITION) {
+        /* stopped before showing much of a video */
+        stat_inc_counter(display->priv->stream_detection_false_positives_counter, 1);
+    }
     display->priv->streams_size_total -= stream->width * stream->height;
     ring_remove(&stream->link);
     video_stream_unref(display, stream);
@@ -173,12 +177,14 @@ static void video_stream_clip_item_free(RedPipeItem *base)
 
     video_stream_agent_unref(display, item->stream_agent);
     g_free(item->rects);
-    g_free(item);
+    red_slab_free(item);
 }
 
 VideoStreamClipItem *video_stream_clip_item_new(VideoStreamAgent *agent)
 {
-    VideoStreamClipItem *item = g_new(VideoStreamClipItem, 1);
+    DisplayChannel *display = DCC_TO_DC(agent->dcc);
+    VideoStreamClipItem *item =
+        (VideoStreamClipItem *) red_slab_alloc(display->priv->stream_clip_item_slab);
     red_pipe_item_init_full(&item->base, RED_PIPE_ITEM_TYPE_STREAM_CLIP,
                             video_stream_clip_item_free);
 
@@ -246,7 +252,10 @@ static bool is_next_stream_frame(const Drawable *candidate,
     }
 
     red_drawable = candidate->red_drawable;
-    if (!container_candidate_allowed) {
+    if (stream && stream->region_detected &&
+        rect_contains(other_dest, &red_drawable->bbox)) {
+        /* a part of the area of the stream is updated */
+    } else if (!container_candidate_allowed) {
         SpiceRect* candidate_src;
 
         if (!rect_is_equal(&red_drawable->bbox, other_dest)) {
@@ -294,6 +303,7 @@ static void attach_stream(DisplayChannel *display, Drawable *drawable, VideoStre
     stream->current = drawable;
     drawable->stream = stream;
     stream->last_time = drawable->creation_time;
+    stream->num_frames++;
 
     uint64_t duration = drawable->creation_time - stream->input_fps_start_time;
     if (duration >= RED_STREAM_INPUT_FPS_TIMEOUT) {
@@ -386,7 +396,10 @@ static VideoStream *display_channel_stream_try_new(DisplayChannel *display)
     return stream;
 }
 
-static void display_channel_create_stream(DisplayChannel *display, Drawable *drawable)
+/* @region is the area of a stream detected from the hot areas of the screen,
+ * NULL for a stream whose frames are drawn at the place of @drawable */
+static void display_channel_create_stream(DisplayChannel *display, Drawable *drawable,
+                                          const SpiceRect *region)
 {
     DisplayChannelClient *dcc;
     VideoStream *stream;
@@ -404,9 +417,17 @@ static void display_channel_create_stream(DisplayChannel *display, Drawable *dra
     ring_add(&display->priv->streams, &stream->link);
     stream->current = drawable;
     stream->last_time = drawable->creation_time;
-    stream->width = src_rect->right - src_rect->left;
-    stream->height = src_rect->bottom - src_rect->top;
     stream->dest_area = drawable->red_drawable->bbox;
+    stream->region_detected = region != NULL;
+    if (region && !rect_is_equal(region, &stream->dest_area)) {
+        stream->dest_area = *region;
+        stream->width = region->right - region->left;
+        stream->height = region->bottom - region->top;
+    } else {
+        stream->width = src_rect->right - src_rect->left;
+        stream->height = src_rect->bottom - src_rect->top;
+    }
+    stream->num_frames = 1;
     stream->refs = 1;
     SpiceBitmap *bitmap = &drawable->red_drawable->u.copy.src_bitmap->u.bitmap;
     stream->top_down = !!(bitmap->flags & SPICE_BITMAP_FLAGS_TOP_DOWN);
@@ -428,11 +449,11 @@ static void display_channel_create_stream(DisplayChannel *display, Drawable *dra
     FOREACH_DCC(display, dcc) {
         dcc_create_stream(dcc, stream);
     }
-    spice_debug("stream %d %dx%d (%d, %d) (%d, %d) %u fps",
+    spice_debug("stream %d %dx%d (%d, %d) (%d, %d) %u fps%s",
                 display_channel_get_video_stream_id(display, stream), stream->width,
                 stream->height, stream->dest_area.left, stream->dest_area.top,
                 stream->dest_area.right, stream->dest_area.bottom,
-                stream->input_fps);
+                stream->input_fps, region ? " region" : "");
 }
 
 // returns whether a stream was created
@@ -463,7 +484,7 @@ static bool video_stream_add_frame(DisplayChannel *display,
     }
 
     if (is_stream_start(frame_drawable)) {
-        display_channel_create_stream(display, frame_drawable);
+        display_channel_create_stream(display, frame_drawable, NULL);
         return TRUE;
     }
     return FALSE;
@@ -504,6 +525,113 @@ GArray *video_stream_parse_preferred_codecs(SpiceMsgcDisplayPreferredVideoCodecT
     return client;
 }
 
+/* counts the update of the area of @drawable in the grid of the primary
+ * surface */
+static void video_stream_grid_update(DisplayChannel *display, Drawable *drawable)
+{
+    DisplayChannelPrivate *priv = display->priv;
+    DrawContext *context = &priv->surfaces[0].context;
+
+    if (priv->stream_grid.width != context->width ||
+        priv->stream_grid.height != context->height) {
+        uint32_t hot_updates = (priv->stream_detection_min_fps * RED_STREAM_GRID_WINDOW +
+                                NSEC_PER_SEC - 1) / NSEC_PER_SEC;
+
+        stream_grid_init(&priv->stream_grid, context->width, context->height,
+                         RED_STREAM_GRID_WINDOW, hot_updates);
+        memset(priv->region_traces, 0, sizeof(priv->region_traces));
+    }
+    stream_grid_update(&priv->stream_grid, &drawable->red_drawable->bbox,
+                       drawable->creation_time);
+}
+
+/* Creates a stream when @drawable is drawn in a hot area of the screen and
+ * enough frames were drawn in this area. Unlike the item traces this does
+ * not need the frames to be drawn at the same place, the video can be
+ * resized, moved a little or painted in several parts. */
+static void video_stream_region_detect(DisplayChannel *display, Drawable *drawable)
+{
+    DisplayChannelPrivate *priv = display->priv;
+    SpiceRect *bbox = &drawable->red_drawable->bbox;
+    RegionTrace *trace = NULL;
+    SpiceRect hot_area;
+    RingItem *item;
+    int i;
+
+    if (!stream_grid_get_hot_area(&priv->stream_grid, bbox, drawable->creation_time,
+                                  &hot_area) ||
+        rect_get_area(&hot_area) < RED_STREAM_MIN_SIZE) {
+        return;
+    }
+
+    for (i = 0; i < NUM_REGION_TRACES; i++) {
+        RegionTrace *region_trace = &priv->region_traces[i];
+
+        if (region_trace->frames_count &&
+            drawable->creation_time - region_trace->time <= RED_STREAM_DETECTION_MAX_DELTA &&
+            rect_intersects(&region_trace->hot_area, &hot_area)) {
+            trace = region_trace;
+            break;
+        }
+        if (!trace || region_trace->time < trace->time) {
+            trace = region_trace;
+        }
+    }
+    if (i == NUM_REGION_TRACES) {
+        /* replace the oldest trace */
+        memset(trace, 0, sizeof(*trace));
+        trace->first_frame_time = drawable->creation_time;
+        trace->frames_area = *bbox;
+    } else {
+        rect_union(&trace->frames_area, bbox);
+    }
+    trace->time = drawable->creation_time;
+    trace->hot_area = hot_area;
+    /* forget the frames drawn where the area is no longer hot */
+    rect_sect(&trace->frames_area, &hot_area);
+
+    update_copy_graduality(display, drawable);
+    trace->frames_count++;
+    if (drawable->copy_bitmap_graduality != BITMAP_GRADUAL_LOW) {
+        if ((trace->frames_count - trace->last_gradual_frame) >
+            RED_STREAM_FRAMES_RESET_CONDITION) {
+            trace->frames_count = 1;
+            trace->gradual_frames_count = 1;
+        } else {
+            trace->gradual_frames_count++;
+        }
+        trace->last_gradual_frame = trace->frames_count;
+    }
+
+    if (trace->frames_count < priv->stream_detection_frames ||
+        trace->gradual_frames_count <
+            RED_STREAM_GRADUAL_FRAMES_START_CONDITION * trace->frames_count) {
+        stat_inc_counter(priv->stream_detection_misses_counter, 1);
+        return;
+    }
+    /* the area is already streamed, @drawable did not fit in the stream */
+    FOREACH_STREAMS(display, item) {
+        VideoStream *stream = SPICE_CONTAINEROF(item, VideoStream, link);
+
+        if (rect_intersects(&stream->dest_area, &trace->frames_area)) {
+            stat_inc_counter(priv->stream_detection_misses_counter, 1);
+            return;
+        }
+    }
+
+    drawable->first_frame_time = trace->first_frame_time;
+    drawable->frames_count = trace->frames_count;
+    drawable->gradual_frames_count = trace->gradual_frames_count;
+    drawable->last_gradual_frame = trace->last_gradual_frame;
+    display_channel_create_stream(display, drawable, &trace->frames_area);
+    if (drawable->stream) {
+        stat_inc_counter(priv->stream_detection_hits_counter, 1);
+        trace->frames_count = 0;
+    } else {
+        stat_inc_counter(priv->stream_detection_misses_counter, 1);
+    }
+}
+
 /* TODO: document the difference between the 2 functions below */
 void video_stream_trace_update(DisplayChannel *display, Drawable *drawable)
 {
@@ -511,6 +639,10 @@ void video_stream_trace_update(DisplayChannel *display, Drawable *drawable)
     ItemTrace *trace_end;
     RingItem *item;
 
+    if (drawable->streamable && display->priv->stream_detection_min_fps) {
+        video_stream_grid_update(display, drawable);
+    }
+
     if (drawable->stream || !drawable->streamable || drawable->frames_count) {
         return;
     }
@@ -549,6 +681,10 @@ void video_stream_trace_update(DisplayChannel *display, Drawable *drawable)
             }
         }
     }
+
+    if (display->priv->stream_detection_min_fps) {
+        video_stream_region_detect(display, drawable);
+    }
 }
 
 void video_stream_maintenance(DisplayChannel *display,
@@ -44,6 +44,10 @@ SPICE_BEGIN_DECLS
 #define RED_STREAM_DEFAULT_HIGH_START_BIT_RATE (10 * 1024 * 1024) // 10Mbps
 #define RED_STREAM_DEFAULT_LOW_START_BIT_RATE (2.5 * 1024 * 1024) // 2.5Mbps
 #define MAX_FPS 30
+/* detection of the streams from the update frequency of the areas of the
+ * screen, see spice_server_set_streaming_video_detection() */
+#define RED_STREAM_GRID_WINDOW (NSEC_PER_SEC / 2)
+#define NUM_REGION_TRACES 4
 
 typedef struct VideoStream VideoStream;
 
@@ -122,6 +126,18 @@ typedef struct ItemTrace {
     SpiceRect dest_area;
 } ItemTrace;
 
+/* frames drawn in a hot area of the screen, see stream-grid.h */
+typedef struct RegionTrace {
+    red_time_t time;
+    red_time_t first_frame_time;
+    int frames_count;
+    int gradual_frames_count;
+    int last_gradual_frame;
+    SpiceRect hot_area;
+    /* bounding box of the frames inside of the hot area */
+    SpiceRect frames_area;
+} RegionTrace;
+
 struct VideoStream {
     uint8_t refs;
     Drawable *current;
@@ -136,6 +152,10 @@ struct VideoStream {
     uint32_t num_input_frames;
     uint64_t input_fps_start_time;
     uint32_t input_fps;
+
+    /* created for a hot area, the frames can be drawn in any part of it */
+    bool region_detected;
+    uint32_t num_frames;
 };
 
 void display_channel_init_video_streams(DisplayChannel *display);
@@ -31,6 +31,9 @@
 #endif
 
 #include <glib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include <common/log.h>
 #include <common/mem.h>
@@ -70,6 +73,13 @@
 #define MAX_CONTROL_DATA 125
 #define CONTROL_HDR_LEN 2
 
+/* reads smaller than this go through the read buffer, so that the frame
+ * headers and the small frames don't need a read from the stream each */
+#define WEBSOCKET_READ_BUF_SIZE 4096
+
+/* iovecs to write a data frame without allocating */
+#define WEBSOCKET_WRITE_IOV_SIZE 64
+
 typedef struct {
     uint8_t raw_pos;
     union {
@@ -97,6 +107,8 @@ struct RedsWebSocket {
     bool closed;
 
     websocket_frame_t read_frame;
+    uint8_t read_buf[WEBSOCKET_READ_BUF_SIZE];
+    uint16_t read_buf_pos, read_buf_len;
     uint64_t write_remainder;
     uint8_t write_header[WEBSOCKET_MAX_HEADER_SIZE];
     uint8_t write_header_pos, write_header_len;
@@ -315,14 +327,69 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
     return true;
 }
 
+/* Unmask @size bytes of @buf, @offset being the position of @buf in the
+ * payload of the frame. The mask is repeated over a word so that the bytes
+ * are processed 8 (or 16 with SSE2) at a time. */
+static void unmask_data(uint8_t *buf, size_t size, const uint8_t mask[4], uint64_t offset)
+{
+    uint8_t word_mask[16];
+    size_t i;
+
+    for (i = 0; i < sizeof(word_mask); i++) {
+        word_mask[i] = mask[(offset + i) % 4];
+    }
+    i = 0;
+#ifdef __SSE2__
+    const __m128i mask128 = _mm_loadu_si128((const __m128i *) word_mask);
+    for (; i + 16 <= size; i += 16) {
+        __m128i data = _mm_loadu_si128((const __m128i *) (buf + i));
+        _mm_storeu_si128((__m128i *) (buf + i), _mm_xor_si128(data, mask128));
+    }
+#endif
+    uint64_t mask64;
+    memcpy(&mask64, word_mask, sizeof(mask64));
+    for (; i + 8 <= size; i += 8) {
+        uint64_t data;
+        memcpy(&data, buf + i, sizeof(data));
+        data ^= mask64;
+        memcpy(buf + i, &data, sizeof(data));
+    }
+    for (; i < size; i++) {
+        buf[i] ^= word_mask[i % 8];
+    }
+}
+
 static void relay_data(uint8_t* buf, size_t size, websocket_frame_t *frame)
 {
     if (frame->masked) {
-        size_t i;
-        for (i = 0; i < size; i++) {
-            *buf++ ^= frame->mask[(frame->relayed + i) % 4];
+        unmask_data(buf, size, frame->mask, frame->relayed);
+    }
+}
+
+/* Read from the stream through the read buffer. Reads as large as the
+ * buffer go directly to @buf, the payload of the large frames is so read
+ * and unmasked in place without copies. */
+static ssize_t websocket_raw_read(RedsWebSocket *ws, uint8_t *buf, size_t size)
+{
+    size_t buffered = ws->read_buf_len - ws->read_buf_pos;
+
+    if (buffered == 0) {
+        if (size >= sizeof(ws->read_buf)) {
+            return ws->raw_read(ws->raw_stream, buf, size);
         }
+        ssize_t rc = ws->raw_read(ws->raw_stream, ws->read_buf, sizeof(ws->read_buf));
+        if (rc <= 0) {
+            return rc;
+        }
+        ws->read_buf_pos = 0;
+        ws->read_buf_len = rc;
+        buffered = rc;
     }
+
+    size = MIN(size, buffered);
+    memcpy(buf, ws->read_buf + ws->read_buf_pos, size);
+    ws->read_buf_pos += size;
+    return size;
 }
 
 int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags)
@@ -337,15 +404,15 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
         /* this avoids infinite loop in the case connection is still open and we have
          * pending data */
         uint8_t discard[128];
-        ws->raw_read(ws->raw_stream, discard, sizeof(discard));
+        websocket_raw_read(ws, discard, sizeof(discard));
         return 0;
     }
 
     while (size > 0) {
         // make sure we have a proper frame ready
         if (!frame->frame_ready) {
-            rc = ws->raw_read(ws->raw_stream, frame->header + frame->header_pos,
-                              frame_bytes_needed(frame));
+            rc = websocket_raw_read(ws, frame->header + frame->header_pos,
+                                    frame_bytes_needed(frame));
             if (rc <= 0) {
                 goto read_error;
             }
@@ -372,8 +439,8 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
         } else if (frame->type == BINARY_FRAME || frame->type == TEXT_FRAME) {
             rc = 0;
             if (frame->expected_len > frame->relayed) {
-                rc = ws->raw_read(ws->raw_stream, buf,
-                                  MIN(size, frame->expected_len - frame->relayed));
+                rc = websocket_raw_read(ws, buf,
+                                        MIN(size, frame->expected_len - frame->relayed));
                 if (rc <= 0) {
                     goto read_error;
                 }
@@ -389,8 +456,8 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
             spice_assert(ws->pong.data_len == frame->expected_len);
             rc = 0;
             if (ws->pong.data_len > (ws->pong.raw_pos - CONTROL_HDR_LEN)) {
-                rc = ws->raw_read(ws->raw_stream, ws->pong.raw_data + ws->pong.raw_pos,
-                                  ws->pong.data_len - (ws->pong.raw_pos - CONTROL_HDR_LEN));
+                rc = websocket_raw_read(ws, ws->pong.raw_data + ws->pong.raw_pos,
+                                        ws->pong.data_len - (ws->pong.raw_pos - CONTROL_HDR_LEN));
                 if (rc <= 0) {
                     goto read_error;
                 }
@@ -415,8 +482,8 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t size, unsigned *flags
             uint8_t discard[128];
             rc = 0;
             if (frame->expected_len > frame->relayed) {
-                rc = ws->raw_read(ws->raw_stream, discard,
-                                  MIN(sizeof(discard), frame->expected_len - frame->relayed));
+                rc = websocket_raw_read(ws, discard,
+                                        MIN(sizeof(discard), frame->expected_len - frame->relayed));
                 if (rc <= 0) {
                     goto read_error;
                 }
@@ -476,19 +543,19 @@ static int fill_header(uint8_t *header, uint64_t len, uint8_t type)
     return used;
 }
 
-static void constrain_iov(struct iovec *iov, int iovcnt,
-                          struct iovec **iov_out, int *iov_out_cnt,
-                          uint64_t maxlen)
+/* Copy to @iov_out the part of @iov holding at most @maxlen bytes,
+ * @iov_out having room for WEBSOCKET_WRITE_IOV_SIZE entries */
+static int constrain_iov(const struct iovec *iov, int iovcnt,
+                         struct iovec *iov_out, uint64_t maxlen)
 {
     int i;
 
+    iovcnt = MIN(iovcnt, WEBSOCKET_WRITE_IOV_SIZE);
     for (i = 0; i < iovcnt && maxlen > 0; i++) {
+        iov_out[i] = iov[i];
         if (iov[i].iov_len > maxlen) {
-            /* TODO - This code has never triggered afaik... */
-            *iov_out_cnt = ++i;
-            *iov_out = g_memdup(iov, i * sizeof (*iov));
-            (*iov_out)[i-1].iov_len = maxlen;
-            return;
+            iov_out[i].iov_len = maxlen;
+            return i + 1;
         }
         maxlen -= iov[i].iov_len;
     }
@@ -496,8 +563,7 @@ static void constrain_iov(struct iovec *iov, int iovcnt,
     /* we must trim the iov in case maxlen initially matches some chunks
      * For instance if initially we had 2 chunks 256 and 128 bytes respectively
      * and a maxlen of 256 we should just return the first chunk */
-    *iov_out_cnt = i;
-    *iov_out = iov;
+    return i;
 }
 
 static int send_data_header_left(RedsWebSocket *ws)
@@ -523,7 +589,7 @@ static int send_data_header_left(RedsWebSocket *ws)
     return -1;
 }
 
-static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+static void fill_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
 {
     spice_assert(ws->write_header_pos >= ws->write_header_len);
     spice_assert(ws->write_remainder == 0);
@@ -535,7 +601,11 @@ static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
     }
     ws->write_header_len = fill_header(ws->write_header, len, type);
     ws->send_unfinished = (type & FIN_FLAG) == 0;
+}
 
+static int send_data_header(RedsWebSocket *ws, uint64_t len, uint8_t type)
+{
+    fill_data_header(ws, len, type);
     return send_data_header_left(ws);
 }
 
@@ -586,58 +656,44 @@ static int send_pending_data(RedsWebSocket *ws)
     return 1;
 }
 
-/* Write a WebSocket frame with the enclosed data out. */
-int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags)
+/* Write the data of a new frame out along with its header, in a single
+ * write. Only the header is copied, it is prepended to the iovecs of
+ * the data. */
+static int send_data_frame(RedsWebSocket *ws, const struct iovec *iov, int iovcnt,
+                           unsigned flags)
 {
+    struct iovec iov_buf[WEBSOCKET_WRITE_IOV_SIZE + 1];
+    struct iovec *iov_out = iov_buf;
+    bool send_unfinished = ws->send_unfinished;
     uint64_t len;
     int rc;
-    struct iovec *iov_out;
-    int iov_out_cnt;
     int i;
 
-    if (ws->closed) {
-        errno = EPIPE;
-        return -1;
+    if (SPICE_UNLIKELY(iovcnt > WEBSOCKET_WRITE_IOV_SIZE)) {
+        iov_out = g_new(struct iovec, iovcnt + 1);
     }
-    rc = send_pending_data(ws);
-    if (rc <= 0) {
-        return rc;
-    }
-    if (ws->write_remainder > 0) {
-        constrain_iov((struct iovec *) iov, iovcnt, &iov_out, &iov_out_cnt, ws->write_remainder);
-        rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-        if (iov_out != iov) {
-            g_free(iov_out);
-        }
-        if (rc <= 0) {
-            return rc;
-        }
-        ws->write_remainder -= rc;
-        return rc;
-    }
-
-    iov_out_cnt = iovcnt + 1;
-    iov_out = g_malloc(iov_out_cnt * sizeof(*iov_out));
-
     for (i = 0, len = 0; i < iovcnt; i++) {
         len += iov[i].iov_len;
         iov_out[i + 1] = iov[i];
     }
 
-    ws->write_header_pos = 0;
-    ws->write_header_len = fill_header(ws->write_header, len, flags);
+    fill_data_header(ws, len, flags);
     iov_out[0].iov_len = ws->write_header_len;
     iov_out[0].iov_base = ws->write_header;
-    rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-    g_free(iov_out);
+    rc = ws->raw_writev(ws->raw_stream, iov_out, iovcnt + 1);
+    if (iov_out != iov_buf) {
+        g_free(iov_out);
+    }
     if (rc <= 0) {
+        /* nothing was sent, the frame will be started again */
         ws->write_header_len = 0;
+        ws->send_unfinished = send_unfinished;
         return rc;
     }
 
     /* this can happen if we can't write the header */
     if (SPICE_UNLIKELY(rc < ws->write_header_len)) {
-        ws->write_header_pos = ws->write_header_len - rc;
+        ws->write_header_pos = rc;
         errno = EAGAIN;
         return -1;
     }
@@ -652,6 +708,34 @@ int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, uns
     return rc;
 }
 
+/* Write a WebSocket frame with the enclosed data out. */
+int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags)
+{
+    int rc;
+
+    if (ws->closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    rc = send_pending_data(ws);
+    if (rc <= 0) {
+        return rc;
+    }
+    if (ws->write_remainder > 0) {
+        struct iovec iov_out[WEBSOCKET_WRITE_IOV_SIZE];
+        int iov_out_cnt = constrain_iov(iov, iovcnt, iov_out, ws->write_remainder);
+
+        rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
+        if (rc <= 0) {
+            return rc;
+        }
+        ws->write_remainder -= rc;
+        return rc;
+    }
+
+    return send_data_frame(ws, iov, iovcnt, flags);
+}
+
 int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned flags)
 {
     int rc;
@@ -666,6 +750,10 @@ int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned fla
         return rc;
     }
     if (ws->write_remainder == 0) {
+        if (ws->raw_writev) {
+            struct iovec iov = { (void *) buf, len };
+            return send_data_frame(ws, &iov, 1, flags);
+        }
         rc = send_data_header(ws, len, flags);
         if (rc <= 0) {
             return rc;
@@ -33,19 +33,135 @@
 #define TAB_LEN 4
 #define VALUE_TABS 7
 #define INVALID_STAT_REF (~(uint32_t)0)
+/* the buckets of the histograms, named by their limit */
+#define BUCKET_PREFIX "lt_"
 
 verify(sizeof(SpiceStat) == 20 || sizeof(SpiceStat) == 24);
 
 static SpiceStatNode *reds_nodes = NULL;
 static uint64_t *values = NULL;
 
+static int is_histogram(const SpiceStatNode *node)
+{
+    uint32_t child;
+
+    if (node->flags & SPICE_STAT_NODE_FLAG_VALUE) {
+        return 0;
+    }
+    for (child = node->first_child_index; child != INVALID_STAT_REF;
+         child = reds_nodes[child].next_sibling_index) {
+        if (strncmp(reds_nodes[child].name, BUCKET_PREFIX, strlen(BUCKET_PREFIX)) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* the samples of a bucket, since the last refresh if @recent */
+static uint64_t bucket_samples(uint32_t bucket, int recent)
+{
+    return reds_nodes[bucket].value - (recent ? values[bucket] : 0);
+}
+
+/* limit of the bucket holding the given percentile of the samples, the
+ * buckets are sorted by their limit */
+static uint64_t histogram_percentile(const SpiceStatNode *node, unsigned percent, int recent)
+{
+    uint64_t total = 0, seen = 0, rank;
+    uint32_t child;
+
+    for (child = node->first_child_index; child != INVALID_STAT_REF;
+         child = reds_nodes[child].next_sibling_index) {
+        if (strncmp(reds_nodes[child].name, BUCKET_PREFIX, strlen(BUCKET_PREFIX)) == 0) {
+            total += bucket_samples(child, recent);
+        }
+    }
+    if (total == 0) {
+        return 0;
+    }
+    rank = (total * percent + 99) / 100;
+    for (child = node->first_child_index; child != INVALID_STAT_REF;
+         child = reds_nodes[child].next_sibling_index) {
+        const char *limit = reds_nodes[child].name + strlen(BUCKET_PREFIX);
+
+        if (strncmp(reds_nodes[child].name, BUCKET_PREFIX, strlen(BUCKET_PREFIX)) != 0) {
+            continue;
+        }
+        seen += bucket_samples(child, recent);
+        if (seen >= rank) {
+            return strcmp(limit, "inf") == 0 ? UINT64_MAX : strtoull(limit, NULL, 10);
+        }
+    }
+    return UINT64_MAX;
+}
+
+static void print_time(uint64_t ns)
+{
+    if (ns == UINT64_MAX) {
+        printf(" inf");
+    } else if (ns < 1000) {
+        printf(" %"PRIu64"ns", ns);
+    } else if (ns < 1000 * 1000) {
+        printf(" %.1fus", ns / 1e3);
+    } else if (ns < 1000 * 1000 * 1000) {
+        printf(" %.1fms", ns / 1e6);
+    } else {
+        printf(" %.1fs", ns / 1e9);
+    }
+}
+
+static void print_percentiles(const SpiceStatNode *node, int recent)
+{
+    static const unsigned percents[] = { 50, 90, 99 };
+    unsigned i;
+
+    for (i = 0; i < sizeof(percents) / sizeof(percents[0]); i++) {
+        printf("%sp%u", i ? " " : "", percents[i]);
+        print_time(histogram_percentile(node, percents[i], recent));
+    }
+}
+
+/* prints the number of samples and the percentiles of the times of a
+ * histogram, in total and since the last refresh */
+static void print_histogram(const SpiceStatNode *node, int depth)
+{
+    uint64_t count = 0, recent_count = 0;
+    uint32_t child;
+
+    for (child = node->first_child_index; child != INVALID_STAT_REF;
+         child = reds_nodes[child].next_sibling_index) {
+        if (strcmp(reds_nodes[child].name, "count") == 0) {
+            count = reds_nodes[child].value;
+            recent_count = count - values[child];
+        }
+    }
+    printf(":%*s%"PRIu64" (%"PRIu64")", (int) ((VALUE_TABS - depth) * TAB_LEN - strlen(node->name) - 1), "",
+           count, recent_count);
+    if (count) {
+        printf("  ");
+        print_percentiles(node, 0);
+    }
+    if (recent_count) {
+        printf(" (");
+        print_percentiles(node, 1);
+        printf(")");
+    }
+    printf("\n");
+    for (child = node->first_child_index; child != INVALID_STAT_REF;
+         child = reds_nodes[child].next_sibling_index) {
+        values[child] = reds_nodes[child].value;
+    }
+}
+
 static void print_stat_tree(int32_t node_index, int depth)
 {
     SpiceStatNode *node = &reds_nodes[node_index];
 
     if ((node->flags & SPICE_STAT_NODE_MASK_SHOW) == SPICE_STAT_NODE_MASK_SHOW) {
         printf("%*s%s", depth * TAB_LEN, "", node->name);
-        if (node->flags & SPICE_STAT_NODE_FLAG_VALUE) {
+        if (is_histogram(node)) {
+            print_histogram(node, depth);
+        } else if (node->flags & SPICE_STAT_NODE_FLAG_VALUE) {
             printf(":%*s%"PRIu64" (%"PRIu64")\n", (int) ((VALUE_TABS - depth) * TAB_LEN - strlen(node->name) - 1), "",
                    node->value, node->value - values[node_index]);
             values[node_index] = node->value;